@@ -1,9 +1,10 @@
 import numpy as np
+import pytest
 from bfloat16 import bfloat16
 
 def test_creation():
     a0 = bfloat16(2.45)
-    assert a0 == 2.45
+    assert a0 == bfloat16(2.45) and a0 == 2.453125
     a1 = np.full([4], 2.45, dtype=bfloat16)
     assert a1 is not None and a1.dtype == bfloat16 and np.all(a1 == bfloat16(2.45))
     a2 = np.arange(4, dtype=bfloat16)
@@ -23,20 +24,30 @@ def test_calc():
     assert np.array_equal(r, np.array([2.453125, 3.453125, 4.437500, 5.437500], dtype=bfloat16))
     ok = False
     try:
-        r = a1 / a2
-    except ArithmeticError:
+        with np.errstate(divide='raise'):
+            r = a1 / a2
+    except FloatingPointError:
         ok = True
     assert ok
     r = a2 / a1
     assert np.array_equal(r, np.array([0.000000, 0.408203, 0.816406, 1.226562], dtype=bfloat16))
-    ok = False
-    np.seterr(divide='ignore', invalid='ignore')
-    r = a1 / 0.0
-    # promotes to float so ieee reporting which is NAN
-    assert np.array_equal(r, np.array([float('inf'), float('inf'), float('inf'), float('inf')], dtype=np.float32))
-    assert np.all(np.isclose(a1 - a2, a1.astype(np.float32) - a2.astype(np.float)))
+    # python scalars keep the bfloat16 type, as NumPy keeps float16
+    with np.errstate(divide='ignore', invalid='ignore'):
+        r = a1 / 0.0
+    assert r.dtype == bfloat16 and np.all(np.isinf(r))
+    assert (a2 * 2).dtype == bfloat16 and (a2 + 0.5).dtype == bfloat16 and (a2 + 1000).dtype == bfloat16
+    # so do small integer and float16 operands, computed in float32 and rounded once
+    assert (a2 + np.ones(4, np.int8)).dtype == bfloat16 and (a2 + a2[1]).dtype == bfloat16
+    assert (a1 * np.ones(4, np.int16)).dtype == bfloat16 and (a2 + np.ones(4, np.uint16)).dtype == bfloat16
+    assert np.array_equal(a2 + np.full(4, 257, np.int16), (a2.astype(np.float32) + 257).astype(bfloat16))
+    assert np.result_type(a2, 0) == bfloat16 and np.where(a2 > 1, a2, np.int8(0)).dtype == bfloat16
+    # wider operands promote
+    assert (a1 + np.ones(4)).dtype == np.float64 and (a1 + np.ones(4, np.float32)).dtype == np.float32
+    assert (a1 + np.ones(4, np.int32)).dtype == np.float64 and (a1 * 1e6).dtype == np.float32
+    assert np.all(a1 != np.float64(2.45)) and np.all(np.arange(4, dtype=np.int32) + 0.5 > a2)
+    assert np.all(np.isclose(a1 - a2, a1.astype(np.float32) - a2.astype(np.float64)))
     r1 = a1 * a2
-    r2 = a1.astype(np.float32) * a2.astype(np.float)
+    r2 = a1.astype(np.float32) * a2.astype(np.float64)
     assert np.all(np.isclose(r1, r2, atol=0.02))
     assert np.sum(a1) == 9.8125
 
@@ -44,3 +55,476 @@ def test_scalars():
     assert bfloat16(1.3) == np.array(1.3, dtype=bfloat16)
     assert int(bfloat16(1.2)) == 1
     assert float(bfloat16(1.2)) == 1.203125
+    # scalars compare exact values, like float, so they agree with the hash
+    assert bfloat16(1.0) != 1.001 and bfloat16(1.0) < 1.001 and bfloat16(1.0) == 1
+    assert bfloat16(256) == 2**8 and bfloat16(3) < 10**400
+    assert bfloat16(1.0) != np.float32(1.001) and hash(bfloat16(1.5)) == hash(1.5)
+
+def check_constructor(t, codes):
+    bits = np.uint8 if np.dtype(t).itemsize == 1 else np.uint16
+    same = lambda x, y: np.array_equal(np.asarray(x, t).view(bits), np.asarray(y, t).view(bits))
+    # every value survives a round trip through float, and through itself
+    with np.errstate(invalid='ignore'):
+        finite = codes[np.isfinite(codes.astype(np.float64))]
+    assert all(same(t(float(x)), x) and same(t(x), x) for x in finite)
+    assert np.isnan(float(t(float('nan'))))
+    # floats, ints and NumPy floats round as the cast from float64 does
+    values = [0.1, -2.5, 1e-30, 3e38, 1e300, -0.0, float('inf'), 7, -300, 65537, True]
+    values += list(np.random.default_rng(0).standard_normal(200) * 10.0 ** np.arange(-10, 10, 0.1))
+    with np.errstate(over='ignore'):
+        for v in values:
+            want = np.array([v], dtype=np.float64).astype(t)[0]
+            assert same(t(v), want) and same(t(np.float64(v)), want)
+            a = np.zeros(2, dtype=t)
+            a[1] = v
+            assert same(a[1], want)
+        for v in (np.float32(0.1), np.float32(-3e38)):
+            assert same(t(v), np.array([v]).astype(t)[0])
+    # arrays are cast, and anything else is refused
+    assert t(np.array([1.0, 2.0])).dtype == t and type(t(np.array(2.5))) is t
+    for args in ((), (1, 2), ("1.5",), (None,)):
+        with pytest.raises(TypeError):
+            t(*args)
+    with pytest.raises(TypeError):
+        t(x=1.0)
+
+def test_constructor():
+    check_constructor(bfloat16, np.arange(1 << 16, dtype=np.uint32).astype(np.uint16).view(bfloat16))
+
+def test_posit8_2_constructor():
+    posit8_2 = pytest.importorskip("posit8_2").posit8_2
+    check_constructor(posit8_2, np.arange(256, dtype=np.uint8).view(posit8_2))
+
+def check_fill(t, codes, steps):
+    bits = codes.dtype
+    values = codes.view(t)
+    for c, x in zip(codes, values):
+        # fill and full store the scalar's bits unchanged, NaN payloads included,
+        assert np.all(np.full(9, x, t).view(bits) == c)
+        a = np.zeros(9, t)
+        a[1::2].fill(x)
+        assert np.all(a[1::2].view(bits) == c) and np.all(a[0::2].view(bits) == 0)
+    # and arange rounds start + i * delta, computed in float32, once per element.
+    for start, step in steps:
+        a = np.arange(start, start + 1000 * step, step, dtype=t)
+        delta = np.float32(t(start + step)) - np.float32(t(start))
+        ref = (np.float32(t(start)) + np.arange(1000, dtype=np.float32) * delta).astype(t)
+        assert len(a) == 1000 and np.array_equal(a[2:].view(bits), ref[2:].view(bits))
+        assert a[0] == t(start) and a[1] == t(start + step)
+
+def test_fill():
+    codes = np.concatenate([np.arange(0, 1 << 16, 257), [0x7f80, 0xff80, 0x7fc1, 0xffff]]).astype(np.uint16)
+    check_fill(bfloat16, codes, [(-3.0, 0.375), (1.0, 2.0**-7), (100.0, -1.25), (0.0, 2.0**-20)])
+
+def test_posit8_2_fill():
+    posit8_2 = pytest.importorskip("posit8_2").posit8_2
+    check_fill(posit8_2, np.arange(256, dtype=np.uint8), [(-3.0, 0.375), (1.0, 2.0**-7), (100.0, -1.25)])
+
+def check_scalar_arithmetic(t):
+    # a scalar gives what the same element of an array would
+    a = np.array([1.5, 3.0, -2.25, 0.0], dtype=t)
+    with np.errstate(all='ignore'):
+        for s in (0.5, 0.1, 2, 1000, 65536, 1e5, 1e39, np.inf):
+            for r, ra in ((a[1] + s, (a + s)[1]), (s - a[2], (s - a)[2]), (a[1] * s, (a * s)[1]),
+                          (s / a[3], (s / a)[3]), (a[0] / a[3], (a / a[3])[0])):
+                assert type(r) is type(ra) and (r == ra or (np.isnan(r) and np.isnan(ra)))
+    # and reports floating-point errors like it
+    with np.errstate(all='raise'):
+        with pytest.raises(FloatingPointError):
+            t(1) / t(0)
+        with pytest.raises(FloatingPointError):
+            t(1) / 0
+    with np.errstate(all='ignore'):
+        t(1) / t(0)
+
+def test_scalar_arithmetic():
+    check_scalar_arithmetic(bfloat16)
+    assert type(bfloat16(2) * 0.5) is bfloat16 and type(bfloat16(2) * 1e5) is np.float32
+    with np.errstate(over='raise'):
+        with pytest.raises(FloatingPointError):
+            bfloat16(3e38) * bfloat16(10)
+
+def test_posit8_2_scalar_arithmetic():
+    posit8_2 = pytest.importorskip("posit8_2").posit8_2
+    check_scalar_arithmetic(posit8_2)
+    assert type(posit8_2(2) * 0.5) is posit8_2 and type(posit8_2(2) * 2**40) is np.float64
+
+def check_broadcast_operands(t, codes):
+    # a broadcast operand, scalar or zero-stride array, on either side and in
+    # reductions, gives what the same operand spelled out in full would
+    bits = np.uint8 if np.dtype(t).itemsize == 1 else np.uint16
+    same = lambda x, y: x.dtype == y.dtype and np.array_equal(x.view(bits) if x.dtype == t else x,
+                                                              y.view(bits) if y.dtype == t else y)
+    with np.errstate(all='ignore'):
+        for n in (1, 7, 63, 64, 65, 200):
+            a = codes[np.arange(n) * 7919 % len(codes)]
+            for s in (t(0.75), a[n // 2], 0.1, 3, np.int8(-5)):
+                # Python scalars go by value, 0.1 as float16 and 3 as uint8
+                full = np.full(n, s, s.dtype if isinstance(s, np.generic) else np.min_scalar_type(s))
+                for f in (np.add, np.subtract, np.multiply, np.divide, np.maximum, np.minimum,
+                          np.equal, np.less, np.greater_equal):
+                    assert same(f(a, s), f(a, full)) and same(f(s, a), f(full, a))
+            for other in (np.int8(-3), np.uint16(300), np.float16(0.3)):
+                wide = np.broadcast_to(np.asarray(other), (n,))
+                for f in (np.add, np.multiply, np.divide, np.less):
+                    assert same(f(a, wide), f(a, wide.copy())) and same(f(wide, a), f(wide.copy(), a))
+            for f in (np.add, np.multiply, np.maximum, np.minimum):
+                acc = [a[:1]]
+                for k in range(1, n):
+                    acc.append(f(acc[-1], a[k:k + 1]))
+                acc = np.concatenate(acc)
+                assert same(f.accumulate(a), acc) and same(f.reduce(a, keepdims=True), acc[-1:])
+
+def test_broadcast_operands():
+    a = np.arange(1 << 16, dtype=np.uint32).astype(np.uint16).view(bfloat16)
+    check_broadcast_operands(bfloat16, a[(a.view(np.uint16) & 0x7f80) != 0x7f80])
+
+def test_posit8_2_broadcast_operands():
+    posit8_2 = pytest.importorskip("posit8_2").posit8_2
+    check_broadcast_operands(posit8_2, np.arange(256, dtype=np.uint8).view(posit8_2))
+
+def test_from_list():
+    values = [0.1, 2.45, -3, 7]
+    a = bfloat16.from_list(values)
+    assert a.dtype == bfloat16 and np.array_equal(a, np.array(values, dtype=bfloat16))
+    assert bfloat16.from_list([[1.0, 2.0], [3.0, 4.0]]).shape == (2, 2)
+
+def test_to_list():
+    a = np.arange(6, dtype=bfloat16).reshape(2, 3)
+    assert bfloat16.to_list(a) == [[0.0, 1.0, 2.0], [3.0, 4.0, 5.0]]
+    assert all(type(x) is bfloat16 for x in bfloat16.to_list(a[0], scalars=True))
+
+def test_transpose_copy():
+    a = np.arange(40 * 70, dtype=np.float32).reshape(40, 70).astype(bfloat16)
+    t = bfloat16.transpose_copy(a)
+    assert t.flags.c_contiguous and np.array_equal(t, a.T)
+    assert np.array_equal(bfloat16.transpose_copy(a[::-1, ::3]), a[::-1, ::3].T)
+
+def test_posit8_2_casts():
+    posit8_2 = pytest.importorskip("posit8_2").posit8_2
+    a = np.array([0.3, -1.5, 100.0, 1e-9, np.nan], dtype=np.float32).astype(bfloat16)
+    assert np.array_equal(a.astype(posit8_2).view(np.uint8), a.astype(np.float32).astype(posit8_2).view(np.uint8))
+    p = np.arange(256, dtype=np.uint8).view(posit8_2)
+    assert np.array_equal(p.astype(bfloat16), p.astype(np.float32).astype(bfloat16), equal_nan=True)
+    assert posit8_2(1.0) != 1.01 and posit8_2(16) < 17 and posit8_2(16) == 16
+    q = np.arange(4).astype(posit8_2)
+    assert (q + np.ones(4)).dtype == np.float64 and (q * np.ones(4, np.int8)).dtype == posit8_2
+    assert (q * 2).dtype == posit8_2 and (q + 0.5).dtype == posit8_2 and np.result_type(q, 0) == posit8_2
+    assert np.array_equal((q * np.full(4, 3, np.int16)).view(np.uint8), (q.astype(np.float64) * 3).astype(posit8_2).view(np.uint8))
+    assert np.all(np.full(4, 16.0).astype(posit8_2) < np.full(4, 17, np.int32))
+    # from_list rounds each value once, like the scalar constructor
+    values = [0.0, -0.0, 1e-300, -3e9, np.inf, np.nan, 1.0 + 2.0**-40, 3, -7] + list(np.geomspace(1e-9, 1e9, 500))
+    assert np.array_equal(posit8_2.from_list(values).view(np.uint8),
+                          np.array([posit8_2(v) for v in values], dtype=posit8_2).view(np.uint8))
+
+def test_posit8_2_interned_scalars():
+    import sys
+    posit8_2 = pytest.importorskip("posit8_2").posit8_2
+    p = np.arange(256, dtype=np.uint8).view(posit8_2)
+    # Every way of getting a scalar returns the one object for its value.
+    assert all(p[i] is p[i] and p[::-1][255 - i] is p[i] for i in range(256))
+    assert all(x is y for x, y in zip(list(p), posit8_2.to_list(p, scalars=True)))
+    assert posit8_2(1.0) is p[64] and posit8_2(posit8_2(1.0)) is p[64] and posit8_2(1) is p[64]
+    assert np.array([1.0]).astype(posit8_2)[0] is p[64] and p.tolist()[64] == 1.0
+    assert -p[64] is p[192] and abs(p[192]) is p[64] and p[72] * p[56] is p[64]
+    # and each read hands out a reference that is given back.
+    before = sys.getrefcount(p[3])
+    for _ in range(1000):
+        p[3], list(p), posit8_2(p[3])
+    after = sys.getrefcount(p[3])
+    assert after == before
+
+def test_posit8_2_copies():
+    posit8_2 = pytest.importorskip("posit8_2").posit8_2
+    codes = np.arange(5000, dtype=np.uint32).astype(np.uint8)
+    p = codes.view(posit8_2)
+    # Copies move single bytes, whatever the stride,
+    assert np.array_equal(np.ascontiguousarray(p[::-7]).view(np.uint8), codes[::-7])
+    assert np.array_equal(p[[5, 3, 1000, 4999]].view(np.uint8), codes[[5, 3, 1000, 4999]])
+    assert np.array_equal(np.take(p, np.arange(0, 5000, 13)).view(np.uint8), codes[::13])
+    assert np.array_equal(np.concatenate([p[::3], p[1::5]]).view(np.uint8), np.concatenate([codes[::3], codes[1::5]]))
+    assert np.array_equal(p.reshape(50, 100).T.copy().view(np.uint8), codes.reshape(50, 100).T)
+    # never touch the bytes between strided elements,
+    buf = np.full(3 * 5000, 0xAB, np.uint8)
+    buf.view(posit8_2)[1::3] = p
+    assert np.array_equal(buf[1::3], codes) and np.all(buf[0::3] == 0xAB) and np.all(buf[2::3] == 0xAB)
+    # and swapping a one-byte value leaves it unchanged.
+    assert np.array_equal(p.byteswap().view(np.uint8), codes)
+    assert np.array_equal(p[::-3].byteswap().view(np.uint8), codes[::-3])
+    assert np.array_equal(p.astype(p.dtype.newbyteorder()).view(np.uint8), codes)
+
+def test_posit8_2_integer_casts():
+    posit8_2 = pytest.importorskip("posit8_2").posit8_2
+    same = lambda a, b: np.array_equal(a.view(np.uint8), b.view(np.uint8))
+    # Every int8, uint8, int16, uint16 and bool, and the extremes of the wider
+    # integers, give what going through float64 would.
+    for t in (np.int8, np.uint8, np.int16, np.uint16):
+        info = np.iinfo(t)
+        v = np.arange(info.min, info.max + 1).astype(t)
+        assert same(v.astype(posit8_2), v.astype(np.float64).astype(posit8_2))
+        assert same(v[::-3].astype(posit8_2), v[::-3].astype(np.float64).astype(posit8_2))
+    v = np.array([False, True])
+    assert same(v.astype(posit8_2), v.astype(np.float64).astype(posit8_2))
+    for t in (np.int32, np.uint32, np.int64, np.uint64):
+        info = np.iinfo(t)
+        v = np.array([info.min, info.min + 1, 0, 1, 2 ** 24 - 1, 2 ** 24 + 1, 3 * 2 ** 20 + 1,
+                      info.max - 1, info.max], dtype=t)
+        assert same(v.astype(posit8_2), v.astype(np.float64).astype(posit8_2))
+    # Every posit8_2 value that fits, NaR aside, truncates as its float64 does.
+    p = np.arange(256, dtype=np.uint8).view(posit8_2)
+    f = p.astype(np.float64)
+    for t in (np.int8, np.uint8, np.int16, np.uint16, np.int32, np.uint32, np.int64, np.uint64, np.bool_):
+        if t is np.bool_:
+            fits = np.isfinite(f)
+        else:
+            info = np.iinfo(t)
+            fits = np.isfinite(f) & (np.trunc(f) >= info.min) & (np.trunc(f) <= info.max)
+        assert np.array_equal(p[fits].astype(t), f[fits].astype(t))
+        assert np.array_equal(p[::-1].astype(t)[fits[::-1]], f[::-1][fits[::-1]].astype(t))
+
+def test_half_casts():
+    h = np.arange(1 << 16, dtype=np.uint32).astype(np.uint16).view(np.float16)
+    b = h.astype(bfloat16)
+    assert np.array_equal(b, h.astype(np.float32).astype(bfloat16), equal_nan=True)
+    assert np.array_equal(b.astype(np.float16), b.astype(np.float32).astype(np.float16), equal_nan=True)
+
+def test_unary_kernels():
+    # Contiguous inputs take the vectorized loops, reversed ones the scalar loop.
+    a = np.arange(1 << 16, dtype=np.uint32).astype(np.uint16).view(bfloat16)
+    with np.errstate(all='ignore'):
+        for f in (np.exp, np.expm1, np.log, np.log1p, np.tanh, np.sin, np.cos):
+            assert np.array_equal(f(a).view(np.uint16), f(a[::-1])[::-1].view(np.uint16))
+
+def test_unary_tables():
+    a = np.arange(1 << 16, dtype=np.uint32).astype(np.uint16).view(bfloat16)
+    assert not bfloat16.use_unary_tables(True)
+    try:
+        with np.errstate(all='ignore'):
+            for f in (np.exp, np.log, np.tanh, np.sin, np.arcsinh, np.cbrt):
+                t = f(a)
+                assert np.array_equal(t.view(np.uint16), f(a[::-1])[::-1].view(np.uint16))
+                # Correctly rounded: within half an ulp of the float64 result.
+                x = a.astype(np.float64)
+                ref = f(x)
+                ok = np.isfinite(ref) & (np.abs(ref) < 1e38)
+                r, t = ref[ok], t[ok].astype(np.float64)
+                ulp = np.spacing(np.abs(t).astype(bfloat16).astype(np.float32)).astype(np.float64) * 65536
+                assert (np.abs(t - r) <= ulp / 2).all()
+    finally:
+        assert bfloat16.use_unary_tables(False)
+
+def test_binary_kernels():
+    # Contiguous, strided and broadcast operands against float32 arithmetic.
+    a = np.linspace(-100, 100, 1001).astype(bfloat16)
+    b = np.linspace(0.5, 3, 1001).astype(bfloat16)
+    fa, fb = a.astype(np.float32), b.astype(np.float32)
+    for f in (np.add, np.subtract, np.multiply, np.divide):
+        assert np.array_equal(f(a, b), f(fa, fb).astype(bfloat16))
+        assert np.array_equal(f(a[::3], b[::3]), f(fa[::3], fb[::3]).astype(bfloat16))
+        assert np.array_equal(f(a, b[7]), f(fa, fb[7]).astype(bfloat16))
+    for f in (np.equal, np.not_equal, np.less, np.greater, np.less_equal, np.greater_equal):
+        assert np.array_equal(f(a, b), f(fa, fb))
+        assert np.array_equal(f(a[::-2], b[500]), f(fa[::-2], fb[500]))
+    # Comparisons are quiet: quiet NaN operands do not report invalid.
+    n = np.array([np.nan, 1, -np.inf, np.nan, 0, 2, np.nan] * 5, dtype=np.float32)
+    with np.errstate(invalid='raise'):
+        for f in (np.less, np.greater, np.less_equal, np.greater_equal, np.maximum, np.fmin):
+            assert np.array_equal(f(n.astype(bfloat16), n[::-1].astype(bfloat16)),
+                                  f(n, n[::-1]).astype(bfloat16), equal_nan=True)
+        assert np.array_equal(np.sign(n.astype(bfloat16)), np.sign(n).astype(bfloat16), equal_nan=True)
+    # Accumulations feed each result into the next element.
+    ones = np.ones(100, dtype=bfloat16)
+    assert np.add.accumulate(ones)[-1] == 100
+
+def test_bit_kernels():
+    # Every bfloat16, contiguous and strided.
+    a = np.arange(1 << 16, dtype=np.uint16).view(bfloat16)
+    b = a[::-1].copy()
+    fa = a.astype(np.float32)
+    bits = lambda x: x.view(np.uint16)
+    assert np.array_equal(bits(-a), bits(a) ^ 0x8000)
+    assert np.array_equal(bits(np.abs(a[::3])), bits(a[::3]) & 0x7fff)
+    assert np.array_equal(np.signbit(a), np.signbit(fa))
+    assert np.array_equal(bits(np.copysign(a, b)), (bits(a) & 0x7fff) | (bits(b) & 0x8000))
+    mantissa, exponent = np.frexp(a[::-5])
+    assert np.array_equal(mantissa, np.frexp(fa[::-5])[0].astype(bfloat16), equal_nan=True)
+    assert np.array_equal(exponent, np.frexp(fa[::-5])[1])
+    with np.errstate(over='ignore', under='ignore', invalid='ignore'):
+        for n in (-140, -3, 0, 7, 300):
+            assert np.array_equal(np.ldexp(a, n), np.ldexp(fa.astype(np.float64), n).astype(bfloat16),
+                                  equal_nan=True)
+        assert np.array_equal(np.nextafter(a[::7], b[::7]), np.nextafter(a, b)[::7], equal_nan=True)
+        # spacing is the step to the next value away from zero.
+        nonzero = (fa != 0) & ((bits(a) & 0x7fff) < 0x7f7f)
+        away = np.nextafter(a, np.copysign(bfloat16(np.inf), a))
+        assert np.array_equal(np.spacing(a)[nonzero].astype(np.float64),
+                              away[nonzero].astype(np.float64) - fa[nonzero])
+        assert np.all(bits(np.spacing(a[fa == 0])) == 1)
+    with np.errstate(over='raise'):
+        try:
+            np.spacing(np.full(100, 0x7f7f, dtype=np.uint16).view(bfloat16))
+            assert False
+        except FloatingPointError:
+            pass
+
+def test_fma():
+    import bfloat16 as module
+    a = np.linspace(-100, 100, 1001).astype(bfloat16)
+    b = np.linspace(0.5, 3, 1001).astype(bfloat16)
+    c = np.linspace(7, -7, 1001).astype(bfloat16)
+    fa, fb, fc = (x.astype(np.float64) for x in (a, b, c))
+    # Rounded once to float32, then to bfloat16.
+    assert np.array_equal(module.fma(a, b, c), (fa * fb + fc).astype(np.float32).astype(bfloat16))
+    assert np.array_equal(module.fma(a[::3], b[7], c[::3]),
+                          (fa[::3] * fb[7] + fc[::3]).astype(np.float32).astype(bfloat16))
+    # Products that overflow or underflow float32 on their own are not rounded
+    # before the sum, whatever the length and so whichever path runs.
+    for big, small in ((2.0 ** 64, -2.0 ** 127), (2.0 ** -75, 2.0 ** -126)):
+        a = (big * np.linspace(1, 1.5, 37)).astype(bfloat16)
+        c = (small * np.linspace(1, 1.1, 37)).astype(bfloat16)
+        fa, fc = a.astype(np.float64), c.astype(np.float64)
+        for n in (1, 5, 8, 16, 37):
+            with np.errstate(all='ignore'):
+                want = (fa[:n] * fa[:n] + fc[:n]).astype(np.float32).astype(bfloat16)
+            assert np.array_equal(module.fma(a[:n], a[:n], c[:n]), want)
+    assert module.fma(bfloat16(2.0 ** 64), bfloat16(2.0 ** 64), bfloat16(-2.0 ** 127)) == 2.0 ** 127
+    # Python and NumPy scalars stay bfloat16, as with the operators.
+    a = np.linspace(-100, 100, 37).astype(bfloat16)
+    fa = a.astype(np.float64)
+    for r in (module.fma(a, 2, 0.5), module.fma(a, np.float64(2), 0.5), module.fma(2, a, np.float32(0.5))):
+        assert r.dtype == bfloat16 and np.array_equal(r, (fa * 2 + 0.5).astype(np.float32).astype(bfloat16))
+    assert module.fma(a, a[3], c).dtype == bfloat16
+    # A float64 array makes the whole fma float64.
+    r = module.fma(a, np.float64(2), np.full(37, 0.5))
+    assert r.dtype == np.float64 and np.array_equal(r, fa * 2 + 0.5)
+
+def test_posit8_2_fma():
+    posit8_2 = pytest.importorskip("posit8_2")
+    p = np.arange(256, dtype=np.uint8).view(posit8_2.posit8_2)
+    x, y = np.repeat(p, 256), np.tile(p, 256)
+    fx, fy = x.astype(np.float64), y.astype(np.float64)
+    # Sums of products of posit8_2 values near 1 are exact in float64.
+    for z in (p[3], p[64], p[200]):
+        ok = (np.abs(fx) <= 4) & (np.abs(fy) <= 4)
+        want = (fx * fy + z.astype(np.float64)).astype(posit8_2.posit8_2)
+        assert np.array_equal(posit8_2.fma(x, y, z)[ok].view(np.uint8), want[ok].view(np.uint8))
+    assert posit8_2.fma(p, 2, 0.5).dtype == posit8_2.posit8_2
+    assert np.array_equal(posit8_2.fma(p, 2, 0.5).view(np.uint8), posit8_2.fma(p, p[72], p[56]).view(np.uint8))
+    assert posit8_2.fma(p, 2, np.full(256, 0.5)).dtype == np.float64
+
+def test_posit8_2_divmod():
+    posit8_2 = pytest.importorskip("posit8_2").posit8_2
+    p = np.arange(256, dtype=np.uint8).view(posit8_2)
+    x, y = np.repeat(p, 256), np.tile(p, 256)
+    fx, fy = x.astype(np.float64), y.astype(np.float64)
+    same = lambda a, b: np.array_equal(a.view(np.uint8), b.astype(posit8_2).view(np.uint8))
+    # Every pair, and every value for modf, against float64 rounded once; the
+    # reversed operands take the strided loops.
+    with np.errstate(all='ignore'):
+        for xs, ys, fxs, fys in ((x, y, fx, fy), (x[::-1], y[::-1], fx[::-1], fy[::-1])):
+            q, r = np.divmod(xs, ys)
+            fq, fr = np.divmod(fxs, fys)
+            assert q.dtype == posit8_2 and same(q, fq) and same(r, fr)
+            assert same(np.floor_divide(xs, ys), np.floor_divide(fxs, fys))
+            assert same(np.remainder(xs, ys), np.remainder(fxs, fys))
+        for ps in (p, p[::-1]):
+            frac, whole = np.modf(ps)
+            ffrac, fwhole = np.modf(ps.astype(np.float64))
+            assert same(frac, ffrac) and same(whole, fwhole)
+
+def round_to_bfloat16(d):
+    # float64 to bfloat16 rounded once: rounding to odd at float32 first keeps
+    # a sticky bit, so the float32 to bfloat16 rounding is the only one.
+    with np.errstate(over='ignore'):
+        f = d.astype(np.float32)
+    f = np.where(np.abs(f.astype(np.float64)) > np.abs(d), np.nextafter(f, np.float32(0)), f)
+    return (f.view(np.uint32) | (f.astype(np.float64) != d)).view(np.float32).astype(bfloat16)
+
+def test_make_unary_ufunc():
+    import bfloat16 as module
+    a = np.arange(1 << 16, dtype=np.uint32).astype(np.uint16).view(bfloat16)
+    finite = np.isfinite(a)
+    def swish(x):
+        return x / (1 + np.exp(-x))
+    f = module.make_unary_ufunc(swish)
+    assert not hasattr(bfloat16, "make_unary_ufunc") and not hasattr(bfloat16, "evaluate")
+    assert f is module.make_unary_ufunc(swish)
+    assert f is not module.make_unary_ufunc(swish, name="silu")
+    assert module.make_unary_ufunc(swish, name="silu").__name__ == "silu"
+    with np.errstate(all='ignore'):
+        # Evaluated in float64 and rounded once.
+        ref = swish(a[finite].astype(np.float64))
+        assert np.array_equal(f(a)[finite], round_to_bfloat16(ref))
+        # A value just above a bfloat16 tie, which rounding through float32 would
+        # round down onto the tie and then to even.
+        tie = 1 + 2.0 ** -8 + 2.0 ** -30
+        assert round_to_bfloat16(np.array([tie])) == 1 + 2.0 ** -7
+        assert module.make_unary_ufunc(lambda x: x * 0 + tie)(a[:1]) == 1 + 2.0 ** -7
+        assert np.array_equal(f(a[::-3]).view(np.uint16), f(a)[::-3].view(np.uint16))
+        g = module.make_unary_ufunc(lambda x: np.tanh(x) * bfloat16(0.5), exact=False)
+        assert np.array_equal(g(a).view(np.uint16), (np.tanh(a) * bfloat16(0.5)).view(np.uint16))
+    with np.errstate(invalid='raise'):
+        try:
+            module.make_unary_ufunc(np.sqrt)(np.array([-1.0], dtype=bfloat16))
+            assert False
+        except FloatingPointError:
+            pass
+    # The callable's own exception survives leaving the errstate context.
+    with pytest.raises(ZeroDivisionError):
+        module.make_unary_ufunc(lambda x: 1 / 0)(a[:4])
+    with pytest.raises(TypeError):
+        module.make_unary_ufunc(5)(a[:4])
+
+def test_make_ufunc():
+    module = pytest.importorskip("posit8_2")
+    posit8_2 = module.posit8_2
+    p = np.arange(256, dtype=np.uint8).view(posit8_2)
+    x = np.random.default_rng(0).integers(0, 256, 1000, dtype=np.uint8).view(posit8_2)
+    with np.errstate(all='ignore'):
+        half_tanh = module.make_unary_ufunc(lambda v: np.tanh(v) * 0.5)
+        assert np.array_equal(half_tanh(x[::-1]).view(np.uint8), (np.tanh(x[::-1]) * posit8_2(0.5)).view(np.uint8))
+        scaled = module.make_binary_ufunc(lambda a, b: np.maximum(a, b) * b, name="scaled")
+        assert scaled.__name__ == "scaled"
+        assert np.array_equal(scaled(x, p[70]).view(np.uint8), (np.maximum(x, p[70]) * p[70]).view(np.uint8))
+
+def test_evaluate():
+    import bfloat16 as module
+    rng = np.random.default_rng(0)
+    a = rng.standard_normal((3, 1000)).astype(bfloat16)
+    w = rng.standard_normal(1000).astype(bfloat16)
+    fa, fw = a.astype(np.float64), w.astype(np.float64)
+    r = module.evaluate("-a ** 2 * w + (a - 1) / 4", {"a": a, "w": w})
+    assert r.dtype == bfloat16 and r.shape == a.shape
+    assert np.array_equal(r.astype(np.float32), (-fa ** 2 * fw + (fa - 1) / 4).astype(bfloat16).astype(np.float32))
+    r = module.evaluate("tanh(a * w + 0.5) * s", {"a": a, "w": w, "s": 2.0})
+    assert np.allclose(r.astype(np.float32), np.tanh(fa * fw + 0.5) * 2.0, rtol=1e-2, atol=1e-6)
+    with np.errstate(divide='raise'):
+        try:
+            module.evaluate("1 / x", {"x": np.zeros(3, dtype=bfloat16)})
+            assert False
+        except FloatingPointError:
+            pass
+
+def test_posit8_2_evaluate():
+    module = pytest.importorskip("posit8_2")
+    posit8_2 = module.posit8_2
+    x = np.arange(256, dtype=np.uint8).view(posit8_2)[(np.arange(256) != 128)]
+    fx = x.astype(np.float64)
+    r = module.evaluate("maximum(x, 0.25) * x - 1", {"x": x})
+    assert np.array_equal(r.view(np.uint8), (np.maximum(fx, 0.25) * fx - 1).astype(posit8_2).view(np.uint8))
+
+def test_errstate():
+    a = np.array([1.0, 0.0, 3e38], dtype=bfloat16)
+    with np.errstate(all='ignore'):
+        a / np.array([0.0, 0.0, 0.5], dtype=bfloat16)
+    for f, args, kind in ((np.divide, (a, bfloat16(0.0)), 'divide'),
+                          (np.multiply, (a, a), 'over'),
+                          (np.exp, (a,), 'over'),
+                          (np.log, (-a,), 'invalid')):
+        ok = False
+        try:
+            with np.errstate(all='ignore', **{kind: 'raise'}):
+                f(*args)
+        except FloatingPointError:
+            ok = True
+        assert ok
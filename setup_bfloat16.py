@@ -33,6 +33,9 @@ module1 = Extension(PACKAGE_NAME,
                    sources=['src/bfloat16.cc'],
                    include_dirs=[np.get_include(), "include/eigen"],#, "include/posit8/include/"],
                    #swig_opts=['-I../include/eigen'],
+                   # npy_set_floatstatus_* come from NumPy's static npymath library
+                   library_dirs=[os.path.join(np.get_include(), '..', 'lib')],
+                   libraries=['npymath'],
                    extra_compile_args=['-std=c++1z', '-pthread', '-fPIC'])        # numpy libraries in C++ is obtained from here
 
 # module2 = Extension(PACKAGE_NAME,
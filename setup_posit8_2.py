@@ -37,6 +37,9 @@ class my_build_ext(build_ext):
 module2 = Extension(PACKAGE_NAME,
                     sources=['src/posit8.cc'],
                     include_dirs=[np.get_include(), "include/posit8/include/"],
+                    # npy_set_floatstatus_* come from NumPy's static npymath library
+                    library_dirs=[os.path.join(np.get_include(), '..', 'lib')],
+                    libraries=['npymath'],
                     extra_compile_args=['-std=c++1z', '-pthread', '-fPIC'])        # numpy libraries in C++ is obtained from here
 
 
@@ -25,7 +25,13 @@ limitations under the License.
 // #define DEBUG_CALLS
 
 #include <Python.h>
+#include <algorithm>
+#include <atomic>
 #include <cinttypes>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 #ifdef DEBUG_CALLS
 #include <iostream>
@@ -34,6 +40,36 @@ limitations under the License.
 #include <fenv.h>
 #include "numpy/arrayobject.h"
 #include "numpy/ufuncobject.h"
+#include "numpy/npy_math.h"
+#include "numpy/arrayscalars.h"
+#include "numpy/halffloat.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 9)
+#define BFLOAT16_VECTOR_KERNELS
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// F16C and AVX2 kernels are compiled for them function by function and chosen
+// at run time, so the module itself does not require either.
+#define BFLOAT16_X86_DISPATCH
+#include <immintrin.h>
+#endif
+#ifdef BFLOAT16_VECTOR_KERNELS
+// The kernels' helpers on 8- and 16-lane vectors are always_inline and only
+// ever inlined into AVX2 and AVX-512 functions, so the ABI they would have out
+// of line does not matter. GCC still checks it for the baseline target as it
+// inlines them, at the end of the file, where no push/pop region can reach, so
+// -Wpsabi is off for the whole file.
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+#if PY_VERSION_HEX < 0x030900A4 && !defined(Py_SET_TYPE)
+#define Py_SET_TYPE(obj, type) ((Py_TYPE(obj) = (type)), (void)0)
+#endif
+#if PY_VERSION_HEX < 0x030900A4 && !defined(Py_IS_TYPE)
+#define Py_IS_TYPE(obj, type) (Py_TYPE(obj) == (type))
+#endif
 
 namespace qsbfloat16
 {
@@ -71,19 +107,35 @@ namespace qsbfloat16
 			return (overflow == 0);
 		}
 
-		// Registered numpy type ID. Global variable populated by the registration code.
-		// Protected by the GIL.
+		// Registered numpy type ID. NumPy's type registry is process-wide, so this is
+		// written exactly once, under registration_mutex, before any module object
+		// is handed out; afterwards it is read-only.
 		int npy_bfloat16 = NPY_NOTYPE;
 
+		// Set, with release ordering, once registration has succeeded. Module exec
+		// reads it before taking registration_mutex, so that on free-threaded builds
+		// npy_bfloat16, bfloat16_type_ptr and fma_ufunc are only read after they are
+		// fully written.
+		std::atomic<bool> bfloat16_registered{false};
+
 		// Forward declaration.
-		extern PyTypeObject bfloat16_type;
 		extern PyArray_Descr NPyBfloat16_Descr;
 
-		// Pointer to the bfloat16 type object we are using. This is either a pointer
-		// to bfloat16_type, if we choose to register it, or to the bfloat16 type
-		// registered by another system into NumPy.
+		// Pointer to the bfloat16 type object we are using. This is either the heap
+		// type created from bfloat16_type_spec, if we choose to register it, or the
+		// bfloat16 type registered by another system into NumPy. Like npy_bfloat16
+		// it is set once per process; each module object holds a reference to it
+		// as its 'bfloat16' attribute.
 		PyTypeObject *bfloat16_type_ptr = nullptr;
 
+		// Per-module state, set up by Bfloat16ModuleExec.
+		struct Bfloat16State
+		{
+			// Ufuncs made by make_unary_ufunc, keyed by (fn, exact, name) and in
+			// least recently used order.
+			PyObject *user_ufunc_cache;
+		};
+
 		// Representation of a Python bfloat16 object.
 		struct PyBfloat16
 		{
@@ -94,7 +146,7 @@ namespace qsbfloat16
 		// Returns true if 'object' is a PyBfloat16.
 		bool PyBfloat16_Check(PyObject *object)
 		{
-			return PyObject_IsInstance(object, reinterpret_cast<PyObject *>(&bfloat16_type));
+			return PyObject_TypeCheck(object, bfloat16_type_ptr);
 		}
 
 		// Extracts the value of a PyBfloat16 object.
@@ -106,13 +158,45 @@ namespace qsbfloat16
 		// Constructs a PyBfloat16 object from a bfloat16.
 		PyObject *PyBfloat16_FromBfloat16(bfloat16 x)
 		{
-			return PyArray_Scalar(&x, &NPyBfloat16_Descr, NULL);
+			if (NPyBfloat16_Descr.typeobj != bfloat16_type_ptr)
+			{
+				// bfloat16 was registered by another module.
+				return PyArray_Scalar(&x, &NPyBfloat16_Descr, NULL);
+			}
+			PyObject *scalar = bfloat16_type_ptr->tp_alloc(bfloat16_type_ptr, 0);
+			if (scalar)
+			{
+				reinterpret_cast<PyBfloat16 *>(scalar)->value = x;
+			}
+			return scalar;
 		}
 
 		// Converts a Python object to a bfloat16 value. Returns true on success,
 		// returns false and reports a Python error on failure.
 		bool CastToBfloat16(PyObject *arg, bfloat16 *output)
 		{
+			// Exact-type fast paths for the common arguments: our own scalars,
+			// Python floats and Python ints that fit in a long.
+			if (Py_IS_TYPE(arg, bfloat16_type_ptr))
+			{
+				*output = PyBfloat16_Bfloat16(arg);
+				return true;
+			}
+			if (PyFloat_CheckExact(arg))
+			{
+				*output = bfloat16(PyFloat_AS_DOUBLE(arg));
+				return true;
+			}
+			if (PyLong_CheckExact(arg))
+			{
+				int overflow = 0;
+				long l = PyLong_AsLongAndOverflow(arg, &overflow); // NOLINT
+				if (!overflow)
+				{
+					*output = bfloat16(static_cast<float>(l));
+					return true;
+				}
+			}
 			if (PyBfloat16_Check(arg))
 			{
 				*output = PyBfloat16_Bfloat16(arg);
@@ -181,23 +265,9 @@ namespace qsbfloat16
 			return false;
 		}
 
-		// Constructs a new PyBfloat16.
-		PyObject *PyBfloat16_New(PyTypeObject *type, PyObject *args, PyObject *kwds)
+		// Converts the single argument of the bfloat16 constructor.
+		PyObject *PyBfloat16_FromArg(PyObject *arg)
 		{
-			if (kwds && PyDict_Size(kwds))
-			{
-				PyErr_SetString(PyExc_TypeError, "constructor takes no keyword arguments");
-				return nullptr;
-			}
-			Py_ssize_t size = PyTuple_Size(args);
-			if (size != 1)
-			{
-				PyErr_SetString(PyExc_TypeError,
-								"expected number as argument to bfloat16 constructor");
-				return nullptr;
-			}
-			PyObject *arg = PyTuple_GetItem(args, 0);
-
 			bfloat16 value;
 			if (PyBfloat16_Check(arg))
 			{
@@ -226,8 +296,49 @@ namespace qsbfloat16
 			return nullptr;
 		}
 
-		// Comparisons on PyBfloat16s.
-		PyObject *PyBfloat16_RichCompare(PyObject *self, PyObject *other, int cmp_op)
+		// Constructs a new PyBfloat16.
+		PyObject *PyBfloat16_New(PyTypeObject *type, PyObject *args, PyObject *kwds)
+		{
+			if (kwds && PyDict_Size(kwds))
+			{
+				PyErr_SetString(PyExc_TypeError, "constructor takes no keyword arguments");
+				return nullptr;
+			}
+			Py_ssize_t size = PyTuple_Size(args);
+			if (size != 1)
+			{
+				PyErr_SetString(PyExc_TypeError,
+								"expected number as argument to bfloat16 constructor");
+				return nullptr;
+			}
+			return PyBfloat16_FromArg(PyTuple_GetItem(args, 0));
+		}
+
+#if PY_VERSION_HEX >= 0x03090000
+		// Vectorcall entry point for bfloat16(x). Calls of the exact type skip the
+		// argument tuple and keyword dict that tp_new needs; subclasses still go
+		// through tp_new.
+		PyObject *PyBfloat16_Vectorcall(PyObject *type, PyObject *const *args,
+										size_t nargsf, PyObject *kwnames)
+		{
+			if (kwnames && PyTuple_GET_SIZE(kwnames))
+			{
+				PyErr_SetString(PyExc_TypeError, "constructor takes no keyword arguments");
+				return nullptr;
+			}
+			if (PyVectorcall_NARGS(nargsf) != 1)
+			{
+				PyErr_SetString(PyExc_TypeError,
+								"expected number as argument to bfloat16 constructor");
+				return nullptr;
+			}
+			return PyBfloat16_FromArg(args[0]);
+		}
+#endif
+
+		// Comparisons of PyBfloat16s with arrays and other objects NumPy knows how to
+		// convert, by way of 0-d arrays and the comparison ufuncs.
+		PyObject *PyBfloat16_ArrayRichCompare(PyObject *self, PyObject *other, int cmp_op)
 		{
 			PyObject *arr, *ret;
 
@@ -265,12 +376,24 @@ namespace qsbfloat16
 			return PyUnicode_FromString(v.c_str());
 		}
 
-		// Hash function for PyBfloat16. We use the identity function, which is a weak
-		// hash function.
+		// Hash of a double, as computed for Python floats.
+		Py_hash_t HashDouble(PyObject *self, double d)
+		{
+#if PY_VERSION_HEX >= 0x030D0000
+			return Py_HashDouble(self, d);
+#elif PY_VERSION_HEX >= 0x030A0000
+			return _Py_HashDouble(self, d);
+#else
+			return _Py_HashDouble(d);
+#endif
+		}
+
+		// Hash function for PyBfloat16. Scalars compare equal to Python floats of
+		// the same value, so they hash like them too.
 		Py_hash_t PyBfloat16_Hash(PyObject *self)
 		{
 			bfloat16 x = reinterpret_cast<PyBfloat16 *>(self)->value;
-			return x.value;
+			return HashDouble(self, static_cast<double>(x));
 		}
 
 		// Converts a PyBfloat16 into a PyFloat.
@@ -286,45 +409,6 @@ namespace qsbfloat16
 			return PyLong_FromLong(y);
 		}
 
-		PyNumberMethods PyBfloat16_AsNumber = {
-			nullptr,     	  	// nb_add
-			nullptr,  			// nb_subtract
-			nullptr,  			// nb_multiply
-			nullptr,              // nb_remainder
-			nullptr,              // nb_divmod
-			nullptr,              // nb_power
-			nullptr,  			  // nb_negative
-			nullptr,              // nb_positive
-			nullptr,              // nb_absolute
-			nullptr,              // nb_nonzero
-			nullptr,              // nb_invert
-			nullptr,              // nb_lshift
-			nullptr,              // nb_rshift
-			nullptr,              // nb_and
-			nullptr,              // nb_xor
-			nullptr,              // nb_or
-			PyBfloat16_Int,       // nb_int
-			nullptr,              // reserved
-			PyBfloat16_Float,     // nb_float
-
-			nullptr,  // nb_inplace_add
-			nullptr,  // nb_inplace_subtract
-			nullptr,  // nb_inplace_multiply
-			nullptr,  // nb_inplace_remainder
-			nullptr,  // nb_inplace_power
-			nullptr,  // nb_inplace_lshift
-			nullptr,  // nb_inplace_rshift
-			nullptr,  // nb_inplace_and
-			nullptr,  // nb_inplace_xor
-			nullptr,  // nb_inplace_or
-
-			nullptr,                // nb_floor_divide
-			nullptr,  				// nb_true_divide
-			nullptr,                // nb_inplace_floor_divide
-			nullptr,                // nb_inplace_true_divide
-			nullptr,                // nb_index
-		};
-
 		// format bfloat16. Convert to a float and call format on that
 		PyObject *PyBfloat16_Format(PyObject *self, PyObject *format)
 		{
@@ -337,6 +421,288 @@ namespace qsbfloat16
 			return f_str;
 		}
 
+		// Copies a list or tuple made up only of Python floats and ints into
+		// 'buffer'. Ints are rounded through float exactly as CastToBfloat16 does.
+		// Returns false, without setting an error, as soon as any other item (or an
+		// int that does not fit in a long) is found.
+		bool SequenceToDoubles(PyObject *seq, std::vector<double> *buffer)
+		{
+			Py_ssize_t size = PySequence_Fast_GET_SIZE(seq);
+			PyObject **items = PySequence_Fast_ITEMS(seq);
+			buffer->resize(size);
+			double *out = buffer->data();
+			for (Py_ssize_t i = 0; i < size; ++i)
+			{
+				PyObject *item = items[i];
+				if (PyFloat_CheckExact(item))
+				{
+					out[i] = PyFloat_AS_DOUBLE(item);
+				}
+				else if (PyLong_CheckExact(item))
+				{
+					int overflow = 0;
+					long l = PyLong_AsLongAndOverflow(item, &overflow); // NOLINT
+					if (overflow)
+					{
+						return false;
+					}
+					out[i] = static_cast<float>(l);
+				}
+				else
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// bfloat16.from_list(seq): builds a bfloat16 array from a list or tuple of
+		// Python numbers. Flat float/int sequences are gathered into a double buffer
+		// in one pass and converted in bulk; anything else, nested sequences
+		// included, goes through np.array(seq, dtype=bfloat16) and may give an n-d
+		// array.
+		PyObject *PyBfloat16_FromList(PyObject *cls, PyObject *seq)
+		{
+			if (PyList_CheckExact(seq) || PyTuple_CheckExact(seq))
+			{
+				std::vector<double> buffer;
+				bool homogeneous;
+#if PY_VERSION_HEX >= 0x030D0000
+				Py_BEGIN_CRITICAL_SECTION(seq);
+				homogeneous = SequenceToDoubles(seq, &buffer);
+				Py_END_CRITICAL_SECTION();
+#else
+				homogeneous = SequenceToDoubles(seq, &buffer);
+#endif
+				if (homogeneous)
+				{
+					npy_intp size = static_cast<npy_intp>(buffer.size());
+					Py_INCREF(&NPyBfloat16_Descr);
+					PyObject *arr = PyArray_NewFromDescr(&PyArray_Type, &NPyBfloat16_Descr, 1,
+														 &size, nullptr, nullptr, 0, nullptr);
+					if (!arr)
+					{
+						return nullptr;
+					}
+					bfloat16 *out = reinterpret_cast<bfloat16 *>(
+						PyArray_DATA(reinterpret_cast<PyArrayObject *>(arr)));
+					for (npy_intp i = 0; i < size; ++i)
+					{
+						out[i] = bfloat16(buffer[i]);
+					}
+					return arr;
+				}
+			}
+			Py_INCREF(&NPyBfloat16_Descr);
+			return PyArray_FromAny(seq, &NPyBfloat16_Descr, 0, 0, 0, nullptr);
+		}
+
+		// Builds the nested lists for dimension 'dim' of 'arr' starting at 'data'.
+		// 'decode' returns a new reference for the element at a given address.
+		template <typename Decode>
+		PyObject *ArrayToList(PyArrayObject *arr, const char *data, int dim, Decode decode)
+		{
+			npy_intp size = PyArray_DIM(arr, dim);
+			npy_intp stride = PyArray_STRIDE(arr, dim);
+			bool innermost = dim + 1 == PyArray_NDIM(arr);
+			PyObject *list = PyList_New(size);
+			if (!list)
+			{
+				return nullptr;
+			}
+			for (npy_intp i = 0; i < size; ++i, data += stride)
+			{
+				PyObject *item = innermost ? decode(data) : ArrayToList(arr, data, dim + 1, decode);
+				if (!item)
+				{
+					Py_DECREF(list);
+					return nullptr;
+				}
+				PyList_SET_ITEM(list, i, item);
+			}
+			return list;
+		}
+
+		template <typename Decode>
+		PyObject *ArrayToList(PyArrayObject *arr, Decode decode)
+		{
+			if (PyArray_NDIM(arr) == 0)
+			{
+				return decode(PyArray_BYTES(arr));
+			}
+			return ArrayToList(arr, PyArray_BYTES(arr), 0, decode);
+		}
+
+		// bfloat16.to_list(arr, scalars=False): the bulk counterpart of arr.tolist().
+		// Elements are decoded straight from the array memory into pre-sized lists,
+		// without going through getitem for each one.
+		PyObject *PyBfloat16_ToList(PyObject *cls, PyObject *args, PyObject *kwds)
+		{
+			static const char *kwlist[] = {"arr", "scalars", nullptr};
+			PyObject *obj;
+			int scalars = 0;
+			if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|p:to_list",
+											 const_cast<char **>(kwlist), &obj, &scalars))
+			{
+				return nullptr;
+			}
+			Py_INCREF(&NPyBfloat16_Descr);
+			Safe_PyObjectPtr ref = make_safe(
+				PyArray_FromAny(obj, &NPyBfloat16_Descr, 0, 0, NPY_ARRAY_FORCECAST, nullptr));
+			if (!ref)
+			{
+				return nullptr;
+			}
+			PyArrayObject *arr = reinterpret_cast<PyArrayObject *>(ref.get());
+			if (scalars)
+			{
+				return ArrayToList(arr, [](const char *p)
+									 {
+										 bfloat16 x;
+										 memcpy(static_cast<void *>(&x), p, sizeof(x));
+										 return PyBfloat16_FromBfloat16(x);
+									 });
+			}
+			return ArrayToList(arr, [](const char *p)
+									 {
+										 bfloat16 x;
+										 memcpy(static_cast<void *>(&x), p, sizeof(x));
+										 return PyFloat_FromDouble(static_cast<float>(x));
+									 });
+		}
+
+		// Transposes of large bfloat16 matrices are done in square blocks that fit
+		// in L1 along with their destination.
+		constexpr npy_intp kTransposeBlock = 64;
+
+#ifdef __SSE2__
+		// Transposes a 8x8 tile of uint16 elements. The source rows are contiguous;
+		// strides are in elements. 3 rounds of interleaving row k with row k + 4
+		// leave the transposed rows in order.
+		void TransposeTile(const uint16 *src, npy_intp src_stride, uint16 *dst, npy_intp dst_stride)
+		{
+			__m128i r[8], t[8];
+			for (int k = 0; k < 8; ++k)
+			{
+				r[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + k * src_stride));
+			}
+			for (int round = 0; round < 3; ++round)
+			{
+				for (int k = 0; k < 4; ++k)
+				{
+					t[2 * k] = _mm_unpacklo_epi16(r[k], r[k + 4]);
+					t[2 * k + 1] = _mm_unpackhi_epi16(r[k], r[k + 4]);
+				}
+				std::copy(t, t + 8, r);
+			}
+			for (int k = 0; k < 8; ++k)
+			{
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + k * dst_stride), r[k]);
+			}
+		}
+#endif
+
+		// Writes the transpose of the rows x cols matrix 'src', whose byte strides
+		// are 'row_stride' and 'col_stride', to 'dst' in C order.
+		void TransposeCopy(const char *src, npy_intp rows, npy_intp cols,
+						   npy_intp row_stride, npy_intp col_stride, uint16 *dst)
+		{
+			for (npy_intp i0 = 0; i0 < rows; i0 += kTransposeBlock)
+			{
+				npy_intp i1 = std::min(i0 + kTransposeBlock, rows);
+				for (npy_intp j0 = 0; j0 < cols; j0 += kTransposeBlock)
+				{
+					npy_intp j1 = std::min(j0 + kTransposeBlock, cols);
+					npy_intp i = i0;
+#ifdef __SSE2__
+					if (col_stride == sizeof(uint16) && row_stride % sizeof(uint16) == 0)
+					{
+						npy_intp src_stride = row_stride / npy_intp(sizeof(uint16));
+						for (; i + 8 <= i1; i += 8)
+						{
+							const uint16 *row = reinterpret_cast<const uint16 *>(src + i * row_stride);
+							npy_intp j = j0;
+							for (; j + 8 <= j1; j += 8)
+							{
+								TransposeTile(row + j, src_stride, dst + j * rows + i, rows);
+							}
+							for (; j < j1; ++j)
+							{
+								for (npy_intp k = 0; k < 8; ++k)
+								{
+									dst[j * rows + i + k] = row[k * src_stride + j];
+								}
+							}
+						}
+					}
+#endif
+					for (; i < i1; ++i)
+					{
+						const char *row = src + i * row_stride;
+						for (npy_intp j = j0; j < j1; ++j)
+						{
+							dst[j * rows + i] = *reinterpret_cast<const uint16 *>(row + j * col_stride);
+						}
+					}
+				}
+			}
+		}
+
+		// bfloat16.transpose_copy(arr): a C-contiguous copy of arr.T. 2-d arrays go
+		// through the blocked kernel above with the GIL released; other ranks fall
+		// back to NumPy's copy.
+		PyObject *PyBfloat16_TransposeCopy(PyObject *cls, PyObject *obj)
+		{
+			Py_INCREF(&NPyBfloat16_Descr);
+			Safe_PyObjectPtr ref = make_safe(PyArray_FromAny(
+				obj, &NPyBfloat16_Descr, 0, 0, NPY_ARRAY_FORCECAST | NPY_ARRAY_ALIGNED, nullptr));
+			if (!ref)
+			{
+				return nullptr;
+			}
+			PyArrayObject *arr = reinterpret_cast<PyArrayObject *>(ref.get());
+			if (PyArray_NDIM(arr) != 2)
+			{
+				Safe_PyObjectPtr transposed = make_safe(PyArray_Transpose(arr, nullptr));
+				if (!transposed)
+				{
+					return nullptr;
+				}
+				return PyArray_NewCopy(reinterpret_cast<PyArrayObject *>(transposed.get()), NPY_CORDER);
+			}
+			npy_intp rows = PyArray_DIM(arr, 0), cols = PyArray_DIM(arr, 1);
+			npy_intp dims[2] = {cols, rows};
+			Py_INCREF(&NPyBfloat16_Descr);
+			PyObject *out = PyArray_NewFromDescr(&PyArray_Type, &NPyBfloat16_Descr, 2, dims,
+												 nullptr, nullptr, 0, nullptr);
+			if (!out)
+			{
+				return nullptr;
+			}
+			uint16 *dst = reinterpret_cast<uint16 *>(PyArray_DATA(reinterpret_cast<PyArrayObject *>(out)));
+			Py_BEGIN_ALLOW_THREADS;
+			TransposeCopy(PyArray_BYTES(arr), rows, cols, PyArray_STRIDE(arr, 0),
+						  PyArray_STRIDE(arr, 1), dst);
+			Py_END_ALLOW_THREADS;
+			return out;
+		}
+
+		// Whether the transcendental ufuncs look their results up in tables of all
+		// 65536 inputs instead of computing them (see UnaryTable). Process-wide.
+		std::atomic<bool> unary_tables_enabled{false};
+
+		// bfloat16.use_unary_tables(flag): switches table mode on or off and
+		// returns the previous setting.
+		PyObject *PyBfloat16_UseUnaryTables(PyObject *cls, PyObject *arg)
+		{
+			int enable = PyObject_IsTrue(arg);
+			if (enable < 0)
+			{
+				return nullptr;
+			}
+			return PyBool_FromLong(unary_tables_enabled.exchange(enable != 0));
+		}
+
 		static PyMethodDef PyBfloat16_methods[] = {
 			{
 				"__format__",
@@ -344,6 +710,34 @@ namespace qsbfloat16
 				METH_O,
 				"__format__ method for bfloat16"
 			},
+			{
+				"from_list",
+				(PyCFunction) PyBfloat16_FromList,
+				METH_O | METH_CLASS,
+				"from_list(seq) -> bfloat16 array built from a list or tuple of numbers; "
+				"nested sequences give n-d arrays"
+			},
+			{
+				"transpose_copy",
+				(PyCFunction) PyBfloat16_TransposeCopy,
+				METH_O | METH_CLASS,
+				"transpose_copy(arr) -> C-contiguous copy of arr.T"
+			},
+			{
+				"to_list",
+				(PyCFunction)(void (*)(void)) PyBfloat16_ToList,
+				METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+				"to_list(arr, scalars=False) -> nested lists of Python floats, or of bfloat16\n"
+				"scalars if scalars is true, with the shape of arr"
+			},
+			{
+				"use_unary_tables",
+				(PyCFunction) PyBfloat16_UseUnaryTables,
+				METH_O | METH_CLASS,
+				"use_unary_tables(flag) -> previous setting. With tables on, exp, log, sin,\n"
+				"tanh, cbrt and the other transcendental ufuncs return correctly rounded\n"
+				"results from tables built on first use, identical on every machine"
+			},
 			{NULL}  /* Sentinel */
 		};
 
@@ -370,73 +764,7 @@ namespace qsbfloat16
 			view->internal = NULL;
 			return 0;
 		}
-
-		static PyBufferProcs PyBfloat16_buffer_procs = {
-			&PyBfloat16_getbuffer,
-			NULL
-		};
-#endif
-
-		// Python type for PyBfloat16 objects.
-
-		PyTypeObject bfloat16_type = {
-			PyVarObject_HEAD_INIT(nullptr, 0) "bfloat16", // tp_name
-			sizeof(PyBfloat16),							  // tp_basicsize
-			0,											  // tp_itemsize
-			nullptr,									  // tp_dealloc
-#if PY_VERSION_HEX < 0x03080000
-			nullptr, // tp_print
-#else
-			0, // tp_vectorcall_offset
-#endif
-			nullptr,			  // tp_getattr
-			nullptr,			  // tp_setattr
-			nullptr,			  // tp_compare / tp_reserved
-			PyBfloat16_Repr,	  // tp_repr
-			&PyBfloat16_AsNumber, // tp_as_number
-			nullptr,			  // tp_as_sequence
-			nullptr,			  // tp_as_mapping
-			PyBfloat16_Hash,	  // tp_hash
-			nullptr,			  // tp_call
-			PyBfloat16_Str,		  // tp_str
-			nullptr,			  // tp_getattro
-			nullptr,			  // tp_setattro
-#ifdef IMPLEMENT_BUFFER
-			&PyBfloat16_buffer_procs,			  // tp_as_buffer
-#else
-			nullptr,
 #endif
-								  // tp_flags
-			Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-			"bfloat16 floating-point values", // tp_doc
-			nullptr,						  // tp_traverse
-			nullptr,						  // tp_clear
-			PyBfloat16_RichCompare,			  // tp_richcompare
-			0,								  // tp_weaklistoffset
-			nullptr,						  // tp_iter
-			nullptr,						  // tp_iternext
-			PyBfloat16_methods,						  // tp_methods
-			nullptr,						  // tp_members
-			nullptr,						  // tp_getset
-			nullptr,			  // tp_base
-			nullptr,						  // tp_dict
-			nullptr,						  // tp_descr_get
-			nullptr,						  // tp_descr_set
-			0,								  // tp_dictoffset
-			nullptr,						  // tp_init
-			nullptr,						  // tp_alloc
-			PyBfloat16_New,					  // tp_new
-			nullptr,						  // tp_free
-			nullptr,						  // tp_is_gc
-			nullptr,						  // tp_bases
-			nullptr,						  // tp_mro
-			nullptr,						  // tp_cache
-			nullptr,						  // tp_subclasses
-			nullptr,						  // tp_weaklist
-			nullptr,						  // tp_del
-			0,								  // tp_version_tag
-		};
-
 
 		// Numpy support
 
@@ -445,7 +773,7 @@ namespace qsbfloat16
 		PyArray_Descr NPyBfloat16_Descr = {
 			PyObject_HEAD_INIT(nullptr) //
 										/*typeobj=*/
-			(&bfloat16_type),
+			nullptr, // Set to bfloat16_type_ptr at registration.
 			// We must register bfloat16 with a kind other than "f", because numpy
 			// considers two types with the same kind and size to be equal, but
 			// float16 != bfloat16.
@@ -475,7 +803,14 @@ namespace qsbfloat16
 		{
 
 			bfloat16 x;
-			NPyBfloat16_Descr.f->copyswap(&x, data, !PyArray_ISNOTSWAPPED(reinterpret_cast<PyArrayObject *>(arr)), NULL);
+			if (arr && !PyArray_ISNOTSWAPPED(reinterpret_cast<PyArrayObject *>(arr)))
+			{
+				NPyBfloat16_Descr.f->copyswap(&x, data, 1, NULL);
+			}
+			else
+			{
+				memcpy(static_cast<void *>(&x), data, sizeof(x));
+			}
 			return PyBfloat16_FromBfloat16(x);
 		}
 
@@ -549,18 +884,66 @@ namespace qsbfloat16
 			return x != static_cast<bfloat16>(0);
 		}
 
+		// Rounds a float to bfloat16 bits the same way Eigen does (round to nearest
+		// even, NaNs become a quiet NaN of the same sign), without branches so that
+		// loops over it vectorize.
+		inline uint16 FloatToBfloat16Bits(float f)
+		{
+			std::uint32_t bits;
+			memcpy(&bits, &f, sizeof(bits));
+			std::uint32_t rounded = (bits + 0x7fffu + ((bits >> 16) & 1u)) >> 16;
+			std::uint32_t nan = (bits >> 16) | 0x7fc0u;
+			return static_cast<uint16>(f != f ? nan & 0xffc0u : rounded);
+		}
+
+		uint16 Bfloat16Bits(bfloat16 x)
+		{
+			uint16 bits;
+			memcpy(&bits, &x, sizeof(bits));
+			return bits;
+		}
+
+		bfloat16 Bfloat16FromBits(uint16 bits)
+		{
+			bfloat16 x;
+			memcpy(static_cast<void *>(&x), &bits, sizeof(bits));
+			return x;
+		}
+
+		// arange fill: values are computed in float in blocks and rounded with
+		// FloatToBfloat16Bits, so both loops vectorize.
 		int NPyBfloat16_Fill(void *buffer_raw, npy_intp length, void *ignored)
 		{
 			bfloat16 *const buffer = reinterpret_cast<bfloat16 *>(buffer_raw);
+			uint16 *const bits = reinterpret_cast<uint16 *>(buffer_raw);
 			const float start(buffer[0]);
 			const float delta = static_cast<float>(buffer[1]) - start;
-			for (npy_intp i = 2; i < length; ++i)
+			constexpr npy_intp kBlock = 256;
+			float values[kBlock];
+			for (npy_intp i0 = 2; i0 < length; i0 += kBlock)
 			{
-				buffer[i] = static_cast<bfloat16>(start + i * delta);
+				npy_intp n = std::min(kBlock, length - i0);
+				for (npy_intp k = 0; k < n; ++k)
+				{
+					values[k] = start + (i0 + k) * delta;
+				}
+				for (npy_intp k = 0; k < n; ++k)
+				{
+					bits[i0 + k] = FloatToBfloat16Bits(values[k]);
+				}
 			}
 			return 0;
 		}
 
+		// Fills 'length' elements with the bfloat16 at 'value' using 16-bit stores.
+		int NPyBfloat16_FillWithScalar(void *buffer, npy_intp length, void *value, void *ignored)
+		{
+			uint16 bits;
+			memcpy(&bits, value, sizeof(bits));
+			std::fill_n(reinterpret_cast<uint16 *>(buffer), length, bits);
+			return 0;
+		}
+
 		void NPyBfloat16_DotFunc(void *ip1, npy_intp is1, void *ip2, npy_intp is2,
 								 void *op, npy_intp n, void *arr)
 		{
@@ -810,40 +1193,3023 @@ namespace qsbfloat16
 			return true;
 		}
 
-		template <typename InType, typename OutType, typename Functor>
-		struct UnaryUFunc
+#ifdef BFLOAT16_X86_DISPATCH
+		// CPU features of the run-time dispatched kernels, checked once.
+		bool HasF16C()
 		{
-			static std::vector<int> Types()
+			static const bool has_f16c = (__builtin_cpu_init(), __builtin_cpu_supports("f16c"));
+			return has_f16c;
+		}
+
+		bool HasAvx2()
+		{
+			static const bool has_avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+			return has_avx2;
+		}
+
+		bool HasAvx512()
+		{
+			static const bool has_avx512 = (__builtin_cpu_init(), __builtin_cpu_supports("avx512f"));
+			return has_avx512;
+		}
+#endif
+
+		// half <-> bfloat16 casts. Both go through float, which holds every half
+		// and bfloat16 value exactly, a block at a time: with F16C eight halves are
+		// widened or narrowed per instruction, and the float <-> bfloat16 half of
+		// each block is plain bit arithmetic that vectorizes.
+		constexpr npy_intp kHalfBlock = 256;
+
+#ifdef BFLOAT16_X86_DISPATCH
+		__attribute__((target("avx,f16c"))) void HalfToFloatF16C(const uint16 *from, float *to, npy_intp n)
+		{
+			npy_intp i = 0;
+			for (; i + 8 <= n; i += 8)
 			{
-				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<OutType>::Dtype()};
+				__m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(from + i));
+				_mm256_storeu_ps(to + i, _mm256_cvtph_ps(h));
 			}
-			static void Call(char **args, const npy_intp *dimensions,
-							 const npy_intp *steps, void *data)
+			for (; i < n; ++i)
 			{
-				const char *i0 = args[0];
-				char *o = args[1];
-				for (npy_intp k = 0; k < *dimensions; k++)
-				{
-					auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
-					*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) = Functor()(x);
-					i0 += steps[0];
-					o += steps[1];
-				}
+				to[i] = _cvtsh_ss(from[i]);
 			}
-		};
+		}
 
-		template <typename InType, typename OutType, typename OutType2,
-				  typename Functor>
-		struct UnaryUFunc2
+		__attribute__((target("avx,f16c"))) void FloatToHalfF16C(const float *from, uint16 *to, npy_intp n)
 		{
-			static std::vector<int> Types()
+			npy_intp i = 0;
+			for (; i + 8 <= n; i += 8)
 			{
-				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<OutType>::Dtype(),
+				__m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(from + i), _MM_FROUND_TO_NEAREST_INT);
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(to + i), h);
+			}
+			for (; i < n; ++i)
+			{
+				to[i] = _cvtss_sh(from[i], _MM_FROUND_TO_NEAREST_INT);
+			}
+		}
+#endif
+
+		void HalfToFloat(const Eigen::half *from, float *to, npy_intp n)
+		{
+#ifdef BFLOAT16_X86_DISPATCH
+			if (HasF16C())
+			{
+				HalfToFloatF16C(reinterpret_cast<const uint16 *>(from), to, n);
+				return;
+			}
+#endif
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				to[i] = static_cast<float>(from[i]);
+			}
+		}
+
+		// 'from' holds no NaN payloads, which Eigen and F16C narrow differently.
+		void FloatToHalf(const float *from, Eigen::half *to, npy_intp n)
+		{
+#ifdef BFLOAT16_X86_DISPATCH
+			if (HasF16C())
+			{
+				FloatToHalfF16C(from, reinterpret_cast<uint16 *>(to), n);
+				return;
+			}
+#endif
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				to[i] = static_cast<Eigen::half>(from[i]);
+			}
+		}
+
+		void NPyCastHalfToBfloat16(void *from_void, void *to_void, npy_intp n, void *fromarr,
+								   void *toarr)
+		{
+			const auto *from = reinterpret_cast<const Eigen::half *>(from_void);
+			auto *to = reinterpret_cast<uint16 *>(to_void);
+			float values[kHalfBlock];
+			for (npy_intp i0 = 0; i0 < n; i0 += kHalfBlock)
+			{
+				npy_intp m = std::min(kHalfBlock, n - i0);
+				HalfToFloat(from + i0, values, m);
+				for (npy_intp k = 0; k < m; ++k)
+				{
+					to[i0 + k] = FloatToBfloat16Bits(values[k]);
+				}
+			}
+		}
+
+		void NPyCastBfloat16ToHalf(void *from_void, void *to_void, npy_intp n, void *fromarr,
+								   void *toarr)
+		{
+			const auto *from = reinterpret_cast<const uint16 *>(from_void);
+			auto *to = reinterpret_cast<Eigen::half *>(to_void);
+			float values[kHalfBlock];
+			for (npy_intp i0 = 0; i0 < n; i0 += kHalfBlock)
+			{
+				npy_intp m = std::min(kHalfBlock, n - i0);
+				for (npy_intp k = 0; k < m; ++k)
+				{
+					// NaNs become the quiet NaN of their sign.
+					std::uint32_t bits = static_cast<std::uint32_t>(from[i0 + k]) << 16;
+					std::uint32_t nan = (bits & 0x80000000u) | 0x7fc00000u;
+					bits = (bits & 0x7fffffffu) > 0x7f800000u ? nan : bits;
+					memcpy(&values[k], &bits, sizeof(float));
+				}
+				FloatToHalf(values, to + i0, m);
+			}
+		}
+
+		bool RegisterHalfCasts()
+		{
+			if (PyArray_RegisterCastFunc(PyArray_DescrFromType(NPY_HALF), npy_bfloat16, NPyCastHalfToBfloat16) < 0)
+			{
+				return false;
+			}
+			if (PyArray_RegisterCastFunc(&NPyBfloat16_Descr, NPY_HALF, NPyCastBfloat16ToHalf) < 0)
+			{
+				return false;
+			}
+			return true;
+		}
+
+		// Marks the operand types of the mixed loops (see RegisterMixedUFuncs) as
+		// casting to bfloat16 safely, although int16, uint16 and half values may
+		// round, like Python ints and floats: promotion, as in np.result_type and
+		// np.where, then agrees with the mixed loops, which keep such operands
+		// bfloat16 the way NumPy keeps them float16.
+		bool RegisterMixedCasts()
+		{
+			for (int type : {NPY_BOOL, NPY_INT8, NPY_UINT8, NPY_INT16, NPY_UINT16, NPY_HALF})
+			{
+				Safe_PyObjectPtr descr = make_safe(reinterpret_cast<PyObject *>(PyArray_DescrFromType(type)));
+				if (!descr || PyArray_RegisterCanCast(reinterpret_cast<PyArray_Descr *>(descr.get()), npy_bfloat16,
+													  NPY_NOSCALAR) < 0)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// Direct casts to and from the posit8_2 type of the posit8 module. This
+		// module does not decode posits itself: both tables are filled once through
+		// the posit8_2 casts to and from float32, which every posit8_2 and bfloat16
+		// value passes through exactly, so the results match casting via float32.
+		PyArray_VectorUnaryFunc *posit8_2_to_float = nullptr;
+		PyArray_VectorUnaryFunc *float_to_posit8_2 = nullptr;
+
+		const std::vector<uint16> &Posit8_2ToBfloat16Table()
+		{
+			static const std::vector<uint16> table = []
+			{
+				uint8 bits[256];
+				float values[256];
+				for (int a = 0; a < 256; ++a)
+				{
+					bits[a] = static_cast<uint8>(a);
+				}
+				posit8_2_to_float(bits, values, 256, nullptr, nullptr);
+				std::vector<uint16> t(256);
+				for (int a = 0; a < 256; ++a)
+				{
+					t[a] = FloatToBfloat16Bits(values[a]);
+				}
+				return t;
+			}();
+			return table;
+		}
+
+		const std::vector<uint8> &Bfloat16ToPosit8_2Table()
+		{
+			static const std::vector<uint8> table = []
+			{
+				std::vector<float> values(65536);
+				for (std::uint32_t b = 0; b < 65536; ++b)
+				{
+					std::uint32_t bits = b << 16;
+					memcpy(&values[b], &bits, sizeof(float));
+				}
+				fenv_t fenv;
+				feholdexcept(&fenv);
+				std::vector<uint8> t(65536);
+				float_to_posit8_2(values.data(), t.data(), 65536, nullptr, nullptr);
+				fesetenv(&fenv);
+				return t;
+			}();
+			return table;
+		}
+
+		void NPyCastPosit8_2ToBfloat16(void *from_void, void *to_void, npy_intp n, void *fromarr,
+									   void *toarr)
+		{
+			const auto *from = reinterpret_cast<const uint8 *>(from_void);
+			auto *to = reinterpret_cast<uint16 *>(to_void);
+			const uint16 *table = Posit8_2ToBfloat16Table().data();
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				to[i] = table[from[i]];
+			}
+		}
+
+		void NPyCastBfloat16ToPosit8_2(void *from_void, void *to_void, npy_intp n, void *fromarr,
+									   void *toarr)
+		{
+			const auto *from = reinterpret_cast<const uint16 *>(from_void);
+			auto *to = reinterpret_cast<uint8 *>(to_void);
+			const uint8 *table = Bfloat16ToPosit8_2Table().data();
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				to[i] = table[from[i]];
+			}
+		}
+
+		// Registers the casts above if a posit8_2 type with casts to and from
+		// float32 is registered with NumPy. Whichever of the two modules is
+		// imported second registers the pair.
+		bool RegisterPosit8_2Casts()
+		{
+			int npy_posit8_2 = PyArray_TypeNumFromName(const_cast<char *>("posit8_2"));
+			if (npy_posit8_2 == NPY_NOTYPE)
+			{
+				return true;
+			}
+			Safe_PyObjectPtr descr_ref = make_safe(reinterpret_cast<PyObject *>(PyArray_DescrFromType(npy_posit8_2)));
+			Safe_PyObjectPtr float_descr = make_safe(reinterpret_cast<PyObject *>(PyArray_DescrFromType(NPY_FLOAT)));
+			PyArray_Descr *descr = reinterpret_cast<PyArray_Descr *>(descr_ref.get());
+			if (!descr || !float_descr || descr->elsize != 1)
+			{
+				PyErr_Clear();
+				return true;
+			}
+			posit8_2_to_float = PyArray_GetCastFunc(descr, NPY_FLOAT);
+			float_to_posit8_2 = PyArray_GetCastFunc(reinterpret_cast<PyArray_Descr *>(float_descr.get()), npy_posit8_2);
+			if (!posit8_2_to_float || !float_to_posit8_2)
+			{
+				PyErr_Clear();
+				return true;
+			}
+			if (PyArray_RegisterCastFunc(descr, npy_bfloat16, NPyCastPosit8_2ToBfloat16) < 0)
+			{
+				return false;
+			}
+			if (PyArray_RegisterCastFunc(&NPyBfloat16_Descr, npy_posit8_2, NPyCastBfloat16ToPosit8_2) < 0)
+			{
+				return false;
+			}
+			if (PyArray_RegisterCanCast(descr, npy_bfloat16, NPY_NOSCALAR) < 0)
+			{
+				return false;
+			}
+			return true;
+		}
+
+		// Vectorized loops over contiguous bfloat16 data, used by UnaryUFunc when
+		// a functor has one (see UnaryKernel below). Unset by default.
+		template <typename Functor>
+		struct UnaryKernel
+		{
+			static constexpr void (*kLoop)(const uint16 *, uint16 *, npy_intp) = nullptr;
+		};
+
+		// Likewise for BinaryUFunc and the bit-level functions of UnaryUFunc,
+		// UnaryUFunc2 and BinaryUFunc2, over any strides. A loop returns false if
+		// it leaves the call to the scalar loop.
+		template <typename Functor>
+		struct StridedKernel
+		{
+			static constexpr bool (*kLoop)(char **, npy_intp, const npy_intp *) = nullptr;
+		};
+
+		// Likewise for BinaryUFuncMixed, over operands already widened to float.
+		// A loop returns how many of the n pairs it did, leaving the rest to the
+		// functor's float overload; by default that is all of them.
+		inline npy_intp NoFloatLoop(const float *, const float *, void *, npy_intp) { return 0; }
+
+		template <typename Functor>
+		struct FloatKernel
+		{
+			static constexpr npy_intp (*kLoop)(const float *, const float *, void *, npy_intp) = NoFloatLoop;
+		};
+
+		// Whether n elements read from 'in' overlap n elements written to 'out'
+		// other than by being the very same elements.
+		inline bool Overlaps(const char *in, npy_intp in_step, std::size_t in_size, const char *out,
+							 npy_intp out_step, std::size_t out_size, npy_intp n)
+		{
+			if (in == out && in_step == out_step && in_step != 0)
+			{
+				return false;
+			}
+			const char *in_lo = in + std::min<npy_intp>(0, (n - 1) * in_step);
+			const char *in_hi = in + std::max<npy_intp>(0, (n - 1) * in_step) + in_size;
+			const char *out_lo = out + std::min<npy_intp>(0, (n - 1) * out_step);
+			const char *out_hi = out + std::max<npy_intp>(0, (n - 1) * out_step) + out_size;
+			return in_lo < out_hi && out_lo < in_hi;
+		}
+
+		// Reports the FE_* exceptions in 'flags' to NumPy, which checks for them
+		// once the loop returns and warns or raises as np.errstate says.
+		void SetFloatStatus(int flags)
+		{
+			if (flags & FE_INVALID)
+			{
+				npy_set_floatstatus_invalid();
+			}
+			if (flags & FE_DIVBYZERO)
+			{
+				npy_set_floatstatus_divbyzero();
+			}
+			if (flags & FE_OVERFLOW)
+			{
+				npy_set_floatstatus_overflow();
+			}
+			if (flags & FE_UNDERFLOW)
+			{
+				npy_set_floatstatus_underflow();
+			}
+		}
+
+		// Saves the floating-point status so that Restore() can discard the flags
+		// raised since, for code that works its flags out separately. On x86 only
+		// the SSE status register is involved, which is far cheaper to save and
+		// restore than the whole floating-point environment.
+		class SavedFloatStatus
+		{
+		public:
+#ifdef __SSE2__
+			SavedFloatStatus() : csr_(_mm_getcsr()) {}
+			void Restore() { _mm_setcsr(csr_); }
+
+		private:
+			unsigned int csr_;
+#else
+			SavedFloatStatus() { feholdexcept(&env_); }
+			void Restore() { fesetenv(&env_); }
+
+		private:
+			fenv_t env_;
+#endif
+		};
+
+		// frexp and ldexp on bfloat16 encodings, in integer arithmetic. A finite
+		// nonzero value is m * 2^(e - 134), with 0x80 <= m <= 0xff once subnormals
+		// are normalized.
+		void Bfloat16Normalize(uint16 x, std::uint32_t *m, int *e)
+		{
+			*m = x & 0x7f;
+			*e = (x >> 7) & 0xff;
+			if (*e == 0)
+			{
+				*e = 1;
+				while (*m < 0x80)
+				{
+					*m <<= 1;
+					--*e;
+				}
+			}
+			else
+			{
+				*m |= 0x80;
+			}
+		}
+
+		// Like std::frexp: a mantissa in [0.5, 1) and the exponent. Zeros,
+		// infinities and NaNs are their own mantissa, with exponent 0.
+		std::pair<uint16, int> FrexpBits(uint16 x)
+		{
+			if ((x & 0x7fff) == 0 || (x & 0x7f80) == 0x7f80)
+			{
+				return {x, 0};
+			}
+			std::uint32_t m;
+			int e;
+			Bfloat16Normalize(x, &m, &e);
+			return {static_cast<uint16>((x & 0x8000) | (126 << 7) | (m & 0x7f)), e - 126};
+		}
+
+		// x * 2^n, rounded to nearest even when it is subnormal. Adds the FE_*
+		// flags it raises to 'flags'.
+		uint16 LdexpBits(uint16 x, int n, int *flags)
+		{
+			if ((x & 0x7fff) == 0 || (x & 0x7f80) == 0x7f80)
+			{
+				return x;
+			}
+			std::uint32_t m;
+			int e;
+			Bfloat16Normalize(x, &m, &e);
+			const uint16 sign = x & 0x8000;
+			// Beyond +-300 every result is infinite or zero anyway.
+			e += std::max(-300, std::min(300, n));
+			if (e >= 255)
+			{
+				*flags |= FE_OVERFLOW;
+				return sign | 0x7f80;
+			}
+			if (e >= 1)
+			{
+				return static_cast<uint16>(sign | (e << 7) | (m & 0x7f));
+			}
+			// Subnormal: m >> (1 - e), where a carry out of the top bit gives the
+			// smallest normal.
+			int shift = std::min(1 - e, 9);
+			std::uint32_t q = m >> shift, rest = m & ((1u << shift) - 1), half = 1u << (shift - 1);
+			if (rest > half || (rest == half && (q & 1)))
+			{
+				++q;
+			}
+			if (rest != 0)
+			{
+				*flags |= FE_UNDERFLOW;
+			}
+			return static_cast<uint16>(sign | q);
+		}
+
+		// Table mode. A bfloat16 function of one argument is fully described by
+		// its 65536 results, so functors with a double-precision reference (see
+		// UnaryTable below) get a table of them, built on first use. Each entry is
+		// the reference result rounded once, correctly, to bfloat16, along with
+		// the floating-point flags computing it raises; NaN results are the
+		// quieted input, or the default NaN for domain errors. Unlike libm's float
+		// functions, which differ between platforms and are then rounded a second
+		// time, the tables give the same bits everywhere.
+		template <typename Functor>
+		struct UnaryTable
+		{
+			static constexpr double (*kReference)(double) = nullptr;
+		};
+
+		enum UnaryTableFlags : uint8
+		{
+			kTableInvalid = 1,
+			kTableDivByZero = 2,
+			kTableOverflow = 4,
+			kTableUnderflow = 8,
+		};
+
+		struct UnaryTableData
+		{
+			// One entry of padding each, so that 32-bit gathers stay in bounds.
+			std::vector<uint16> results = std::vector<uint16>(65536 + 1);
+			std::vector<uint8> flags = std::vector<uint8>(65536 + 3);
+		};
+
+		// Rounds 'd', which is not a NaN, to the nearest bfloat16. Rounding to
+		// odd on the way to float keeps the rounding to bfloat16 a single one.
+		uint16 DoubleToBfloat16Bits(double d)
+		{
+			float f = static_cast<float>(d);
+			std::uint32_t bits;
+			memcpy(&bits, &f, sizeof(bits));
+			if (std::fabs(static_cast<double>(f)) > std::fabs(d))
+			{
+				--bits;
+				memcpy(&f, &bits, sizeof(f));
+			}
+			if (static_cast<double>(f) != d)
+			{
+				bits |= 1;
+				memcpy(&f, &bits, sizeof(f));
+			}
+			return FloatToBfloat16Bits(f);
+		}
+
+		// Sets entry 'b' to 'd' rounded to bfloat16, adding the flags of that
+		// rounding to 'flags'. A NaN result keeps the payload of a NaN input.
+		void SetUnaryTableEntry(UnaryTableData *table, std::uint32_t b, double d, uint8 flags)
+		{
+			uint16 r;
+			if (std::isnan(d))
+			{
+				r = (b & 0x7fff) > 0x7f80 ? static_cast<uint16>(b | 0x0040) : 0x7fc0;
+			}
+			else
+			{
+				r = DoubleToBfloat16Bits(d);
+				std::uint32_t r_bits = static_cast<std::uint32_t>(r) << 16;
+				float rf;
+				memcpy(&rf, &r_bits, sizeof(rf));
+				bool exact = static_cast<double>(rf) == d;
+				if (std::isinf(rf) && !std::isinf(d))
+				{
+					flags |= kTableOverflow;
+				}
+				if ((r & 0x7f80) == 0 && d != 0 && !exact)
+				{
+					flags |= kTableUnderflow;
+				}
+			}
+			table->results[b] = r;
+			table->flags[b] = flags;
+		}
+
+		UnaryTableData BuildUnaryTable(double (*reference)(double))
+		{
+			UnaryTableData table;
+			fenv_t fenv;
+			feholdexcept(&fenv);
+			for (std::uint32_t b = 0; b < 65536; ++b)
+			{
+				std::uint32_t bits = b << 16;
+				float x;
+				memcpy(&x, &bits, sizeof(x));
+				feclearexcept(FE_ALL_EXCEPT);
+				// Widening a signaling NaN to double raises invalid, as it should.
+				double d = reference(static_cast<double>(x));
+				int raised = fetestexcept(FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW);
+				SetUnaryTableEntry(&table, b, d,
+								   (raised & FE_INVALID ? kTableInvalid : 0) |
+									   (raised & FE_DIVBYZERO ? kTableDivByZero : 0) |
+									   (raised & FE_OVERFLOW ? kTableOverflow : 0));
+			}
+			fesetenv(&fenv);
+			return table;
+		}
+
+		template <typename Functor>
+		const UnaryTableData &UnaryTableFor()
+		{
+			static const UnaryTableData table = BuildUnaryTable(UnaryTable<Functor>::kReference);
+			return table;
+		}
+
+#ifdef BFLOAT16_X86_DISPATCH
+		// Eight lookups per gather. Returns how many elements it handled.
+		__attribute__((target("avx2"))) npy_intp UnaryTableGatherAvx2(const UnaryTableData &table,
+																	   const uint16 *in, uint16 *out,
+																	   npy_intp n, uint8 *flags)
+		{
+			const int *results = reinterpret_cast<const int *>(table.results.data());
+			const int *flag_bytes = reinterpret_cast<const int *>(table.flags.data());
+			const __m256i low16 = _mm256_set1_epi32(0xffff);
+			__m256i raised = _mm256_setzero_si256();
+			npy_intp i = 0;
+			for (; i + 8 <= n; i += 8)
+			{
+				__m256i idx = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)));
+				__m256i r = _mm256_and_si256(_mm256_i32gather_epi32(results, idx, 2), low16);
+				raised = _mm256_or_si256(raised, _mm256_i32gather_epi32(flag_bytes, idx, 1));
+				__m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), packed);
+			}
+			alignas(32) std::uint32_t lanes[8];
+			_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), raised);
+			for (std::uint32_t lane : lanes)
+			{
+				*flags |= static_cast<uint8>(lane);
+			}
+			return i;
+		}
+#endif
+
+		void UnaryTableLoop(const UnaryTableData &table, const char *in, char *out, npy_intp n,
+							npy_intp in_step, npy_intp out_step)
+		{
+			uint8 flags = 0;
+			npy_intp i = 0;
+			if (in_step == sizeof(uint16) && out_step == sizeof(uint16))
+			{
+#ifdef BFLOAT16_X86_DISPATCH
+				if (HasAvx2())
+				{
+					i = UnaryTableGatherAvx2(table, reinterpret_cast<const uint16 *>(in),
+											 reinterpret_cast<uint16 *>(out), n, &flags);
+					in += i * in_step;
+					out += i * out_step;
+				}
+#endif
+			}
+			for (; i < n; ++i)
+			{
+				uint16 x = *reinterpret_cast<const uint16 *>(in);
+				*reinterpret_cast<uint16 *>(out) = table.results[x];
+				flags |= table.flags[x];
+				in += in_step;
+				out += out_step;
+			}
+			SetFloatStatus((flags & kTableInvalid ? FE_INVALID : 0) |
+						   (flags & kTableDivByZero ? FE_DIVBYZERO : 0) |
+						   (flags & kTableOverflow ? FE_OVERFLOW : 0) |
+						   (flags & kTableUnderflow ? FE_UNDERFLOW : 0));
+		}
+
+		// Ufuncs made from Python callables by bfloat16.make_unary_ufunc. The
+		// callable is evaluated once over all 65536 inputs, however many NumPy
+		// operations it chains, and the ufunc's loop is UnaryTableLoop over the
+		// results. An input that is not a NaN but gives one is tabulated as
+		// invalid, and rounding as overflow and underflow, so those are reported
+		// as for the built-in tables; NumPy's own warnings are suppressed while
+		// tabulating, since every NaN and infinity is among the inputs. The
+		// capsule holding the table and the name is the ufunc's 'obj', which the
+		// ufunc releases when it is deallocated.
+		struct UserUFunc
+		{
+			std::string name;
+			UnaryTableData table;
+		};
+
+		void UserUFuncLoop(char **args, const npy_intp *dimensions, const npy_intp *steps, void *data)
+		{
+			UnaryTableLoop(*static_cast<const UnaryTableData *>(data), args[0], args[1], *dimensions, steps[0],
+						   steps[1]);
+		}
+
+		void UserUFuncCapsuleDestructor(PyObject *capsule)
+		{
+			delete static_cast<UserUFunc *>(PyCapsule_GetPointer(capsule, "bfloat16.ufunc"));
+		}
+
+		// Made ufuncs kept by the cache in Bfloat16State. Each holds a 256 KiB
+		// table, so only the most recently used ones are kept. Dicts keep their
+		// insertion order, so a hit is moved to the end and the first entry is the
+		// one evicted.
+		constexpr Py_ssize_t kUserUFuncCacheSize = 32;
+
+		// Returns a new reference to the cached ufunc for 'key', or nullptr, with
+		// an error set only if the lookup failed.
+		PyObject *UserUFuncCacheGet(PyObject *cache, PyObject *key)
+		{
+			PyObject *ufunc;
+#if PY_VERSION_HEX >= 0x030D0000
+			Py_BEGIN_CRITICAL_SECTION(cache);
+#endif
+			ufunc = PyDict_GetItemWithError(cache, key);
+			Py_XINCREF(ufunc);
+			if (ufunc && (PyDict_DelItem(cache, key) < 0 || PyDict_SetItem(cache, key, ufunc) < 0))
+			{
+				Py_CLEAR(ufunc);
+			}
+#if PY_VERSION_HEX >= 0x030D0000
+			Py_END_CRITICAL_SECTION();
+#endif
+			return ufunc;
+		}
+
+		bool UserUFuncCachePut(PyObject *cache, PyObject *key, PyObject *ufunc)
+		{
+			bool ok = true;
+#if PY_VERSION_HEX >= 0x030D0000
+			Py_BEGIN_CRITICAL_SECTION(cache);
+#endif
+			Py_ssize_t pos = 0;
+			PyObject *oldest;
+			if (PyDict_Size(cache) >= kUserUFuncCacheSize && PyDict_Next(cache, &pos, &oldest, nullptr))
+			{
+				Py_INCREF(oldest);
+				Safe_PyObjectPtr evicted = make_safe(oldest);
+				ok = PyDict_DelItem(cache, oldest) == 0;
+			}
+			ok = ok && PyDict_SetItem(cache, key, ufunc) == 0;
+#if PY_VERSION_HEX >= 0x030D0000
+			Py_END_CRITICAL_SECTION();
+#endif
+			return ok;
+		}
+
+		// Calls fn(x) with NumPy's floating-point errors ignored.
+		PyObject *CallIgnoringErrors(PyObject *fn, PyObject *x)
+		{
+			Safe_PyObjectPtr numpy = make_safe(PyImport_ImportModule("numpy"));
+			Safe_PyObjectPtr errstate = make_safe(numpy ? PyObject_GetAttrString(numpy.get(), "errstate") : nullptr);
+			Safe_PyObjectPtr kwargs = make_safe(Py_BuildValue("{s:s}", "all", "ignore"));
+			Safe_PyObjectPtr empty = make_safe(PyTuple_New(0));
+			if (!errstate || !kwargs || !empty)
+			{
+				return nullptr;
+			}
+			Safe_PyObjectPtr context = make_safe(PyObject_Call(errstate.get(), empty.get(), kwargs.get()));
+			Safe_PyObjectPtr entered = make_safe(context ? PyObject_CallMethod(context.get(), "__enter__", nullptr) : nullptr);
+			if (!entered)
+			{
+				return nullptr;
+			}
+			PyObject *result = PyObject_CallFunctionObjArgs(fn, x, nullptr);
+			// __exit__ must not run with fn's exception pending, which is put back
+			// afterwards in preference to any error of its own.
+			PyObject *type, *value, *traceback;
+			PyErr_Fetch(&type, &value, &traceback);
+			Safe_PyObjectPtr exited = make_safe(
+				PyObject_CallMethod(context.get(), "__exit__", "OOO", Py_None, Py_None, Py_None));
+			if (!result)
+			{
+				PyErr_Clear();
+				PyErr_Restore(type, value, traceback);
+				return nullptr;
+			}
+			if (!exited)
+			{
+				Py_DECREF(result);
+				return nullptr;
+			}
+			return result;
+		}
+
+		PyObject *PyBfloat16_MakeUnaryUFunc(PyObject *module, PyObject *args, PyObject *kwds)
+		{
+			static const char *kwlist[] = {"fn", "exact", "name", nullptr};
+			PyObject *fn;
+			int exact = 1;
+			const char *name = nullptr;
+			if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|pz:make_unary_ufunc", const_cast<char **>(kwlist), &fn,
+											 &exact, &name))
+			{
+				return nullptr;
+			}
+			PyObject *cache = static_cast<Bfloat16State *>(PyModule_GetState(module))->user_ufunc_cache;
+			// Unhashable callables are not cached.
+			Safe_PyObjectPtr key;
+			if (PyObject_Hash(fn) == -1)
+			{
+				PyErr_Clear();
+			}
+			else if (!(key = make_safe(Py_BuildValue("(OOz)", fn, exact ? Py_True : Py_False, name))))
+			{
+				return nullptr;
+			}
+			PyObject *cached = key ? UserUFuncCacheGet(cache, key.get()) : nullptr;
+			if (cached)
+			{
+				return cached;
+			}
+			if (PyErr_Occurred())
+			{
+				return nullptr;
+			}
+
+			// Every bfloat16 code, as bfloat16 or as float64. Signaling NaNs are
+			// quieted first, so that widening them raises nothing.
+			npy_intp n = 65536;
+			Safe_PyObjectPtr x = make_safe(PyArray_SimpleNew(1, &n, exact ? NPY_DOUBLE : NPY_UINT16));
+			if (!x)
+			{
+				return nullptr;
+			}
+			char *inputs = PyArray_BYTES(reinterpret_cast<PyArrayObject *>(x.get()));
+			for (std::uint32_t b = 0; b < 65536; ++b)
+			{
+				if (exact)
+				{
+					std::uint32_t bits = ((b & 0x7fff) > 0x7f80 ? b | 0x0040 : b) << 16;
+					float f;
+					memcpy(&f, &bits, sizeof(f));
+					reinterpret_cast<double *>(inputs)[b] = f;
+				}
+				else
+				{
+					reinterpret_cast<uint16 *>(inputs)[b] = static_cast<uint16>(b);
+				}
+			}
+			if (!exact)
+			{
+				Py_INCREF(&NPyBfloat16_Descr);
+				x = make_safe(PyArray_View(reinterpret_cast<PyArrayObject *>(x.get()), &NPyBfloat16_Descr, nullptr));
+				if (!x)
+				{
+					return nullptr;
+				}
+			}
+			Safe_PyObjectPtr result = make_safe(CallIgnoringErrors(fn, x.get()));
+			if (!result)
+			{
+				return nullptr;
+			}
+			// The results may be of any type, or a single value, as long as they
+			// broadcast against the inputs.
+			Safe_PyObjectPtr values = make_safe(PyArray_FromAny(result.get(), nullptr, 0, 0, 0, nullptr));
+			// PyArray_NewFromDescr steals a reference, which PyArray_DescrFromType
+			// already returns.
+			PyArray_Descr *descr = exact ? PyArray_DescrFromType(NPY_DOUBLE) : &NPyBfloat16_Descr;
+			if (!exact)
+			{
+				Py_INCREF(descr);
+			}
+			Safe_PyObjectPtr tabulated = make_safe(
+				PyArray_NewFromDescr(&PyArray_Type, descr, 1, &n, nullptr, nullptr, 0, nullptr));
+			if (!values || !tabulated ||
+				PyArray_CopyInto(reinterpret_cast<PyArrayObject *>(tabulated.get()),
+								 reinterpret_cast<PyArrayObject *>(values.get())) < 0)
+			{
+				return nullptr;
+			}
+
+			std::unique_ptr<UserUFunc> user(new UserUFunc);
+			const char *results = PyArray_BYTES(reinterpret_cast<PyArrayObject *>(tabulated.get()));
+			for (std::uint32_t b = 0; b < 65536; ++b)
+			{
+				bool nan_input = (b & 0x7fff) > 0x7f80;
+				if (exact)
+				{
+					double d = reinterpret_cast<const double *>(results)[b];
+					SetUnaryTableEntry(&user->table, b, d, std::isnan(d) && !nan_input ? kTableInvalid : 0);
+				}
+				else
+				{
+					uint16 r = reinterpret_cast<const uint16 *>(results)[b];
+					user->table.results[b] = r;
+					user->table.flags[b] = (r & 0x7fff) > 0x7f80 && !nan_input ? kTableInvalid : 0;
+				}
+			}
+			if (name)
+			{
+				user->name = name;
+			}
+			else
+			{
+				Safe_PyObjectPtr fn_name = make_safe(PyObject_GetAttrString(fn, "__name__"));
+				const char *utf8 = fn_name && PyUnicode_Check(fn_name.get()) ? PyUnicode_AsUTF8(fn_name.get()) : nullptr;
+				PyErr_Clear();
+				user->name = utf8 ? utf8 : "bfloat16_ufunc";
+			}
+
+			Safe_PyObjectPtr ufunc = make_safe(PyUFunc_FromFuncAndData(
+				nullptr, nullptr, nullptr, 0, 1, 1, PyUFunc_None, user->name.c_str(), nullptr, 0));
+			if (!ufunc)
+			{
+				return nullptr;
+			}
+			int types[] = {npy_bfloat16, npy_bfloat16};
+			if (PyUFunc_RegisterLoopForType(reinterpret_cast<PyUFuncObject *>(ufunc.get()), npy_bfloat16,
+											UserUFuncLoop, types, &user->table) < 0)
+			{
+				return nullptr;
+			}
+			PyObject *capsule = PyCapsule_New(user.get(), "bfloat16.ufunc", UserUFuncCapsuleDestructor);
+			if (!capsule)
+			{
+				return nullptr;
+			}
+			user.release();
+			reinterpret_cast<PyUFuncObject *>(ufunc.get())->obj = capsule;
+			if (key && !UserUFuncCachePut(cache, key.get(), ufunc.get()))
+			{
+				return nullptr;
+			}
+			return ufunc.release();
+		}
+
+		// bfloat16.evaluate: elementwise expressions such as "tanh(a * w + b) * s"
+		// in a single pass. The expression is compiled to a short program for a
+		// machine whose registers each hold kExprBlock float32 values, all of them
+		// small enough to stay in L1. Operands are broadcast by a buffered NumPy
+		// iterator and widened a block at a time, and only the final result is
+		// rounded to bfloat16, so unlike the equivalent chain of ufuncs nothing is
+		// rounded in between and no full-size temporaries are allocated.
+		enum ExprOp : uint8
+		{
+			kExprLoad,
+			kExprConst,
+			kExprNegative,
+			kExprAdd,
+			kExprSubtract,
+			kExprMultiply,
+			kExprDivide,
+			kExprPower,
+			kExprPowerConst,
+			kExprMaximum,
+			kExprMinimum,
+			kExprAbs,
+			kExprSqrt,
+			kExprExp,
+			kExprExp2,
+			kExprExpm1,
+			kExprLog,
+			kExprLog2,
+			kExprLog10,
+			kExprLog1p,
+			kExprTanh,
+			kExprSin,
+			kExprCos,
+		};
+
+		// Replaces register 'dst' by op(dst) or op(dst, dst + 1). Loads read
+		// operand 'operand'; constants and constant exponents are 'value'.
+		struct ExprStep
+		{
+			ExprOp op;
+			int dst;
+			int operand;
+			float value;
+		};
+
+		struct ExprProgram
+		{
+			std::vector<ExprStep> steps;
+			// Operand names, in order of first use.
+			std::vector<std::string> names;
+			int registers = 0;
+		};
+
+		struct ExprFunction
+		{
+			const char *name;
+			ExprOp op;
+			int arity;
+		};
+
+		const ExprFunction kExprFunctions[] = {
+			{"abs", kExprAbs, 1},
+			{"sqrt", kExprSqrt, 1},
+			{"exp", kExprExp, 1},
+			{"exp2", kExprExp2, 1},
+			{"expm1", kExprExpm1, 1},
+			{"log", kExprLog, 1},
+			{"log2", kExprLog2, 1},
+			{"log10", kExprLog10, 1},
+			{"log1p", kExprLog1p, 1},
+			{"tanh", kExprTanh, 1},
+			{"sin", kExprSin, 1},
+			{"cos", kExprCos, 1},
+			{"maximum", kExprMaximum, 2},
+			{"minimum", kExprMinimum, 2},
+			{"power", kExprPower, 2},
+		};
+
+		constexpr npy_intp kExprBlock = 256;
+		constexpr int kExprMaxRegisters = 16;
+		constexpr int kExprMaxDepth = 64;
+
+		// Recursive descent over + - * / **, unary signs, parentheses, numbers,
+		// names and calls of kExprFunctions, with Python's precedences. Each
+		// subexpression is compiled to leave its value in the register it is
+		// given, and its operands in the registers above, so registers are
+		// allocated like a stack.
+		class ExprParser
+		{
+		public:
+			ExprParser(const char *text, ExprProgram *program) : text_(text), p_(text), program_(program) {}
+
+			// Sets a Python exception and returns false if the text is not an
+			// expression.
+			bool Parse()
+			{
+				SkipSpaces();
+				if (!Sum(0))
+				{
+					return false;
+				}
+				return *p_ == '\0' || Error("unexpected character");
+			}
+
+		private:
+			void SkipSpaces()
+			{
+				while (Py_ISSPACE(*p_))
+				{
+					++p_;
+				}
+			}
+
+			bool Error(const char *what)
+			{
+				PyErr_Format(PyExc_ValueError, "%s at position %d of expression '%s'", what,
+							 static_cast<int>(p_ - text_), text_);
+				return false;
+			}
+
+			bool Emit(ExprOp op, int dst, float value = 0.0f, int operand = 0)
+			{
+				program_->steps.push_back({op, dst, operand, value});
+				program_->registers = std::max(program_->registers, dst + 1);
+				return true;
+			}
+
+			// A constant right operand needs no register of its own.
+			bool EmitPower(int dst)
+			{
+				const ExprStep &last = program_->steps.back();
+				if (last.op == kExprConst && last.dst == dst + 1)
+				{
+					float value = last.value;
+					program_->steps.pop_back();
+					return Emit(kExprPowerConst, dst, value);
+				}
+				return Emit(kExprPower, dst);
+			}
+
+			bool Sum(int r)
+			{
+				if (depth_ >= kExprMaxDepth)
+				{
+					return Error("expression nested too deeply");
+				}
+				++depth_;
+				bool ok = Product(r);
+				while (ok && (*p_ == '+' || *p_ == '-'))
+				{
+					ExprOp op = *p_ == '+' ? kExprAdd : kExprSubtract;
+					++p_;
+					SkipSpaces();
+					ok = Product(r + 1) && Emit(op, r);
+				}
+				--depth_;
+				return ok;
+			}
+
+			bool Product(int r)
+			{
+				bool ok = Signed(r);
+				while (ok && ((*p_ == '*' && p_[1] != '*') || *p_ == '/'))
+				{
+					ExprOp op = *p_ == '*' ? kExprMultiply : kExprDivide;
+					++p_;
+					SkipSpaces();
+					ok = Signed(r + 1) && Emit(op, r);
+				}
+				return ok;
+			}
+
+			// As in Python, -x ** y is -(x ** y) and x ** -y is x ** (-y).
+			bool Signed(int r)
+			{
+				bool negative = false;
+				while (*p_ == '-' || *p_ == '+')
+				{
+					negative ^= *p_ == '-';
+					++p_;
+					SkipSpaces();
+				}
+				if (!Power(r))
+				{
+					return false;
+				}
+				if (!negative)
+				{
+					return true;
+				}
+				ExprStep &last = program_->steps.back();
+				if (last.op == kExprConst && last.dst == r)
+				{
+					last.value = -last.value;
+					return true;
+				}
+				return Emit(kExprNegative, r);
+			}
+
+			bool Power(int r)
+			{
+				if (!Atom(r))
+				{
+					return false;
+				}
+				if (*p_ != '*' || p_[1] != '*')
+				{
+					return true;
+				}
+				p_ += 2;
+				SkipSpaces();
+				return Signed(r + 1) && EmitPower(r);
+			}
+
+			bool Atom(int r)
+			{
+				if (r >= kExprMaxRegisters)
+				{
+					return Error("expression too complex");
+				}
+				if (Py_ISDIGIT(*p_) || (*p_ == '.' && Py_ISDIGIT(p_[1])))
+				{
+					char *end;
+					double value = PyOS_string_to_double(p_, &end, nullptr);
+					if (value == -1.0 && PyErr_Occurred())
+					{
+						return false;
+					}
+					p_ = end;
+					SkipSpaces();
+					return Emit(kExprConst, r, static_cast<float>(value));
+				}
+				if (Py_ISALPHA(*p_) || *p_ == '_')
+				{
+					const char *start = p_;
+					while (Py_ISALNUM(*p_) || *p_ == '_')
+					{
+						++p_;
+					}
+					std::string name(start, p_);
+					SkipSpaces();
+					if (*p_ != '(')
+					{
+						auto it = std::find(program_->names.begin(), program_->names.end(), name);
+						int operand = static_cast<int>(it - program_->names.begin());
+						if (it == program_->names.end())
+						{
+							program_->names.push_back(name);
+						}
+						return Emit(kExprLoad, r, 0.0f, operand);
+					}
+					const ExprFunction *function = nullptr;
+					for (const ExprFunction &f : kExprFunctions)
+					{
+						if (name == f.name)
+						{
+							function = &f;
+						}
+					}
+					if (!function)
+					{
+						p_ = start;
+						return Error("unknown function");
+					}
+					++p_;
+					SkipSpaces();
+					for (int k = 0; k < function->arity; ++k)
+					{
+						if (k > 0 && *p_ != ',')
+						{
+							return Error("expected ','");
+						}
+						if (k > 0)
+						{
+							++p_;
+							SkipSpaces();
+						}
+						if (!Sum(r + k))
+						{
+							return false;
+						}
+					}
+					if (*p_ != ')')
+					{
+						return Error("expected ')'");
+					}
+					++p_;
+					SkipSpaces();
+					return function->op == kExprPower ? EmitPower(r) : Emit(function->op, r);
+				}
+				if (*p_ == '(')
+				{
+					++p_;
+					SkipSpaces();
+					if (!Sum(r))
+					{
+						return false;
+					}
+					if (*p_ != ')')
+					{
+						return Error("expected ')'");
+					}
+					++p_;
+					SkipSpaces();
+					return true;
+				}
+				return Error(*p_ ? "unexpected character" : "unexpected end");
+			}
+
+			const char *text_;
+			const char *p_;
+			ExprProgram *program_;
+			int depth_ = 0;
+		};
+
+		template <typename F>
+		void ExprMap(float *a, const float *b, npy_intp m, F f)
+		{
+			for (npy_intp k = 0; k < m; ++k)
+			{
+				a[k] = f(a[k], b[k]);
+			}
+		}
+
+		// Runs a step on m elements of its registers, a = dst and b = dst + 1, one
+		// element at a time with the floating-point status live, so that it
+		// raises exactly what the ufuncs would in float32. Loads and constants are
+		// left to RunExprProgram.
+		void ExprScalarStep(const ExprStep &step, float *a, const float *b, npy_intp m)
+		{
+			const float value = step.value;
+			switch (step.op)
+			{
+			case kExprNegative:
+				ExprMap(a, b, m, [](float x, float) { return -x; });
+				break;
+			case kExprAdd:
+				ExprMap(a, b, m, [](float x, float y) { return x + y; });
+				break;
+			case kExprSubtract:
+				ExprMap(a, b, m, [](float x, float y) { return x - y; });
+				break;
+			case kExprMultiply:
+				ExprMap(a, b, m, [](float x, float y) { return x * y; });
+				break;
+			case kExprDivide:
+				ExprMap(a, b, m, [](float x, float y) { return x / y; });
+				break;
+			case kExprPower:
+				ExprMap(a, b, m, [](float x, float y) { return std::pow(x, y); });
+				break;
+			case kExprPowerConst:
+				if (value == 2.0f)
+				{
+					ExprMap(a, b, m, [](float x, float) { return x * x; });
+				}
+				else
+				{
+					ExprMap(a, b, m, [value](float x, float) { return std::pow(x, value); });
+				}
+				break;
+			// NaNs propagate, as with np.maximum and np.minimum, and the
+			// comparisons are quiet.
+			case kExprMaximum:
+				ExprMap(a, b, m, [](float x, float y) { return x != x || (y == y && x >= y) ? x : y; });
+				break;
+			case kExprMinimum:
+				ExprMap(a, b, m, [](float x, float y) { return x != x || (y == y && x <= y) ? x : y; });
+				break;
+			case kExprAbs:
+				ExprMap(a, b, m, [](float x, float) { return std::fabs(x); });
+				break;
+			case kExprSqrt:
+				ExprMap(a, b, m, [](float x, float) { return std::sqrt(x); });
+				break;
+			case kExprExp:
+				ExprMap(a, b, m, [](float x, float) { return std::exp(x); });
+				break;
+			case kExprExp2:
+				ExprMap(a, b, m, [](float x, float) { return std::exp2(x); });
+				break;
+			case kExprExpm1:
+				ExprMap(a, b, m, [](float x, float) { return std::expm1(x); });
+				break;
+			case kExprLog:
+				ExprMap(a, b, m, [](float x, float) { return std::log(x); });
+				break;
+			case kExprLog2:
+				ExprMap(a, b, m, [](float x, float) { return std::log2(x); });
+				break;
+			case kExprLog10:
+				ExprMap(a, b, m, [](float x, float) { return std::log10(x); });
+				break;
+			case kExprLog1p:
+				ExprMap(a, b, m, [](float x, float) { return std::log1p(x); });
+				break;
+			case kExprTanh:
+				ExprMap(a, b, m, [](float x, float) { return std::tanh(x); });
+				break;
+			case kExprSin:
+				ExprMap(a, b, m, [](float x, float) { return std::sin(x); });
+				break;
+			case kExprCos:
+				ExprMap(a, b, m, [](float x, float) { return std::cos(x); });
+				break;
+			case kExprLoad:
+			case kExprConst:
+				break;
+			}
+		}
+
+		// Runs 'program' over n elements of the iterator's operands, the result
+		// being the last, with the loads, steps and stores of Machine.
+		// 'registers' holds program.registers + 2 blocks: the registers, the one
+		// above the highest, which unary steps name as their unused second
+		// operand, and scratch space. Returns the FE_* flags the steps call for
+		// beyond those they raise.
+		template <typename Machine>
+		inline __attribute__((always_inline)) int RunExprProgram(const ExprProgram &program, char *const *data,
+																 const npy_intp *strides, npy_intp n, float *registers)
+		{
+			const std::size_t out = program.names.size();
+			float *scratch = registers + (program.registers + 1) * kExprBlock;
+			int flags = 0;
+			for (npy_intp i0 = 0; i0 < n; i0 += kExprBlock)
+			{
+				const npy_intp m = std::min(kExprBlock, n - i0);
+				for (const ExprStep &step : program.steps)
+				{
+					float *a = registers + step.dst * kExprBlock;
+					if (step.op == kExprLoad)
+					{
+						npy_intp stride = strides[step.operand];
+						Machine::Load(data[step.operand] + i0 * stride, stride, a, m);
+					}
+					else if (step.op == kExprConst)
+					{
+						std::fill(a, a + m, step.value);
+					}
+					else
+					{
+						Machine::Step(step, a, a + kExprBlock, scratch, m, &flags);
+					}
+				}
+				Machine::Store(registers, data[out] + i0 * strides[out], strides[out], m);
+			}
+			return flags;
+		}
+
+		// Element by element, for builds without the vector kernels and for the
+		// elements that do not fill a vector.
+		struct ExprScalarMachine
+		{
+			static void Load(const char *in, npy_intp stride, float *a, npy_intp m)
+			{
+				for (npy_intp k = 0; k < m; ++k)
+				{
+					std::uint32_t bits = static_cast<std::uint32_t>(*reinterpret_cast<const uint16 *>(in + k * stride))
+										 << 16;
+					memcpy(a + k, &bits, sizeof(float));
+				}
+			}
+
+			static void Step(const ExprStep &step, float *a, const float *b, float *scratch, npy_intp m, int *flags)
+			{
+				ExprScalarStep(step, a, b, m);
+			}
+
+			static void Store(const float *a, char *out, npy_intp stride, npy_intp m)
+			{
+				for (npy_intp k = 0; k < m; ++k)
+				{
+					*reinterpret_cast<uint16 *>(out + k * stride) = FloatToBfloat16Bits(a[k]);
+				}
+			}
+		};
+
+		int RunExprProgramScalar(const ExprProgram &program, char *const *data, const npy_intp *strides, npy_intp n,
+								 float *registers)
+		{
+			return RunExprProgram<ExprScalarMachine>(program, data, strides, n, registers);
+		}
+
+		// Warns or raises for the FE_* flags in 'status' as np.errstate says, for
+		// functions that are not ufuncs, whose flags NumPy does not check. 'call'
+		// and 'log' are treated like 'warn'.
+		bool ReportFloatStatus(int status, const char *where)
+		{
+			static const struct
+			{
+				int flag;
+				const char *key, *what;
+			} kErrors[] = {{FE_DIVBYZERO, "divide", "divide by zero"},
+						   {FE_OVERFLOW, "over", "overflow"},
+						   {FE_UNDERFLOW, "under", "underflow"},
+						   {FE_INVALID, "invalid", "invalid value"}};
+			if (!(status & (FE_DIVBYZERO | FE_OVERFLOW | FE_UNDERFLOW | FE_INVALID)))
+			{
+				return true;
+			}
+			Safe_PyObjectPtr numpy = make_safe(PyImport_ImportModule("numpy"));
+			Safe_PyObjectPtr modes = make_safe(numpy ? PyObject_CallMethod(numpy.get(), "geterr", nullptr) : nullptr);
+			if (!modes)
+			{
+				return false;
+			}
+			for (const auto &error : kErrors)
+			{
+				PyObject *mode = (status & error.flag) ? PyDict_GetItemString(modes.get(), error.key) : nullptr;
+				const char *name = mode && PyUnicode_Check(mode) ? PyUnicode_AsUTF8(mode) : "ignore";
+				if (!name)
+				{
+					return false;
+				}
+				if (strcmp(name, "raise") == 0)
+				{
+					PyErr_Format(PyExc_FloatingPointError, "%s encountered in %s", error.what, where);
+					return false;
+				}
+				if (strcmp(name, "ignore") != 0 &&
+					PyErr_WarnFormat(PyExc_RuntimeWarning, 1, "%s encountered in %s", error.what, where) < 0)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+#ifdef BFLOAT16_VECTOR_KERNELS
+		// float32 kernels for the common transcendental ufuncs, written with GCC
+		// vector extensions so that every lane runs the same branch-free code:
+		// Cephes-style range reductions and polynomials, accurate to a couple of
+		// float ulps, far more than the 8 significant bits the results are then
+		// rounded to. Lanes are 4 wide on baseline x86-64 and 8 wide with AVX2;
+		// neither target enables FMA, so the polynomials are never contracted.
+		// The 16-lane AVX-512 paths, where the compiler may contract, only run
+		// single operations and Fma, whose product is exact, so results do not
+		// depend on the CPU.
+		namespace kernels
+		{
+			typedef float Floats4 __attribute__((vector_size(16)));
+			typedef float Floats8 __attribute__((vector_size(32)));
+			typedef float Floats16 __attribute__((vector_size(64)));
+
+			template <typename V>
+			using Mask = decltype(V() < V());
+
+#define BFLOAT16_KERNEL_INLINE inline __attribute__((always_inline))
+
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE V Select(Mask<V> m, V a, V b)
+			{
+				return (V)((m & (Mask<V>)a) | (~m & (Mask<V>)b));
+			}
+
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE V Abs(V x)
+			{
+				return (V)((Mask<V>)x & 0x7fffffff);
+			}
+
+			// Gives 'x' the sign of 'y'.
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE V CopySign(V x, V y)
+			{
+				return (V)(((Mask<V>)x & 0x7fffffff) | ((Mask<V>)y & std::numeric_limits<int>::min()));
+			}
+
+			// Rounds to the nearest integer, for |x| < 2^22.
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE V Round(V x)
+			{
+				return (x + 12582912.0f) - 12582912.0f;
+			}
+
+			// 2^n, for -126 <= n <= 127.
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE V Pow2(Mask<V> n)
+			{
+				return (V)((n + 127) << 23);
+			}
+
+			// e^r - 1 for |r| <= ln(2)/2.
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE V Expm1Reduced(V r)
+			{
+				V p = ((((1.9875691500e-4f * r + 1.3981999507e-3f) * r + 8.3334519073e-3f) * r +
+						4.1665795894e-2f) * r + 1.6666665459e-1f) * r + 5.0000001201e-1f;
+				return p * (r * r) + r;
+			}
+
+			// e^r * 2^n, splitting the scale in two so that subnormal results are
+			// rounded once, for -151 <= n <= 129.
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE V ScaledExp(V r, V n)
+			{
+				Mask<V> ni = __builtin_convertvector(n, Mask<V>);
+				Mask<V> n1 = ni >> 1;
+				return ((Expm1Reduced(r) + 1.0f) * Pow2<V>(n1)) * Pow2<V>(ni - n1);
+			}
+
+			// x = n * ln(2) + r with |r| <= ln(2)/2, for |x| <= 104.
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE V ReduceLn2(V x, V *n)
+			{
+				*n = Round(x * 1.44269504088896341f);
+				return (x - *n * 0.693359375f) - *n * -2.12194440e-4f;
+			}
+
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE V Clamp(V x, float lo, float hi)
+			{
+				x = Select<V>(x < lo, V() + lo, x);
+				return Select<V>(x > hi, V() + hi, x);
+			}
+
+			// Splits finite x > 0 into x = 2^e * (1 + f) with sqrt(1/2) <= 1 + f <
+			// sqrt(2) and returns ln(1 + f).
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE V LogReduced(V x, V *e)
+			{
+				Mask<V> subnormal = x < std::numeric_limits<float>::min();
+				Mask<V> bits = (Mask<V>)Select(subnormal, x * 8388608.0f, x);
+				Mask<V> ei = ((bits >> 23) & 0xff) - 127 + (subnormal & -23);
+				V m = (V)((bits & 0x007fffff) | 0x3f800000);
+				Mask<V> high = m > 1.41421356237309505f;
+				m = Select(high, m * 0.5f, m);
+				*e = __builtin_convertvector(ei - high, V);
+				V f = m - 1.0f;
+				V z = f * f;
+				V p = ((((((((7.0376836292e-2f * f - 1.1514610310e-1f) * f + 1.1676998740e-1f) * f -
+							 1.2420140846e-1f) * f + 1.4249322787e-1f) * f - 1.6668057665e-1f) * f +
+						  2.0000714765e-1f) * f - 2.4999993993e-1f) * f + 3.3333331174e-1f);
+				return f + (p * f * z - 0.5f * z);
+			}
+
+			// Gives log's results for the zero and infinite lanes of 'r'.
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE V LogSpecialCases(V x, V r)
+			{
+				const float inf = std::numeric_limits<float>::infinity();
+				r = Select<V>(x == 0.0f, V() - inf, r);
+				return Select<V>(x == inf, x, r);
+			}
+
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE V NaturalLog(V x)
+			{
+				V e;
+				V lm = LogReduced(x, &e);
+				return LogSpecialCases(x, (lm + e * -2.12194440e-4f) + e * 0.693359375f);
+			}
+
+			// Each kernel gives its vector evaluation, the libm function it
+			// replaces, the arguments it handles (NaNs, domain errors and
+			// arguments beyond its range reduction go to libm), the flag a finite
+			// argument with an infinite result raises, and whether a zero result
+			// from a finite argument is an underflow.
+			struct Exp
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V x)
+				{
+					V n;
+					V r = ReduceLn2(Clamp(x, -104.0f, 89.0f), &n);
+					return ScaledExp(r, n);
+				}
+				// The scalar loop gives NaN results a positive sign (exp is never
+				// negative, so the compiler drops the sign bit), and so does this.
+				static float Scalar(float x)
+				{
+					float r = std::exp(x);
+					return r != r ? std::numeric_limits<float>::quiet_NaN() : r;
+				}
+				template <typename T>
+				static BFLOAT16_KERNEL_INLINE auto Inside(T x) { return x == x; }
+				static constexpr int kInfFlag = FE_OVERFLOW;
+				static constexpr bool kZeroUnderflows = true;
+			};
+
+			struct Exp2
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V x)
+				{
+					V c = Clamp(x, -151.0f, 129.0f);
+					V n = Round(c);
+					return ScaledExp((c - n) * 0.693147180559945309f, n);
+				}
+				static float Scalar(float x)
+				{
+					float r = std::exp2(x);
+					return r != r ? std::numeric_limits<float>::quiet_NaN() : r;
+				}
+				template <typename T>
+				static BFLOAT16_KERNEL_INLINE auto Inside(T x) { return x == x; }
+				static constexpr int kInfFlag = FE_OVERFLOW;
+				static constexpr bool kZeroUnderflows = true;
+			};
+
+			struct Expm1
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V x)
+				{
+					V n;
+					V r = ReduceLn2(Clamp(x, -18.0f, 89.0f), &n);
+					// 2^n * (e^r - 1) + (2^n - 1) is exact apart from e^r - 1 while
+					// 2^n - 1 is; beyond that the - 1 no longer matters.
+					Mask<V> ni = __builtin_convertvector(n, Mask<V>);
+					V t = Pow2<V>(ni - ((ni > 24) & (ni - 24)));
+					V small = t * Expm1Reduced(r) + (t - 1.0f);
+					V r2 = Select<V>(ni > 24, ScaledExp(r, n), small);
+					return Select<V>(x == 0.0f, x, r2);
+				}
+				static float Scalar(float x) { return std::expm1(x); }
+				template <typename T>
+				static BFLOAT16_KERNEL_INLINE auto Inside(T x) { return x == x; }
+				static constexpr int kInfFlag = FE_OVERFLOW;
+				static constexpr bool kZeroUnderflows = false;
+			};
+
+			struct Log
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V x) { return NaturalLog(x); }
+				static float Scalar(float x) { return std::log(x); }
+				template <typename T>
+				static BFLOAT16_KERNEL_INLINE auto Inside(T x) { return x >= 0.0f; }
+				static constexpr int kInfFlag = FE_DIVBYZERO;
+				static constexpr bool kZeroUnderflows = false;
+			};
+
+			struct Log2
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V x)
+				{
+					V e;
+					V lm = LogReduced(x, &e);
+					return LogSpecialCases(x, e + lm * 1.44269504088896341f);
+				}
+				static float Scalar(float x) { return std::log2(x); }
+				template <typename T>
+				static BFLOAT16_KERNEL_INLINE auto Inside(T x) { return x >= 0.0f; }
+				static constexpr int kInfFlag = FE_DIVBYZERO;
+				static constexpr bool kZeroUnderflows = false;
+			};
+
+			struct Log10
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V x)
+				{
+					V e;
+					V lm = LogReduced(x, &e);
+					return LogSpecialCases(x, lm * 0.434294481903251828f + e * 0.301029995663981195f);
+				}
+				static float Scalar(float x) { return std::log10(x); }
+				template <typename T>
+				static BFLOAT16_KERNEL_INLINE auto Inside(T x) { return x >= 0.0f; }
+				static constexpr int kInfFlag = FE_DIVBYZERO;
+				static constexpr bool kZeroUnderflows = false;
+			};
+
+			struct Log1p
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V x)
+				{
+					// log(u) * x / (u - 1) cancels the rounding error of u = 1 + x.
+					V u = x + 1.0f;
+					V d = u - 1.0f;
+					V r = NaturalLog(u) * (x / d);
+					r = Select<V>(d == 0.0f, x, r);
+					return Select<V>(x == std::numeric_limits<float>::infinity(), x, r);
+				}
+				static float Scalar(float x) { return std::log1p(x); }
+				template <typename T>
+				static BFLOAT16_KERNEL_INLINE auto Inside(T x) { return x >= -1.0f; }
+				static constexpr int kInfFlag = FE_DIVBYZERO;
+				static constexpr bool kZeroUnderflows = false;
+			};
+
+			struct Tanh
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V x)
+				{
+					V z = x * x;
+					V small = ((((-5.70498872745e-3f * z + 2.06390887954e-2f) * z - 5.37397155531e-2f) * z +
+								1.33314422036e-1f) * z - 3.33332819422e-1f) * z * x + x;
+					V e = Exp::Eval(Abs(x) * 2.0f);
+					V large = CopySign(1.0f - 2.0f / (e + 1.0f), x);
+					V r = Select<V>(Abs(x) < 0.625f, small, large);
+					return Select<V>(x == 0.0f, x, r);
+				}
+				static float Scalar(float x) { return std::tanh(x); }
+				template <typename T>
+				static BFLOAT16_KERNEL_INLINE auto Inside(T x) { return x == x; }
+				static constexpr int kInfFlag = 0;
+				static constexpr bool kZeroUnderflows = false;
+			};
+
+			// sin and cos of x = j * pi/2 + y, |y| <= pi/4. The three-part pi/2 is
+			// exact to multiply by j for |x| <= 8192.
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE void SinCosReduced(V x, V *s, V *c, Mask<V> *quadrant)
+			{
+				V ax = Abs(x);
+				V j = Round(ax * 0.636619772367581343f);
+				V y = ((ax - j * 1.5703125f) - j * 4.837512969970703125e-4f) - j * 7.54978995489188216e-8f;
+				V z = y * y;
+				*s = y + y * z * (-1.6666654611e-1f + z * (8.3321608736e-3f + z * -1.9515295891e-4f));
+				*c = (1.0f - 0.5f * z) +
+					 z * z * (4.166664568298827e-2f + z * (-1.388731625493765e-3f + z * 2.443315711809948e-5f));
+				*quadrant = __builtin_convertvector(j, Mask<V>) & 3;
+			}
+
+			struct Sin
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V x)
+				{
+					V s, c;
+					Mask<V> q;
+					SinCosReduced(x, &s, &c, &q);
+					V r = Select((q & 1) != 0, c, s);
+					// Negative in quadrants 2 and 3, and for negative x.
+					const int sign = std::numeric_limits<int>::min();
+					r = (V)((Mask<V>)r ^ (((q & 2) != 0) & sign) ^ ((Mask<V>)x & sign));
+					return Select<V>(x == 0.0f, x, r);
+				}
+				static float Scalar(float x) { return std::sin(x); }
+				template <typename T>
+				static BFLOAT16_KERNEL_INLINE auto Inside(T x) { return (x >= -8192.0f) & (x <= 8192.0f); }
+				static constexpr int kInfFlag = 0;
+				static constexpr bool kZeroUnderflows = false;
+			};
+
+			struct Cos
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V x)
+				{
+					V s, c;
+					Mask<V> q;
+					SinCosReduced(x, &s, &c, &q);
+					V r = Select((q & 1) != 0, s, c);
+					// Negative in quadrants 1 and 2.
+					return (V)((Mask<V>)r ^ ((((q + 1) & 2) != 0) & std::numeric_limits<int>::min()));
+				}
+				static float Scalar(float x) { return std::cos(x); }
+				template <typename T>
+				static BFLOAT16_KERNEL_INLINE auto Inside(T x) { return (x >= -8192.0f) & (x <= 8192.0f); }
+				static constexpr int kInfFlag = 0;
+				static constexpr bool kZeroUnderflows = false;
+			};
+
+			constexpr npy_intp kBlock = 256;
+
+			// Lane types for 4-, 8- and 16-wide evaluation.
+			struct Lanes4
+			{
+				typedef Floats4 F;
+				typedef std::uint32_t U __attribute__((vector_size(16)));
+				typedef uint16 Bits __attribute__((vector_size(8)));
+				typedef npy_bool Bools __attribute__((vector_size(4)));
+			};
+
+			struct Lanes8
+			{
+				typedef Floats8 F;
+				typedef std::uint32_t U __attribute__((vector_size(32)));
+				typedef uint16 Bits __attribute__((vector_size(16)));
+				typedef npy_bool Bools __attribute__((vector_size(8)));
+			};
+
+			struct Lanes16
+			{
+				typedef Floats16 F;
+				typedef std::uint32_t U __attribute__((vector_size(64)));
+				typedef uint16 Bits __attribute__((vector_size(32)));
+				typedef npy_bool Bools __attribute__((vector_size(16)));
+			};
+
+			template <typename L>
+			BFLOAT16_KERNEL_INLINE typename L::F Widen(const uint16 *in)
+			{
+				typename L::Bits b;
+				memcpy(&b, in, sizeof(b));
+				return (typename L::F)(__builtin_convertvector(b, typename L::U) << 16);
+			}
+
+			// FloatToBfloat16Bits lane by lane. Integer arithmetic only, so it
+			// raises no flags.
+			template <typename L>
+			BFLOAT16_KERNEL_INLINE void Narrow(typename L::F r, uint16 *out)
+			{
+				typedef typename L::U U;
+				U u = (U)r;
+				U rounded = (u + 0x7fffu + ((u >> 16) & 1u)) >> 16;
+				U nan = ((u >> 16) | 0x7fc0u) & 0xffc0u;
+				U nan_lanes = (U)(r != r);
+				typename L::Bits b = __builtin_convertvector((nan_lanes & nan) | (~nan_lanes & rounded), typename L::Bits);
+				memcpy(out, &b, sizeof(b));
+			}
+
+			template <typename L>
+			BFLOAT16_KERNEL_INLINE void Narrow(typename L::F r, bfloat16 *out)
+			{
+				Narrow<L>(r, reinterpret_cast<uint16 *>(out));
+			}
+
+			template <typename L>
+			BFLOAT16_KERNEL_INLINE void Narrow(Mask<typename L::F> m, npy_bool *out)
+			{
+				typename L::Bools b = __builtin_convertvector(m, typename L::Bools) & 1;
+				memcpy(out, &b, sizeof(b));
+			}
+
+			// What a block of results calls for: the flags libm would raise for
+			// them, and whether some lanes are left for libm (see UnaryLoop).
+			struct BlockStatus
+			{
+				bool invalid, infinite, underflow, outside;
+			};
+
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE bool Any(Mask<V> m)
+			{
+				bool any = false;
+				for (std::size_t i = 0; i < sizeof(V) / sizeof(float); ++i)
+				{
+					any |= m[i] != 0;
+				}
+				return any;
+			}
+
+			// Widens kBlock bfloat16 values, evaluates Kernel on them and rounds the
+			// results back.
+			template <typename Kernel, typename L>
+			BFLOAT16_KERNEL_INLINE BlockStatus EvalBlock(const uint16 *in, uint16 *out)
+			{
+				typedef typename L::F V;
+				typedef Mask<V> M;
+				M invalid = M(), infinite = M(), underflow = M(), outside = M();
+				const M zero_underflows = M() - Kernel::kZeroUnderflows;
+				for (npy_intp i = 0; i < kBlock; i += sizeof(V) / sizeof(float))
+				{
+					V x = Widen<L>(in + i);
+					V r = Kernel::Eval(x);
+					V ax = Abs(x), ar = Abs(r);
+					M inside = Kernel::Inside(x);
+					M finite = ax <= std::numeric_limits<float>::max();
+					invalid |= inside & (r != r);
+					infinite |= inside & finite & (ar > std::numeric_limits<float>::max());
+					underflow |= inside & finite & (x != 0.0f) & (ar < std::numeric_limits<float>::min()) &
+								 ((r != 0.0f) | zero_underflows);
+					outside |= ~inside;
+					Narrow<L>(r, out + i);
+				}
+				return {Any<V>(invalid), Any<V>(infinite), Any<V>(underflow), Any<V>(outside)};
+			}
+
+			template <typename Kernel>
+			BlockStatus EvalBlockGeneric(const uint16 *in, uint16 *out)
+			{
+				return EvalBlock<Kernel, Lanes4>(in, out);
+			}
+
+#ifdef BFLOAT16_X86_DISPATCH
+			template <typename Kernel>
+			__attribute__((target("avx2"))) BlockStatus EvalBlockAvx2(const uint16 *in, uint16 *out)
+			{
+				return EvalBlock<Kernel, Lanes8>(in, out);
+			}
+#endif
+
+			template <typename Kernel>
+			void UnaryLoop(const uint16 *in, uint16 *out, npy_intp n)
+			{
+				BlockStatus (*eval)(const uint16 *, uint16 *) = EvalBlockGeneric<Kernel>;
+#ifdef BFLOAT16_X86_DISPATCH
+				if (HasAvx2())
+				{
+					eval = EvalBlockAvx2<Kernel>;
+				}
+#endif
+				// Every lane is computed, including NaN and out-of-range ones, so
+				// the flags the arithmetic raises mean nothing; they are dropped
+				// and the flags libm would raise are derived from the results.
+				bool invalid = false, infinite = false, underflow = false;
+				uint16 in_tail[kBlock], out_tail[kBlock];
+				SavedFloatStatus saved;
+				for (npy_intp i0 = 0; i0 < n; i0 += kBlock)
+				{
+					npy_intp m = std::min(kBlock, n - i0);
+					const uint16 *x = in + i0;
+					uint16 *r = out + i0;
+					if (m < kBlock)
+					{
+						// Padded with 1.0, which raises nothing in any kernel.
+						std::fill(std::copy(x, x + m, in_tail), in_tail + kBlock, 0x3f80);
+						x = in_tail;
+						r = out_tail;
+					}
+					BlockStatus status = eval(x, r);
+					invalid |= status.invalid;
+					infinite |= status.infinite;
+					underflow |= status.underflow;
+					// NaNs, infinities and arguments the reduction cannot handle go
+					// to libm.
+					for (npy_intp k = 0; status.outside && k < m; ++k)
+					{
+						std::uint32_t bits = static_cast<std::uint32_t>(x[k]) << 16;
+						float xk;
+						memcpy(&xk, &bits, sizeof(xk));
+						if (Kernel::Inside(xk))
+						{
+							continue;
+						}
+						float rk = Kernel::Scalar(xk);
+						bool signaling = (bits & 0x7fc00000u) == 0x7f800000u && (bits & 0x003fffffu);
+						invalid |= xk != xk ? signaling : rk != rk;
+						r[k] = FloatToBfloat16Bits(rk);
+					}
+					if (m < kBlock)
+					{
+						std::copy(out_tail, out_tail + m, out + i0);
+					}
+				}
+				saved.Restore();
+				SetFloatStatus((invalid ? FE_INVALID : 0) | (infinite ? Kernel::kInfFlag : 0) |
+							   (underflow ? FE_UNDERFLOW : 0));
+			}
+
+			// Arithmetic and comparisons, computed in float32 and rounded to
+			// bfloat16 exactly like Eigen's scalar operators. Only lanes holding real
+			// elements are ever computed, so the flags they raise are the ones the
+			// scalar loop would raise.
+			struct Add
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V a, V b) { return a + b; }
+			};
+			struct Subtract
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V a, V b) { return a - b; }
+			};
+			struct Multiply
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V a, V b) { return a * b; }
+			};
+			struct TrueDivide
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V a, V b) { return a / b; }
+			};
+			// Vector <, <=, > and >= are the signaling predicates and would report
+			// invalid for quiet NaN operands, which NumPy's comparisons do not. NaN
+			// lanes are found with integer compares and zeroed in both operands, so
+			// the float compare never sees a NaN, and their result is patched in.
+			template <typename V>
+			BFLOAT16_KERNEL_INLINE Mask<V> Unordered(V &a, V &b)
+			{
+				const Mask<V> abs_mask = Mask<V>() + 0x7fffffff, inf = Mask<V>() + 0x7f800000;
+				Mask<V> nan = (((Mask<V>)a & abs_mask) > inf) | (((Mask<V>)b & abs_mask) > inf);
+				a = (V)((Mask<V>)a & ~nan);
+				b = (V)((Mask<V>)b & ~nan);
+				return nan;
+			}
+
+			struct Eq
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE Mask<V> Eval(V a, V b) { return a == b; }
+			};
+			struct Ne
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE Mask<V> Eval(V a, V b) { return a != b; }
+			};
+			struct Lt
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE Mask<V> Eval(V a, V b)
+				{
+					Mask<V> nan = Unordered(a, b);
+					return (a < b) & ~nan;
+				}
+			};
+			struct Gt
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE Mask<V> Eval(V a, V b)
+				{
+					Mask<V> nan = Unordered(a, b);
+					return (a > b) & ~nan;
+				}
+			};
+			struct Le
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE Mask<V> Eval(V a, V b)
+				{
+					Mask<V> nan = Unordered(a, b);
+					return (a <= b) & ~nan;
+				}
+			};
+			struct Ge
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE Mask<V> Eval(V a, V b)
+				{
+					Mask<V> nan = Unordered(a, b);
+					return (a >= b) & ~nan;
+				}
+			};
+
+			// Strided operands are gathered lane by lane and strided results
+			// scattered, still one vector operation per group of lanes. The lanes
+			// are listed out so that they go straight into registers.
+			template <typename L, std::size_t... l>
+			BFLOAT16_KERNEL_INLINE typename L::F LoadStrided(const char *in, npy_intp step,
+															 std::index_sequence<l...>)
+			{
+				typename L::U u = {*reinterpret_cast<const uint16 *>(in + npy_intp(l) * step)...};
+				return (typename L::F)(u << 16);
+			}
+
+			template <typename L>
+			BFLOAT16_KERNEL_INLINE typename L::F LoadStrided(const char *in, npy_intp step)
+			{
+				return LoadStrided<L>(in, step, std::make_index_sequence<sizeof(typename L::F) / sizeof(float)>());
+			}
+
+			template <typename L, typename Out, typename R, std::size_t... l>
+			BFLOAT16_KERNEL_INLINE void StoreStrided(R r, char *out, npy_intp step, std::index_sequence<l...>)
+			{
+				Out lanes[sizeof...(l)];
+				Narrow<L>(r, lanes);
+				int unused[] = {(*reinterpret_cast<Out *>(out + npy_intp(l) * step) = lanes[l], 0)...};
+				(void)unused;
+			}
+
+			// Evaluates Kernel on the first n - n % lanes pairs and returns how many
+			// that is. A zero step makes that operand a broadcast scalar.
+			template <typename Kernel, typename L, typename Out>
+			BFLOAT16_KERNEL_INLINE npy_intp EvalBinary(const char *x, npy_intp x_step, const char *y,
+													   npy_intp y_step, char *out, npy_intp out_step,
+													   npy_intp n)
+			{
+				typedef typename L::F V;
+				constexpr npy_intp kLanes = sizeof(V) / sizeof(float);
+				const V xs = V() + LoadStrided<Lanes4>(x, 0)[0], ys = V() + LoadStrided<Lanes4>(y, 0)[0];
+				npy_intp i = 0;
+				for (; i + kLanes <= n; i += kLanes)
+				{
+					V a = x_step == sizeof(uint16) ? Widen<L>(reinterpret_cast<const uint16 *>(x))
+							: x_step == 0		 ? xs
+												 : LoadStrided<L>(x, x_step);
+					V b = y_step == sizeof(uint16) ? Widen<L>(reinterpret_cast<const uint16 *>(y))
+							: y_step == 0		 ? ys
+												 : LoadStrided<L>(y, y_step);
+					if (out_step == sizeof(Out))
+					{
+						Narrow<L>(Kernel::Eval(a, b), reinterpret_cast<Out *>(out));
+					}
+					else
+					{
+						StoreStrided<L, Out>(Kernel::Eval(a, b), out, out_step, std::make_index_sequence<kLanes>());
+					}
+					x += kLanes * x_step;
+					y += kLanes * y_step;
+					out += kLanes * out_step;
+				}
+				return i;
+			}
+
+			template <typename Kernel, typename Out>
+			npy_intp EvalBinaryGeneric(const char *x, npy_intp x_step, const char *y, npy_intp y_step,
+									   char *out, npy_intp out_step, npy_intp n)
+			{
+				return EvalBinary<Kernel, Lanes4, Out>(x, x_step, y, y_step, out, out_step, n);
+			}
+
+#ifdef BFLOAT16_X86_DISPATCH
+			template <typename Kernel, typename Out>
+			__attribute__((target("avx2"))) npy_intp EvalBinaryAvx2(const char *x, npy_intp x_step,
+																	const char *y, npy_intp y_step,
+																	char *out, npy_intp out_step, npy_intp n)
+			{
+				return EvalBinary<Kernel, Lanes8, Out>(x, x_step, y, y_step, out, out_step, n);
+			}
+
+			template <typename Kernel, typename Out>
+			__attribute__((target("avx512f"))) npy_intp EvalBinaryAvx512(const char *x, npy_intp x_step,
+																		 const char *y, npy_intp y_step,
+																		 char *out, npy_intp out_step,
+																		 npy_intp n)
+			{
+				return EvalBinary<Kernel, Lanes16, Out>(x, x_step, y, y_step, out, out_step, n);
+			}
+#endif
+
+			// Loop of BinaryUFunc over bfloat16 pairs, Functor being the scalar
+			// equivalent of Kernel; the vector kernels stop short of the last few
+			// elements, which Functor does. Returns false, doing nothing, when an
+			// input overlaps the output: reductions and accumulations feed each
+			// result into the next step, one element at a time.
+			template <typename Kernel, typename Functor>
+			bool BinaryLoop(char **args, npy_intp n, const npy_intp *steps)
+			{
+				typedef decltype(Functor()(bfloat16(), bfloat16())) Out;
+				const char *x = args[0], *y = args[1];
+				char *out = args[2];
+				if (n <= 0 || Overlaps(x, steps[0], sizeof(uint16), out, steps[2], sizeof(Out), n) ||
+					Overlaps(y, steps[1], sizeof(uint16), out, steps[2], sizeof(Out), n))
+				{
+					return false;
+				}
+				npy_intp (*eval)(const char *, npy_intp, const char *, npy_intp, char *, npy_intp, npy_intp) =
+					EvalBinaryGeneric<Kernel, Out>;
+#ifdef BFLOAT16_X86_DISPATCH
+				if (HasAvx512())
+				{
+					eval = EvalBinaryAvx512<Kernel, Out>;
+				}
+				else if (HasAvx2())
+				{
+					eval = EvalBinaryAvx2<Kernel, Out>;
+				}
+#endif
+				npy_intp i = eval(x, steps[0], y, steps[1], out, steps[2], n);
+				x += i * steps[0];
+				y += i * steps[1];
+				out += i * steps[2];
+				for (; i < n; ++i)
+				{
+					*reinterpret_cast<Out *>(out) =
+						Functor()(*reinterpret_cast<const bfloat16 *>(x), *reinterpret_cast<const bfloat16 *>(y));
+					x += steps[0];
+					y += steps[1];
+					out += steps[2];
+				}
+				return true;
+			}
+
+			// Evaluates Kernel on the first n - n % lanes pairs of floats and returns
+			// how many that is, for BinaryUFuncMixed.
+			template <typename Kernel, typename L, typename Out>
+			BFLOAT16_KERNEL_INLINE npy_intp EvalFloats(const float *x, const float *y, Out *out, npy_intp n)
+			{
+				typedef typename L::F V;
+				constexpr npy_intp kLanes = sizeof(V) / sizeof(float);
+				npy_intp i = 0;
+				for (; i + kLanes <= n; i += kLanes)
+				{
+					V a, b;
+					memcpy(&a, x + i, sizeof(a));
+					memcpy(&b, y + i, sizeof(b));
+					Narrow<L>(Kernel::Eval(a, b), out + i);
+				}
+				return i;
+			}
+
+			template <typename Kernel, typename Out>
+			npy_intp EvalFloatsGeneric(const float *x, const float *y, Out *out, npy_intp n)
+			{
+				return EvalFloats<Kernel, Lanes4, Out>(x, y, out, n);
+			}
+
+#ifdef BFLOAT16_X86_DISPATCH
+			template <typename Kernel, typename Out>
+			__attribute__((target("avx2"))) npy_intp EvalFloatsAvx2(const float *x, const float *y, Out *out,
+																	npy_intp n)
+			{
+				return EvalFloats<Kernel, Lanes8, Out>(x, y, out, n);
+			}
+
+			template <typename Kernel, typename Out>
+			__attribute__((target("avx512f"))) npy_intp EvalFloatsAvx512(const float *x, const float *y,
+																		 Out *out, npy_intp n)
+			{
+				return EvalFloats<Kernel, Lanes16, Out>(x, y, out, n);
+			}
+#endif
+
+			// Loop of BinaryUFuncMixed, Functor being the scalar equivalent of Kernel.
+			template <typename Kernel, typename Functor>
+			npy_intp FloatLoop(const float *x, const float *y, void *out, npy_intp n)
+			{
+				typedef decltype(Functor()(0.0f, 0.0f)) Out;
+				npy_intp (*eval)(const float *, const float *, Out *, npy_intp) = EvalFloatsGeneric<Kernel, Out>;
+#ifdef BFLOAT16_X86_DISPATCH
+				if (HasAvx512())
+				{
+					eval = EvalFloatsAvx512<Kernel, Out>;
+				}
+				else if (HasAvx2())
+				{
+					eval = EvalFloatsAvx2<Kernel, Out>;
+				}
+#endif
+				return eval(x, y, static_cast<Out *>(out), n);
+			}
+
+			// a * b + c, rounded once to float like ufuncs::Fma. The product of two
+			// bfloat16 values has at most 16 significant bits but can overflow or
+			// underflow float, so it is formed in double, where it is always exact;
+			// the double sum rounded to float is then the correctly rounded fmaf, as
+			// double has more than 2 * 24 + 1 bits. An exact product also makes the
+			// result independent of whether the compiler contracts it into an FMA,
+			// so every width agrees with the scalar loop.
+			struct Fma
+			{
+				template <typename V>
+				static BFLOAT16_KERNEL_INLINE V Eval(V a, V b, V c)
+				{
+					typedef double D __attribute__((vector_size(2 * sizeof(V))));
+					D r = __builtin_convertvector(a, D) * __builtin_convertvector(b, D) + __builtin_convertvector(c, D);
+					return __builtin_convertvector(r, V);
+				}
+			};
+
+			template <typename L>
+			BFLOAT16_KERNEL_INLINE typename L::F LoadOperand(const char *in, npy_intp step, typename L::F broadcast)
+			{
+				return step == sizeof(uint16) ? Widen<L>(reinterpret_cast<const uint16 *>(in))
+					   : step == 0			  ? broadcast
+											  : LoadStrided<L>(in, step);
+			}
+
+			// EvalBinary with three operands.
+			template <typename Kernel, typename L>
+			BFLOAT16_KERNEL_INLINE npy_intp EvalTernary(char **args, const npy_intp *steps, npy_intp n)
+			{
+				typedef typename L::F V;
+				constexpr npy_intp kLanes = sizeof(V) / sizeof(float);
+				const char *x = args[0], *y = args[1], *z = args[2];
+				char *out = args[3];
+				const V xs = V() + LoadStrided<Lanes4>(x, 0)[0], ys = V() + LoadStrided<Lanes4>(y, 0)[0],
+						zs = V() + LoadStrided<Lanes4>(z, 0)[0];
+				npy_intp i = 0;
+				for (; i + kLanes <= n; i += kLanes)
+				{
+					V r = Kernel::Eval(LoadOperand<L>(x, steps[0], xs), LoadOperand<L>(y, steps[1], ys),
+									   LoadOperand<L>(z, steps[2], zs));
+					if (steps[3] == sizeof(uint16))
+					{
+						Narrow<L>(r, reinterpret_cast<uint16 *>(out));
+					}
+					else
+					{
+						StoreStrided<L, uint16>(r, out, steps[3], std::make_index_sequence<kLanes>());
+					}
+					x += kLanes * steps[0];
+					y += kLanes * steps[1];
+					z += kLanes * steps[2];
+					out += kLanes * steps[3];
+				}
+				return i;
+			}
+
+			template <typename Kernel>
+			npy_intp EvalTernaryGeneric(char **args, const npy_intp *steps, npy_intp n)
+			{
+				return EvalTernary<Kernel, Lanes4>(args, steps, n);
+			}
+
+#ifdef BFLOAT16_X86_DISPATCH
+			template <typename Kernel>
+			__attribute__((target("avx2"))) npy_intp EvalTernaryAvx2(char **args, const npy_intp *steps, npy_intp n)
+			{
+				return EvalTernary<Kernel, Lanes8>(args, steps, n);
+			}
+
+			template <typename Kernel>
+			__attribute__((target("avx512f"))) npy_intp EvalTernaryAvx512(char **args, const npy_intp *steps,
+																		  npy_intp n)
+			{
+				return EvalTernary<Kernel, Lanes16>(args, steps, n);
+			}
+#endif
+
+			// Loop of TernaryUFunc, like BinaryLoop.
+			template <typename Kernel, typename Functor>
+			bool TernaryLoop(char **args, npy_intp n, const npy_intp *steps)
+			{
+				if (n <= 0)
+				{
+					return false;
+				}
+				for (int k = 0; k < 3; ++k)
+				{
+					if (Overlaps(args[k], steps[k], sizeof(uint16), args[3], steps[3], sizeof(uint16), n))
+					{
+						return false;
+					}
+				}
+				npy_intp (*eval)(char **, const npy_intp *, npy_intp) = EvalTernaryGeneric<Kernel>;
+#ifdef BFLOAT16_X86_DISPATCH
+				if (HasAvx512())
+				{
+					eval = EvalTernaryAvx512<Kernel>;
+				}
+				else if (HasAvx2())
+				{
+					eval = EvalTernaryAvx2<Kernel>;
+				}
+#endif
+				npy_intp i = eval(args, steps, n);
+				const char *x = args[0] + i * steps[0], *y = args[1] + i * steps[1], *z = args[2] + i * steps[2];
+				char *out = args[3] + i * steps[3];
+				for (; i < n; ++i)
+				{
+					*reinterpret_cast<bfloat16 *>(out) =
+						Functor()(*reinterpret_cast<const bfloat16 *>(x), *reinterpret_cast<const bfloat16 *>(y),
+								  *reinterpret_cast<const bfloat16 *>(z));
+					x += steps[0];
+					y += steps[1];
+					z += steps[2];
+					out += steps[3];
+				}
+				return true;
+			}
+
+			// Bit-level kernels. Sign manipulation, nextafter, spacing, frexp and
+			// ldexp are integer arithmetic on the encodings, so nothing is widened
+			// and a vector register holds twice the lanes of the float kernels.
+			// Vectors are kBytes wide: 16 on baseline x86-64 and 32 with AVX2. The
+			// loops are bound by memory, and AVX-512 only adds mask juggling.
+			template <std::size_t kBytes>
+			struct Ints
+			{
+				typedef uint16 W __attribute__((vector_size(kBytes)));
+				typedef npy_bool Bools __attribute__((vector_size(kBytes / 2)));
+				// 32-bit lanes for frexp's and ldexp's int operand, with the
+				// bfloat16 values that go with them.
+				typedef std::uint32_t U __attribute__((vector_size(kBytes)));
+				typedef int I __attribute__((vector_size(kBytes)));
+				typedef uint16 HalfW __attribute__((vector_size(kBytes / 2)));
+			};
+
+			template <typename M>
+			BFLOAT16_KERNEL_INLINE bool AnyLane(M m)
+			{
+				std::uint64_t words[sizeof(M) / sizeof(std::uint64_t)], any = 0;
+				memcpy(words, &m, sizeof(m));
+				for (std::uint64_t word : words)
+				{
+					any |= word;
+				}
+				return any != 0;
+			}
+
+			// Whole vectors of T over any step, a zero step being a broadcast.
+			template <typename V, typename T, std::size_t... l>
+			BFLOAT16_KERNEL_INLINE V LoadLanes(const char *in, npy_intp step, std::index_sequence<l...>)
+			{
+				V v;
+				if (step == sizeof(T))
+				{
+					memcpy(&v, in, sizeof(v));
+				}
+				else if (step == 0)
+				{
+					v = V() + *reinterpret_cast<const T *>(in);
+				}
+				else
+				{
+					v = V{*reinterpret_cast<const T *>(in + npy_intp(l) * step)...};
+				}
+				return v;
+			}
+
+			template <typename V, typename T>
+			BFLOAT16_KERNEL_INLINE V LoadLanes(const char *in, npy_intp step)
+			{
+				return LoadLanes<V, T>(in, step, std::make_index_sequence<sizeof(V) / sizeof(T)>());
+			}
+
+			template <typename T, typename V, std::size_t... l>
+			BFLOAT16_KERNEL_INLINE void StoreLanes(V v, char *out, npy_intp step, std::index_sequence<l...>)
+			{
+				if (step == sizeof(T))
+				{
+					memcpy(out, &v, sizeof(v));
+					return;
+				}
+				int unused[] = {(*reinterpret_cast<T *>(out + npy_intp(l) * step) = v[l], 0)...};
+				(void)unused;
+			}
+
+			template <typename T, typename V>
+			BFLOAT16_KERNEL_INLINE void StoreLanes(V v, char *out, npy_intp step)
+			{
+				StoreLanes<T>(v, out, step, std::make_index_sequence<sizeof(V) / sizeof(T)>());
+			}
+
+			namespace bits
+			{
+				// x86 has no unsigned 16-bit comparisons before AVX-512, so words
+				// below 0x8000 are compared as signed ones.
+				template <typename W>
+				BFLOAT16_KERNEL_INLINE Mask<W> Signed(W x)
+				{
+					return (Mask<W>)x;
+				}
+
+				struct Negative
+				{
+					template <typename W>
+					static BFLOAT16_KERNEL_INLINE W Eval(W x) { return x ^ 0x8000; }
+				};
+
+				struct Abs
+				{
+					template <typename W>
+					static BFLOAT16_KERNEL_INLINE W Eval(W x) { return x & 0x7fff; }
+				};
+
+				struct SignBit
+				{
+					template <typename W>
+					static BFLOAT16_KERNEL_INLINE W Eval(W x) { return x >> 15; }
+				};
+
+				struct CopySign
+				{
+					template <typename W>
+					static BFLOAT16_KERNEL_INLINE W Eval(W x, W y) { return (x & 0x7fff) | (y & 0x8000); }
+				};
+
+				struct NextAfter
+				{
+					template <typename W>
+					static BFLOAT16_KERNEL_INLINE W Eval(W x, W y)
+					{
+						W ax = x & 0x7fff, ay = y & 0x7fff;
+						// One step down in magnitude if y is nearer zero or on the
+						// other side of it, else one up; zeros step to the smallest
+						// subnormal on y's side.
+						W step = (W)((Signed(ax) > Signed(ay)) | (Signed(x ^ y) < 0)) | 1;
+						W r = Select(ax == 0, (y & 0x8000) | 1, x + step);
+						r = Select((x == y) | ((ax | ay) == 0), y, r);
+						return Select((Signed(ax) > 0x7f80) | (Signed(ay) > 0x7f80), W() + 0x7fc0, r);
+					}
+				};
+
+				// 2^(e - 134) for exponent field e, which is subnormal for e <= 7;
+				// zeros and subnormals have the spacing of e = 1.
+				struct Spacing
+				{
+					template <typename W>
+					static BFLOAT16_KERNEL_INLINE W Eval(W x)
+					{
+						W ax = x & 0x7fff, e = ax >> 7;
+						W sign = Select(ax == 0, W(), x & 0x8000);
+						// 1 << (e - 1) for the subnormal ones, a bit of e - 1 at a time
+						// since there are no variable 16-bit shifts before AVX-512.
+						W k = Select(e == 0, W(), e - 1), sub = W() + 1;
+						sub = Select((k & 1) != 0, sub << 1, sub);
+						sub = Select((k & 2) != 0, sub << 2, sub);
+						sub = Select((k & 4) != 0, sub << 4, sub);
+						W r = Select(Signed(e) > 7, (e - 7) << 7, sub);
+						r = Select(ax == 0x7f7f, W() + 0x7f80, r) | sign;
+						r = Select(ax == 0x7f80, W() + 0x7fc0, r);
+						return Select(Signed(ax) > 0x7f80, x | 0x0040, r);
+					}
+				};
+
+				// Stores the results r of x. Infinities from finite values are
+				// overflows: spacing of the largest values, nextafter past them.
+				template <typename W>
+				BFLOAT16_KERNEL_INLINE void Store(W x, W r, char *out, npy_intp step, Mask<W> *overflow, bfloat16 *)
+				{
+					*overflow |= (Signed(x & 0x7fff) < 0x7f80) & ((r & 0x7fff) == 0x7f80);
+					StoreLanes<uint16>(r, out, step);
+				}
+
+				template <typename W>
+				BFLOAT16_KERNEL_INLINE void Store(W x, W r, char *out, npy_intp step, Mask<W> *overflow, npy_bool *)
+				{
+					StoreLanes<npy_bool>(__builtin_convertvector(r, typename Ints<sizeof(W)>::Bools), out, step);
+				}
+
+				// Bodies of the loops below. Each evaluates as many whole vectors of
+				// kBytes as n holds, adds the FE_* flags of the results to 'flags'
+				// and returns how many elements it did.
+				template <typename Kernel, typename Out>
+				struct Unary
+				{
+					template <std::size_t kBytes>
+					static BFLOAT16_KERNEL_INLINE npy_intp Run(char **args, const npy_intp *steps, npy_intp n,
+															   int *flags)
+					{
+						typedef typename Ints<kBytes>::W W;
+						constexpr npy_intp kLanes = sizeof(W) / sizeof(uint16);
+						const char *x = args[0];
+						char *out = args[1];
+						Mask<W> overflow = Mask<W>();
+						npy_intp i = 0;
+						for (; i + kLanes <= n; i += kLanes)
+						{
+							W a = LoadLanes<W, uint16>(x, steps[0]);
+							Store(a, Kernel::Eval(a), out, steps[1], &overflow, static_cast<Out *>(nullptr));
+							x += kLanes * steps[0];
+							out += kLanes * steps[1];
+						}
+						*flags |= AnyLane(overflow) ? FE_OVERFLOW : 0;
+						return i;
+					}
+				};
+
+				template <typename Kernel>
+				struct Binary
+				{
+					template <std::size_t kBytes>
+					static BFLOAT16_KERNEL_INLINE npy_intp Run(char **args, const npy_intp *steps, npy_intp n,
+															   int *flags)
+					{
+						typedef typename Ints<kBytes>::W W;
+						constexpr npy_intp kLanes = sizeof(W) / sizeof(uint16);
+						const char *x = args[0], *y = args[1];
+						char *out = args[2];
+						Mask<W> overflow = Mask<W>();
+						npy_intp i = 0;
+						for (; i + kLanes <= n; i += kLanes)
+						{
+							W a = LoadLanes<W, uint16>(x, steps[0]);
+							W b = LoadLanes<W, uint16>(y, steps[1]);
+							Store(a, Kernel::Eval(a, b), out, steps[2], &overflow, static_cast<bfloat16 *>(nullptr));
+							x += kLanes * steps[0];
+							y += kLanes * steps[1];
+							out += kLanes * steps[2];
+						}
+						*flags |= AnyLane(overflow) ? FE_OVERFLOW : 0;
+						return i;
+					}
+				};
+
+				// Normal values only change exponent; subnormals are normalized
+				// lane by lane.
+				struct Frexp
+				{
+					template <std::size_t kBytes>
+					static BFLOAT16_KERNEL_INLINE npy_intp Run(char **args, const npy_intp *steps, npy_intp n, int *)
+					{
+						typedef typename Ints<kBytes>::U U;
+						typedef typename Ints<kBytes>::I I;
+						typedef typename Ints<kBytes>::HalfW HalfW;
+						constexpr npy_intp kLanes = sizeof(U) / sizeof(std::uint32_t);
+						const char *x = args[0];
+						char *mantissa = args[1], *exponent = args[2];
+						npy_intp i = 0;
+						for (; i + kLanes <= n; i += kLanes)
+						{
+							U a = __builtin_convertvector(LoadLanes<HalfW, uint16>(x, steps[0]), U);
+							I e = (I)((a >> 7) & 0xff);
+							Mask<U> normal = (e != 0) & (e != 0xff);
+							StoreLanes<uint16>(
+								__builtin_convertvector(Select(normal, (a & 0x807f) | (126 << 7), a), HalfW),
+								mantissa, steps[1]);
+							StoreLanes<int>(Select(normal, e - 126, I()), exponent, steps[2]);
+							Mask<U> subnormal = (e == 0) & ((a & 0x7fff) != 0);
+							if (AnyLane(subnormal))
+							{
+								for (npy_intp k = 0; k < kLanes; ++k)
+								{
+									if (subnormal[k])
+									{
+										std::pair<uint16, int> r = FrexpBits(static_cast<uint16>(a[k]));
+										*reinterpret_cast<uint16 *>(mantissa + k * steps[1]) = r.first;
+										*reinterpret_cast<int *>(exponent + k * steps[2]) = r.second;
+									}
+								}
+							}
+							x += kLanes * steps[0];
+							mantissa += kLanes * steps[1];
+							exponent += kLanes * steps[2];
+						}
+						return i;
+					}
+				};
+
+				// Adds n to the exponent field while the result stays normal;
+				// anything that overflows or goes subnormal is left to LdexpBits.
+				struct Ldexp
+				{
+					template <std::size_t kBytes>
+					static BFLOAT16_KERNEL_INLINE npy_intp Run(char **args, const npy_intp *steps, npy_intp n,
+															   int *flags)
+					{
+						typedef typename Ints<kBytes>::U U;
+						typedef typename Ints<kBytes>::I I;
+						typedef typename Ints<kBytes>::HalfW HalfW;
+						constexpr npy_intp kLanes = sizeof(U) / sizeof(std::uint32_t);
+						const char *x = args[0], *y = args[1];
+						char *out = args[2];
+						npy_intp i = 0;
+						for (; i + kLanes <= n; i += kLanes)
+						{
+							U a = __builtin_convertvector(LoadLanes<HalfW, uint16>(x, steps[0]), U);
+							I m = LoadLanes<I, int>(y, steps[1]);
+							I e = (I)((a >> 7) & 0xff);
+							m = Select(m < -300, I() - 300, Select(m > 300, I() + 300, m));
+							Mask<U> normal = (e != 0) & (e != 0xff) & (e + m >= 1) & (e + m <= 254);
+							Mask<U> kept = ((a & 0x7fff) == 0) | (e == 0xff);
+							Mask<U> slow = ~(normal | kept);
+							U r = Select(normal, a + ((U)m << 7), a);
+							if (AnyLane(slow))
+							{
+								for (npy_intp k = 0; k < kLanes; ++k)
+								{
+									if (slow[k])
+									{
+										r[k] = LdexpBits(static_cast<uint16>(a[k]), m[k], flags);
+									}
+								}
+							}
+							StoreLanes<uint16>(__builtin_convertvector(r, HalfW), out, steps[2]);
+							x += kLanes * steps[0];
+							y += kLanes * steps[1];
+							out += kLanes * steps[2];
+						}
+						return i;
+					}
+				};
+
+				template <typename Body>
+				npy_intp RunGeneric(char **args, const npy_intp *steps, npy_intp n, int *flags)
+				{
+					return Body::template Run<16>(args, steps, n, flags);
+				}
+
+#ifdef BFLOAT16_X86_DISPATCH
+				template <typename Body>
+				__attribute__((target("avx2"))) npy_intp RunAvx2(char **args, const npy_intp *steps, npy_intp n,
+																 int *flags)
+				{
+					return Body::template Run<32>(args, steps, n, flags);
+				}
+#endif
+
+				// Runs Body in the widest vectors the CPU has and reports the flags
+				// of the results.
+				template <typename Body>
+				npy_intp Run(char **args, const npy_intp *steps, npy_intp n)
+				{
+					npy_intp (*run)(char **, const npy_intp *, npy_intp, int *) = RunGeneric<Body>;
+#ifdef BFLOAT16_X86_DISPATCH
+					if (HasAvx2())
+					{
+						run = RunAvx2<Body>;
+					}
+#endif
+					int flags = 0;
+					npy_intp i = run(args, steps, n, &flags);
+					SetFloatStatus(flags);
+					return i;
+				}
+			} // namespace bits
+
+			// Loops of UnaryUFunc, BinaryUFunc, UnaryUFunc2 (frexp) and
+			// BinaryUFunc2 (ldexp) over the bit-level kernels, Functor doing the
+			// last few elements. Like BinaryLoop, they leave inputs that overlap an
+			// output to the scalar loop.
+			template <typename Kernel, typename Functor>
+			bool UnaryBitLoop(char **args, npy_intp n, const npy_intp *steps)
+			{
+				typedef decltype(Functor()(bfloat16())) Out;
+				if (n <= 0 || Overlaps(args[0], steps[0], sizeof(uint16), args[1], steps[1], sizeof(Out), n))
+				{
+					return false;
+				}
+				npy_intp i = bits::Run<bits::Unary<Kernel, Out>>(args, steps, n);
+				const char *x = args[0] + i * steps[0];
+				char *out = args[1] + i * steps[1];
+				for (; i < n; ++i)
+				{
+					*reinterpret_cast<Out *>(out) = Functor()(*reinterpret_cast<const bfloat16 *>(x));
+					x += steps[0];
+					out += steps[1];
+				}
+				return true;
+			}
+
+			template <typename Kernel, typename Functor>
+			bool BinaryBitLoop(char **args, npy_intp n, const npy_intp *steps)
+			{
+				if (n <= 0 || Overlaps(args[0], steps[0], sizeof(uint16), args[2], steps[2], sizeof(uint16), n) ||
+					Overlaps(args[1], steps[1], sizeof(uint16), args[2], steps[2], sizeof(uint16), n))
+				{
+					return false;
+				}
+				npy_intp i = bits::Run<bits::Binary<Kernel>>(args, steps, n);
+				const char *x = args[0] + i * steps[0], *y = args[1] + i * steps[1];
+				char *out = args[2] + i * steps[2];
+				for (; i < n; ++i)
+				{
+					*reinterpret_cast<bfloat16 *>(out) =
+						Functor()(*reinterpret_cast<const bfloat16 *>(x), *reinterpret_cast<const bfloat16 *>(y));
+					x += steps[0];
+					y += steps[1];
+					out += steps[2];
+				}
+				return true;
+			}
+
+			template <typename Functor>
+			bool FrexpLoop(char **args, npy_intp n, const npy_intp *steps)
+			{
+				if (n <= 0 || Overlaps(args[0], steps[0], sizeof(uint16), args[1], steps[1], sizeof(uint16), n) ||
+					Overlaps(args[0], steps[0], sizeof(uint16), args[2], steps[2], sizeof(int), n))
+				{
+					return false;
+				}
+				npy_intp i = bits::Run<bits::Frexp>(args, steps, n);
+				const char *x = args[0] + i * steps[0];
+				char *mantissa = args[1] + i * steps[1], *exponent = args[2] + i * steps[2];
+				for (; i < n; ++i)
+				{
+					std::tie(*reinterpret_cast<bfloat16 *>(mantissa), *reinterpret_cast<int *>(exponent)) =
+						Functor()(*reinterpret_cast<const bfloat16 *>(x));
+					x += steps[0];
+					mantissa += steps[1];
+					exponent += steps[2];
+				}
+				return true;
+			}
+
+			template <typename Functor>
+			bool LdexpLoop(char **args, npy_intp n, const npy_intp *steps)
+			{
+				if (n <= 0 || Overlaps(args[0], steps[0], sizeof(uint16), args[2], steps[2], sizeof(uint16), n) ||
+					Overlaps(args[1], steps[1], sizeof(int), args[2], steps[2], sizeof(uint16), n))
+				{
+					return false;
+				}
+				npy_intp i = bits::Run<bits::Ldexp>(args, steps, n);
+				const char *x = args[0] + i * steps[0], *y = args[1] + i * steps[1];
+				char *out = args[2] + i * steps[2];
+				for (; i < n; ++i)
+				{
+					*reinterpret_cast<bfloat16 *>(out) =
+						Functor()(*reinterpret_cast<const bfloat16 *>(x), *reinterpret_cast<const int *>(y));
+					x += steps[0];
+					y += steps[1];
+					out += steps[2];
+				}
+				return true;
+			}
+
+			// ExprScalarStep on whole vectors, for the steps that have a vector
+			// form. Arithmetic runs on the lanes holding elements only, so it
+			// raises what the scalar step would, and returns how many elements it
+			// did. The transcendental kernels run on every element, padding 'a' with
+			// 1.0 and deriving their flags like EvalBlock; lanes they do not handle
+			// go to libm. 'scratch' holds kExprBlock floats.
+			template <typename Op, typename L>
+			BFLOAT16_KERNEL_INLINE npy_intp ExprArithmetic(float *a, const float *b, npy_intp m)
+			{
+				typedef typename L::F V;
+				constexpr npy_intp kLanes = sizeof(V) / sizeof(float);
+				npy_intp i = 0;
+				for (; i + kLanes <= m; i += kLanes)
+				{
+					V x, y;
+					memcpy(&x, a + i, sizeof(x));
+					memcpy(&y, b + i, sizeof(y));
+					x = Op::Eval(x, y);
+					memcpy(a + i, &x, sizeof(x));
+				}
+				return i;
+			}
+
+			template <typename Kernel, typename L>
+			BFLOAT16_KERNEL_INLINE npy_intp ExprKernel(float *a, float *scratch, npy_intp m, int *flags)
+			{
+				typedef typename L::F V;
+				typedef Mask<V> M;
+				constexpr npy_intp kLanes = sizeof(V) / sizeof(float);
+				const npy_intp padded = (m + kLanes - 1) / kLanes * kLanes;
+				std::fill(a + m, a + padded, 1.0f);
+				M invalid = M(), infinite = M(), underflow = M(), outside = M();
+				const M zero_underflows = M() - Kernel::kZeroUnderflows;
+				SavedFloatStatus saved;
+				for (npy_intp i = 0; i < padded; i += kLanes)
+				{
+					V x;
+					memcpy(&x, a + i, sizeof(x));
+					V r = Kernel::Eval(x);
+					V ax = Abs(x), ar = Abs(r);
+					M inside = Kernel::Inside(x);
+					M finite = ax <= std::numeric_limits<float>::max();
+					invalid |= inside & (r != r);
+					infinite |= inside & finite & (ar > std::numeric_limits<float>::max());
+					underflow |= inside & finite & (x != 0.0f) & (ar < std::numeric_limits<float>::min()) &
+								 ((r != 0.0f) | zero_underflows);
+					outside |= ~inside;
+					memcpy(scratch + i, &r, sizeof(r));
+				}
+				saved.Restore();
+				for (npy_intp k = 0; Any<V>(outside) && k < m; ++k)
+				{
+					if (!Kernel::Inside(a[k]))
+					{
+						scratch[k] = Kernel::Scalar(a[k]);
+					}
+				}
+				memcpy(a, scratch, m * sizeof(float));
+				*flags |= (Any<V>(invalid) ? FE_INVALID : 0) | (Any<V>(infinite) ? Kernel::kInfFlag : 0) |
+						  (Any<V>(underflow) ? FE_UNDERFLOW : 0);
+				return m;
+			}
+
+			template <typename L>
+			BFLOAT16_KERNEL_INLINE npy_intp ExprVectorStep(const ExprStep &step, float *a, const float *b,
+														   float *scratch, npy_intp m, int *flags)
+			{
+				switch (step.op)
+				{
+				case kExprAdd:
+					return ExprArithmetic<Add, L>(a, b, m);
+				case kExprSubtract:
+					return ExprArithmetic<Subtract, L>(a, b, m);
+				case kExprMultiply:
+					return ExprArithmetic<Multiply, L>(a, b, m);
+				case kExprDivide:
+					return ExprArithmetic<TrueDivide, L>(a, b, m);
+				case kExprExp:
+					return ExprKernel<Exp, L>(a, scratch, m, flags);
+				case kExprExp2:
+					return ExprKernel<Exp2, L>(a, scratch, m, flags);
+				case kExprExpm1:
+					return ExprKernel<Expm1, L>(a, scratch, m, flags);
+				case kExprLog:
+					return ExprKernel<Log, L>(a, scratch, m, flags);
+				case kExprLog2:
+					return ExprKernel<Log2, L>(a, scratch, m, flags);
+				case kExprLog10:
+					return ExprKernel<Log10, L>(a, scratch, m, flags);
+				case kExprLog1p:
+					return ExprKernel<Log1p, L>(a, scratch, m, flags);
+				case kExprTanh:
+					return ExprKernel<Tanh, L>(a, scratch, m, flags);
+				case kExprSin:
+					return ExprKernel<Sin, L>(a, scratch, m, flags);
+				case kExprCos:
+					return ExprKernel<Cos, L>(a, scratch, m, flags);
+				default:
+					return 0;
+				}
+			}
+
+			template <typename L>
+			struct ExprMachine
+			{
+				typedef typename L::F V;
+				static constexpr npy_intp kLanes = sizeof(V) / sizeof(float);
+
+				static BFLOAT16_KERNEL_INLINE void Load(const char *in, npy_intp stride, float *a, npy_intp m)
+				{
+					npy_intp i = 0;
+					for (; stride == sizeof(uint16) && i + kLanes <= m; i += kLanes)
+					{
+						V x = Widen<L>(reinterpret_cast<const uint16 *>(in) + i);
+						memcpy(a + i, &x, sizeof(x));
+					}
+					ExprScalarMachine::Load(in + i * stride, stride, a + i, m - i);
+				}
+
+				static BFLOAT16_KERNEL_INLINE void Step(const ExprStep &step, float *a, const float *b, float *scratch,
+														npy_intp m, int *flags)
+				{
+					npy_intp i = ExprVectorStep<L>(step, a, b, scratch, m, flags);
+					ExprScalarStep(step, a + i, b + i, m - i);
+				}
+
+				static BFLOAT16_KERNEL_INLINE void Store(const float *a, char *out, npy_intp stride, npy_intp m)
+				{
+					npy_intp i = 0;
+					for (; stride == sizeof(uint16) && i + kLanes <= m; i += kLanes)
+					{
+						V x;
+						memcpy(&x, a + i, sizeof(x));
+						Narrow<L>(x, reinterpret_cast<uint16 *>(out) + i);
+					}
+					ExprScalarMachine::Store(a + i, out + i * stride, stride, m - i);
+				}
+			};
+
+			int RunExprProgramGeneric(const ExprProgram &program, char *const *data, const npy_intp *strides,
+									  npy_intp n, float *registers)
+			{
+				return RunExprProgram<ExprMachine<Lanes4>>(program, data, strides, n, registers);
+			}
+
+#ifdef BFLOAT16_X86_DISPATCH
+			__attribute__((target("avx2"))) int RunExprProgramAvx2(const ExprProgram &program, char *const *data,
+																   const npy_intp *strides, npy_intp n,
+																   float *registers)
+			{
+				return RunExprProgram<ExprMachine<Lanes8>>(program, data, strides, n, registers);
+			}
+#endif
+		} // namespace kernels
+#endif
+
+		PyObject *PyBfloat16_Evaluate(PyObject *module, PyObject *args, PyObject *kwds)
+		{
+			static const char *kwlist[] = {"ex", "local_dict", nullptr};
+			const char *ex;
+			PyObject *local_dict;
+			if (!PyArg_ParseTupleAndKeywords(args, kwds, "sO:evaluate", const_cast<char **>(kwlist), &ex,
+											 &local_dict))
+			{
+				return nullptr;
+			}
+			ExprProgram program;
+			if (!ExprParser(ex, &program).Parse())
+			{
+				return nullptr;
+			}
+			const std::size_t nop = program.names.size() + 1;
+			if (nop > NPY_MAXARGS)
+			{
+				PyErr_Format(PyExc_ValueError, "more than %d arrays in expression '%s'", NPY_MAXARGS - 1, ex);
+				return nullptr;
+			}
+
+			// The operands, converted to bfloat16 as by astype, and the result.
+			std::vector<Safe_PyObjectPtr> arrays;
+			std::vector<PyArrayObject *> ops(nop, nullptr);
+			std::vector<npy_uint32> op_flags(nop, NPY_ITER_READONLY);
+			Safe_PyObjectPtr descr = make_safe(reinterpret_cast<PyObject *>(PyArray_DescrFromType(npy_bfloat16)));
+			std::vector<PyArray_Descr *> op_dtypes(nop, reinterpret_cast<PyArray_Descr *>(descr.get()));
+			for (std::size_t k = 0; k < program.names.size(); ++k)
+			{
+				Safe_PyObjectPtr value = make_safe(PyMapping_GetItemString(local_dict, program.names[k].c_str()));
+				if (!value)
+				{
+					if (PyErr_ExceptionMatches(PyExc_KeyError))
+					{
+						PyErr_Clear();
+						PyErr_Format(PyExc_NameError, "name '%s' is not defined", program.names[k].c_str());
+					}
+					return nullptr;
+				}
+				arrays.push_back(make_safe(PyArray_FromAny(value.get(), nullptr, 0, 0, 0, nullptr)));
+				if (!arrays.back())
+				{
+					return nullptr;
+				}
+				ops[k] = reinterpret_cast<PyArrayObject *>(arrays.back().get());
+			}
+			op_flags[nop - 1] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
+			NpyIter *iter = NpyIter_MultiNew(static_cast<int>(nop), ops.data(),
+											 NPY_ITER_EXTERNAL_LOOP | NPY_ITER_BUFFERED | NPY_ITER_ZEROSIZE_OK,
+											 NPY_KEEPORDER, NPY_UNSAFE_CASTING, op_flags.data(), op_dtypes.data());
+			if (!iter)
+			{
+				return nullptr;
+			}
+
+			int (*run)(const ExprProgram &, char *const *, const npy_intp *, npy_intp, float *) = RunExprProgramScalar;
+#ifdef BFLOAT16_VECTOR_KERNELS
+			run = kernels::RunExprProgramGeneric;
+#ifdef BFLOAT16_X86_DISPATCH
+			if (HasAvx2())
+			{
+				run = kernels::RunExprProgramAvx2;
+			}
+#endif
+#endif
+			std::vector<float> registers((program.registers + 2) * kExprBlock);
+			bool ok = true;
+			int status = 0;
+			fenv_t fenv;
+			feholdexcept(&fenv);
+			if (NpyIter_GetIterSize(iter) > 0)
+			{
+				NpyIter_IterNextFunc *iternext = NpyIter_GetIterNext(iter, nullptr);
+				char **data = NpyIter_GetDataPtrArray(iter);
+				npy_intp *strides = NpyIter_GetInnerStrideArray(iter);
+				npy_intp *size = NpyIter_GetInnerLoopSizePtr(iter);
+				if (iternext)
+				{
+					do
+					{
+						status |= run(program, data, strides, *size, registers.data());
+					} while (iternext(iter));
+				}
+				ok = !PyErr_Occurred();
+			}
+			status |= fetestexcept(FE_DIVBYZERO | FE_OVERFLOW | FE_UNDERFLOW | FE_INVALID);
+			fesetenv(&fenv);
+			PyObject *result = reinterpret_cast<PyObject *>(NpyIter_GetOperandArray(iter)[nop - 1]);
+			Py_INCREF(result);
+			if (NpyIter_Deallocate(iter) != NPY_SUCCEED || !ok || !ReportFloatStatus(status, "evaluate"))
+			{
+				Py_DECREF(result);
+				return nullptr;
+			}
+			return result;
+		}
+
+		template <typename InType, typename OutType, typename Functor>
+		struct UnaryUFunc
+		{
+			static std::vector<int> Types()
+			{
+				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<OutType>::Dtype()};
+			}
+			static void Call(char **args, const npy_intp *dimensions,
+							 const npy_intp *steps, void *data)
+			{
+				if (UnaryTable<Functor>::kReference && unary_tables_enabled.load(std::memory_order_relaxed))
+				{
+					UnaryTableLoop(UnaryTableFor<Functor>(), args[0], args[1], *dimensions, steps[0], steps[1]);
+					return;
+				}
+				if (UnaryKernel<Functor>::kLoop && steps[0] == sizeof(bfloat16) && steps[1] == sizeof(bfloat16))
+				{
+					UnaryKernel<Functor>::kLoop(reinterpret_cast<const uint16 *>(args[0]),
+												reinterpret_cast<uint16 *>(args[1]), *dimensions);
+					return;
+				}
+				if (StridedKernel<Functor>::kLoop && StridedKernel<Functor>::kLoop(args, *dimensions, steps))
+				{
+					return;
+				}
+				const char *i0 = args[0];
+				char *o = args[1];
+				for (npy_intp k = 0; k < *dimensions; k++)
+				{
+					auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+					*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) = Functor()(x);
+					i0 += steps[0];
+					o += steps[1];
+				}
+			}
+		};
+
+		template <typename InType, typename OutType, typename OutType2,
+				  typename Functor>
+		struct UnaryUFunc2
+		{
+			static std::vector<int> Types()
+			{
+				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<OutType>::Dtype(),
 						TypeDescriptor<OutType2>::Dtype()};
 			}
 			static void Call(char **args, const npy_intp *dimensions,
 							 const npy_intp *steps, void *data)
 			{
+				if (StridedKernel<Functor>::kLoop && StridedKernel<Functor>::kLoop(args, *dimensions, steps))
+				{
+					return;
+				}
 				const char *i0 = args[0];
 				char *o0 = args[1];
 				char *o1 = args[2];
@@ -877,30 +4243,50 @@ namespace qsbfloat16
 				const char *i0 = args[0];
 				const char *i1 = args[1];
 				char *o = args[2];
-				fenv_t fenv;
-				feholdexcept(&fenv);
-				for (npy_intp k = 0; k < *dimensions; k++)
+				if (StridedKernel<Functor>::kLoop && StridedKernel<Functor>::kLoop(args, *dimensions, steps))
 				{
-					auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
-					auto y = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i1);
-					*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
-						Functor()(x, y);
-					i0 += steps[0];
-					i1 += steps[1];
-					o += steps[2];
+					// Done by the vectorized loop.
+				}
+				// A broadcast (zero-stride) operand is loaded once so the compiler can
+				// keep it, and anything derived from it, out of the loop. A zero-stride
+				// operand that is also the output is a reduction's accumulator instead.
+				else if (steps[1] == 0 && i1 != o)
+				{
+					const auto y = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i1);
+					for (npy_intp k = 0; k < *dimensions; k++)
+					{
+						auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+						*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
+							Functor()(x, y);
+						i0 += steps[0];
+						o += steps[2];
+					}
 				}
-				if (fetestexcept(FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW | FE_UNDERFLOW)) {
-					if (fetestexcept(FE_INVALID)) {
-						PyErr_SetString(PyExc_ArithmeticError, "bfloat16 invalid");
-					} else if (fetestexcept(FE_DIVBYZERO)) {
-						PyErr_SetString(PyExc_ArithmeticError, "bfloat16 divide by zero");
-					} else if (fetestexcept(FE_OVERFLOW)) {
-						PyErr_SetString(PyExc_ArithmeticError, "bfloat16 overflow");
-					} else if (fetestexcept(FE_UNDERFLOW)) {
-						PyErr_SetString(PyExc_ArithmeticError, "bfloat16 underflow");
+				else if (steps[0] == 0 && i0 != o)
+				{
+					const auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+					for (npy_intp k = 0; k < *dimensions; k++)
+					{
+						auto y = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i1);
+						*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
+							Functor()(x, y);
+						i1 += steps[1];
+						o += steps[2];
+					}
+				}
+				else
+				{
+					for (npy_intp k = 0; k < *dimensions; k++)
+					{
+						auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+						auto y = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i1);
+						*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
+							Functor()(x, y);
+						i0 += steps[0];
+						i1 += steps[1];
+						o += steps[2];
 					}
 				}
-				fesetenv(&fenv);
 			}
 		};
 
@@ -918,34 +4304,169 @@ namespace qsbfloat16
 #ifdef DEBUG_CALLS
 				std::cout << "BinaryUFunc2->Call\n";
 #endif
+				if (StridedKernel<Functor>::kLoop && StridedKernel<Functor>::kLoop(args, *dimensions, steps))
+				{
+					return;
+				}
 				const char *i0 = args[0];
 				const char *i1 = args[1];
 				char *o = args[2];
-				fenv_t fenv;
-				feholdexcept(&fenv);
+				if (steps[1] == 0 && i1 != o)
+				{
+					const auto y =
+						*reinterpret_cast<const typename TypeDescriptor<InType2>::T *>(i1);
+					for (npy_intp k = 0; k < *dimensions; k++)
+					{
+						auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+						*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
+							Functor()(x, y);
+						i0 += steps[0];
+						o += steps[2];
+					}
+				}
+				else
+				{
+					for (npy_intp k = 0; k < *dimensions; k++)
+					{
+						auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+						auto y =
+							*reinterpret_cast<const typename TypeDescriptor<InType2>::T *>(i1);
+						*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
+							Functor()(x, y);
+						i0 += steps[0];
+						i1 += steps[1];
+						o += steps[2];
+					}
+				}
+			}
+		};
+
+		template <typename InType, typename OutType, typename Functor>
+		struct TernaryUFunc
+		{
+			static std::vector<int> Types()
+			{
+				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<InType>::Dtype(),
+						TypeDescriptor<InType>::Dtype(), TypeDescriptor<OutType>::Dtype()};
+			}
+			static void Call(char **args, const npy_intp *dimensions,
+							 const npy_intp *steps, void *data)
+			{
+				if (StridedKernel<Functor>::kLoop && StridedKernel<Functor>::kLoop(args, *dimensions, steps))
+				{
+					return;
+				}
+				const char *i0 = args[0];
+				const char *i1 = args[1];
+				const char *i2 = args[2];
+				char *o = args[3];
 				for (npy_intp k = 0; k < *dimensions; k++)
 				{
 					auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
-					auto y =
-						*reinterpret_cast<const typename TypeDescriptor<InType2>::T *>(i1);
-					*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
-						Functor()(x, y);
+					auto y = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i1);
+					auto z = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i2);
+					*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) = Functor()(x, y, z);
 					i0 += steps[0];
 					i1 += steps[1];
-					o += steps[2];
+					i2 += steps[2];
+					o += steps[3];
 				}
-				if (fetestexcept(FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW | FE_UNDERFLOW)) {
-					if (fetestexcept(FE_INVALID)) {
-						PyErr_SetString(PyExc_ArithmeticError, "bfloat16 invalid");
-					} else if (fetestexcept(FE_DIVBYZERO)) {
-						PyErr_SetString(PyExc_ArithmeticError, "bfloat16 divide by zero");
-					} else if (fetestexcept(FE_OVERFLOW)) {
-						PyErr_SetString(PyExc_ArithmeticError, "bfloat16 overflow");
-					} else if (fetestexcept(FE_UNDERFLOW)) {
-						PyErr_SetString(PyExc_ArithmeticError, "bfloat16 underflow");
+			}
+		};
+
+		// Widens n values of type T, 'step' bytes apart, to float.
+		template <typename T>
+		void WidenToFloat(const char *in, npy_intp step, float *out, npy_intp n)
+		{
+			if (std::is_same<T, Eigen::half>::value && step == sizeof(T))
+			{
+				HalfToFloat(reinterpret_cast<const Eigen::half *>(in), out, n);
+				return;
+			}
+			for (npy_intp k = 0; k < n; ++k)
+			{
+				out[k] = static_cast<float>(*reinterpret_cast<const T *>(in + k * step));
+			}
+		}
+
+		constexpr npy_intp kMixedBlock = 256;
+
+		// Loop for a binary functor on bfloat16 and 'Other' (the second operand,
+		// or the first if 'Swapped'), a type whose values float holds exactly. A
+		// block at a time, both operands are widened to float and the functor's
+		// float overload rounds the result once, through FloatKernel where there
+		// is one, so that, as NumPy does for float16, the result stays bfloat16
+		// without rounding the other operand first. Inputs overlapping the output
+		// go one element at a time.
+		template <typename Other, typename OutType, typename Functor, bool Swapped = false>
+		struct BinaryUFuncMixed
+		{
+			static std::vector<int> Types()
+			{
+				int other = TypeDescriptor<Other>::Dtype(), self = TypeDescriptor<bfloat16>::Dtype();
+				return {Swapped ? other : self, Swapped ? self : other,
+						TypeDescriptor<OutType>::Dtype()};
+			}
+			static void Call(char **args, const npy_intp *dimensions,
+							 const npy_intp *steps, void *data)
+			{
+				typedef typename TypeDescriptor<OutType>::T Out;
+				const int self = Swapped ? 1 : 0, other = Swapped ? 0 : 1;
+				const char *i0 = args[self];
+				const char *i1 = args[other];
+				char *o = args[2];
+				const npy_intp n = *dimensions;
+				const npy_intp block =
+					Overlaps(i0, steps[self], sizeof(bfloat16), o, steps[2], sizeof(Out), n) ||
+							Overlaps(i1, steps[other], sizeof(typename TypeDescriptor<Other>::T), o, steps[2],
+									 sizeof(Out), n)
+						? 1
+						: kMixedBlock;
+				float xs[kMixedBlock], ys[kMixedBlock];
+				Out results[kMixedBlock];
+				for (npy_intp i = 0; i < n; i += block)
+				{
+					const npy_intp m = std::min(block, n - i);
+					WidenToFloat<bfloat16>(i0, steps[self], Swapped ? ys : xs, m);
+					WidenToFloat<typename TypeDescriptor<Other>::T>(i1, steps[other], Swapped ? xs : ys, m);
+					npy_intp k = FloatKernel<Functor>::kLoop(xs, ys, results, m);
+					for (; k < m; ++k)
+					{
+						results[k] = Functor()(xs[k], ys[k]);
+					}
+					for (k = 0; k < m; ++k)
+					{
+						*reinterpret_cast<Out *>(o + k * steps[2]) = results[k];
 					}
+					i0 += m * steps[self];
+					i1 += m * steps[other];
+					o += m * steps[2];
+				}
+			}
+		};
+
+		// fma on float64, the ufunc's one built-in loop. NumPy tries the bfloat16 loop
+		// first and casts Python and NumPy scalars to it by value, so this only
+		// runs when an array operand does not cast safely to bfloat16.
+		struct TernaryUFuncFmaDouble
+		{
+			static void Call(char **args, const npy_intp *dimensions,
+							 const npy_intp *steps, void *data)
+			{
+				const char *i0 = args[0];
+				const char *i1 = args[1];
+				const char *i2 = args[2];
+				char *o = args[3];
+				for (npy_intp k = 0; k < *dimensions; k++)
+				{
+					*reinterpret_cast<double *>(o) = std::fma(*reinterpret_cast<const double *>(i0),
+															  *reinterpret_cast<const double *>(i1),
+															  *reinterpret_cast<const double *>(i2));
+					i0 += steps[0];
+					i1 += steps[1];
+					i2 += steps[2];
+					o += steps[3];
 				}
-				fesetenv(&fenv);
 			}
 		};
 
@@ -976,18 +4497,14 @@ namespace qsbfloat16
 		// 	}
 		// };
 
+		// Adds the loop of UFunc to 'ufunc_obj', called 'name' in errors.
 		template <typename UFunc>
-		bool RegisterUFunc(PyObject *numpy, const char *name)
+		bool RegisterUFuncLoop(PyObject *ufunc_obj, const char *name)
 		{
 			std::vector<int> types = UFunc::Types();
 			PyUFuncGenericFunction fn =
 				reinterpret_cast<PyUFuncGenericFunction>(UFunc::Call);
-			Safe_PyObjectPtr ufunc_obj = make_safe(PyObject_GetAttrString(numpy, name));
-			if (!ufunc_obj)
-			{
-				return false;
-			}
-			PyUFuncObject *ufunc = reinterpret_cast<PyUFuncObject *>(ufunc_obj.get());
+			PyUFuncObject *ufunc = reinterpret_cast<PyUFuncObject *>(ufunc_obj);
 			if (static_cast<int>(types.size()) != ufunc->nargs)
 			{
 				PyErr_Format(PyExc_AssertionError,
@@ -1004,32 +4521,46 @@ namespace qsbfloat16
 			return true;
 		}
 
+		template <typename UFunc>
+		bool RegisterUFunc(PyObject *numpy, const char *name)
+		{
+			Safe_PyObjectPtr ufunc_obj = make_safe(PyObject_GetAttrString(numpy, name));
+			return ufunc_obj && RegisterUFuncLoop<UFunc>(ufunc_obj.get(), name);
+		}
+
 		namespace ufuncs
 		{
 
+			// The float overloads of arithmetic and comparisons are for
+			// BinaryUFuncMixed, whose operands are widened to float.
 			struct Add
 			{
 				bfloat16 operator()(bfloat16 a, bfloat16 b) { return a + b; }
-			};
-			struct AddScalarFloat
-			{
-				bfloat16 operator()(bfloat16 a, float b) { return a + bfloat16(b); }
-			};
-			struct ScalarFloatAdd
-			{
-				bfloat16 operator()(float a, bfloat16 b) { return bfloat16(a) + b; }
+				bfloat16 operator()(float a, float b) { return bfloat16(a + b); }
 			};
 			struct Subtract
 			{
 				bfloat16 operator()(bfloat16 a, bfloat16 b) { return a - b; }
+				bfloat16 operator()(float a, float b) { return bfloat16(a - b); }
 			};
 			struct Multiply
 			{
 				bfloat16 operator()(bfloat16 a, bfloat16 b) { return a * b; }
+				bfloat16 operator()(float a, float b) { return bfloat16(a * b); }
 			};
 			struct TrueDivide
 			{
 				bfloat16 operator()(bfloat16 a, bfloat16 b) { return a / b; }
+				bfloat16 operator()(float a, float b) { return bfloat16(a / b); }
+			};
+			// fmaf rounded to bfloat16. The product may overflow or underflow float,
+			// so it must not be rounded on its own.
+			struct Fma
+			{
+				bfloat16 operator()(bfloat16 a, bfloat16 b, bfloat16 c)
+				{
+					return bfloat16(std::fma(static_cast<float>(a), static_cast<float>(b), static_cast<float>(c)));
+				}
 			};
 
 			std::pair<float, float> divmod(float a, float b)
@@ -1140,7 +4671,7 @@ namespace qsbfloat16
 			{
 				bfloat16 operator()(bfloat16 a)
 				{
-					return bfloat16(std::abs(static_cast<float>(a)));
+					return Bfloat16FromBits(Bfloat16Bits(a) & 0x7fff);
 				}
 			};
 			struct Cbrt
@@ -1161,8 +4692,7 @@ namespace qsbfloat16
 			{
 				bfloat16 operator()(bfloat16 a, bfloat16 b)
 				{
-					return bfloat16(
-						std::copysign(static_cast<float>(a), static_cast<float>(b)));
+					return Bfloat16FromBits((Bfloat16Bits(a) & 0x7fff) | (Bfloat16Bits(b) & 0x8000));
 				}
 			};
 			struct Exp
@@ -1197,9 +4727,8 @@ namespace qsbfloat16
 			{
 				std::pair<bfloat16, int> operator()(bfloat16 a)
 				{
-					int exp;
-					float f = std::frexp(static_cast<float>(a), &exp);
-					return {bfloat16(f), exp};
+					std::pair<uint16, int> r = FrexpBits(Bfloat16Bits(a));
+					return {Bfloat16FromBits(r.first), r.second};
 				}
 			};
 			struct Heaviside
@@ -1245,7 +4774,10 @@ namespace qsbfloat16
 			{
 				bfloat16 operator()(bfloat16 a, int exp)
 				{
-					return bfloat16(std::ldexp(static_cast<float>(a), exp));
+					int flags = 0;
+					uint16 r = LdexpBits(Bfloat16Bits(a), exp, &flags);
+					SetFloatStatus(flags);
+					return Bfloat16FromBits(r);
 				}
 			};
 			struct Log
@@ -1351,11 +4883,11 @@ namespace qsbfloat16
 				bfloat16 operator()(bfloat16 a)
 				{
 					float f(a);
-					if (f < 0)
+					if (std::isless(f, 0.0f))
 					{
 						return bfloat16(-1);
 					}
-					if (f > 0)
+					if (std::isgreater(f, 0.0f))
 					{
 						return bfloat16(1);
 					}
@@ -1364,7 +4896,7 @@ namespace qsbfloat16
 			};
 			struct SignBit
 			{
-				bool operator()(bfloat16 a) { return std::signbit(static_cast<float>(a)); }
+				npy_bool operator()(bfloat16 a) { return Bfloat16Bits(a) >> 15; }
 			};
 			struct Sqrt
 			{
@@ -1508,81 +5040,41 @@ namespace qsbfloat16
 			struct Eq
 			{
 				npy_bool operator()(bfloat16 a, bfloat16 b) { return a == b; }
-			};
-			struct EqFloat
-			{
-				npy_bool operator()(bfloat16 a, float b) { return a == bfloat16(b); }
-			};
-			struct EqDouble
-			{
-				npy_bool operator()(bfloat16 a, double b) { return a == bfloat16(b); }
+				npy_bool operator()(float a, float b) { return a == b; }
 			};
 			struct Ne
 			{
-				npy_bool operator()(bfloat16 a, bfloat16 b) { return a != b; }
-			};
-			struct NeFloat
-			{
-				npy_bool operator()(bfloat16 a, float b) { return a != bfloat16(b); }
-			};
-			struct NeDouble
-			{
-				npy_bool operator()(bfloat16 a, double b) { return a != bfloat16(b); }
-			};
-			struct Lt
-			{
-				npy_bool operator()(bfloat16 a, bfloat16 b) { return a < b; }
-			};
-			struct LtFloat
-			{
-				npy_bool operator()(bfloat16 a, float b) { return a < bfloat16(b); }
-			};
-			struct LtDouble
-			{
-				npy_bool operator()(bfloat16 a, double b) { return a < bfloat16(b); }
-			};
-			struct Gt
-			{
-				npy_bool operator()(bfloat16 a, bfloat16 b) { return a > b; }
-			};
-			struct GtFloat
-			{
-				npy_bool operator()(bfloat16 a, float b) { return a > bfloat16(b); }
-			};
-			struct GtDouble
-			{
-				npy_bool operator()(bfloat16 a, double b) { return a > bfloat16(b); }
-			};
-			struct Le
-			{
-				npy_bool operator()(bfloat16 a, bfloat16 b) { return a <= b; }
-			};
-			struct LeFloat
-			{
-				npy_bool operator()(bfloat16 a, float b) { return a <= bfloat16(b); }
+				npy_bool operator()(bfloat16 a, bfloat16 b) { return a != b; }
+				npy_bool operator()(float a, float b) { return a != b; }
 			};
-			struct LeDouble
+			// Ordered comparisons use the quiet predicates: like NumPy's, they do
+			// not report invalid for quiet NaN operands.
+			struct Lt
 			{
-				npy_bool operator()(bfloat16 a, double b) { return a <= bfloat16(b); }
+				npy_bool operator()(bfloat16 a, bfloat16 b) { return std::isless(static_cast<float>(a), static_cast<float>(b)); }
+				npy_bool operator()(float a, float b) { return std::isless(a, b); }
 			};
-			struct Ge
+			struct Gt
 			{
-				npy_bool operator()(bfloat16 a, bfloat16 b) { return a >= b; }
+				npy_bool operator()(bfloat16 a, bfloat16 b) { return std::isgreater(static_cast<float>(a), static_cast<float>(b)); }
+				npy_bool operator()(float a, float b) { return std::isgreater(a, b); }
 			};
-			struct GeFloat
+			struct Le
 			{
-				npy_bool operator()(bfloat16 a, float b) { return a >= bfloat16(b); }
+				npy_bool operator()(bfloat16 a, bfloat16 b) { return std::islessequal(static_cast<float>(a), static_cast<float>(b)); }
+				npy_bool operator()(float a, float b) { return std::islessequal(a, b); }
 			};
-			struct GeDouble
+			struct Ge
 			{
-				npy_bool operator()(bfloat16 a, double b) { return a >= bfloat16(b); }
+				npy_bool operator()(bfloat16 a, bfloat16 b) { return std::isgreaterequal(static_cast<float>(a), static_cast<float>(b)); }
+				npy_bool operator()(float a, float b) { return std::isgreaterequal(a, b); }
 			};
 			struct Maximum
 			{
 				bfloat16 operator()(bfloat16 a, bfloat16 b)
 				{
 					float fa(a), fb(b);
-					return Eigen::numext::isnan(fa) || fa > fb ? a : b;
+					return Eigen::numext::isnan(fa) || std::isgreater(fa, fb) ? a : b;
 				}
 			};
 			struct Minimum
@@ -1590,7 +5082,7 @@ namespace qsbfloat16
 				bfloat16 operator()(bfloat16 a, bfloat16 b)
 				{
 					float fa(a), fb(b);
-					return Eigen::numext::isnan(fa) || fa < fb ? a : b;
+					return Eigen::numext::isnan(fa) || std::isless(fa, fb) ? a : b;
 				}
 			};
 			struct Fmax
@@ -1598,7 +5090,7 @@ namespace qsbfloat16
 				bfloat16 operator()(bfloat16 a, bfloat16 b)
 				{
 					float fa(a), fb(b);
-					return Eigen::numext::isnan(fb) || fa > fb ? a : b;
+					return Eigen::numext::isnan(fb) || std::isgreater(fa, fb) ? a : b;
 				}
 			};
 			struct Fmin
@@ -1606,7 +5098,7 @@ namespace qsbfloat16
 				bfloat16 operator()(bfloat16 a, bfloat16 b)
 				{
 					float fa(a), fb(b);
-					return Eigen::numext::isnan(fb) || fa < fb ? a : b;
+					return Eigen::numext::isnan(fb) || std::isless(fa, fb) ? a : b;
 				}
 			};
 
@@ -1670,16 +5162,504 @@ namespace qsbfloat16
 					uint16_t magnitude_adjustment =
 						(from_abs > to_abs || from_sign != to_sign) ? 0xFFFF : 0x0001;
 					uint16_t out_int = from_as_int + magnitude_adjustment;
+					if ((out_int & ~sign_mask) == 0x7f80)
+					{
+						// Stepped past the largest finite value.
+						SetFloatStatus(FE_OVERFLOW);
+					}
 					bfloat16 out;
 					memcpy(&out, &out_int, sizeof(bfloat16));
 					return out;
 				}
 			};
 
-			// TODO(phawkins): implement spacing
+			// The gap between 'a' and the next bfloat16 away from zero, signed like
+			// 'a' (+0 for -0), as NumPy's spacing is for its float types.
+			struct Spacing
+			{
+				bfloat16 operator()(bfloat16 a)
+				{
+					uint16 x = Bfloat16Bits(a), ax = x & 0x7fff, e = ax >> 7;
+					uint16 sign = ax == 0 ? 0 : x & 0x8000;
+					if (ax > 0x7f80)
+					{
+						return Bfloat16FromBits(x | 0x0040);
+					}
+					if (ax == 0x7f80)
+					{
+						return Bfloat16FromBits(0x7fc0);
+					}
+					if (ax == 0x7f7f)
+					{
+						SetFloatStatus(FE_OVERFLOW);
+						return Bfloat16FromBits(sign | 0x7f80);
+					}
+					// 2^(e - 134), subnormal for e <= 7.
+					return Bfloat16FromBits(sign | (e > 7 ? (e - 7) << 7 : 1 << (e == 0 ? 0 : e - 1)));
+				}
+			};
 
 		} // namespace ufuncs
 
+#ifdef BFLOAT16_VECTOR_KERNELS
+#define BFLOAT16_UNARY_KERNEL(name)                                                               \
+	template <>                                                                                   \
+	struct UnaryKernel<ufuncs::name>                                                              \
+	{                                                                                             \
+		static constexpr void (*kLoop)(const uint16 *, uint16 *, npy_intp) = kernels::UnaryLoop<kernels::name>; \
+	}
+
+		BFLOAT16_UNARY_KERNEL(Exp);
+		BFLOAT16_UNARY_KERNEL(Exp2);
+		BFLOAT16_UNARY_KERNEL(Expm1);
+		BFLOAT16_UNARY_KERNEL(Log);
+		BFLOAT16_UNARY_KERNEL(Log2);
+		BFLOAT16_UNARY_KERNEL(Log10);
+		BFLOAT16_UNARY_KERNEL(Log1p);
+		BFLOAT16_UNARY_KERNEL(Tanh);
+		BFLOAT16_UNARY_KERNEL(Sin);
+		BFLOAT16_UNARY_KERNEL(Cos);
+
+#define BFLOAT16_BINARY_KERNEL(name)                                                              \
+	template <>                                                                                   \
+	struct StridedKernel<ufuncs::name>                                                            \
+	{                                                                                             \
+		static constexpr bool (*kLoop)(char **, npy_intp, const npy_intp *) =                     \
+			kernels::BinaryLoop<kernels::name, ufuncs::name>;                                     \
+	};                                                                                            \
+	template <>                                                                                   \
+	struct FloatKernel<ufuncs::name>                                                              \
+	{                                                                                             \
+		static constexpr npy_intp (*kLoop)(const float *, const float *, void *, npy_intp) =      \
+			kernels::FloatLoop<kernels::name, ufuncs::name>;                                      \
+	}
+
+		BFLOAT16_BINARY_KERNEL(Add);
+		BFLOAT16_BINARY_KERNEL(Subtract);
+		BFLOAT16_BINARY_KERNEL(Multiply);
+		BFLOAT16_BINARY_KERNEL(TrueDivide);
+		BFLOAT16_BINARY_KERNEL(Eq);
+		BFLOAT16_BINARY_KERNEL(Ne);
+		BFLOAT16_BINARY_KERNEL(Lt);
+		BFLOAT16_BINARY_KERNEL(Gt);
+		BFLOAT16_BINARY_KERNEL(Le);
+		BFLOAT16_BINARY_KERNEL(Ge);
+
+		template <>
+		struct StridedKernel<ufuncs::Fma>
+		{
+			static constexpr bool (*kLoop)(char **, npy_intp, const npy_intp *) =
+				kernels::TernaryLoop<kernels::Fma, ufuncs::Fma>;
+		};
+
+#define BFLOAT16_BIT_KERNEL(name, loop)                                                           \
+	template <>                                                                                   \
+	struct StridedKernel<ufuncs::name>                                                            \
+	{                                                                                             \
+		static constexpr bool (*kLoop)(char **, npy_intp, const npy_intp *) = loop;               \
+	}
+
+		BFLOAT16_BIT_KERNEL(Negative, (kernels::UnaryBitLoop<kernels::bits::Negative, ufuncs::Negative>));
+		BFLOAT16_BIT_KERNEL(Abs, (kernels::UnaryBitLoop<kernels::bits::Abs, ufuncs::Abs>));
+		BFLOAT16_BIT_KERNEL(SignBit, (kernels::UnaryBitLoop<kernels::bits::SignBit, ufuncs::SignBit>));
+		BFLOAT16_BIT_KERNEL(Spacing, (kernels::UnaryBitLoop<kernels::bits::Spacing, ufuncs::Spacing>));
+		BFLOAT16_BIT_KERNEL(CopySign, (kernels::BinaryBitLoop<kernels::bits::CopySign, ufuncs::CopySign>));
+		BFLOAT16_BIT_KERNEL(NextAfter, (kernels::BinaryBitLoop<kernels::bits::NextAfter, ufuncs::NextAfter>));
+		BFLOAT16_BIT_KERNEL(Frexp, kernels::FrexpLoop<ufuncs::Frexp>);
+		BFLOAT16_BIT_KERNEL(Ldexp, kernels::LdexpLoop<ufuncs::Ldexp>);
+#endif
+
+#define BFLOAT16_UNARY_TABLE(name, reference)                               \
+	template <>                                                             \
+	struct UnaryTable<ufuncs::name>                                         \
+	{                                                                       \
+		static constexpr double (*kReference)(double) = reference;          \
+	}
+
+		BFLOAT16_UNARY_TABLE(Exp, ::exp);
+		BFLOAT16_UNARY_TABLE(Exp2, ::exp2);
+		BFLOAT16_UNARY_TABLE(Expm1, ::expm1);
+		BFLOAT16_UNARY_TABLE(Log, ::log);
+		BFLOAT16_UNARY_TABLE(Log2, ::log2);
+		BFLOAT16_UNARY_TABLE(Log10, ::log10);
+		BFLOAT16_UNARY_TABLE(Log1p, ::log1p);
+		BFLOAT16_UNARY_TABLE(Cbrt, ::cbrt);
+		BFLOAT16_UNARY_TABLE(Sin, ::sin);
+		BFLOAT16_UNARY_TABLE(Cos, ::cos);
+		BFLOAT16_UNARY_TABLE(Tan, ::tan);
+		BFLOAT16_UNARY_TABLE(Arcsin, ::asin);
+		BFLOAT16_UNARY_TABLE(Arccos, ::acos);
+		BFLOAT16_UNARY_TABLE(Arctan, ::atan);
+		BFLOAT16_UNARY_TABLE(Sinh, ::sinh);
+		BFLOAT16_UNARY_TABLE(Cosh, ::cosh);
+		BFLOAT16_UNARY_TABLE(Tanh, ::tanh);
+		BFLOAT16_UNARY_TABLE(Arcsinh, ::asinh);
+		BFLOAT16_UNARY_TABLE(Arccosh, ::acosh);
+		BFLOAT16_UNARY_TABLE(Arctanh, ::atanh);
+
+		// NumPy has no fused multiply-add ufunc, so the module exports its own
+		// fma(a, b, c). Like the type it is created once per process.
+		PyObject *fma_ufunc = nullptr;
+
+		bool CreateFmaUFunc()
+		{
+			static PyUFuncGenericFunction double_loops[] = {TernaryUFuncFmaDouble::Call};
+			static void *double_data[] = {nullptr};
+			static char double_types[] = {NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE};
+			Safe_PyObjectPtr ufunc = make_safe(PyUFunc_FromFuncAndData(
+				double_loops, double_data, double_types, 1, 3, 1, PyUFunc_None, "fma",
+				"Fused multiply-add: a * b + c in one pass, without a temporary. The exact value is "
+				"rounded once to float32, as fmaf does, and then to bfloat16, so a product that "
+				"overflows or underflows float32 on its own still gives a finite sum. Python and "
+				"NumPy scalars are converted to bfloat16, as by the arithmetic operators, and so are "
+				"small integer and float16 arrays; a wider array among the operands makes the whole "
+				"computation float64.",
+				0));
+			if (!ufunc || !RegisterUFuncLoop<TernaryUFunc<bfloat16, bfloat16, ufuncs::Fma>>(ufunc.get(), "fma"))
+			{
+				return false;
+			}
+			fma_ufunc = ufunc.release();
+			return true;
+		}
+
+		// Registers Functor for bfloat16 combined with 'Other' on either side.
+		template <typename Other, typename OutType, typename Functor>
+		bool RegisterMixedUFunc(PyObject *numpy, const char *name)
+		{
+			return RegisterUFunc<BinaryUFuncMixed<Other, OutType, Functor>>(numpy, name) &&
+				   RegisterUFunc<BinaryUFuncMixed<Other, OutType, Functor, true>>(numpy, name);
+		}
+
+		// Arithmetic and comparison loops between bfloat16 and 'Other', a type
+		// that casts to bfloat16 safely (see RegisterMixedCast), so that mixed
+		// expressions stay bfloat16 instead of being promoted.
+		template <typename Other>
+		bool RegisterMixedUFuncs(PyObject *numpy)
+		{
+			return RegisterMixedUFunc<Other, bfloat16, ufuncs::Add>(numpy, "add") &&
+				   RegisterMixedUFunc<Other, bfloat16, ufuncs::Subtract>(numpy, "subtract") &&
+				   RegisterMixedUFunc<Other, bfloat16, ufuncs::Multiply>(numpy, "multiply") &&
+				   RegisterMixedUFunc<Other, bfloat16, ufuncs::TrueDivide>(numpy, "true_divide") &&
+				   RegisterMixedUFunc<Other, bool, ufuncs::Eq>(numpy, "equal") &&
+				   RegisterMixedUFunc<Other, bool, ufuncs::Ne>(numpy, "not_equal") &&
+				   RegisterMixedUFunc<Other, bool, ufuncs::Lt>(numpy, "less") &&
+				   RegisterMixedUFunc<Other, bool, ufuncs::Gt>(numpy, "greater") &&
+				   RegisterMixedUFunc<Other, bool, ufuncs::Le>(numpy, "less_equal") &&
+				   RegisterMixedUFunc<Other, bool, ufuncs::Ge>(numpy, "greater_equal");
+		}
+
+		// Scalar arithmetic. bfloat16 scalars combined with each other or with
+		// Python floats and ints are computed here. Python operands are ranked by
+		// the value-based rule NumPy applies to them next to a bfloat16 array, so
+		// that a scalar gives what a 0-d slice of the array would: ints of up to
+		// 16 bits and floats NumPy would store as float16 combine with bfloat16
+		// (see RegisterMixedUFuncs), computed in float and rounded once, other
+		// floats give float32 and other ints float64. Any other operand (arrays,
+		// other NumPy scalars) is handed to NumPy's generic scalar math, which is
+		// what these slots inherited before.
+		enum class ScalarRank
+		{
+			kBfloat16,
+			kFloat,
+			kDouble,
+		};
+
+		// Converts an operand of scalar arithmetic to the value it takes part
+		// with. Returns false, without setting an error, if the operand is not
+		// handled natively.
+		bool Bfloat16Operand(PyObject *arg, double *output, ScalarRank *rank)
+		{
+			if (PyBfloat16_Check(arg))
+			{
+				*output = static_cast<float>(PyBfloat16_Bfloat16(arg));
+				*rank = ScalarRank::kBfloat16;
+				return true;
+			}
+			if (PyFloat_CheckExact(arg))
+			{
+				double d = PyFloat_AS_DOUBLE(arg);
+				if ((d > -65000.0 && d < 65000.0) || !std::isfinite(d))
+				{
+					*output = npy_half_to_double(npy_double_to_half(d));
+					*rank = ScalarRank::kBfloat16;
+				}
+				else
+				{
+					*output = d;
+					*rank = d > -3.4e38 && d < 3.4e38 ? ScalarRank::kFloat : ScalarRank::kDouble;
+				}
+				return true;
+			}
+			if (PyLong_CheckExact(arg))
+			{
+				double d = PyLong_AsDouble(arg);
+				if ((d == -1.0 && PyErr_Occurred()) || d < -0x1p63 || d >= 0x1p64)
+				{
+					PyErr_Clear();
+					return false;
+				}
+				*output = d;
+				*rank = d >= -32768.0 && d <= 65535.0 ? ScalarRank::kBfloat16 : ScalarRank::kDouble;
+				return true;
+			}
+			return false;
+		}
+
+		// Raises or warns, as np.errstate says, for the floating-point exceptions
+		// flagged since the last npy_clear_floatstatus_barrier, the check NumPy
+		// runs after a ufunc loop. 'name' is the operation in the message, and
+		// 'result' is what was computed, which is stored before the flags are read.
+		template <typename T>
+		bool CheckFloatStatus(const char *name, T *result)
+		{
+			int status = npy_get_floatstatus_barrier(reinterpret_cast<char *>(result));
+			if (!status)
+			{
+				return true;
+			}
+			int bufsize, errmask, first = 1;
+			PyObject *errobj;
+			if (PyUFunc_GetPyValues(const_cast<char *>(name), &bufsize, &errmask, &errobj) < 0)
+			{
+				return false;
+			}
+			int failed = PyUFunc_handlefperr(errmask, errobj, status, &first);
+			Py_XDECREF(errobj);
+			return !failed;
+		}
+
+		// np.float32 and np.float64 scalars, for results wider than bfloat16.
+		PyObject *NumpyScalar(float value)
+		{
+			PyObject *scalar = PyArrayScalar_New(Float);
+			if (scalar)
+			{
+				PyArrayScalar_ASSIGN(scalar, Float, value);
+			}
+			return scalar;
+		}
+
+		PyObject *NumpyScalar(double value)
+		{
+			PyObject *scalar = PyArrayScalar_New(Double);
+			if (scalar)
+			{
+				PyArrayScalar_ASSIGN(scalar, Double, value);
+			}
+			return scalar;
+		}
+
+		template <typename Op, binaryfunc PyNumberMethods::*Slot>
+		PyObject *PyBfloat16_BinaryNumber(PyObject *a, PyObject *b, const char *name)
+		{
+			double x, y;
+			ScalarRank x_rank, y_rank;
+			// Cleared before the operands are even read, so the arithmetic cannot be
+			// moved ahead of it.
+			npy_clear_floatstatus_barrier(reinterpret_cast<char *>(&x));
+			if (!Bfloat16Operand(a, &x, &x_rank) || !Bfloat16Operand(b, &y, &y_rank))
+			{
+				return (PyGenericArrType_Type.tp_as_number->*Slot)(a, b);
+			}
+			switch (std::max(x_rank, y_rank))
+			{
+			case ScalarRank::kBfloat16:
+			{
+				bfloat16 r(Op()(static_cast<float>(x), static_cast<float>(y)));
+				return CheckFloatStatus(name, &r) ? PyBfloat16_FromBfloat16(r) : nullptr;
+			}
+			case ScalarRank::kFloat:
+			{
+				float r = Op()(static_cast<float>(x), static_cast<float>(y));
+				return CheckFloatStatus(name, &r) ? NumpyScalar(r) : nullptr;
+			}
+			default:
+			{
+				double r = Op()(x, y);
+				return CheckFloatStatus(name, &r) ? NumpyScalar(r) : nullptr;
+			}
+			}
+		}
+
+		template <typename Functor>
+		PyObject *PyBfloat16_UnaryNumber(PyObject *a)
+		{
+			return PyBfloat16_FromBfloat16(Functor()(PyBfloat16_Bfloat16(a)));
+		}
+
+		PyObject *PyBfloat16_Add(PyObject *a, PyObject *b)
+		{
+			return PyBfloat16_BinaryNumber<std::plus<>, &PyNumberMethods::nb_add>(a, b, "scalar add");
+		}
+
+		PyObject *PyBfloat16_Subtract(PyObject *a, PyObject *b)
+		{
+			return PyBfloat16_BinaryNumber<std::minus<>, &PyNumberMethods::nb_subtract>(a, b, "scalar subtract");
+		}
+
+		PyObject *PyBfloat16_Multiply(PyObject *a, PyObject *b)
+		{
+			return PyBfloat16_BinaryNumber<std::multiplies<>, &PyNumberMethods::nb_multiply>(a, b, "scalar multiply");
+		}
+
+		PyObject *PyBfloat16_TrueDivide(PyObject *a, PyObject *b)
+		{
+			return PyBfloat16_BinaryNumber<std::divides<>, &PyNumberMethods::nb_true_divide>(a, b, "scalar divide");
+		}
+
+		PyObject *PyBfloat16_Negative(PyObject *a)
+		{
+			return PyBfloat16_UnaryNumber<ufuncs::Negative>(a);
+		}
+
+		PyObject *PyBfloat16_Positive(PyObject *a)
+		{
+			return PyBfloat16_UnaryNumber<ufuncs::Positive>(a);
+		}
+
+		PyObject *PyBfloat16_Absolute(PyObject *a)
+		{
+			return PyBfloat16_UnaryNumber<ufuncs::Abs>(a);
+		}
+
+		// Comparisons on PyBfloat16s. Two bfloat16 values are compared with the same
+		// functors as the comparison ufunc loops. Anything else is compared exactly,
+		// the way float does: self is widened to double, which holds every bfloat16
+		// value, and the other operand is never rounded, so comparisons agree with
+		// the hash. Python ints go through float's own comparison, which is exact
+		// at any magnitude. Arrays and other NumPy scalars go through NumPy;
+		// anything else is not comparable.
+		bool Bfloat16CompareOperand(PyObject *arg, double *output)
+		{
+			if (PyFloat_Check(arg))
+			{
+				*output = PyFloat_AS_DOUBLE(arg);
+				return true;
+			}
+			if (PyArray_IsScalar(arg, Half))
+			{
+				Eigen::half h;
+				PyArray_ScalarAsCtype(arg, &h);
+				*output = static_cast<double>(h);
+				return true;
+			}
+			if (PyArray_IsScalar(arg, Float))
+			{
+				float f;
+				PyArray_ScalarAsCtype(arg, &f);
+				*output = f;
+				return true;
+			}
+			if (PyArray_IsScalar(arg, Double))
+			{
+				double f;
+				PyArray_ScalarAsCtype(arg, &f);
+				*output = f;
+				return true;
+			}
+			return false;
+		}
+
+		PyObject *PyBfloat16_RichCompare(PyObject *self, PyObject *other, int cmp_op)
+		{
+			bfloat16 x = PyBfloat16_Bfloat16(self);
+			if (PyBfloat16_Check(other))
+			{
+				bfloat16 y = PyBfloat16_Bfloat16(other);
+				bool result;
+				switch (cmp_op)
+				{
+				case Py_LT:
+					result = ufuncs::Lt()(x, y);
+					break;
+				case Py_LE:
+					result = ufuncs::Le()(x, y);
+					break;
+				case Py_EQ:
+					result = ufuncs::Eq()(x, y);
+					break;
+				case Py_NE:
+					result = ufuncs::Ne()(x, y);
+					break;
+				case Py_GT:
+					result = ufuncs::Gt()(x, y);
+					break;
+				case Py_GE:
+					result = ufuncs::Ge()(x, y);
+					break;
+				default:
+					Py_RETURN_NOTIMPLEMENTED;
+				}
+				return PyBool_FromLong(result);
+			}
+			double dx = static_cast<double>(x);
+			if (PyLong_Check(other))
+			{
+				Safe_PyObjectPtr f = make_safe(PyFloat_FromDouble(dx));
+				if (!f)
+				{
+					return nullptr;
+				}
+				return PyObject_RichCompare(f.get(), other, cmp_op);
+			}
+			double dy;
+			if (!Bfloat16CompareOperand(other, &dy))
+			{
+				if (PyArray_Check(other) || PyArray_IsScalar(other, Generic))
+				{
+					return PyBfloat16_ArrayRichCompare(self, other, cmp_op);
+				}
+				Py_RETURN_NOTIMPLEMENTED;
+			}
+			Py_RETURN_RICHCOMPARE(dx, dy, cmp_op);
+		}
+
+		// Heap-type instances own a reference to their type, which must be released
+		// here.
+		void PyBfloat16_Dealloc(PyObject *self)
+		{
+			PyTypeObject *type = Py_TYPE(self);
+			type->tp_free(self);
+			Py_DECREF(type);
+		}
+
+		// Python type for PyBfloat16 objects. This is a heap type, created once per
+		// process when bfloat16 is registered with NumPy.
+
+		PyType_Slot bfloat16_type_slots[] = {
+			{Py_tp_dealloc, reinterpret_cast<void *>(PyBfloat16_Dealloc)},
+			{Py_tp_repr, reinterpret_cast<void *>(PyBfloat16_Repr)},
+			{Py_tp_str, reinterpret_cast<void *>(PyBfloat16_Str)},
+			{Py_tp_hash, reinterpret_cast<void *>(PyBfloat16_Hash)},
+			{Py_tp_richcompare, reinterpret_cast<void *>(PyBfloat16_RichCompare)},
+			{Py_tp_methods, PyBfloat16_methods},
+			{Py_tp_new, reinterpret_cast<void *>(PyBfloat16_New)},
+			{Py_tp_doc, const_cast<char *>("bfloat16 floating-point values")},
+			{Py_nb_add, reinterpret_cast<void *>(PyBfloat16_Add)},
+			{Py_nb_subtract, reinterpret_cast<void *>(PyBfloat16_Subtract)},
+			{Py_nb_multiply, reinterpret_cast<void *>(PyBfloat16_Multiply)},
+			{Py_nb_true_divide, reinterpret_cast<void *>(PyBfloat16_TrueDivide)},
+			{Py_nb_negative, reinterpret_cast<void *>(PyBfloat16_Negative)},
+			{Py_nb_positive, reinterpret_cast<void *>(PyBfloat16_Positive)},
+			{Py_nb_absolute, reinterpret_cast<void *>(PyBfloat16_Absolute)},
+			{Py_nb_int, reinterpret_cast<void *>(PyBfloat16_Int)},
+			{Py_nb_float, reinterpret_cast<void *>(PyBfloat16_Float)},
+#ifdef IMPLEMENT_BUFFER
+			{Py_bf_getbuffer, reinterpret_cast<void *>(PyBfloat16_getbuffer)},
+#endif
+			{0, nullptr},
+		};
+
+		PyType_Spec bfloat16_type_spec = {
+			"bfloat16.bfloat16",							  // name
+			sizeof(PyBfloat16),							  // basicsize
+			0,											  // itemsize
+			Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,	  // flags
+			bfloat16_type_slots,						  // slots
+		};
+
+
 	} // namespace
 
 	// Initializes the module.
@@ -1722,14 +5702,25 @@ namespace qsbfloat16
 			}
 		}
 
-		bfloat16_type.tp_base = &PyGenericArrType_Type;
-
-		if (PyType_Ready(&bfloat16_type) < 0)
+		Safe_PyObjectPtr bases = make_safe(PyTuple_Pack(1, &PyGenericArrType_Type));
+		if (!bases)
+		{
+			return false;
+		}
+		PyObject *type = PyType_FromSpecWithBases(&bfloat16_type_spec, bases.get());
+		if (!type)
 		{
-			PyErr_Print();
-	        PyErr_SetString(PyExc_SystemError, "could not initialize bfloat16");
 			return false;
 		}
+		// The spec name gives the type its __module__, but NumPy, and the other
+		// module's casts, look the type up by tp_name, which must stay unqualified.
+		reinterpret_cast<PyTypeObject *>(type)->tp_name = "bfloat16";
+		// The NumPy descriptor keeps referring to the type for the lifetime of the
+		// process, so this reference is never released.
+		bfloat16_type_ptr = reinterpret_cast<PyTypeObject *>(type);
+#if PY_VERSION_HEX >= 0x03090000
+		bfloat16_type_ptr->tp_vectorcall = PyBfloat16_Vectorcall;
+#endif
 
 		// Initializes the NumPy descriptor.
 		PyArray_InitArrFuncs(&NPyBfloat16_ArrFuncs);
@@ -1739,29 +5730,31 @@ namespace qsbfloat16
 		NPyBfloat16_ArrFuncs.copyswap = NPyBfloat16_CopySwap;
 		NPyBfloat16_ArrFuncs.nonzero = NPyBfloat16_NonZero;
 		NPyBfloat16_ArrFuncs.fill = NPyBfloat16_Fill;
+		NPyBfloat16_ArrFuncs.fillwithscalar = NPyBfloat16_FillWithScalar;
 		NPyBfloat16_ArrFuncs.dotfunc = NPyBfloat16_DotFunc;
 		NPyBfloat16_ArrFuncs.compare = NPyBfloat16_CompareFunc;
 		NPyBfloat16_ArrFuncs.argmax = NPyBfloat16_ArgMaxFunc;
 		NPyBfloat16_ArrFuncs.argmin = NPyBfloat16_ArgMinFunc;
 
-		Py_TYPE(&NPyBfloat16_Descr) = &PyArrayDescr_Type;
-		npy_bfloat16 = PyArray_RegisterDataType(&NPyBfloat16_Descr);
-		bfloat16_type_ptr = &bfloat16_type;
-		if (npy_bfloat16 < 0)
+		NPyBfloat16_Descr.typeobj = bfloat16_type_ptr;
+		Py_SET_TYPE(&NPyBfloat16_Descr, &PyArrayDescr_Type);
+		int typenum_registered = PyArray_RegisterDataType(&NPyBfloat16_Descr);
+		if (typenum_registered < 0)
 		{
 			return false;
 		}
 
 		// Support dtype(bfloat16)
-		if (PyDict_SetItemString(bfloat16_type.tp_dict, "dtype",
-								 reinterpret_cast<PyObject *>(&NPyBfloat16_Descr)) <
+		if (PyObject_SetAttrString(type, "dtype",
+								   reinterpret_cast<PyObject *>(&NPyBfloat16_Descr)) <
 			0)
 		{
 			return false;
 		}
+		npy_bfloat16 = typenum_registered;
 
 		// Register casts
-		if (!RegisterBfloat16Cast<Eigen::half>(NPY_HALF, /*cast_is_safe=*/false))
+		if (!RegisterHalfCasts())
 		{
 			return false;
 		}
@@ -1836,11 +5829,17 @@ namespace qsbfloat16
 		{
 			return false;
 		}
+		if (!RegisterMixedCasts())
+		{
+			return false;
+		}
+		if (!RegisterPosit8_2Casts())
+		{
+			return false;
+		}
 
 		bool ok =
 			RegisterUFunc<BinaryUFunc<bfloat16, bfloat16, ufuncs::Add>>(numpy.get(), "add") &&
-			RegisterUFunc<BinaryUFunc2<float, bfloat16, bfloat16, ufuncs::ScalarFloatAdd>>(numpy.get(), "add") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, float, bfloat16, ufuncs::AddScalarFloat>>(numpy.get(), "add") &&
 			RegisterUFunc<BinaryUFunc<bfloat16, bfloat16, ufuncs::Subtract>>(numpy.get(), "subtract") &&
 			RegisterUFunc<BinaryUFunc<bfloat16, bfloat16, ufuncs::Multiply>>(
 				numpy.get(), "multiply") &&
@@ -1938,40 +5937,16 @@ namespace qsbfloat16
 			// 													   "equal") &&
 			RegisterUFunc<BinaryUFunc<bfloat16, bool, ufuncs::Eq>>(numpy.get(),
 																   "equal") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, float, bool, ufuncs::EqFloat>>(numpy.get(),
-																   "equal") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, double, bool, ufuncs::EqDouble>>(numpy.get(),
-																   "equal") &&
 			RegisterUFunc<BinaryUFunc<bfloat16, bool, ufuncs::Ne>>(numpy.get(),
 																   "not_equal") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, float, bool, ufuncs::NeFloat>>(numpy.get(),
-																   "not_equal") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, double, bool, ufuncs::NeDouble>>(numpy.get(),
-																   "not_equal") &&
 			RegisterUFunc<BinaryUFunc<bfloat16, bool, ufuncs::Lt>>(numpy.get(),
 																   "less") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, float, bool, ufuncs::LtFloat>>(numpy.get(),
-																   "less") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, double, bool, ufuncs::LtDouble>>(numpy.get(),
-																   "less") &&
 			RegisterUFunc<BinaryUFunc<bfloat16, bool, ufuncs::Gt>>(numpy.get(),
 																   "greater") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, float, bool, ufuncs::GtFloat>>(numpy.get(),
-																   "greater") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, double, bool, ufuncs::GtDouble>>(numpy.get(),
-																   "greater") &&
 			RegisterUFunc<BinaryUFunc<bfloat16, bool, ufuncs::Le>>(numpy.get(),
 																   "less_equal") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, float, bool, ufuncs::LeFloat>>(numpy.get(),
-																   "less_equal") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, double, bool, ufuncs::LeDouble>>(numpy.get(),
-																   "less_equal") &&
 			RegisterUFunc<BinaryUFunc<bfloat16, bool, ufuncs::Ge>>(numpy.get(),
 																   "greater_equal") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, float, bool, ufuncs::GeFloat>>(numpy.get(),
-																   "greater_equal") &&
-			RegisterUFunc<BinaryUFunc2<bfloat16, double, bool, ufuncs::GeDouble>>(numpy.get(),
-																   "greater_equal") &&
 			RegisterUFunc<BinaryUFunc<bfloat16, bfloat16, ufuncs::Maximum>>(
 				numpy.get(), "maximum") &&
 			RegisterUFunc<BinaryUFunc<bfloat16, bfloat16, ufuncs::Minimum>>(
@@ -2013,28 +5988,55 @@ namespace qsbfloat16
 			RegisterUFunc<UnaryUFunc<bfloat16, bfloat16, ufuncs::Trunc>>(numpy.get(),
 																		 "trunc") &&
 			RegisterUFunc<BinaryUFunc<bfloat16, bfloat16, ufuncs::NextAfter>>(
-				numpy.get(), "nextafter");
+				numpy.get(), "nextafter") &&
+			RegisterUFunc<UnaryUFunc<bfloat16, bfloat16, ufuncs::Spacing>>(numpy.get(),
+																		   "spacing") &&
+			// Mixed loops go last. Wider operands need none: bfloat16 casts to
+			// float and double safely, so NumPy runs its own loops on the widened
+			// values.
+			RegisterMixedUFuncs<bool>(numpy.get()) &&
+			RegisterMixedUFuncs<int8>(numpy.get()) &&
+			RegisterMixedUFuncs<uint8>(numpy.get()) &&
+			RegisterMixedUFuncs<int16>(numpy.get()) &&
+			RegisterMixedUFuncs<uint16>(numpy.get()) &&
+			RegisterMixedUFuncs<Eigen::half>(numpy.get()) &&
+			CreateFmaUFunc();
 
 		return ok;
 	}
 
-	bool RegisterNumpyBfloat16()
+#if PY_VERSION_HEX >= 0x030D0000
+	// Module exec may run concurrently on free-threaded builds. NumPy's dtype
+	// registry is process-wide, so registration is serialized here and happens
+	// only once per process.
+	PyMutex registration_mutex = {0};
+#endif
+
+	// Returns the registered bfloat16 type, registering it first if this is the
+	// first module object in the process, or nullptr with an error set.
+	PyTypeObject *RegisterNumpyBfloat16()
 	{
-		if (npy_bfloat16 != NPY_NOTYPE)
+		if (bfloat16_registered.load(std::memory_order_acquire))
 		{
-			// Already initialized.
-			return true;
+			return bfloat16_type_ptr;
 		}
-		if (!Initialize())
+#if PY_VERSION_HEX >= 0x030D0000
+		PyMutex_Lock(&registration_mutex);
+#endif
+		PyTypeObject *type = nullptr;
+		if (bfloat16_registered.load(std::memory_order_relaxed) || Initialize())
 		{
-			if (!PyErr_Occurred())
-			{
-				PyErr_SetString(PyExc_RuntimeError, "cannot load bfloat16 module.");
-			}
-			PyErr_Print();
-			return false;
+			bfloat16_registered.store(true, std::memory_order_release);
+			type = bfloat16_type_ptr;
+		}
+		else if (!PyErr_Occurred())
+		{
+			PyErr_SetString(PyExc_RuntimeError, "cannot load bfloat16 module.");
 		}
-		return true;
+#if PY_VERSION_HEX >= 0x030D0000
+		PyMutex_Unlock(&registration_mutex);
+#endif
+		return type;
 	}
 
 	PyObject *Bfloat16Dtype()
@@ -2044,39 +6046,122 @@ namespace qsbfloat16
 
 	int Bfloat16NumpyType() { return npy_bfloat16; }
 
+	int Bfloat16ModuleExec(PyObject *m)
+	{
+		PyTypeObject *type = RegisterNumpyBfloat16();
+		if (!type)
+		{
+			return -1;
+		}
+		Bfloat16State *state = static_cast<Bfloat16State *>(PyModule_GetState(m));
+		state->user_ufunc_cache = PyDict_New();
+		if (!state->user_ufunc_cache)
+		{
+			return -1;
+		}
+		// The type is shared by the whole process; NumPy's loops and casts have no
+		// module to look it up in, so it stays a global and each module object
+		// just holds a reference to it.
+		Py_INCREF(type);
+		if (PyModule_AddObject(m, "bfloat16", reinterpret_cast<PyObject *>(type)) < 0)
+		{
+			Py_DECREF(type);
+			return -1;
+		}
+		// Not created when another module registered the bfloat16 type first.
+		if (fma_ufunc)
+		{
+			Py_INCREF(fma_ufunc);
+			if (PyModule_AddObject(m, "fma", fma_ufunc) < 0)
+			{
+				Py_DECREF(fma_ufunc);
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	int Bfloat16ModuleTraverse(PyObject *m, visitproc visit, void *arg)
+	{
+		Bfloat16State *state = static_cast<Bfloat16State *>(PyModule_GetState(m));
+		if (state)
+		{
+			Py_VISIT(state->user_ufunc_cache);
+		}
+		return 0;
+	}
+
+	int Bfloat16ModuleClear(PyObject *m)
+	{
+		Bfloat16State *state = static_cast<Bfloat16State *>(PyModule_GetState(m));
+		if (state)
+		{
+			Py_CLEAR(state->user_ufunc_cache);
+		}
+		return 0;
+	}
+
+	void Bfloat16ModuleFree(void *m)
+	{
+		Bfloat16ModuleClear(static_cast<PyObject *>(m));
+	}
+
 	static PyMethodDef Bfloat16ModuleMethods[] = {
+		{
+			"make_unary_ufunc",
+			(PyCFunction)(void (*)(void)) PyBfloat16_MakeUnaryUFunc,
+			METH_VARARGS | METH_KEYWORDS,
+			"make_unary_ufunc(fn, exact=True, name=None) -> ufunc over bfloat16 computing fn(x)\n"
+			"by lookup in a table of all 65536 inputs. fn is called once: with exact true, on\n"
+			"float64 values, whose results are rounded once to bfloat16; otherwise on bfloat16\n"
+			"values, giving exactly what calling fn would. Ufuncs are cached per (fn, exact, name)"
+		},
+		{
+			"evaluate",
+			(PyCFunction)(void (*)(void)) PyBfloat16_Evaluate,
+			METH_VARARGS | METH_KEYWORDS,
+			"evaluate(ex, local_dict) -> bfloat16 array of the expression ex over the arrays\n"
+			"and numbers named in local_dict, broadcast together, in one pass without\n"
+			"temporaries. Intermediates are float32 and only the result is rounded. ex may\n"
+			"use + - * / **, numbers, parentheses, abs, sqrt, exp, exp2, expm1, log, log2,\n"
+			"log10, log1p, tanh, sin, cos, maximum, minimum and power"
+		},
 		{NULL, NULL, 0, NULL}
 	};
 
+	static PyModuleDef_Slot Bfloat16ModuleSlots[] = {
+		{Py_mod_exec, reinterpret_cast<void *>(Bfloat16ModuleExec)},
+#if PY_VERSION_HEX >= 0x030C0000
+		// The NumPy registration (type number, descriptor and scalar type) is
+		// process-wide and NumPy itself cannot be loaded into isolated
+		// sub-interpreters, so we cannot give each interpreter its own copy.
+		{Py_mod_multiple_interpreters, Py_MOD_MULTIPLE_INTERPRETERS_NOT_SUPPORTED},
+#endif
+#if PY_VERSION_HEX >= 0x030D0000
+		// All mutable state is either per-module, written once under
+		// registration_mutex and published through bfloat16_registered, or atomic
+		// (the table mode switch); the NumPy loops only add lazily built tables,
+		// through thread-safe static initialization.
+		{Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+		{0, NULL}
+	};
+
 	static struct PyModuleDef Bfloat16Module = {
 		PyModuleDef_HEAD_INIT,
 		"numpy_bfloat16",
 		NULL,
-		-1,
+		sizeof(Bfloat16State),
 		Bfloat16ModuleMethods,
-		NULL,
-		NULL,
-		NULL,
-		NULL
+		Bfloat16ModuleSlots,
+		Bfloat16ModuleTraverse,
+		Bfloat16ModuleClear,
+		Bfloat16ModuleFree
 	};
 
 	PyMODINIT_FUNC
 	PyInit_bfloat16(void)
 	{
-		PyObject *m;
-		m = PyModule_Create(&Bfloat16Module);
-		if (m == NULL)
-			return NULL;
-		RegisterNumpyBfloat16();
-		Py_INCREF(&bfloat16_type);
-		Py_XINCREF(&NPyBfloat16_Descr);
-		if (PyModule_AddObject(m, "bfloat16", (PyObject *)&bfloat16_type) < 0)
-		{
-			Py_DECREF(&bfloat16_type);
-			Py_DECREF(m);
-			return NULL;
-		}
-
-		return m;
+		return PyModuleDef_Init(&Bfloat16Module);
 	}
 } // namespace greenwaves
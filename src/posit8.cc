@@ -25,7 +25,13 @@ limitations under the License.
 // #define DEBUG_CALLS
 
 #include <Python.h>
+#include <algorithm>
+#include <atomic>
 #include <cinttypes>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
 #include <vector>
 #ifdef DEBUG_CALLS
 #include <iostream>
@@ -39,7 +45,30 @@ limitations under the License.
 #include <fenv.h>
 #include "numpy/arrayobject.h"
 #include "numpy/ufuncobject.h"
+#include "numpy/npy_math.h"
+#include "numpy/arrayscalars.h"
+#include "numpy/halffloat.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 9)
+#define POSIT8_VECTOR_KERNELS
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// AVX2 table gathers are compiled for it function by function and chosen at
+// run time, so the module itself does not require it.
+#define POSIT8_X86_DISPATCH
+#include <immintrin.h>
+#endif
 #include <typeinfo>
+#include <utility>
+
+#if PY_VERSION_HEX < 0x030900A4 && !defined(Py_SET_TYPE)
+#define Py_SET_TYPE(obj, type) ((Py_TYPE(obj) = (type)), (void)0)
+#endif
+#if PY_VERSION_HEX < 0x030900A4 && !defined(Py_IS_TYPE)
+#define Py_IS_TYPE(obj, type) (Py_TYPE(obj) == (type))
+#endif
 
 namespace xposit8
 {
@@ -60,28 +89,6 @@ namespace xposit8
 			posit8_2 value;
 		};
 
-		void unmarshallPositRaw(PyObject *data, posit8_t &out) {
-			posit8_2 num = reinterpret_cast<PyPosit8_2 *>(data)->value;
-			int nrBytes = 0;
-			int maxBitsInByte = 8;
-
-			sw::universal::bitblock<8UL> raw = num.get();
-			nrBytes = 1;
-
-			uint32_t bit_cntr = 0;
-			for (int c = 0; c < nrBytes; ++c) {
-				unsigned char byte = 0;
-				unsigned char mask = (unsigned char) (1);
-				for (int b = 0; b < maxBitsInByte; ++b) {
-					if (raw[bit_cntr++]) {
-						byte |= mask;
-					}
-					mask <<= 1;
-				}
-				out.x[c] = byte;
-			}
-		}
-		
 		// marshal takes a posit8_t and marshals it into a raw bitblock
 		template<size_t nbits, size_t es, typename posit8_t>
 		void marshal(posit8_t a, sw::universal::bitblock<8UL>& raw) {
@@ -196,6 +203,25 @@ namespace xposit8
 			return encode(pa);
 		}
 
+		// posit8_2 is stored as its raw 8-bit encoding, so the encoding can be read
+		// and written with a byte copy. Lookup tables are indexed by it.
+		static_assert(sizeof(posit8_2) == sizeof(uint8),
+					  "posit8_2 is expected to be stored as its 8-bit encoding");
+
+		uint8 Posit8_2Bits(posit8_2 x)
+		{
+			uint8 bits;
+			memcpy(&bits, static_cast<void *>(&x), sizeof(bits));
+			return bits;
+		}
+
+		posit8_2 Posit8_2FromBits(uint8 bits)
+		{
+			posit8_2 x;
+			memcpy(static_cast<void *>(&x), &bits, sizeof(bits));
+			return x;
+		}
+
 		struct PyDecrefDeleter
 		{
 			void operator()(PyObject *p) const { Py_DECREF(p); }
@@ -220,23 +246,31 @@ namespace xposit8
 			return (overflow == 0);
 		}
 
-		// Registered numpy type ID. Global variable populated by the registration code.
-		// Protected by the GIL.
+		// Registered numpy type ID. NumPy's type registry is process-wide, so this is
+		// written exactly once, under registration_mutex, before any module object
+		// is handed out; afterwards it is read-only.
 		int npy_posit8_2 = NPY_NOTYPE;
 
+		// Set, with release ordering, once registration has succeeded. Module exec
+		// reads it before taking registration_mutex, so that on free-threaded builds
+		// npy_posit8_2, posit8_2_type_ptr and fma_ufunc are only read after they are
+		// fully written.
+		std::atomic<bool> posit8_2_registered{false};
+
 		// Forward declaration.
-		extern PyTypeObject posit8_2_type;
 		extern PyArray_Descr NPyPosit8_2_Descr;
 
-		// Pointer to the posit8_2 type object we are using. This is either a pointer
-		// to Posit8_2_type, if we choose to register it, or to the posit8_2 type
-		// registered by another system into NumPy.
+		// Pointer to the posit8_2 type object we are using. This is either the heap
+		// type created from posit8_2_type_spec, if we choose to register it, or the
+		// posit8_2 type registered by another system into NumPy. Like npy_posit8_2
+		// it is set once per process; each module object holds a reference to it
+		// as its 'posit8_2' attribute.
 		PyTypeObject *posit8_2_type_ptr = nullptr;
 
 		// Returns true if 'object' is a PyPosit8_2.
 		bool PyPosit8_2_Check(PyObject *object)
 		{
-			return PyObject_IsInstance(object, reinterpret_cast<PyObject *>(&posit8_2_type));
+			return PyObject_TypeCheck(object, posit8_2_type_ptr);
 		}
 
 		// Extracts the value of a PyPosit8_2 object.
@@ -245,16 +279,66 @@ namespace xposit8
 			return reinterpret_cast<PyPosit8_2 *>(object)->value;
 		}
 
-		// Constructs a PyPosit8_2 object from a posit8_2.
+		// There are only 256 posit8_2 values, so one scalar object per encoding is
+		// allocated when the type is registered and shared from then on. Like the
+		// type itself these live for the lifetime of the process.
+		PyObject *posit8_2_scalars[256] = {};
+
+		// The Python float for each encoding, shared the same way.
+		PyObject *posit8_2_floats[256] = {};
+
+		// Returns a new reference to the Python float for the encoding 'bits'.
+		PyObject *Posit8_2ToPyFloat(uint8 bits)
+		{
+			PyObject *f = posit8_2_floats[bits];
+			if (!f)
+			{
+				return PyFloat_FromDouble(static_cast<double>(Posit8_2FromBits(bits)));
+			}
+			Py_INCREF(f);
+			return f;
+		}
+
+		// Constructs a PyPosit8_2 object from a posit8_2. Returns a new reference to
+		// the interned scalar for x.
 		PyObject *PyPosit8_2_FromPosit8_2(posit8_2 x)
 		{
-			return PyArray_Scalar(&x, &NPyPosit8_2_Descr, NULL);
+			PyObject *scalar = posit8_2_scalars[Posit8_2Bits(x)];
+			if (!scalar)
+			{
+				// posit8_2 was registered by another module.
+				return PyArray_Scalar(&x, &NPyPosit8_2_Descr, NULL);
+			}
+			Py_INCREF(scalar);
+			return scalar;
 		}
 
 		// Converts a Python object to a posit8_2 value. Returns true on success,
 		// returns false and reports a Python error on failure.
 		bool CastToPosit8_2(PyObject *arg, posit8_2 *output)
 		{
+			// Exact-type fast paths for the common arguments: our own scalars,
+			// Python floats and Python ints that fit in a long.
+			if (Py_IS_TYPE(arg, posit8_2_type_ptr))
+			{
+				*output = PyPosit8_2_Posit8_2(arg);
+				return true;
+			}
+			if (PyFloat_CheckExact(arg))
+			{
+				*output = posit8_2(PyFloat_AS_DOUBLE(arg));
+				return true;
+			}
+			if (PyLong_CheckExact(arg))
+			{
+				int overflow = 0;
+				long l = PyLong_AsLongAndOverflow(arg, &overflow); // NOLINT
+				if (!overflow)
+				{
+					*output = posit8_2(static_cast<float>(l));
+					return true;
+				}
+			}
 			if (PyPosit8_2_Check(arg))
 			{
 				*output = PyPosit8_2_Posit8_2(arg);
@@ -323,23 +407,9 @@ namespace xposit8
 			return false;
 		}
 
-		// Constructs a new PyPosit8_2.
-		PyObject *PyPosit8_2_New(PyTypeObject *type, PyObject *args, PyObject *kwds)
+		// Converts the single argument of the posit8_2 constructor.
+		PyObject *PyPosit8_2_FromArg(PyObject *arg)
 		{
-			if (kwds && PyDict_Size(kwds))
-			{
-				PyErr_SetString(PyExc_TypeError, "constructor takes no keyword arguments");
-				return nullptr;
-			}
-			Py_ssize_t size = PyTuple_Size(args);
-			if (size != 1)
-			{
-				PyErr_SetString(PyExc_TypeError,
-								"expected number as argument to posit8_2 constructor");
-				return nullptr;
-			}
-			PyObject *arg = PyTuple_GetItem(args, 0);
-
 			posit8_2 value;
 			if (PyPosit8_2_Check(arg))
 			{
@@ -368,8 +438,49 @@ namespace xposit8
 			return nullptr;
 		}
 
-		// Comparisons on PyPosit8_2s.
-		PyObject *PyPosit8_2_RichCompare(PyObject *self, PyObject *other, int cmp_op)
+		// Constructs a new PyPosit8_2.
+		PyObject *PyPosit8_2_New(PyTypeObject *type, PyObject *args, PyObject *kwds)
+		{
+			if (kwds && PyDict_Size(kwds))
+			{
+				PyErr_SetString(PyExc_TypeError, "constructor takes no keyword arguments");
+				return nullptr;
+			}
+			Py_ssize_t size = PyTuple_Size(args);
+			if (size != 1)
+			{
+				PyErr_SetString(PyExc_TypeError,
+								"expected number as argument to posit8_2 constructor");
+				return nullptr;
+			}
+			return PyPosit8_2_FromArg(PyTuple_GetItem(args, 0));
+		}
+
+#if PY_VERSION_HEX >= 0x03090000
+		// Vectorcall entry point for posit8_2(x). Calls of the exact type skip the
+		// argument tuple and keyword dict that tp_new needs; subclasses still go
+		// through tp_new.
+		PyObject *PyPosit8_2_Vectorcall(PyObject *type, PyObject *const *args,
+										size_t nargsf, PyObject *kwnames)
+		{
+			if (kwnames && PyTuple_GET_SIZE(kwnames))
+			{
+				PyErr_SetString(PyExc_TypeError, "constructor takes no keyword arguments");
+				return nullptr;
+			}
+			if (PyVectorcall_NARGS(nargsf) != 1)
+			{
+				PyErr_SetString(PyExc_TypeError,
+								"expected number as argument to posit8_2 constructor");
+				return nullptr;
+			}
+			return PyPosit8_2_FromArg(args[0]);
+		}
+#endif
+
+		// Comparisons of PyPosit8_2s with arrays and other objects NumPy knows how to
+		// convert, by way of 0-d arrays and the comparison ufuncs.
+		PyObject *PyPosit8_2_ArrayRichCompare(PyObject *self, PyObject *other, int cmp_op)
 		{
 			PyObject *arr, *ret;
 
@@ -407,14 +518,24 @@ namespace xposit8
 			return PyUnicode_FromString(v.c_str());
 		}
 
-		// Hash function for PyPosit8_2. We use the identity function, which is a weak
-		// hash function.
+		// Hash of a double, as computed for Python floats.
+		Py_hash_t HashDouble(PyObject *self, double d)
+		{
+#if PY_VERSION_HEX >= 0x030D0000
+			return Py_HashDouble(self, d);
+#elif PY_VERSION_HEX >= 0x030A0000
+			return _Py_HashDouble(self, d);
+#else
+			return _Py_HashDouble(d);
+#endif
+		}
+
+		// Hash function for PyPosit8_2. Scalars compare equal to Python floats of
+		// the same value, so they hash like them too.
 		Py_hash_t PyPosit8_2_Hash(PyObject *self)
 		{
-			posit8_t out;
-			unmarshallPositRaw(self, out);
-			//unmarshal<8UL, 2UL>(raw, out);
-			return out.v;
+			posit8_2 x = reinterpret_cast<PyPosit8_2 *>(self)->value;
+			return HashDouble(self, static_cast<double>(x));
 		}
 
 		// Converts a PyPosit8_2 into a PyFloat.
@@ -430,45 +551,6 @@ namespace xposit8
 			return PyLong_FromLong(y);
 		}
 
-		PyNumberMethods PyPosit8_2_AsNumber = {
-			nullptr,     	  	// nb_add
-			nullptr,  			// nb_subtract
-			nullptr,  			// nb_multiply
-			nullptr,              // nb_remainder
-			nullptr,              // nb_divmod
-			nullptr,              // nb_power
-			nullptr,  			  // nb_negative
-			nullptr,              // nb_positive
-			nullptr,              // nb_absolute
-			nullptr,              // nb_nonzero
-			nullptr,              // nb_invert
-			nullptr,              // nb_lshift
-			nullptr,              // nb_rshift
-			nullptr,              // nb_and
-			nullptr,              // nb_xor
-			nullptr,              // nb_or
-			PyPosit8_2_Int,       // nb_int
-			nullptr,              // reserved
-			PyPosit8_2_Float,     // nb_float
-
-			nullptr,  // nb_inplace_add
-			nullptr,  // nb_inplace_subtract
-			nullptr,  // nb_inplace_multiply
-			nullptr,  // nb_inplace_remainder
-			nullptr,  // nb_inplace_power
-			nullptr,  // nb_inplace_lshift
-			nullptr,  // nb_inplace_rshift
-			nullptr,  // nb_inplace_and
-			nullptr,  // nb_inplace_xor
-			nullptr,  // nb_inplace_or
-
-			nullptr,                // nb_floor_divide
-			nullptr,  				// nb_true_divide
-			nullptr,                // nb_inplace_floor_divide
-			nullptr,                // nb_inplace_true_divide
-			nullptr,                // nb_index
-		};
-
 		// format posit8_2. Convert to a float and call format on that
 		PyObject *PyPosit8_2_Format(PyObject *self, PyObject *format)
 		{
@@ -481,6 +563,271 @@ namespace xposit8
 			return f_str;
 		}
 
+		// Copies a list or tuple made up only of Python floats and ints into
+		// 'buffer'. Ints are rounded through float exactly as CastToPosit8_2 does.
+		// Returns false, without setting an error, as soon as any other item (or an
+		// int that does not fit in a long) is found.
+		bool SequenceToDoubles(PyObject *seq, std::vector<double> *buffer)
+		{
+			Py_ssize_t size = PySequence_Fast_GET_SIZE(seq);
+			PyObject **items = PySequence_Fast_ITEMS(seq);
+			buffer->resize(size);
+			double *out = buffer->data();
+			for (Py_ssize_t i = 0; i < size; ++i)
+			{
+				PyObject *item = items[i];
+				if (PyFloat_CheckExact(item))
+				{
+					out[i] = PyFloat_AS_DOUBLE(item);
+				}
+				else if (PyLong_CheckExact(item))
+				{
+					int overflow = 0;
+					long l = PyLong_AsLongAndOverflow(item, &overflow); // NOLINT
+					if (overflow)
+					{
+						return false;
+					}
+					out[i] = static_cast<float>(l);
+				}
+				else
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// posit8_2.from_list(seq): builds a posit8_2 array from a list or tuple of
+		// Python numbers. Flat float/int sequences are gathered into a double buffer
+		// in one pass and converted in bulk through the bfloat16 table; anything
+		// else, nested sequences included, goes through np.array(seq,
+		// dtype=posit8_2) and may give an n-d array.
+		void DoublesToPosit8_2(const double *from, uint8 *to, npy_intp n);
+
+		PyObject *PyPosit8_2_FromList(PyObject *cls, PyObject *seq)
+		{
+			if (PyList_CheckExact(seq) || PyTuple_CheckExact(seq))
+			{
+				std::vector<double> buffer;
+				bool homogeneous;
+#if PY_VERSION_HEX >= 0x030D0000
+				Py_BEGIN_CRITICAL_SECTION(seq);
+				homogeneous = SequenceToDoubles(seq, &buffer);
+				Py_END_CRITICAL_SECTION();
+#else
+				homogeneous = SequenceToDoubles(seq, &buffer);
+#endif
+				if (homogeneous)
+				{
+					npy_intp size = static_cast<npy_intp>(buffer.size());
+					Py_INCREF(&NPyPosit8_2_Descr);
+					PyObject *arr = PyArray_NewFromDescr(&PyArray_Type, &NPyPosit8_2_Descr, 1,
+														 &size, nullptr, nullptr, 0, nullptr);
+					if (!arr)
+					{
+						return nullptr;
+					}
+					DoublesToPosit8_2(buffer.data(),
+									  reinterpret_cast<uint8 *>(PyArray_DATA(reinterpret_cast<PyArrayObject *>(arr))),
+									  size);
+					return arr;
+				}
+			}
+			Py_INCREF(&NPyPosit8_2_Descr);
+			return PyArray_FromAny(seq, &NPyPosit8_2_Descr, 0, 0, 0, nullptr);
+		}
+
+		// Builds the nested lists for dimension 'dim' of 'arr' starting at 'data'.
+		// 'decode' returns a new reference for the element at a given address.
+		template <typename Decode>
+		PyObject *ArrayToList(PyArrayObject *arr, const char *data, int dim, Decode decode)
+		{
+			npy_intp size = PyArray_DIM(arr, dim);
+			npy_intp stride = PyArray_STRIDE(arr, dim);
+			bool innermost = dim + 1 == PyArray_NDIM(arr);
+			PyObject *list = PyList_New(size);
+			if (!list)
+			{
+				return nullptr;
+			}
+			for (npy_intp i = 0; i < size; ++i, data += stride)
+			{
+				PyObject *item = innermost ? decode(data) : ArrayToList(arr, data, dim + 1, decode);
+				if (!item)
+				{
+					Py_DECREF(list);
+					return nullptr;
+				}
+				PyList_SET_ITEM(list, i, item);
+			}
+			return list;
+		}
+
+		template <typename Decode>
+		PyObject *ArrayToList(PyArrayObject *arr, Decode decode)
+		{
+			if (PyArray_NDIM(arr) == 0)
+			{
+				return decode(PyArray_BYTES(arr));
+			}
+			return ArrayToList(arr, PyArray_BYTES(arr), 0, decode);
+		}
+
+		// posit8_2.to_list(arr, scalars=False): the bulk counterpart of arr.tolist().
+		// Elements are decoded straight from the array memory into pre-sized lists,
+		// without going through getitem for each one.
+		PyObject *PyPosit8_2_ToList(PyObject *cls, PyObject *args, PyObject *kwds)
+		{
+			static const char *kwlist[] = {"arr", "scalars", nullptr};
+			PyObject *obj;
+			int scalars = 0;
+			if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|p:to_list",
+											 const_cast<char **>(kwlist), &obj, &scalars))
+			{
+				return nullptr;
+			}
+			Py_INCREF(&NPyPosit8_2_Descr);
+			Safe_PyObjectPtr ref = make_safe(
+				PyArray_FromAny(obj, &NPyPosit8_2_Descr, 0, 0, NPY_ARRAY_FORCECAST, nullptr));
+			if (!ref)
+			{
+				return nullptr;
+			}
+			PyArrayObject *arr = reinterpret_cast<PyArrayObject *>(ref.get());
+			if (scalars)
+			{
+				return ArrayToList(arr, [](const char *p)
+									 {
+										 uint8 bits;
+										 memcpy(&bits, p, sizeof(bits));
+										 return PyPosit8_2_FromPosit8_2(Posit8_2FromBits(bits));
+									 });
+			}
+			return ArrayToList(arr, [](const char *p)
+									 {
+										 uint8 bits;
+										 memcpy(&bits, p, sizeof(bits));
+										 return Posit8_2ToPyFloat(bits);
+									 });
+		}
+
+		// Transposes of large posit8_2 matrices are done in square blocks that fit
+		// in L1 along with their destination.
+		constexpr npy_intp kTransposeBlock = 64;
+
+#ifdef __SSE2__
+		// Transposes a 16x16 tile of uint8 elements. The source rows are contiguous;
+		// strides are in elements. 4 rounds of interleaving row k with row k + 8
+		// leave the transposed rows in order.
+		void TransposeTile(const uint8 *src, npy_intp src_stride, uint8 *dst, npy_intp dst_stride)
+		{
+			__m128i r[16], t[16];
+			for (int k = 0; k < 16; ++k)
+			{
+				r[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + k * src_stride));
+			}
+			for (int round = 0; round < 4; ++round)
+			{
+				for (int k = 0; k < 8; ++k)
+				{
+					t[2 * k] = _mm_unpacklo_epi8(r[k], r[k + 8]);
+					t[2 * k + 1] = _mm_unpackhi_epi8(r[k], r[k + 8]);
+				}
+				std::copy(t, t + 16, r);
+			}
+			for (int k = 0; k < 16; ++k)
+			{
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + k * dst_stride), r[k]);
+			}
+		}
+#endif
+
+		// Writes the transpose of the rows x cols matrix 'src', whose byte strides
+		// are 'row_stride' and 'col_stride', to 'dst' in C order.
+		void TransposeCopy(const char *src, npy_intp rows, npy_intp cols,
+						   npy_intp row_stride, npy_intp col_stride, uint8 *dst)
+		{
+			for (npy_intp i0 = 0; i0 < rows; i0 += kTransposeBlock)
+			{
+				npy_intp i1 = std::min(i0 + kTransposeBlock, rows);
+				for (npy_intp j0 = 0; j0 < cols; j0 += kTransposeBlock)
+				{
+					npy_intp j1 = std::min(j0 + kTransposeBlock, cols);
+					npy_intp i = i0;
+#ifdef __SSE2__
+					if (col_stride == sizeof(uint8) && row_stride % sizeof(uint8) == 0)
+					{
+						npy_intp src_stride = row_stride / npy_intp(sizeof(uint8));
+						for (; i + 16 <= i1; i += 16)
+						{
+							const uint8 *row = reinterpret_cast<const uint8 *>(src + i * row_stride);
+							npy_intp j = j0;
+							for (; j + 16 <= j1; j += 16)
+							{
+								TransposeTile(row + j, src_stride, dst + j * rows + i, rows);
+							}
+							for (; j < j1; ++j)
+							{
+								for (npy_intp k = 0; k < 16; ++k)
+								{
+									dst[j * rows + i + k] = row[k * src_stride + j];
+								}
+							}
+						}
+					}
+#endif
+					for (; i < i1; ++i)
+					{
+						const char *row = src + i * row_stride;
+						for (npy_intp j = j0; j < j1; ++j)
+						{
+							dst[j * rows + i] = *reinterpret_cast<const uint8 *>(row + j * col_stride);
+						}
+					}
+				}
+			}
+		}
+
+		// posit8_2.transpose_copy(arr): a C-contiguous copy of arr.T. 2-d arrays go
+		// through the blocked kernel above with the GIL released; other ranks fall
+		// back to NumPy's copy.
+		PyObject *PyPosit8_2_TransposeCopy(PyObject *cls, PyObject *obj)
+		{
+			Py_INCREF(&NPyPosit8_2_Descr);
+			Safe_PyObjectPtr ref = make_safe(PyArray_FromAny(
+				obj, &NPyPosit8_2_Descr, 0, 0, NPY_ARRAY_FORCECAST | NPY_ARRAY_ALIGNED, nullptr));
+			if (!ref)
+			{
+				return nullptr;
+			}
+			PyArrayObject *arr = reinterpret_cast<PyArrayObject *>(ref.get());
+			if (PyArray_NDIM(arr) != 2)
+			{
+				Safe_PyObjectPtr transposed = make_safe(PyArray_Transpose(arr, nullptr));
+				if (!transposed)
+				{
+					return nullptr;
+				}
+				return PyArray_NewCopy(reinterpret_cast<PyArrayObject *>(transposed.get()), NPY_CORDER);
+			}
+			npy_intp rows = PyArray_DIM(arr, 0), cols = PyArray_DIM(arr, 1);
+			npy_intp dims[2] = {cols, rows};
+			Py_INCREF(&NPyPosit8_2_Descr);
+			PyObject *out = PyArray_NewFromDescr(&PyArray_Type, &NPyPosit8_2_Descr, 2, dims,
+												 nullptr, nullptr, 0, nullptr);
+			if (!out)
+			{
+				return nullptr;
+			}
+			uint8 *dst = reinterpret_cast<uint8 *>(PyArray_DATA(reinterpret_cast<PyArrayObject *>(out)));
+			Py_BEGIN_ALLOW_THREADS;
+			TransposeCopy(PyArray_BYTES(arr), rows, cols, PyArray_STRIDE(arr, 0),
+						  PyArray_STRIDE(arr, 1), dst);
+			Py_END_ALLOW_THREADS;
+			return out;
+		}
+
 		static PyMethodDef PyPosit8_2_methods[] = {
 			{
 				"__format__",
@@ -488,6 +835,26 @@ namespace xposit8
 				METH_O,
 				"__format__ method for posit8_2"
 			},
+			{
+				"from_list",
+				(PyCFunction) PyPosit8_2_FromList,
+				METH_O | METH_CLASS,
+				"from_list(seq) -> posit8_2 array built from a list or tuple of numbers; "
+				"nested sequences give n-d arrays"
+			},
+			{
+				"transpose_copy",
+				(PyCFunction) PyPosit8_2_TransposeCopy,
+				METH_O | METH_CLASS,
+				"transpose_copy(arr) -> C-contiguous copy of arr.T"
+			},
+			{
+				"to_list",
+				(PyCFunction)(void (*)(void)) PyPosit8_2_ToList,
+				METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+				"to_list(arr, scalars=False) -> nested lists of Python floats, or of posit8_2\n"
+				"scalars if scalars is true, with the shape of arr"
+			},
 			{NULL}  /* Sentinel */
 		};
 
@@ -514,74 +881,8 @@ namespace xposit8
 //			view->internal = NULL;
 //			return 0;
 //		}
-//
-//		static PyBufferProcs PyPosit8_2_buffer_procs = {
-//			&PyPosit8_2_getbuffer,
-//			NULL
-//		};
 //#endif
 
-		// Python type for PyPosit8_2 objects.
-
-		PyTypeObject posit8_2_type = {
-			PyVarObject_HEAD_INIT(nullptr, 0) "posit8_2", // tp_name
-			sizeof(PyPosit8_2),							  // tp_basicsize
-			0,											  // tp_itemsize
-			nullptr,									  // tp_dealloc
-#if PY_VERSION_HEX < 0x03080000
-			nullptr, // tp_print
-#else
-			0, // tp_vectorcall_offset
-#endif
-			nullptr,			  // tp_getattr
-			nullptr,			  // tp_setattr
-			nullptr,			  // tp_compare / tp_reserved
-			PyPosit8_2_Repr,	  // tp_repr
-			&PyPosit8_2_AsNumber, // tp_as_number
-			nullptr,			  // tp_as_sequence
-			nullptr,			  // tp_as_mapping
-			PyPosit8_2_Hash,	  // tp_hash
-			nullptr,			  // tp_call
-			PyPosit8_2_Str,		  // tp_str
-			nullptr,			  // tp_getattro
-			nullptr,			  // tp_setattro
-#ifdef IMPLEMENT_BUFFER
-			&PyPosit8_2_buffer_procs,			  // tp_as_buffer
-#else
-			nullptr,
-#endif
-								  // tp_flags
-			Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-			"posit8_2 floating-point values", // tp_doc
-			nullptr,						  // tp_traverse
-			nullptr,						  // tp_clear
-			PyPosit8_2_RichCompare,			  // tp_richcompare
-			0,								  // tp_weaklistoffset
-			nullptr,						  // tp_iter
-			nullptr,						  // tp_iternext
-			PyPosit8_2_methods,						  // tp_methods
-			nullptr,						  // tp_members
-			nullptr,						  // tp_getset
-			nullptr,			  // tp_base
-			nullptr,						  // tp_dict
-			nullptr,						  // tp_descr_get
-			nullptr,						  // tp_descr_set
-			0,								  // tp_dictoffset
-			nullptr,						  // tp_init
-			nullptr,						  // tp_alloc
-			PyPosit8_2_New,					  // tp_new
-			nullptr,						  // tp_free
-			nullptr,						  // tp_is_gc
-			nullptr,						  // tp_bases
-			nullptr,						  // tp_mro
-			nullptr,						  // tp_cache
-			nullptr,						  // tp_subclasses
-			nullptr,						  // tp_weaklist
-			nullptr,						  // tp_del
-			0,								  // tp_version_tag
-		};
-
-
 		// Numpy support
 
 		PyArray_ArrFuncs NPyPosit8_2_ArrFuncs;
@@ -589,7 +890,7 @@ namespace xposit8
 		PyArray_Descr NPyPosit8_2_Descr = {
 			PyObject_HEAD_INIT(nullptr) //
 										/*typeobj=*/
-			(&posit8_2_type),
+			nullptr, // Set to posit8_2_type_ptr at registration.
 			// We must register posit8_2 with a kind other than "f", because numpy
 			// considers two types with the same kind and size to be equal, but
 			// float16 != posit8_2.
@@ -600,7 +901,9 @@ namespace xposit8
 			// character is unique.
 			/*type=*/'E',
 			/*byteorder=*/'=',
-			/*flags=*/NPY_NEEDS_PYAPI, // | NPY_USE_GETITEM | NPY_USE_SETITEM,
+			// NPY_USE_GETITEM routes indexing and reductions to scalars through
+			// NPyPosit8_2_GetItem, and so through the interned scalars.
+			/*flags=*/NPY_NEEDS_PYAPI | NPY_USE_GETITEM, // | NPY_USE_SETITEM,
 			/*type_num=*/0,
 			/*elsize=*/sizeof(posit8_2),
 			/*alignment=*/alignof(posit8_2),
@@ -615,12 +918,13 @@ namespace xposit8
 
 		// Implementations of NumPy array methods.
 
+		// A single byte never needs swapping. 'arr' may be NULL here: with
+		// NPY_USE_GETITEM NumPy also calls this from PyArray_Scalar.
 		PyObject *NPyPosit8_2_GetItem(void *data, void  *arr)
 		{
-
-			posit8_2 x;
-			NPyPosit8_2_Descr.f->copyswap(&x, data, !PyArray_ISNOTSWAPPED(reinterpret_cast<PyArrayObject *>(arr)), NULL);
-			return PyPosit8_2_FromPosit8_2(x);
+			uint8 bits;
+			memcpy(&bits, data, sizeof(bits));
+			return PyPosit8_2_FromPosit8_2(Posit8_2FromBits(bits));
 		}
 
 		int NPyPosit8_2_SetItem(PyObject *item, void *data, void *arr)
@@ -636,40 +940,38 @@ namespace xposit8
 			return 0;
 		}
 
-		void ByteSwap16(void *value)
-		{
-			char *p = reinterpret_cast<char *>(value);
-			std::swap(p[0], p[1]);
-		}
-
+		// posit8_2 is a single byte, so copyswap never has anything to swap and
+		// 'swap' is ignored.
 		void NPyPosit8_2_CopySwapN(void *dstv, npy_intp dstride, void *srcv,
 								   npy_intp sstride, npy_intp n, int swap, void *arr)
 		{
 			char *dst = reinterpret_cast<char *>(dstv);
-			char *src = reinterpret_cast<char *>(srcv);
+			const char *src = reinterpret_cast<const char *>(srcv);
 			if (!src)
 			{
 				return;
 			}
-			if (swap)
+			if (dstride == 1 && sstride == 1)
 			{
-				for (npy_intp i = 0; i < n; i++)
-				{
-					char *r = dst + dstride * i;
-					memcpy(r, src + sstride * i, sizeof(uint16_t));
-					ByteSwap16(r);
-				}
+				memcpy(dst, src, n);
+				return;
 			}
-			else if (dstride == sizeof(uint16_t) && sstride == sizeof(uint16_t))
-			{
-				memcpy(dst, src, n * sizeof(uint16_t));
+			npy_intp i = 0;
+			for (; i + 4 <= n; i += 4)
+			{
+				char b0 = src[0], b1 = src[sstride], b2 = src[2 * sstride], b3 = src[3 * sstride];
+				dst[0] = b0;
+				dst[dstride] = b1;
+				dst[2 * dstride] = b2;
+				dst[3 * dstride] = b3;
+				src += 4 * sstride;
+				dst += 4 * dstride;
 			}
-			else
+			for (; i < n; ++i)
 			{
-				for (npy_intp i = 0; i < n; i++)
-				{
-					memcpy(dst + dstride * i, src + sstride * i, sizeof(uint16_t));
-				}
+				*dst = *src;
+				src += sstride;
+				dst += dstride;
 			}
 		}
 
@@ -679,11 +981,7 @@ namespace xposit8
 			{
 				return;
 			}
-			memcpy(dst, src, sizeof(uint16_t));
-			if (swap)
-			{
-				ByteSwap16(dst);
-			}
+			*reinterpret_cast<char *>(dst) = *reinterpret_cast<const char *>(src);
 		}
 
 		npy_bool NPyPosit8_2_NonZero(void *data, void *arr)
@@ -705,6 +1003,14 @@ namespace xposit8
 			return 0;
 		}
 
+		// Fills 'length' elements with the posit8_2 at 'value'. Every element is the
+		// same byte, so this is a memset.
+		int NPyPosit8_2_FillWithScalar(void *buffer, npy_intp length, void *value, void *ignored)
+		{
+			memset(buffer, *reinterpret_cast<const uint8 *>(value), length);
+			return 0;
+		}
+
 		void NPyPosit8_2_DotFunc(void *ip1, npy_intp is1, void *ip2, npy_intp is2,
 								 void *op, npy_intp n, void *arr)
 		{
@@ -876,12 +1182,12 @@ namespace xposit8
 			static int Dtype() { return NPY_BOOL; }
 		};
 
-		//template <>
-		//struct TypeDescriptor<Eigen::half>
-		//{
-		//	typedef Eigen::half T;
-		//	static int Dtype() { return NPY_HALF; }
-		//};
+		template <>
+		struct TypeDescriptor<Eigen::half>
+		{
+			typedef Eigen::half T;
+			static int Dtype() { return NPY_HALF; }
+		};
 
 		template <>
 		struct TypeDescriptor<float>
@@ -897,19 +1203,19 @@ namespace xposit8
 			static int Dtype() { return NPY_DOUBLE; }
 		};
 
-		//template <>
-		//struct TypeDescriptor<std::complex<float>>
-		//{
-		//	typedef std::complex<float> T;
-		//	static int Dtype() { return NPY_COMPLEX64; }
-		//};
+		template <>
+		struct TypeDescriptor<std::complex<float>>
+		{
+			typedef std::complex<float> T;
+			static int Dtype() { return NPY_COMPLEX64; }
+		};
 
-		//template <>
-		//struct TypeDescriptor<std::complex<double>>
-		//{
-		//	typedef std::complex<double> T;
-		//	static int Dtype() { return NPY_COMPLEX128; }
-		//};
+		template <>
+		struct TypeDescriptor<std::complex<double>>
+		{
+			typedef std::complex<double> T;
+			static int Dtype() { return NPY_COMPLEX128; }
+		};
 
 		template <>
 		struct TypeDescriptor<PyObject *>
@@ -982,874 +1288,3123 @@ namespace xposit8
 			return true;
 		}
 
-		template <typename InType, typename OutType, typename Functor>
-		struct UnaryUFunc
+		// Lookup tables over posit8_2 encodings. An operation on posit8_2 has at
+		// most 256 x 256 distinct inputs, so its results are tabulated the first
+		// time they are needed and every later evaluation is a single load. Entries
+		// hold the raw encoding of posit8_2 results, or the value of npy_bool ones,
+		// together with the floating-point exceptions computing them raised, so
+		// loops that read a table can report the same errors as computing directly.
+		uint8 TableEntry(posit8_2 x) { return Posit8_2Bits(x); }
+		uint8 TableEntry(npy_bool x) { return x; }
+
+		constexpr int kPosit8_2Exceptions = FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW | FE_UNDERFLOW;
+		static_assert(kPosit8_2Exceptions < 256, "FE_* flags must fit in a byte");
+
+		// Reports the FE_* exceptions in 'status' to NumPy, which checks for them
+		// once the loop returns and warns or raises as np.errstate says.
+		void SetFloatStatus(int status)
 		{
-			static std::vector<int> Types()
+			if (status & FE_INVALID)
 			{
-				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<OutType>::Dtype()};
+				npy_set_floatstatus_invalid();
 			}
-			static void Call(char **args, const npy_intp *dimensions,
-							 const npy_intp *steps, void *data)
+			if (status & FE_DIVBYZERO)
 			{
-				const char *i0 = args[0];
-				char *o = args[1];
-				for (npy_intp k = 0; k < *dimensions; k++)
-				{
-					auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
-					*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) = Functor()(x);
-					i0 += steps[0];
-					o += steps[1];
-				}
+				npy_set_floatstatus_divbyzero();
 			}
-		};
-
-		template <typename InType, typename OutType, typename OutType2,
-				  typename Functor>
-		struct UnaryUFunc2
-		{
-			static std::vector<int> Types()
+			if (status & FE_OVERFLOW)
 			{
-				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<OutType>::Dtype(),
-						TypeDescriptor<OutType2>::Dtype()};
+				npy_set_floatstatus_overflow();
 			}
-			static void Call(char **args, const npy_intp *dimensions,
-							 const npy_intp *steps, void *data)
+			if (status & FE_UNDERFLOW)
 			{
-				const char *i0 = args[0];
-				char *o0 = args[1];
-				char *o1 = args[2];
-				for (npy_intp k = 0; k < *dimensions; k++)
-				{
-					auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
-					std::tie(*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o0),
-							 *reinterpret_cast<typename TypeDescriptor<OutType2>::T *>(o1)) =
-						Functor()(x);
-					i0 += steps[0];
-					o0 += steps[1];
-					o1 += steps[2];
-				}
+				npy_set_floatstatus_underflow();
 			}
+		}
+
+		struct Posit8_2Table
+		{
+			std::vector<uint8> values;
+			std::vector<uint8> status;
 		};
 
-		template <typename InType, typename OutType, typename Functor>
-		struct BinaryUFunc
+		template <typename Functor>
+		const Posit8_2Table &Posit8_2UnaryTable()
 		{
-			static std::vector<int> Types()
+			// Function-local statics are initialized exactly once, even when several
+			// threads get here first at the same time.
+			static const Posit8_2Table table = []
 			{
-				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<InType>::Dtype(),
-						TypeDescriptor<OutType>::Dtype()};
-			}
-			static void Call(char **args, const npy_intp *dimensions,
-							 const npy_intp *steps, void *data)
-			{
-#ifdef DEBUG_CALLS
-				std::cout << "BinaryUFunc->Call\n";
-#endif
-				const char *i0 = args[0];
-				const char *i1 = args[1];
-				char *o = args[2];
+				// Tabulating visits every input, including ones that raise; keep
+				// those flags out of the caller's floating-point environment.
 				fenv_t fenv;
 				feholdexcept(&fenv);
-				for (npy_intp k = 0; k < *dimensions; k++)
+				Posit8_2Table t{std::vector<uint8>(256), std::vector<uint8>(256)};
+				for (int a = 0; a < 256; ++a)
 				{
-					auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
-					auto y = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i1);
-					*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
-						Functor()(x, y);
-					i0 += steps[0];
-					i1 += steps[1];
-					o += steps[2];
-				}
-				if (fetestexcept(FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW | FE_UNDERFLOW)) {
-					if (fetestexcept(FE_INVALID)) {
-						PyErr_SetString(PyExc_ArithmeticError, "posit8_2 invalid");
-					} else if (fetestexcept(FE_DIVBYZERO)) {
-						PyErr_SetString(PyExc_ArithmeticError, "posit8_2 divide by zero");
-					} else if (fetestexcept(FE_OVERFLOW)) {
-						PyErr_SetString(PyExc_ArithmeticError, "posit8_2 overflow");
-					} else if (fetestexcept(FE_UNDERFLOW)) {
-						PyErr_SetString(PyExc_ArithmeticError, "posit8_2 underflow");
-					}
+					feclearexcept(FE_ALL_EXCEPT);
+					t.values[a] = TableEntry(Functor()(Posit8_2FromBits(static_cast<uint8>(a))));
+					t.status[a] = static_cast<uint8>(fetestexcept(kPosit8_2Exceptions));
 				}
 				fesetenv(&fenv);
-			}
-		};
+				return t;
+			}();
+			return table;
+		}
 
-		template <typename InType, typename InType2, typename OutType, typename Functor>
-		struct BinaryUFunc2
+		// Row 'a' of the returned table holds Functor()(a, b) for every b.
+		template <typename Functor>
+		const Posit8_2Table &Posit8_2BinaryTable()
 		{
-			static std::vector<int> Types()
-			{
-				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<InType2>::Dtype(),
-						TypeDescriptor<OutType>::Dtype()};
-			}
-			static void Call(char **args, const npy_intp *dimensions,
-							 const npy_intp *steps, void *data)
+			static const Posit8_2Table table = []
 			{
-#ifdef DEBUG_CALLS
-				std::cout << "BinaryUFunc2->Call\n";
-#endif
-				const char *i0 = args[0];
-				const char *i1 = args[1];
-				char *o = args[2];
 				fenv_t fenv;
 				feholdexcept(&fenv);
-				for (npy_intp k = 0; k < *dimensions; k++)
+				Posit8_2Table t{std::vector<uint8>(256 * 256), std::vector<uint8>(256 * 256)};
+				for (int a = 0; a < 256; ++a)
 				{
-					auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
-					auto y =
-						*reinterpret_cast<const typename TypeDescriptor<InType2>::T *>(i1);
-					*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
-						Functor()(x, y);
-					i0 += steps[0];
-					i1 += steps[1];
-					o += steps[2];
-				}
-				if (fetestexcept(FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW | FE_UNDERFLOW)) {
-					if (fetestexcept(FE_INVALID)) {
-						PyErr_SetString(PyExc_ArithmeticError, "posit8_2 invalid");
-					} else if (fetestexcept(FE_DIVBYZERO)) {
-						PyErr_SetString(PyExc_ArithmeticError, "posit8_2 divide by zero");
-					} else if (fetestexcept(FE_OVERFLOW)) {
-						PyErr_SetString(PyExc_ArithmeticError, "posit8_2 overflow");
-					} else if (fetestexcept(FE_UNDERFLOW)) {
-						PyErr_SetString(PyExc_ArithmeticError, "posit8_2 underflow");
+					for (int b = 0; b < 256; ++b)
+					{
+						feclearexcept(FE_ALL_EXCEPT);
+						t.values[a * 256 + b] = TableEntry(Functor()(Posit8_2FromBits(static_cast<uint8>(a)),
+																	 Posit8_2FromBits(static_cast<uint8>(b))));
+						t.status[a * 256 + b] = static_cast<uint8>(fetestexcept(kPosit8_2Exceptions));
 					}
 				}
 				fesetenv(&fenv);
-			}
-		};
+				return t;
+			}();
+			return table;
+		}
 
-		// template <typename InType, typename OutType, typename Functor>
-		// struct BinaryUFuncObj
-		// {
-		// 	static std::vector<int> Types()
-		// 	{
-		// 		return {TypeDescriptor<InType>::Dtype(), NPY_OBJECT,
-		// 				TypeDescriptor<OutType>::Dtype()};
-		// 	}
-		// 	static void Call(char **args, const npy_intp *dimensions,
-		// 					 const npy_intp *steps, void *data)
-		// 	{
-		// 		const char *i0 = args[0];
-		// 		char *i1 = args[1];
-		// 		char *o = args[2];
-		// 		for (npy_intp k = 0; k < *dimensions; k++)
-		// 		{
-		// 			auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
-		// 			posit8_2 y = *reinterpret_cast<posit8_2 *>(i1);
-		// 			*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
-		// 				Functor()(x, y);
-		// 			i0 += steps[0];
-		// 			i1 += steps[1];
-		// 			o += steps[2];
-		// 		}
-		// 	}
-		// };
+		// Below this many elements a broadcast loop is not worth extracting a table
+		// row for.
+		constexpr npy_intp kPosit8_2BroadcastMin = 64;
 
-		template <typename UFunc>
-		bool RegisterUFunc(PyObject *numpy, const char *name)
+		// Binary loop where one operand is a broadcast scalar ('fixed', first
+		// operand if 'fixed_first'). The 256 results for that operand are pulled
+		// out of the table once, after which each element is a byte lookup. The
+		// exceptions the looked-up entries raised are reported at the end.
+		template <typename Functor>
+		void Posit8_2BroadcastLoop(uint8 fixed, bool fixed_first, const char *x, npy_intp x_step,
+								   char *o, npy_intp o_step, npy_intp n)
 		{
-			std::vector<int> types = UFunc::Types();
-			PyUFuncGenericFunction fn =
-				reinterpret_cast<PyUFuncGenericFunction>(UFunc::Call);
-			Safe_PyObjectPtr ufunc_obj = make_safe(PyObject_GetAttrString(numpy, name));
-			if (!ufunc_obj)
+			const Posit8_2Table &table = Posit8_2BinaryTable<Functor>();
+			uint8 row[256], row_status[256];
+			for (int v = 0; v < 256; ++v)
 			{
-				return false;
+				int index = fixed_first ? fixed * 256 + v : v * 256 + fixed;
+				row[v] = table.values[index];
+				row_status[v] = table.status[index];
 			}
-			PyUFuncObject *ufunc = reinterpret_cast<PyUFuncObject *>(ufunc_obj.get());
-			if (static_cast<int>(types.size()) != ufunc->nargs)
-			{
-				PyErr_Format(PyExc_AssertionError,
-							 "ufunc %s takes %d arguments, loop takes %lu", name,
-							 ufunc->nargs, types.size());
-				return false;
+			uint8 status = 0;
+			for (npy_intp k = 0; k < n; k++)
+			{
+				uint8 v = *reinterpret_cast<const uint8 *>(x);
+				*reinterpret_cast<uint8 *>(o) = row[v];
+				status |= row_status[v];
+				x += x_step;
+				o += o_step;
 			}
-			if (PyUFunc_RegisterLoopForType(ufunc, npy_posit8_2, fn,
-											const_cast<int *>(types.data()),
-											nullptr) < 0)
+			SetFloatStatus(status);
+		}
+
+		// Loops over any strides for functors that have one, used by UnaryUFunc,
+		// UnaryUFunc2, BinaryUFunc and BinaryUFunc2. Unset by default. A loop
+		// returns false if it leaves the call to the scalar loop.
+		template <typename Functor>
+		struct StridedKernel
+		{
+			static constexpr bool (*kLoop)(char **, npy_intp, const npy_intp *) = nullptr;
+		};
+
+		// Whether n elements read from 'in', 'in_size' bytes each, overlap n bytes
+		// written to 'out' other than by being the very same elements.
+		inline bool Overlaps(const char *in, npy_intp in_step, const char *out, npy_intp out_step, npy_intp n,
+							 std::size_t in_size = 1)
+		{
+			if (in == out && in_step == out_step && in_step != 0 && in_size == 1)
 			{
 				return false;
 			}
-			return true;
+			const char *in_lo = in + std::min<npy_intp>(0, (n - 1) * in_step);
+			const char *in_hi = in + std::max<npy_intp>(0, (n - 1) * in_step) + in_size;
+			const char *out_lo = out + std::min<npy_intp>(0, (n - 1) * out_step);
+			const char *out_hi = out + std::max<npy_intp>(0, (n - 1) * out_step) + 1;
+			return in_lo < out_hi && out_lo < in_hi;
 		}
 
-		namespace ufuncs
+		// Unary loop that reads Posit8_2UnaryTable, for functions that are cheaper
+		// looked up than computed.
+		template <typename Functor>
+		bool Posit8_2UnaryTableLoop(char **args, npy_intp n, const npy_intp *steps)
 		{
+			const Posit8_2Table &table = Posit8_2UnaryTable<Functor>();
+			const char *x = args[0];
+			char *o = args[1];
+			uint8 status = 0;
+			for (npy_intp k = 0; k < n; k++)
+			{
+				uint8 v = *reinterpret_cast<const uint8 *>(x);
+				*reinterpret_cast<uint8 *>(o) = table.values[v];
+				status |= table.status[v];
+				x += steps[0];
+				o += steps[1];
+			}
+			SetFloatStatus(status);
+			return true;
+		}
 
-			struct Add
-			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b) { return a + b; }
-			};
-			struct AddScalarFloat
-			{
-				posit8_2 operator()(posit8_2 a, float b) { return a + posit8_2(b); }
-			};
-			struct ScalarFloatAdd
-			{
-				posit8_2 operator()(float a, posit8_2 b) { return posit8_2(a) + b; }
-			};
-			struct Subtract
-			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b) { return a - b; }
-			};
-			struct Multiply
-			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b) { return a * b; }
-			};
-			struct TrueDivide
+		// frexp of every posit8_2: the encodings of the mantissas and the
+		// exponents. Exact, so no exceptions.
+		template <typename Functor>
+		bool Posit8_2FrexpLoop(char **args, npy_intp n, const npy_intp *steps)
+		{
+			struct Table
 			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b) { return a / b; }
+				uint8 mantissas[256];
+				int exponents[256];
 			};
-
-			std::pair<float, float> divmod(float a, float b)
+			static const Table table = []
 			{
-				if (b == 0.0f)
-				{
-					float nan = std::numeric_limits<float>::quiet_NaN();
-					return {nan, nan};
-				}
-				float mod = std::fmod(a, b);
-				float div = (a - mod) / b;
-				if (mod != 0.0f)
-				{
-					if ((b < 0.0f) != (mod < 0.0f))
-					{
-						mod += b;
-						div -= 1.0f;
-					}
-				}
-				else
+				Table t;
+				for (int a = 0; a < 256; ++a)
 				{
-					mod = std::copysign(0.0f, b);
+					std::pair<posit8_2, int> r = Functor()(Posit8_2FromBits(static_cast<uint8>(a)));
+					t.mantissas[a] = Posit8_2Bits(r.first);
+					t.exponents[a] = r.second;
 				}
+				return t;
+			}();
+			const char *x = args[0];
+			char *mantissa = args[1], *exponent = args[2];
+			for (npy_intp k = 0; k < n; k++)
+			{
+				uint8 v = *reinterpret_cast<const uint8 *>(x);
+				*reinterpret_cast<uint8 *>(mantissa) = table.mantissas[v];
+				*reinterpret_cast<int *>(exponent) = table.exponents[v];
+				x += steps[0];
+				mantissa += steps[1];
+				exponent += steps[2];
+			}
+			return true;
+		}
 
-				float floordiv;
-				if (div != 0.0f)
+		// Scaling by more than 2^48 takes any nonzero posit8_2 to maxpos or
+		// minpos, so ldexp is a table over exponents in [-48, 48].
+		constexpr int kPosit8_2LdexpRange = 48;
+
+		template <typename Functor>
+		bool Posit8_2LdexpLoop(char **args, npy_intp n, const npy_intp *steps)
+		{
+			constexpr int kExponents = 2 * kPosit8_2LdexpRange + 1;
+			static const std::vector<uint8> table = []
+			{
+				std::vector<uint8> t(256 * kExponents);
+				for (int a = 0; a < 256; ++a)
 				{
-					floordiv = std::floor(div);
-					if (div - floordiv > 0.5f)
+					for (int e = 0; e < kExponents; ++e)
 					{
-						floordiv += 1.0f;
+						t[a * kExponents + e] = Posit8_2Bits(
+							Functor()(Posit8_2FromBits(static_cast<uint8>(a)), e - kPosit8_2LdexpRange));
 					}
 				}
-				else
-				{
-					floordiv = std::copysign(0.0f, a / b);
-				}
-				return {floordiv, mod};
+				return t;
+			}();
+			const char *x = args[0], *y = args[1];
+			char *o = args[2];
+			for (npy_intp k = 0; k < n; k++)
+			{
+				uint8 v = *reinterpret_cast<const uint8 *>(x);
+				int e = std::max(-kPosit8_2LdexpRange,
+								 std::min(kPosit8_2LdexpRange, *reinterpret_cast<const int *>(y)));
+				*reinterpret_cast<uint8 *>(o) = table[v * kExponents + e + kPosit8_2LdexpRange];
+				x += steps[0];
+				y += steps[1];
+				o += steps[2];
 			}
+			return true;
+		}
 
-			struct FloorDivide
+		// Tables of functions with two posit8_2 results, such as divmod and modf.
+		// Each entry packs both encodings and the exceptions computing them
+		// raised as first | second << 8 | status << 16, so that one load serves
+		// every output.
+		std::uint32_t PairTableEntry(std::pair<posit8_2, posit8_2> r, int status)
+		{
+			return Posit8_2Bits(r.first) | Posit8_2Bits(r.second) << 8 |
+				   static_cast<std::uint32_t>(status & kPosit8_2Exceptions) << 16;
+		}
+
+		template <typename Functor>
+		const std::vector<std::uint32_t> &Posit8_2UnaryPairTable()
+		{
+			static const std::vector<std::uint32_t> table = []
 			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b)
+				fenv_t fenv;
+				feholdexcept(&fenv);
+				std::vector<std::uint32_t> t(256);
+				for (int a = 0; a < 256; ++a)
 				{
-					return posit8_2(divmod(static_cast<float>(a), static_cast<float>(b)).first);
+					feclearexcept(FE_ALL_EXCEPT);
+					std::pair<posit8_2, posit8_2> r = Functor()(Posit8_2FromBits(static_cast<uint8>(a)));
+					t[a] = PairTableEntry(r, fetestexcept(kPosit8_2Exceptions));
 				}
-			};
-			struct Remainder
+				fesetenv(&fenv);
+				return t;
+			}();
+			return table;
+		}
+
+		// Entry a * 256 + b holds Functor()(a, b).
+		template <typename Functor>
+		const std::vector<std::uint32_t> &Posit8_2BinaryPairTable()
+		{
+			static const std::vector<std::uint32_t> table = []
 			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b)
+				fenv_t fenv;
+				feholdexcept(&fenv);
+				std::vector<std::uint32_t> t(256 * 256);
+				for (int a = 0; a < 256; ++a)
 				{
-					return posit8_2(
-						divmod(static_cast<float>(a), static_cast<float>(b)).second);
+					for (int b = 0; b < 256; ++b)
+					{
+						feclearexcept(FE_ALL_EXCEPT);
+						std::pair<posit8_2, posit8_2> r = Functor()(Posit8_2FromBits(static_cast<uint8>(a)),
+																	Posit8_2FromBits(static_cast<uint8>(b)));
+						t[a * 256 + b] = PairTableEntry(r, fetestexcept(kPosit8_2Exceptions));
+					}
 				}
-			};
-			struct DivmodUFunc
-			{
-				static std::vector<int> Types()
+				fesetenv(&fenv);
+				return t;
+			}();
+			return table;
+		}
+
+#ifdef POSIT8_X86_DISPATCH
+		bool HasAvx2()
+		{
+			static const bool has_avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+			return has_avx2;
+		}
+
+		// Pair table lookups over contiguous operands, eight entries per gather.
+		// The entry number is x, or x * 256 + y if there is a 'y'; byte 0 of each
+		// entry goes to 'first' and byte 1 to 'second', either of which may be
+		// null. Returns how many elements it did, adding the exceptions of their
+		// entries to 'status'.
+		__attribute__((target("avx2"))) npy_intp PairTableGatherAvx2(const std::uint32_t *table, const uint8 *x,
+																		 const uint8 *y, uint8 *first, uint8 *second,
+																		 npy_intp n, int *status)
+		{
+			// Within each 128-bit half, bytes 0 and 1 of its four entries.
+			const __m256i split = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, -1, -1, -1, -1, -1, -1, -1, -1,
+												   0, 4, 8, 12, 1, 5, 9, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+			__m256i raised = _mm256_setzero_si256();
+			npy_intp i = 0;
+			for (; i + 8 <= n; i += 8)
+			{
+				__m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(x + i)));
+				if (y)
 				{
-					return {npy_posit8_2, npy_posit8_2, npy_posit8_2, npy_posit8_2};
+					__m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(y + i)));
+					index = _mm256_or_si256(_mm256_slli_epi32(index, 8), b);
 				}
-				static void Call(char **args, npy_intp *dimensions, npy_intp *steps,
-								 void *data)
+				__m256i entries = _mm256_i32gather_epi32(reinterpret_cast<const int *>(table), index, 4);
+				raised = _mm256_or_si256(raised, entries);
+				__m256i halves = _mm256_shuffle_epi8(entries, split);
+				// Eight first bytes, then eight second bytes.
+				__m128i bytes = _mm_unpacklo_epi32(_mm256_castsi256_si128(halves), _mm256_extracti128_si256(halves, 1));
+				if (first)
 				{
-					const char *i0 = args[0];
-					const char *i1 = args[1];
-					char *o0 = args[2];
-					char *o1 = args[3];
-					for (npy_intp k = 0; k < *dimensions; k++)
-					{
-						posit8_2 x = *reinterpret_cast<const posit8_2 *>(i0);
-						posit8_2 y = *reinterpret_cast<const posit8_2 *>(i1);
-						float floordiv, mod;
-						std::tie(floordiv, mod) =
-							divmod(static_cast<float>(x), static_cast<float>(y));
-						*reinterpret_cast<posit8_2 *>(o0) = posit8_2(floordiv);
-						*reinterpret_cast<posit8_2 *>(o1) = posit8_2(mod);
-						i0 += steps[0];
-						i1 += steps[1];
-						o0 += steps[2];
-						o1 += steps[3];
-					}
+					_mm_storel_epi64(reinterpret_cast<__m128i *>(first + i), bytes);
 				}
-			};
-			struct Fmod
-			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b)
+				if (second)
 				{
-					return posit8_2(std::fmod(static_cast<float>(a), static_cast<float>(b)));
+					_mm_storel_epi64(reinterpret_cast<__m128i *>(second + i), _mm_srli_si128(bytes, 8));
 				}
-			};
-			struct Negative
+			}
+			alignas(32) std::uint32_t lanes[8];
+			_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), raised);
+			for (std::uint32_t lane : lanes)
 			{
-				posit8_2 operator()(posit8_2 a) { return -a; }
-			};
-			struct Positive
+				*status |= lane >> 16;
+			}
+			return i;
+		}
+#endif
+
+		// Looks up 'table' for each element of x, or each pair of elements of x
+		// and y if there is a 'y', storing the first results to 'first' and the
+		// second to 'second' where those are set.
+		void Posit8_2PairTableLoop(const std::vector<std::uint32_t> &table, const char *x, npy_intp x_step,
+								   const char *y, npy_intp y_step, char *first, npy_intp first_step,
+								   char *second, npy_intp second_step, npy_intp n)
+		{
+			int status = 0;
+			npy_intp k = 0;
+#ifdef POSIT8_X86_DISPATCH
+			auto contiguous = [&](const char *in, npy_intp in_step, char *out, npy_intp out_step)
 			{
-				posit8_2 operator()(posit8_2 a) { return a; }
+				return !in || !out || (in_step == 1 && out_step == 1 && !Overlaps(in, 1, out, 1, n));
 			};
-			struct Power
+			if (x_step == 1 && (!y || y_step == 1) && contiguous(x, x_step, first, first_step) &&
+				contiguous(x, x_step, second, second_step) && contiguous(y, y_step, first, first_step) &&
+				contiguous(y, y_step, second, second_step) && HasAvx2())
+			{
+				k = PairTableGatherAvx2(table.data(), reinterpret_cast<const uint8 *>(x),
+										reinterpret_cast<const uint8 *>(y), reinterpret_cast<uint8 *>(first),
+										reinterpret_cast<uint8 *>(second), n, &status);
+				x += k;
+				y = y ? y + k : y;
+				first = first ? first + k : first;
+				second = second ? second + k : second;
+			}
+#endif
+			for (; k < n; k++)
 			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b)
+				int index = *reinterpret_cast<const uint8 *>(x);
+				if (y)
 				{
-					return posit8_2(std::pow(static_cast<float>(a), static_cast<float>(b)));
+					index = index * 256 + *reinterpret_cast<const uint8 *>(y);
+					y += y_step;
 				}
-			};
-			struct Abs
-			{
-				posit8_2 operator()(posit8_2 a)
+				std::uint32_t entry = table[index];
+				if (first)
 				{
-					return posit8_2(std::abs(static_cast<float>(a)));
+					*reinterpret_cast<uint8 *>(first) = static_cast<uint8>(entry);
+					first += first_step;
 				}
-			};
-			struct Cbrt
+				if (second)
+				{
+					*reinterpret_cast<uint8 *>(second) = static_cast<uint8>(entry >> 8);
+					second += second_step;
+				}
+				status |= entry >> 16;
+				x += x_step;
+			}
+			SetFloatStatus(status);
+		}
+
+		// floor_divide, remainder and divmod all read the table of divmod, and
+		// modf its own.
+		template <typename Divmod>
+		bool Posit8_2FloorDivideLoop(char **args, npy_intp n, const npy_intp *steps)
+		{
+			Posit8_2PairTableLoop(Posit8_2BinaryPairTable<Divmod>(), args[0], steps[0], args[1], steps[1], args[2],
+								  steps[2], nullptr, 0, n);
+			return true;
+		}
+
+		template <typename Divmod>
+		bool Posit8_2RemainderLoop(char **args, npy_intp n, const npy_intp *steps)
+		{
+			Posit8_2PairTableLoop(Posit8_2BinaryPairTable<Divmod>(), args[0], steps[0], args[1], steps[1], nullptr,
+								  0, args[2], steps[2], n);
+			return true;
+		}
+
+		template <typename Divmod>
+		bool Posit8_2DivmodLoop(char **args, npy_intp n, const npy_intp *steps)
+		{
+			Posit8_2PairTableLoop(Posit8_2BinaryPairTable<Divmod>(), args[0], steps[0], args[1], steps[1], args[2],
+								  steps[2], args[3], steps[3], n);
+			return true;
+		}
+
+		template <typename Modf>
+		bool Posit8_2ModfLoop(char **args, npy_intp n, const npy_intp *steps)
+		{
+			Posit8_2PairTableLoop(Posit8_2UnaryPairTable<Modf>(), args[0], steps[0], nullptr, 0, args[1], steps[1],
+								  args[2], steps[2], n);
+			return true;
+		}
+
+#ifdef POSIT8_VECTOR_KERNELS
+		// Sign manipulation and nextafter on posit8_2 encodings, with GCC vector
+		// extensions. posit8_2 values are ordered like their encodings read as
+		// two's-complement int8, negating one negates its encoding and NaR, 0x80,
+		// is its own negative, so each of these is a few byte operations on 16
+		// lanes at a time.
+		namespace kernels
+		{
+			typedef uint8 Bytes __attribute__((vector_size(16)));
+			typedef int8 Mask __attribute__((vector_size(16)));
+			constexpr npy_intp kLanes = sizeof(Bytes);
+
+#define POSIT8_KERNEL_INLINE inline __attribute__((always_inline))
+
+			POSIT8_KERNEL_INLINE Mask Signed(Bytes x) { return (Mask)x; }
+
+			POSIT8_KERNEL_INLINE Bytes Select(Mask m, Bytes a, Bytes b)
+			{
+				return ((Bytes)m & a) | (~(Bytes)m & b);
+			}
+
+			// NaR is neither negative nor positive.
+			POSIT8_KERNEL_INLINE Mask IsNegative(Bytes x) { return (Signed(x) < 0) & (x != 0x80); }
+
+			POSIT8_KERNEL_INLINE Bytes AbsBits(Bytes x) { return Select(Signed(x) < 0, -x, x); }
+
+			struct Negative
+			{
+				static POSIT8_KERNEL_INLINE Bytes Eval(Bytes x) { return -x; }
+			};
+
+			struct Abs
+			{
+				static POSIT8_KERNEL_INLINE Bytes Eval(Bytes x) { return AbsBits(x); }
+			};
+
+			struct SignBit
+			{
+				static POSIT8_KERNEL_INLINE Bytes Eval(Bytes x) { return (Bytes)IsNegative(x) & 1; }
+			};
+
+			struct CopySign
+			{
+				static POSIT8_KERNEL_INLINE Bytes Eval(Bytes x, Bytes y)
+				{
+					Bytes a = AbsBits(x);
+					return Select(IsNegative(y), -a, a);
+				}
+			};
+
+			// One step along the int8 order toward y; NaR if either is NaR.
+			struct NextAfter
+			{
+				static POSIT8_KERNEL_INLINE Bytes Eval(Bytes x, Bytes y)
+				{
+					Bytes r = Select(Signed(x) < Signed(y), x + 1, x - 1);
+					r = Select(x == y, y, r);
+					return Select((x == 0x80) | (y == 0x80), Bytes() + 0x80, r);
+				}
+			};
+
+			// 16 elements over any step, a zero step being a broadcast. Strided
+			// lanes are listed out so that they go straight into registers.
+			template <std::size_t... l>
+			POSIT8_KERNEL_INLINE Bytes Load(const char *in, npy_intp step, std::index_sequence<l...>)
+			{
+				Bytes v;
+				if (step == 1)
+				{
+					memcpy(&v, in, sizeof(v));
+				}
+				else if (step == 0)
+				{
+					v = Bytes() + *reinterpret_cast<const uint8 *>(in);
+				}
+				else
+				{
+					v = Bytes{*reinterpret_cast<const uint8 *>(in + npy_intp(l) * step)...};
+				}
+				return v;
+			}
+
+			template <std::size_t... l>
+			POSIT8_KERNEL_INLINE void Store(Bytes v, char *out, npy_intp step, std::index_sequence<l...>)
+			{
+				if (step == 1)
+				{
+					memcpy(out, &v, sizeof(v));
+					return;
+				}
+				int unused[] = {(*reinterpret_cast<uint8 *>(out + npy_intp(l) * step) = v[l], 0)...};
+				(void)unused;
+			}
+
+			// Loops of UnaryUFunc and BinaryUFunc over Kernel, Functor being its
+			// scalar equivalent, which does the last few elements. Inputs that
+			// overlap the output, as in reductions, are left to the scalar loop.
+			template <typename Kernel, typename Functor>
+			bool UnaryLoop(char **args, npy_intp n, const npy_intp *steps)
+			{
+				typedef decltype(Functor()(posit8_2())) Out;
+				const char *x = args[0];
+				char *o = args[1];
+				if (n <= 0 || Overlaps(x, steps[0], o, steps[1], n))
+				{
+					return false;
+				}
+				npy_intp i = 0;
+				for (; i + kLanes <= n; i += kLanes)
+				{
+					Store(Kernel::Eval(Load(x, steps[0], std::make_index_sequence<kLanes>())), o, steps[1],
+						  std::make_index_sequence<kLanes>());
+					x += kLanes * steps[0];
+					o += kLanes * steps[1];
+				}
+				for (; i < n; ++i)
+				{
+					*reinterpret_cast<Out *>(o) = Functor()(*reinterpret_cast<const posit8_2 *>(x));
+					x += steps[0];
+					o += steps[1];
+				}
+				return true;
+			}
+
+			template <typename Kernel, typename Functor>
+			bool BinaryLoop(char **args, npy_intp n, const npy_intp *steps)
+			{
+				const char *x = args[0], *y = args[1];
+				char *o = args[2];
+				if (n <= 0 || Overlaps(x, steps[0], o, steps[2], n) || Overlaps(y, steps[1], o, steps[2], n))
+				{
+					return false;
+				}
+				npy_intp i = 0;
+				for (; i + kLanes <= n; i += kLanes)
+				{
+					Bytes a = Load(x, steps[0], std::make_index_sequence<kLanes>());
+					Bytes b = Load(y, steps[1], std::make_index_sequence<kLanes>());
+					Store(Kernel::Eval(a, b), o, steps[2], std::make_index_sequence<kLanes>());
+					x += kLanes * steps[0];
+					y += kLanes * steps[1];
+					o += kLanes * steps[2];
+				}
+				for (; i < n; ++i)
+				{
+					*reinterpret_cast<posit8_2 *>(o) =
+						Functor()(*reinterpret_cast<const posit8_2 *>(x), *reinterpret_cast<const posit8_2 *>(y));
+					x += steps[0];
+					y += steps[1];
+					o += steps[2];
+				}
+				return true;
+			}
+		} // namespace kernels
+#endif
+
+		// Conversions to and from posit8_2 for any NumPy operand type. float and
+		// double convert directly so they are rounded once; bool, integers and half
+		// go through float, which is exact over the whole posit8_2 range (larger
+		// magnitudes saturate either way). Complex values use their real part,
+		// following the numpy convention.
+		posit8_2 ToPosit8_2(float v) { return posit8_2(v); }
+		posit8_2 ToPosit8_2(double v) { return posit8_2(v); }
+		template <typename T>
+		posit8_2 ToPosit8_2(T v) { return posit8_2(static_cast<float>(v)); }
+		template <typename T>
+		posit8_2 ToPosit8_2(std::complex<T> v) { return ToPosit8_2(v.real()); }
+
+		template <typename T>
+		T FromPosit8_2(posit8_2 p) { return static_cast<T>(static_cast<float>(p)); }
+
+		// Array casts through ToPosit8_2/FromPosit8_2, for the types the posit
+		// constructors and conversion operators do not cover.
+		template <typename T>
+		void NPyCastToPosit8_2(void *from_void, void *to_void, npy_intp n, void *fromarr,
+							   void *toarr)
+		{
+			const auto *from = reinterpret_cast<const typename TypeDescriptor<T>::T *>(from_void);
+			auto *to = reinterpret_cast<posit8_2 *>(to_void);
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				to[i] = ToPosit8_2(from[i]);
+			}
+		}
+
+		template <typename T>
+		void NPyCastFromPosit8_2(void *from_void, void *to_void, npy_intp n, void *fromarr,
+								 void *toarr)
+		{
+			const auto *from = reinterpret_cast<const posit8_2 *>(from_void);
+			auto *to = reinterpret_cast<typename TypeDescriptor<T>::T *>(to_void);
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				to[i] = static_cast<typename TypeDescriptor<T>::T>(FromPosit8_2<T>(from[i]));
+			}
+		}
+
+		// Like RegisterPosit8_2Cast, using the casts above.
+		template <typename T>
+		bool RegisterPosit8_2CastViaFloat(int numpy_type, bool cast_is_safe)
+		{
+			if (PyArray_RegisterCastFunc(PyArray_DescrFromType(numpy_type), npy_posit8_2, NPyCastToPosit8_2<T>) < 0)
+			{
+				return false;
+			}
+			if (PyArray_RegisterCastFunc(&NPyPosit8_2_Descr, numpy_type, NPyCastFromPosit8_2<T>) < 0)
+			{
+				return false;
+			}
+			if (cast_is_safe && PyArray_RegisterCanCast(&NPyPosit8_2_Descr, numpy_type, NPY_NOSCALAR) < 0)
+			{
+				return false;
+			}
+			return true;
+		}
+
+		// Direct casts to and from the bfloat16 type of the bfloat16 module. Every
+		// posit8_2 value is exact in bfloat16, so that direction is a 256-entry
+		// table of bfloat16 bits. The other direction tabulates all 65536 bfloat16
+		// encodings, rounded exactly as a cast through float32 would round them.
+		inline uint16 FloatToBfloat16Bits(float f)
+		{
+			std::uint32_t bits;
+			memcpy(&bits, &f, sizeof(bits));
+			std::uint32_t rounded = (bits + 0x7fffu + ((bits >> 16) & 1u)) >> 16;
+			std::uint32_t nan = (bits >> 16) | 0x7fc0u;
+			return static_cast<uint16>(f != f ? nan & 0xffc0u : rounded);
+		}
+
+		const std::vector<uint16> &Posit8_2ToBfloat16Table()
+		{
+			static const std::vector<uint16> table = []
+			{
+				std::vector<uint16> t(256);
+				for (int a = 0; a < 256; ++a)
+				{
+					t[a] = FloatToBfloat16Bits(static_cast<float>(Posit8_2FromBits(static_cast<uint8>(a))));
+				}
+				return t;
+			}();
+			return table;
+		}
+
+		const std::vector<uint8> &Bfloat16ToPosit8_2Table()
+		{
+			static const std::vector<uint8> table = []
+			{
+				fenv_t fenv;
+				feholdexcept(&fenv);
+				std::vector<uint8> t(65536);
+				for (std::uint32_t b = 0; b < 65536; ++b)
+				{
+					std::uint32_t bits = b << 16;
+					float f;
+					memcpy(&f, &bits, sizeof(f));
+					t[b] = Posit8_2Bits(posit8_2(f));
+				}
+				fesetenv(&fenv);
+				return t;
+			}();
+			return table;
+		}
+
+		void NPyCastPosit8_2ToBfloat16(void *from_void, void *to_void, npy_intp n, void *fromarr,
+									   void *toarr)
+		{
+			const auto *from = reinterpret_cast<const uint8 *>(from_void);
+			auto *to = reinterpret_cast<uint16 *>(to_void);
+			const uint16 *table = Posit8_2ToBfloat16Table().data();
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				to[i] = table[from[i]];
+			}
+		}
+
+		void NPyCastBfloat16ToPosit8_2(void *from_void, void *to_void, npy_intp n, void *fromarr,
+									   void *toarr)
+		{
+			const auto *from = reinterpret_cast<const uint16 *>(from_void);
+			auto *to = reinterpret_cast<uint8 *>(to_void);
+			const uint8 *table = Bfloat16ToPosit8_2Table().data();
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				to[i] = table[from[i]];
+			}
+		}
+
+		// Marks the operand types of the mixed loops (see RegisterMixedUFuncs) as
+		// casting to posit8_2 safely. Only False and True are exact in posit8_2,
+		// but the others round just as Python ints and floats do: promotion, as
+		// in np.result_type and np.where, then agrees with the mixed loops, which
+		// keep such operands posit8_2 the way NumPy keeps them float16.
+		bool RegisterMixedCasts()
+		{
+			for (int type : {NPY_BOOL, NPY_INT8, NPY_UINT8, NPY_INT16, NPY_UINT16, NPY_HALF})
+			{
+				Safe_PyObjectPtr descr = make_safe(reinterpret_cast<PyObject *>(PyArray_DescrFromType(type)));
+				if (!descr || PyArray_RegisterCanCast(reinterpret_cast<PyArray_Descr *>(descr.get()), npy_posit8_2,
+													  NPY_NOSCALAR) < 0)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// Registers the casts above if a bfloat16 type is registered with NumPy.
+		// Whichever of the two modules is imported second registers the pair.
+		bool RegisterBfloat16Casts()
+		{
+			// The bfloat16 module's own type, or the one it adopts when another
+			// module registered bfloat16 first.
+			int npy_bfloat16 = PyArray_TypeNumFromName(const_cast<char *>("bfloat16"));
+			if (npy_bfloat16 == NPY_NOTYPE)
+			{
+				return true;
+			}
+			Safe_PyObjectPtr descr_ref = make_safe(reinterpret_cast<PyObject *>(PyArray_DescrFromType(npy_bfloat16)));
+			PyArray_Descr *descr = reinterpret_cast<PyArray_Descr *>(descr_ref.get());
+			if (!descr || descr->elsize != 2)
+			{
+				PyErr_Clear();
+				return true;
+			}
+			if (PyArray_RegisterCastFunc(descr, npy_posit8_2, NPyCastBfloat16ToPosit8_2) < 0)
+			{
+				return false;
+			}
+			if (PyArray_RegisterCastFunc(&NPyPosit8_2_Descr, npy_bfloat16, NPyCastPosit8_2ToBfloat16) < 0)
+			{
+				return false;
+			}
+			if (PyArray_RegisterCanCast(&NPyPosit8_2_Descr, npy_bfloat16, NPY_NOSCALAR) < 0)
+			{
+				return false;
+			}
+			return true;
+		}
+
+		// Casts between posit8_2 and bool, integer and half types. A type of at
+		// most 16 bits converts through a table over all of its values. Wider
+		// integers are clamped to +-2^24, the largest posit8_2 magnitude, so that
+		// they convert to float exactly, and then go through the bfloat16 table
+		// above. The bfloat16 index is rounded to odd, keeping any discarded bits
+		// as a sticky bit, so the value is still rounded only once. posit8_2
+		// converts to any of these types through a 256-entry table.
+		template <typename T>
+		using TableIndex = typename std::conditional<sizeof(T) == 1, uint8, uint16>::type;
+
+		template <typename T>
+		const std::vector<uint8> &ToPosit8_2Table()
+		{
+			static_assert(sizeof(T) <= 2, "wider integers use NPyCastWideIntToPosit8_2");
+			static const std::vector<uint8> table = []
+			{
+				std::vector<uint8> t(std::size_t(1) << (8 * sizeof(T)));
+				for (std::size_t b = 0; b < t.size(); ++b)
+				{
+					TableIndex<T> bits = static_cast<TableIndex<T>>(b);
+					T v = std::is_same<T, bool>::value ? T(bits != 0) : Eigen::numext::bit_cast<T>(bits);
+					t[b] = Posit8_2Bits(ToPosit8_2(v));
+				}
+				return t;
+			}();
+			return table;
+		}
+
+		template <typename T>
+		const std::vector<typename TypeDescriptor<T>::T> &FromPosit8_2Table()
+		{
+			static const std::vector<typename TypeDescriptor<T>::T> table = []
+			{
+				// NaR has no integer value and large values overflow half; keep the
+				// flags converting them raises out of the caller's floating-point
+				// environment.
+				fenv_t fenv;
+				feholdexcept(&fenv);
+				std::vector<typename TypeDescriptor<T>::T> t(256);
+				for (int a = 0; a < 256; ++a)
+				{
+					t[a] = FromPosit8_2<T>(Posit8_2FromBits(static_cast<uint8>(a)));
+				}
+				fesetenv(&fenv);
+				return t;
+			}();
+			return table;
+		}
+
+		template <typename T>
+		void NPyCastToPosit8_2ByTable(void *from_void, void *to_void, npy_intp n, void *fromarr,
+								  void *toarr)
+		{
+			const auto *from = reinterpret_cast<const TableIndex<T> *>(from_void);
+			auto *to = reinterpret_cast<uint8 *>(to_void);
+			const uint8 *table = ToPosit8_2Table<T>().data();
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				to[i] = table[from[i]];
+			}
+		}
+
+		template <typename T>
+		void NPyCastWideIntToPosit8_2(void *from_void, void *to_void, npy_intp n, void *fromarr,
+									  void *toarr)
+		{
+			const auto *from = reinterpret_cast<const T *>(from_void);
+			auto *to = reinterpret_cast<uint8 *>(to_void);
+			const uint8 *table = Bfloat16ToPosit8_2Table().data();
+			constexpr T kLimit = T(1) << 24;
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				T v = std::min(from[i], kLimit);
+				if (std::is_signed<T>::value)
+				{
+					v = std::max(v, static_cast<T>(-kLimit));
+				}
+				float f = static_cast<float>(v);
+				std::uint32_t bits;
+				memcpy(&bits, &f, sizeof(bits));
+				to[i] = table[(bits >> 16) | ((bits & 0xffffu) != 0)];
+			}
+		}
+
+		// The same for doubles, as used by from_list. Magnitudes are clamped to
+		// [2^-32, 2^24], beyond which posit8_2 saturates to minpos and maxpos, so
+		// that the bfloat16 index can be taken straight from the double's bits,
+		// again rounded to odd. Infinities and NaN give NaR.
+		void DoublesToPosit8_2(const double *from, uint8 *to, npy_intp n)
+		{
+			const uint8 *table = Bfloat16ToPosit8_2Table().data();
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				double v = from[i];
+				if (!std::isfinite(v))
+				{
+					// Before any ordered comparison, which would report NaN as invalid.
+					to[i] = table[0x7fc0];
+					continue;
+				}
+				double a = std::min(std::max(std::fabs(v), 0x1p-32), 0x1p24);
+				std::uint64_t bits;
+				memcpy(&bits, &a, sizeof(bits));
+				// Rebias the exponent from double (1023) to bfloat16 (127).
+				std::uint32_t index = static_cast<std::uint32_t>((bits >> 45) - (std::uint64_t(1023 - 127) << 7)) |
+									  ((bits & ((std::uint64_t(1) << 45) - 1)) != 0) | (std::signbit(v) ? 0x8000u : 0u);
+				to[i] = v == 0 ? 0 : table[index];
+			}
+		}
+
+		template <typename T>
+		void NPyCastFromPosit8_2ByTable(void *from_void, void *to_void, npy_intp n, void *fromarr,
+								  void *toarr)
+		{
+			const auto *from = reinterpret_cast<const uint8 *>(from_void);
+			auto *to = reinterpret_cast<typename TypeDescriptor<T>::T *>(to_void);
+			const auto *table = FromPosit8_2Table<T>().data();
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				to[i] = table[from[i]];
+			}
+		}
+
+		template <typename T>
+		PyArray_VectorUnaryFunc *ToPosit8_2TableCast(std::true_type /*narrow*/)
+		{
+			return NPyCastToPosit8_2ByTable<T>;
+		}
+
+		template <typename T>
+		PyArray_VectorUnaryFunc *ToPosit8_2TableCast(std::false_type /*narrow*/)
+		{
+			return NPyCastWideIntToPosit8_2<T>;
+		}
+
+		// Like RegisterPosit8_2Cast, using the casts above.
+		template <typename T>
+		bool RegisterPosit8_2TableCast(int numpy_type, bool cast_is_safe)
+		{
+			PyArray_VectorUnaryFunc *to_posit8_2 =
+				ToPosit8_2TableCast<T>(std::integral_constant<bool, sizeof(T) <= 2>());
+			if (PyArray_RegisterCastFunc(PyArray_DescrFromType(numpy_type), npy_posit8_2, to_posit8_2) < 0)
+			{
+				return false;
+			}
+			if (PyArray_RegisterCastFunc(&NPyPosit8_2_Descr, numpy_type, NPyCastFromPosit8_2ByTable<T>) < 0)
+			{
+				return false;
+			}
+			if (cast_is_safe && PyArray_RegisterCanCast(&NPyPosit8_2_Descr, numpy_type, NPY_NOSCALAR) < 0)
+			{
+				return false;
+			}
+			return true;
+		}
+
+		template <typename InType, typename OutType, typename Functor>
+		struct UnaryUFunc
+		{
+			static std::vector<int> Types()
+			{
+				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<OutType>::Dtype()};
+			}
+			static void Call(char **args, const npy_intp *dimensions,
+							 const npy_intp *steps, void *data)
+			{
+				if (StridedKernel<Functor>::kLoop && StridedKernel<Functor>::kLoop(args, *dimensions, steps))
+				{
+					return;
+				}
+				const char *i0 = args[0];
+				char *o = args[1];
+				for (npy_intp k = 0; k < *dimensions; k++)
+				{
+					auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+					*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) = Functor()(x);
+					i0 += steps[0];
+					o += steps[1];
+				}
+			}
+		};
+
+		template <typename InType, typename OutType, typename OutType2,
+				  typename Functor>
+		struct UnaryUFunc2
+		{
+			static std::vector<int> Types()
+			{
+				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<OutType>::Dtype(),
+						TypeDescriptor<OutType2>::Dtype()};
+			}
+			static void Call(char **args, const npy_intp *dimensions,
+							 const npy_intp *steps, void *data)
+			{
+				if (StridedKernel<Functor>::kLoop && StridedKernel<Functor>::kLoop(args, *dimensions, steps))
+				{
+					return;
+				}
+				const char *i0 = args[0];
+				char *o0 = args[1];
+				char *o1 = args[2];
+				for (npy_intp k = 0; k < *dimensions; k++)
+				{
+					auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+					std::tie(*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o0),
+							 *reinterpret_cast<typename TypeDescriptor<OutType2>::T *>(o1)) =
+						Functor()(x);
+					i0 += steps[0];
+					o0 += steps[1];
+					o1 += steps[2];
+				}
+			}
+		};
+
+		template <typename InType, typename OutType, typename Functor>
+		struct BinaryUFunc
+		{
+			static std::vector<int> Types()
+			{
+				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<InType>::Dtype(),
+						TypeDescriptor<OutType>::Dtype()};
+			}
+			static void Call(char **args, const npy_intp *dimensions,
+							 const npy_intp *steps, void *data)
+			{
+#ifdef DEBUG_CALLS
+				std::cout << "BinaryUFunc->Call\n";
+#endif
+				if (StridedKernel<Functor>::kLoop && StridedKernel<Functor>::kLoop(args, *dimensions, steps))
+				{
+					return;
+				}
+				const char *i0 = args[0];
+				const char *i1 = args[1];
+				char *o = args[2];
+				// A zero-stride operand that is also the output is a reduction's
+				// accumulator, not a broadcast value.
+				bool fixed0 = steps[0] == 0 && i0 != o, fixed1 = steps[1] == 0 && i1 != o;
+				if (*dimensions >= kPosit8_2BroadcastMin && (fixed0 || fixed1))
+				{
+					bool fixed_first = !fixed1;
+					uint8 fixed = *reinterpret_cast<const uint8 *>(fixed_first ? i0 : i1);
+					Posit8_2BroadcastLoop<Functor>(fixed, fixed_first, fixed_first ? i1 : i0,
+												   steps[fixed_first ? 1 : 0], o, steps[2], *dimensions);
+				}
+				else
+				{
+					for (npy_intp k = 0; k < *dimensions; k++)
+					{
+						auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+						auto y = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i1);
+						*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
+							Functor()(x, y);
+						i0 += steps[0];
+						i1 += steps[1];
+						o += steps[2];
+					}
+				}
+			}
+		};
+
+		template <typename InType, typename InType2, typename OutType, typename Functor>
+		struct BinaryUFunc2
+		{
+			static std::vector<int> Types()
+			{
+				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<InType2>::Dtype(),
+						TypeDescriptor<OutType>::Dtype()};
+			}
+			static void Call(char **args, const npy_intp *dimensions,
+							 const npy_intp *steps, void *data)
+			{
+#ifdef DEBUG_CALLS
+				std::cout << "BinaryUFunc2->Call\n";
+#endif
+				if (StridedKernel<Functor>::kLoop && StridedKernel<Functor>::kLoop(args, *dimensions, steps))
+				{
+					return;
+				}
+				const char *i0 = args[0];
+				const char *i1 = args[1];
+				char *o = args[2];
+				if (steps[1] == 0 && i1 != o)
+				{
+					const auto y =
+						*reinterpret_cast<const typename TypeDescriptor<InType2>::T *>(i1);
+					for (npy_intp k = 0; k < *dimensions; k++)
+					{
+						auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+						*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
+							Functor()(x, y);
+						i0 += steps[0];
+						o += steps[2];
+					}
+				}
+				else
+				{
+					for (npy_intp k = 0; k < *dimensions; k++)
+					{
+						auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+						auto y =
+							*reinterpret_cast<const typename TypeDescriptor<InType2>::T *>(i1);
+						*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
+							Functor()(x, y);
+						i0 += steps[0];
+						i1 += steps[1];
+						o += steps[2];
+					}
+				}
+			}
+		};
+
+		template <typename InType, typename OutType, typename Functor>
+		struct TernaryUFunc
+		{
+			static std::vector<int> Types()
+			{
+				return {TypeDescriptor<InType>::Dtype(), TypeDescriptor<InType>::Dtype(),
+						TypeDescriptor<InType>::Dtype(), TypeDescriptor<OutType>::Dtype()};
+			}
+			static void Call(char **args, const npy_intp *dimensions,
+							 const npy_intp *steps, void *data)
+			{
+				if (StridedKernel<Functor>::kLoop && StridedKernel<Functor>::kLoop(args, *dimensions, steps))
+				{
+					return;
+				}
+				const char *i0 = args[0];
+				const char *i1 = args[1];
+				const char *i2 = args[2];
+				char *o = args[3];
+				for (npy_intp k = 0; k < *dimensions; k++)
+				{
+					auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+					auto y = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i1);
+					auto z = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i2);
+					*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) = Functor()(x, y, z);
+					i0 += steps[0];
+					i1 += steps[1];
+					i2 += steps[2];
+					o += steps[3];
+				}
+			}
+		};
+
+		// posit8_2 values as doubles for comparing them, with NaR, which posits
+		// order below every real, as -inf.
+		const std::vector<double> &Posit8_2OrderTable()
+		{
+			static const std::vector<double> table = []
+			{
+				std::vector<double> t = FromPosit8_2Table<double>();
+				for (double &v : t)
+				{
+					v = std::isnan(v) ? -std::numeric_limits<double>::infinity() : v;
+				}
+				return t;
+			}();
+			return table;
+		}
+
+		constexpr npy_intp kMixedBlock = 256;
+
+		// Loop for a binary functor on posit8_2 and 'Other' (the second operand,
+		// or the first if 'Swapped'), a type whose values double holds exactly. A
+		// block at a time, posits are decoded through a table, the other operand
+		// is widened to double and the functor's double overload computes exactly
+		// or nearly so; arithmetic results are then rounded to posit8_2 together by
+		// DoublesToPosit8_2. So, as NumPy does for float16, the result stays
+		// posit8_2 without rounding the other operand first. Inputs overlapping
+		// the output go one element at a time.
+		template <typename Other, typename OutType, typename Functor, bool Swapped = false>
+		struct BinaryUFuncMixed
+		{
+			static std::vector<int> Types()
+			{
+				int other = TypeDescriptor<Other>::Dtype(), self = TypeDescriptor<posit8_2>::Dtype();
+				return {Swapped ? other : self, Swapped ? self : other,
+						TypeDescriptor<OutType>::Dtype()};
+			}
+			static void Call(char **args, const npy_intp *dimensions,
+							 const npy_intp *steps, void *data)
+			{
+				typedef typename TypeDescriptor<Other>::T T;
+				constexpr bool kCompare = std::is_same<OutType, bool>::value;
+				const int self = Swapped ? 1 : 0, other = Swapped ? 0 : 1;
+				const char *i0 = args[self];
+				const char *i1 = args[other];
+				char *o = args[2];
+				const npy_intp n = *dimensions;
+				const npy_intp block =
+					Overlaps(i0, steps[self], o, steps[2], n) || Overlaps(i1, steps[other], o, steps[2], n, sizeof(T))
+						? 1
+						: kMixedBlock;
+				const double *decode = kCompare ? Posit8_2OrderTable().data() : FromPosit8_2Table<double>().data();
+				double xs[kMixedBlock], ys[kMixedBlock], results[kMixedBlock];
+				uint8 out[kMixedBlock];
+				double *ps = Swapped ? ys : xs, *ts = Swapped ? xs : ys;
+				for (npy_intp i = 0; i < n; i += block)
+				{
+					const npy_intp m = std::min(block, n - i);
+					for (npy_intp k = 0; k < m; ++k)
+					{
+						ps[k] = decode[*reinterpret_cast<const uint8 *>(i0 + k * steps[self])];
+						ts[k] = static_cast<double>(*reinterpret_cast<const T *>(i1 + k * steps[other]));
+					}
+					if (kCompare)
+					{
+						for (npy_intp k = 0; k < m; ++k)
+						{
+							out[k] = Functor()(xs[k], ys[k]);
+						}
+					}
+					else
+					{
+						for (npy_intp k = 0; k < m; ++k)
+						{
+							results[k] = Functor()(xs[k], ys[k]);
+						}
+						DoublesToPosit8_2(results, out, m);
+					}
+					for (npy_intp k = 0; k < m; ++k)
+					{
+						*reinterpret_cast<uint8 *>(o + k * steps[2]) = out[k];
+					}
+					i0 += m * steps[self];
+					i1 += m * steps[other];
+					o += m * steps[2];
+				}
+			}
+		};
+
+		// fma on float64, the ufunc's one built-in loop. NumPy tries the posit8_2 loop
+		// first and casts Python and NumPy scalars to it by value, so this only
+		// runs when an array operand does not cast safely to posit8_2.
+		struct TernaryUFuncFmaDouble
+		{
+			static void Call(char **args, const npy_intp *dimensions,
+							 const npy_intp *steps, void *data)
+			{
+				const char *i0 = args[0];
+				const char *i1 = args[1];
+				const char *i2 = args[2];
+				char *o = args[3];
+				for (npy_intp k = 0; k < *dimensions; k++)
+				{
+					*reinterpret_cast<double *>(o) = std::fma(*reinterpret_cast<const double *>(i0),
+															  *reinterpret_cast<const double *>(i1),
+															  *reinterpret_cast<const double *>(i2));
+					i0 += steps[0];
+					i1 += steps[1];
+					i2 += steps[2];
+					o += steps[3];
+				}
+			}
+		};
+
+		// template <typename InType, typename OutType, typename Functor>
+		// struct BinaryUFuncObj
+		// {
+		// 	static std::vector<int> Types()
+		// 	{
+		// 		return {TypeDescriptor<InType>::Dtype(), NPY_OBJECT,
+		// 				TypeDescriptor<OutType>::Dtype()};
+		// 	}
+		// 	static void Call(char **args, const npy_intp *dimensions,
+		// 					 const npy_intp *steps, void *data)
+		// 	{
+		// 		const char *i0 = args[0];
+		// 		char *i1 = args[1];
+		// 		char *o = args[2];
+		// 		for (npy_intp k = 0; k < *dimensions; k++)
+		// 		{
+		// 			auto x = *reinterpret_cast<const typename TypeDescriptor<InType>::T *>(i0);
+		// 			posit8_2 y = *reinterpret_cast<posit8_2 *>(i1);
+		// 			*reinterpret_cast<typename TypeDescriptor<OutType>::T *>(o) =
+		// 				Functor()(x, y);
+		// 			i0 += steps[0];
+		// 			i1 += steps[1];
+		// 			o += steps[2];
+		// 		}
+		// 	}
+		// };
+
+		// Adds the loop of UFunc to 'ufunc_obj', called 'name' in errors.
+		template <typename UFunc>
+		bool RegisterUFuncLoop(PyObject *ufunc_obj, const char *name)
+		{
+			std::vector<int> types = UFunc::Types();
+			PyUFuncGenericFunction fn =
+				reinterpret_cast<PyUFuncGenericFunction>(UFunc::Call);
+			PyUFuncObject *ufunc = reinterpret_cast<PyUFuncObject *>(ufunc_obj);
+			if (static_cast<int>(types.size()) != ufunc->nargs)
+			{
+				PyErr_Format(PyExc_AssertionError,
+							 "ufunc %s takes %d arguments, loop takes %lu", name,
+							 ufunc->nargs, types.size());
+				return false;
+			}
+			if (PyUFunc_RegisterLoopForType(ufunc, npy_posit8_2, fn,
+											const_cast<int *>(types.data()),
+											nullptr) < 0)
+			{
+				return false;
+			}
+			return true;
+		}
+
+		template <typename UFunc>
+		bool RegisterUFunc(PyObject *numpy, const char *name)
+		{
+			Safe_PyObjectPtr ufunc_obj = make_safe(PyObject_GetAttrString(numpy, name));
+			return ufunc_obj && RegisterUFuncLoop<UFunc>(ufunc_obj.get(), name);
+		}
+
+		namespace ufuncs
+		{
+
+			// The double overloads of arithmetic and comparisons are for
+			// BinaryUFuncMixed, which rounds the arithmetic results itself.
+			struct Add
+			{
+				posit8_2 operator()(posit8_2 a, posit8_2 b) { return a + b; }
+				double operator()(double a, double b) { return a + b; }
+			};
+			struct Subtract
+			{
+				posit8_2 operator()(posit8_2 a, posit8_2 b) { return a - b; }
+				double operator()(double a, double b) { return a - b; }
+			};
+			struct Multiply
+			{
+				posit8_2 operator()(posit8_2 a, posit8_2 b) { return a * b; }
+				double operator()(double a, double b) { return a * b; }
+			};
+			struct TrueDivide
+			{
+				posit8_2 operator()(posit8_2 a, posit8_2 b) { return a / b; }
+				double operator()(double a, double b) { return a / b; }
+			};
+			// a * b + c rounded once, as accumulating in a quire would round it. The
+			// product of two posit8_2 values is exact in float and TwoSum gives the
+			// rounding error of the sum, so the sum rounded to odd and narrowed to
+			// a bfloat16 index with a sticky bit, as the wide integer casts do,
+			// still rounds to the posit8_2 nearest the exact value.
+			struct Fma
+			{
+				posit8_2 operator()(posit8_2 a, posit8_2 b, posit8_2 c)
+				{
+					float p = static_cast<float>(a) * static_cast<float>(b);
+					float z = static_cast<float>(c);
+					float s = p + z;
+					float t = s - p;
+					float err = (p - (s - t)) + (z - t);
+					std::uint32_t bits, err_bits;
+					memcpy(&bits, &s, sizeof(bits));
+					memcpy(&err_bits, &err, sizeof(err_bits));
+					if (err != 0.0f && !(bits & 1))
+					{
+						// One step away from zero if the error has the sign of the
+						// sum, toward it otherwise.
+						bits += (bits ^ err_bits) >> 31 ? ~0u : 1u;
+					}
+					return Posit8_2FromBits(Bfloat16ToPosit8_2Table()[(bits >> 16) | ((bits & 0xffffu) != 0)]);
+				}
+			};
+
+			std::pair<float, float> divmod(float a, float b)
+			{
+				if (b == 0.0f)
+				{
+					float nan = std::numeric_limits<float>::quiet_NaN();
+					return {nan, nan};
+				}
+				float mod = std::fmod(a, b);
+				float div = (a - mod) / b;
+				if (mod != 0.0f)
+				{
+					if ((b < 0.0f) != (mod < 0.0f))
+					{
+						mod += b;
+						div -= 1.0f;
+					}
+				}
+				else
+				{
+					mod = std::copysign(0.0f, b);
+				}
+
+				float floordiv;
+				if (div != 0.0f)
+				{
+					floordiv = std::floor(div);
+					if (div - floordiv > 0.5f)
+					{
+						floordiv += 1.0f;
+					}
+				}
+				else
+				{
+					floordiv = std::copysign(0.0f, a / b);
+				}
+				return {floordiv, mod};
+			}
+
+			struct Divmod
+			{
+				std::pair<posit8_2, posit8_2> operator()(posit8_2 a, posit8_2 b)
+				{
+					float floordiv, mod;
+					std::tie(floordiv, mod) = divmod(static_cast<float>(a), static_cast<float>(b));
+					return {posit8_2(floordiv), posit8_2(mod)};
+				}
+			};
+			struct FloorDivide
+			{
+				posit8_2 operator()(posit8_2 a, posit8_2 b) { return Divmod()(a, b).first; }
+			};
+			struct Remainder
+			{
+				posit8_2 operator()(posit8_2 a, posit8_2 b) { return Divmod()(a, b).second; }
+			};
+			struct DivmodUFunc
+			{
+				static std::vector<int> Types()
+				{
+					return {npy_posit8_2, npy_posit8_2, npy_posit8_2, npy_posit8_2};
+				}
+				static void Call(char **args, npy_intp *dimensions, npy_intp *steps,
+								 void *data)
+				{
+					Posit8_2DivmodLoop<Divmod>(args, *dimensions, steps);
+				}
+			};
+			struct Fmod
+			{
+				posit8_2 operator()(posit8_2 a, posit8_2 b)
+				{
+					return posit8_2(std::fmod(static_cast<float>(a), static_cast<float>(b)));
+				}
+			};
+			struct Negative
+			{
+				posit8_2 operator()(posit8_2 a) { return -a; }
+			};
+			struct Positive
+			{
+				posit8_2 operator()(posit8_2 a) { return a; }
+			};
+			struct Power
+			{
+				posit8_2 operator()(posit8_2 a, posit8_2 b)
+				{
+					return posit8_2(std::pow(static_cast<float>(a), static_cast<float>(b)));
+				}
+			};
+			struct Abs
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return static_cast<int8>(Posit8_2Bits(a)) < 0 ? -a : a;
+				}
+			};
+			struct Cbrt
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::cbrt(static_cast<float>(a)));
+				}
+			};
+			struct Ceil
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::ceil(static_cast<float>(a)));
+				}
+			};
+			struct CopySign
+			{
+				posit8_2 operator()(posit8_2 a, posit8_2 b)
+				{
+					posit8_2 magnitude = Abs()(a);
+					return Posit8_2Bits(b) > 0x80 ? -magnitude : magnitude;
+				}
+			};
+			struct Exp
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::exp(static_cast<float>(a)));
+				}
+			};
+			struct Exp2
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::exp2(static_cast<float>(a)));
+				}
+			};
+			struct Expm1
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::expm1(static_cast<float>(a)));
+				}
+			};
+			struct Floor
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::floor(static_cast<float>(a)));
+				}
+			};
+			struct Frexp
+			{
+				std::pair<posit8_2, int> operator()(posit8_2 a)
+				{
+					int exp;
+					float f = std::frexp(static_cast<float>(a), &exp);
+					return {posit8_2(f), exp};
+				}
+			};
+			struct Heaviside
+			{
+				posit8_2 operator()(posit8_2 bx, posit8_2 h0)
+				{
+					float x = static_cast<float>(bx);
+					if (Eigen::numext::isnan(x))
+					{
+						return bx;
+					}
+					if (x < 0)
+					{
+						return posit8_2(0.0f);
+					}
+					if (x > 0)
+					{
+						return posit8_2(1.0f);
+					}
+					return h0; // x == 0
+				}
+			};
+			struct Conjugate
+			{
+				posit8_2 operator()(posit8_2 a) { return a; }
+			};
+			struct IsFinite
+			{
+				bool operator()(posit8_2 a) { return std::isfinite(static_cast<float>(a)); }
+			};
+			struct IsInf
+			{
+				bool operator()(posit8_2 a) { return std::isinf(static_cast<float>(a)); }
+			};
+			struct IsNan
+			{
+				bool operator()(posit8_2 a)
+				{
+					return Eigen::numext::isnan(static_cast<float>(a));
+				}
+			};
+			struct Ldexp
+			{
+				posit8_2 operator()(posit8_2 a, int exp)
+				{
+					// Exact in double, and the result saturates beyond the range.
+					exp = std::max(-kPosit8_2LdexpRange, std::min(kPosit8_2LdexpRange, exp));
+					return posit8_2(std::ldexp(static_cast<double>(a), exp));
+				}
+			};
+			struct Log
 			{
 				posit8_2 operator()(posit8_2 a)
 				{
-					return posit8_2(std::cbrt(static_cast<float>(a)));
+					return posit8_2(std::log(static_cast<float>(a)));
 				}
 			};
-			struct Ceil
+			struct Log2
 			{
 				posit8_2 operator()(posit8_2 a)
 				{
-					return posit8_2(std::ceil(static_cast<float>(a)));
+					return posit8_2(std::log2(static_cast<float>(a)));
 				}
 			};
-			struct CopySign
+			struct Log10
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::log10(static_cast<float>(a)));
+				}
+			};
+			struct Log1p
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::log1p(static_cast<float>(a)));
+				}
+			};
+			struct LogAddExp
+			{
+				posit8_2 operator()(posit8_2 bx, posit8_2 by)
+				{
+					float x = static_cast<float>(bx);
+					float y = static_cast<float>(by);
+					if (x == y)
+					{
+						// Handles infinities of the same sign.
+						return posit8_2(x + std::log(2.0f));
+					}
+					float out = std::numeric_limits<float>::quiet_NaN();
+					if (x > y)
+					{
+						out = x + std::log1p(std::exp(y - x));
+					}
+					else if (x < y)
+					{
+						out = y + std::log1p(std::exp(x - y));
+					}
+					return posit8_2(out);
+				}
+			};
+			struct LogAddExp2
+			{
+				posit8_2 operator()(posit8_2 bx, posit8_2 by)
+				{
+					float x = static_cast<float>(bx);
+					float y = static_cast<float>(by);
+					if (x == y)
+					{
+						// Handles infinities of the same sign.
+						return posit8_2(x + 1.0f);
+					}
+					float out = std::numeric_limits<float>::quiet_NaN();
+					if (x > y)
+					{
+						out = x + std::log1p(std::exp2(y - x)) / std::log(2.0f);
+					}
+					else if (x < y)
+					{
+						out = y + std::log1p(std::exp2(x - y)) / std::log(2.0f);
+					}
+					return posit8_2(out);
+				}
+			};
+			struct Modf
+			{
+				std::pair<posit8_2, posit8_2> operator()(posit8_2 a)
+				{
+					float integral;
+					float f = std::modf(static_cast<float>(a), &integral);
+					return {posit8_2(f), posit8_2(integral)};
+				}
+			};
+
+			struct Reciprocal
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(1.f / static_cast<float>(a));
+				}
+			};
+			struct Rint
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::rint(static_cast<float>(a)));
+				}
+			};
+			struct Sign
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					float f(a);
+					if (f < 0)
+					{
+						return posit8_2(-1);
+					}
+					if (f > 0)
+					{
+						return posit8_2(1);
+					}
+					return a;
+				}
+			};
+			struct SignBit
+			{
+				// Negative encodings are 0x81 to 0xff; NaR, 0x80, has no sign.
+				bool operator()(posit8_2 a) { return Posit8_2Bits(a) > 0x80; }
+			};
+			struct Sqrt
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::sqrt(static_cast<float>(a)));
+				}
+			};
+			struct Square
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					float f(a);
+					return posit8_2(f * f);
+				}
+			};
+			struct Trunc
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::trunc(static_cast<float>(a)));
+				}
+			};
+
+			// Trigonometric functions
+			struct Sin
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::sin(static_cast<float>(a)));
+				}
+			};
+			struct Cos
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::cos(static_cast<float>(a)));
+				}
+			};
+			struct Tan
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::tan(static_cast<float>(a)));
+				}
+			};
+			struct Arcsin
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::asin(static_cast<float>(a)));
+				}
+			};
+			struct Arccos
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::acos(static_cast<float>(a)));
+				}
+			};
+			struct Arctan
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::atan(static_cast<float>(a)));
+				}
+			};
+			struct Arctan2
 			{
 				posit8_2 operator()(posit8_2 a, posit8_2 b)
 				{
-					return posit8_2(
-						std::copysign(static_cast<float>(a), static_cast<float>(b)));
+					return posit8_2(std::atan2(static_cast<float>(a), static_cast<float>(b)));
 				}
 			};
-			struct Exp
+			struct Hypot
+			{
+				posit8_2 operator()(posit8_2 a, posit8_2 b)
+				{
+					return posit8_2(std::hypot(static_cast<float>(a), static_cast<float>(b)));
+				}
+			};
+			struct Sinh
 			{
 				posit8_2 operator()(posit8_2 a)
 				{
-					return posit8_2(std::exp(static_cast<float>(a)));
+					return posit8_2(std::sinh(static_cast<float>(a)));
 				}
 			};
-			struct Exp2
+			struct Cosh
 			{
 				posit8_2 operator()(posit8_2 a)
 				{
-					return posit8_2(std::exp2(static_cast<float>(a)));
+					return posit8_2(std::cosh(static_cast<float>(a)));
 				}
 			};
-			struct Expm1
+			struct Tanh
 			{
 				posit8_2 operator()(posit8_2 a)
 				{
-					return posit8_2(std::expm1(static_cast<float>(a)));
+					return posit8_2(std::tanh(static_cast<float>(a)));
 				}
 			};
-			struct Floor
+			struct Arcsinh
 			{
 				posit8_2 operator()(posit8_2 a)
 				{
-					return posit8_2(std::floor(static_cast<float>(a)));
+					return posit8_2(std::asinh(static_cast<float>(a)));
 				}
 			};
-			struct Frexp
+			struct Arccosh
 			{
-				std::pair<posit8_2, int> operator()(posit8_2 a)
+				posit8_2 operator()(posit8_2 a)
 				{
-					int exp;
-					float f = std::frexp(static_cast<float>(a), &exp);
-					return {posit8_2(f), exp};
+					return posit8_2(std::acosh(static_cast<float>(a)));
 				}
 			};
-			struct Heaviside
+			struct Arctanh
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					return posit8_2(std::atanh(static_cast<float>(a)));
+				}
+			};
+			struct Deg2rad
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					static constexpr float radians_per_degree = M_PI / 180.0f;
+					return posit8_2(static_cast<float>(a) * radians_per_degree);
+				}
+			};
+			struct Rad2deg
+			{
+				posit8_2 operator()(posit8_2 a)
+				{
+					static constexpr float degrees_per_radian = 180.0f / M_PI;
+					return posit8_2(static_cast<float>(a) * degrees_per_radian);
+				}
+			};
+
+			struct Eq
+			{
+				npy_bool operator()(posit8_2 a, posit8_2 b) { return a == b; }
+				npy_bool operator()(double a, double b) { return a == b; }
+			};
+			struct Ne
+			{
+				npy_bool operator()(posit8_2 a, posit8_2 b) { return a != b; }
+				npy_bool operator()(double a, double b) { return a != b; }
+			};
+			struct Lt
 			{
-				posit8_2 operator()(posit8_2 bx, posit8_2 h0)
-				{
-					float x = static_cast<float>(bx);
-					if (Eigen::numext::isnan(x))
-					{
-						return bx;
-					}
-					if (x < 0)
-					{
-						return posit8_2(0.0f);
-					}
-					if (x > 0)
-					{
-						return posit8_2(1.0f);
-					}
-					return h0; // x == 0
-				}
+				npy_bool operator()(posit8_2 a, posit8_2 b) { return a < b; }
+				npy_bool operator()(double a, double b) { return a < b; }
 			};
-			struct Conjugate
+			struct Gt
 			{
-				posit8_2 operator()(posit8_2 a) { return a; }
+				npy_bool operator()(posit8_2 a, posit8_2 b) { return a > b; }
+				npy_bool operator()(double a, double b) { return a > b; }
 			};
-			struct IsFinite
+			struct Le
 			{
-				bool operator()(posit8_2 a) { return std::isfinite(static_cast<float>(a)); }
+				npy_bool operator()(posit8_2 a, posit8_2 b) { return a <= b; }
+				npy_bool operator()(double a, double b) { return a <= b; }
 			};
-			struct IsInf
+			struct Ge
 			{
-				bool operator()(posit8_2 a) { return std::isinf(static_cast<float>(a)); }
+				npy_bool operator()(posit8_2 a, posit8_2 b) { return a >= b; }
+				npy_bool operator()(double a, double b) { return a >= b; }
 			};
-			struct IsNan
+			struct Maximum
 			{
-				bool operator()(posit8_2 a)
+				posit8_2 operator()(posit8_2 a, posit8_2 b)
 				{
-					return Eigen::numext::isnan(static_cast<float>(a));
+					float fa(a), fb(b);
+					return Eigen::numext::isnan(fa) || fa > fb ? a : b;
 				}
 			};
-			struct Ldexp
+			struct Minimum
 			{
-				posit8_2 operator()(posit8_2 a, int exp)
+				posit8_2 operator()(posit8_2 a, posit8_2 b)
 				{
-					return posit8_2(std::ldexp(static_cast<float>(a), exp));
+					float fa(a), fb(b);
+					return Eigen::numext::isnan(fa) || fa < fb ? a : b;
 				}
 			};
-			struct Log
+			struct Fmax
 			{
-				posit8_2 operator()(posit8_2 a)
+				posit8_2 operator()(posit8_2 a, posit8_2 b)
 				{
-					return posit8_2(std::log(static_cast<float>(a)));
+					float fa(a), fb(b);
+					return Eigen::numext::isnan(fb) || fa > fb ? a : b;
 				}
 			};
-			struct Log2
+			struct Fmin
 			{
-				posit8_2 operator()(posit8_2 a)
+				posit8_2 operator()(posit8_2 a, posit8_2 b)
 				{
-					return posit8_2(std::log2(static_cast<float>(a)));
+					float fa(a), fb(b);
+					return Eigen::numext::isnan(fb) || fa < fb ? a : b;
 				}
 			};
-			struct Log10
+
+/*			struct LogicalNot
 			{
-				posit8_2 operator()(posit8_2 a)
-				{
-					return posit8_2(std::log10(static_cast<float>(a)));
-				}
+				npy_bool operator()(posit8_2 a) { return !a; }
 			};
-			struct Log1p
+			struct LogicalAnd
 			{
-				posit8_2 operator()(posit8_2 a)
+				npy_bool operator()(posit8_2 a, posit8_2 b) { return a && b; }
+			};
+			struct LogicalOr
+			{
+				npy_bool operator()(posit8_2 a, posit8_2 b) { return a || b; }
+			};
+			struct LogicalXor
+			{
+				npy_bool operator()(posit8_2 a, posit8_2 b)
 				{
-					return posit8_2(std::log1p(static_cast<float>(a)));
+					return static_cast<bool>(a) ^ static_cast<bool>(b);
 				}
 			};
-			struct LogAddExp
+*/
+			// The next posit8_2 toward 'to' is one encoding away, in the order of
+			// the encodings as int8. NaR if either is NaR.
+			struct NextAfter
 			{
-				posit8_2 operator()(posit8_2 bx, posit8_2 by)
+				posit8_2 operator()(posit8_2 from, posit8_2 to)
 				{
-					float x = static_cast<float>(bx);
-					float y = static_cast<float>(by);
-					if (x == y)
-					{
-						// Handles infinities of the same sign.
-						return posit8_2(x + std::log(2.0f));
-					}
-					float out = std::numeric_limits<float>::quiet_NaN();
-					if (x > y)
+					uint8 x = Posit8_2Bits(from), y = Posit8_2Bits(to);
+					if (x == 0x80 || y == 0x80)
 					{
-						out = x + std::log1p(std::exp(y - x));
+						return Posit8_2FromBits(0x80);
 					}
-					else if (x < y)
+					if (x == y)
 					{
-						out = y + std::log1p(std::exp(x - y));
+						return to;
 					}
-					return posit8_2(out);
+					bool up = static_cast<int8>(x) < static_cast<int8>(y);
+					return Posit8_2FromBits(static_cast<uint8>(up ? x + 1 : x - 1));
 				}
 			};
-			struct LogAddExp2
+
+			// The gap between 'a' and the next posit8_2 away from zero, signed like
+			// 'a' and rounded to posit8_2; minpos for zero. maxpos has no next
+			// value, so its spacing is NaR and overflows, as the largest float's
+			// spacing does.
+			struct Spacing
 			{
-				posit8_2 operator()(posit8_2 bx, posit8_2 by)
+				posit8_2 operator()(posit8_2 a)
 				{
-					float x = static_cast<float>(bx);
-					float y = static_cast<float>(by);
-					if (x == y)
-					{
-						// Handles infinities of the same sign.
-						return posit8_2(x + 1.0f);
-					}
-					float out = std::numeric_limits<float>::quiet_NaN();
-					if (x > y)
+					uint8 x = Posit8_2Bits(a);
+					if (x == 0x7f || x == 0x81)
 					{
-						out = x + std::log1p(std::exp2(y - x)) / std::log(2.0f);
+						feraiseexcept(FE_OVERFLOW);
+						return Posit8_2FromBits(0x80);
 					}
-					else if (x < y)
+					if (x == 0x80 || x == 0)
 					{
-						out = y + std::log1p(std::exp2(x - y)) / std::log(2.0f);
+						return Posit8_2FromBits(x == 0 ? 1 : 0x80);
 					}
-					return posit8_2(out);
+					uint8 next = static_cast<int8>(x) < 0 ? x - 1 : x + 1;
+					return posit8_2(static_cast<double>(Posit8_2FromBits(next)) - static_cast<double>(a));
 				}
 			};
-			struct Modf
+
+		} // namespace ufuncs
+
+#ifdef POSIT8_VECTOR_KERNELS
+		namespace kernels
+		{
+			typedef float Floats __attribute__((vector_size(4 * kLanes)));
+			typedef std::uint32_t Words __attribute__((vector_size(4 * kLanes)));
+
+			// ufuncs::Fma on 16 lanes. Widening and narrowing are table loads per
+			// lane; the arithmetic in between is vectorized.
+			template <std::size_t... l>
+			POSIT8_KERNEL_INLINE Bytes Fma(Bytes a, Bytes b, Bytes c, const uint16 *widen, const uint8 *narrow,
+										   std::index_sequence<l...>)
+			{
+				Floats x = (Floats)(Words{widen[a[l]]...} << 16);
+				Floats y = (Floats)(Words{widen[b[l]]...} << 16);
+				Floats z = (Floats)(Words{widen[c[l]]...} << 16);
+				Floats p = x * y, s = p + z, t = s - p;
+				Floats err = (p - (s - t)) + (z - t);
+				Words bits = (Words)s;
+				Words to_odd = (Words)((err != 0.0f) & ((bits & 1) == 0));
+				bits += to_odd & (1 - 2 * ((bits ^ (Words)err) >> 31));
+				Words index = (bits >> 16) | ((Words)((bits & 0xffff) != 0) & 1);
+				return Bytes{narrow[index[l]]...};
+			}
+
+			template <typename Functor>
+			bool FmaLoop(char **args, npy_intp n, const npy_intp *steps)
 			{
-				std::pair<posit8_2, posit8_2> operator()(posit8_2 a)
+				if (n <= 0 || Overlaps(args[0], steps[0], args[3], steps[3], n) ||
+					Overlaps(args[1], steps[1], args[3], steps[3], n) || Overlaps(args[2], steps[2], args[3], steps[3], n))
 				{
-					float integral;
-					float f = std::modf(static_cast<float>(a), &integral);
-					return {posit8_2(f), posit8_2(integral)};
+					return false;
 				}
-			};
+				const uint16 *widen = Posit8_2ToBfloat16Table().data();
+				const uint8 *narrow = Bfloat16ToPosit8_2Table().data();
+				const char *x = args[0], *y = args[1], *z = args[2];
+				char *o = args[3];
+				npy_intp i = 0;
+				for (; i + kLanes <= n; i += kLanes)
+				{
+					Bytes a = Load(x, steps[0], std::make_index_sequence<kLanes>());
+					Bytes b = Load(y, steps[1], std::make_index_sequence<kLanes>());
+					Bytes c = Load(z, steps[2], std::make_index_sequence<kLanes>());
+					Store(Fma(a, b, c, widen, narrow, std::make_index_sequence<kLanes>()), o, steps[3],
+						  std::make_index_sequence<kLanes>());
+					x += kLanes * steps[0];
+					y += kLanes * steps[1];
+					z += kLanes * steps[2];
+					o += kLanes * steps[3];
+				}
+				for (; i < n; ++i)
+				{
+					*reinterpret_cast<posit8_2 *>(o) =
+						Functor()(*reinterpret_cast<const posit8_2 *>(x), *reinterpret_cast<const posit8_2 *>(y),
+								  *reinterpret_cast<const posit8_2 *>(z));
+					x += steps[0];
+					y += steps[1];
+					z += steps[2];
+					o += steps[3];
+				}
+				return true;
+			}
+		} // namespace kernels
+#endif
 
-			struct Reciprocal
+#define POSIT8_STRIDED_KERNEL(name, loop)                                         \
+	template <>                                                                   \
+	struct StridedKernel<ufuncs::name>                                            \
+	{                                                                             \
+		static constexpr bool (*kLoop)(char **, npy_intp, const npy_intp *) = loop; \
+	}
+
+		POSIT8_STRIDED_KERNEL(Spacing, Posit8_2UnaryTableLoop<ufuncs::Spacing>);
+		POSIT8_STRIDED_KERNEL(Frexp, Posit8_2FrexpLoop<ufuncs::Frexp>);
+		POSIT8_STRIDED_KERNEL(Ldexp, Posit8_2LdexpLoop<ufuncs::Ldexp>);
+		POSIT8_STRIDED_KERNEL(FloorDivide, Posit8_2FloorDivideLoop<ufuncs::Divmod>);
+		POSIT8_STRIDED_KERNEL(Remainder, Posit8_2RemainderLoop<ufuncs::Divmod>);
+		POSIT8_STRIDED_KERNEL(Modf, Posit8_2ModfLoop<ufuncs::Modf>);
+#ifdef POSIT8_VECTOR_KERNELS
+		POSIT8_STRIDED_KERNEL(Negative, (kernels::UnaryLoop<kernels::Negative, ufuncs::Negative>));
+		POSIT8_STRIDED_KERNEL(Abs, (kernels::UnaryLoop<kernels::Abs, ufuncs::Abs>));
+		POSIT8_STRIDED_KERNEL(SignBit, (kernels::UnaryLoop<kernels::SignBit, ufuncs::SignBit>));
+		POSIT8_STRIDED_KERNEL(CopySign, (kernels::BinaryLoop<kernels::CopySign, ufuncs::CopySign>));
+		POSIT8_STRIDED_KERNEL(NextAfter, (kernels::BinaryLoop<kernels::NextAfter, ufuncs::NextAfter>));
+		POSIT8_STRIDED_KERNEL(Fma, kernels::FmaLoop<ufuncs::Fma>);
+#endif
+
+		// NumPy has no fused multiply-add ufunc, so the module exports its own
+		// fma(a, b, c). Like the type it is created once per process.
+		PyObject *fma_ufunc = nullptr;
+
+		bool CreateFmaUFunc()
+		{
+			static PyUFuncGenericFunction double_loops[] = {TernaryUFuncFmaDouble::Call};
+			static void *double_data[] = {nullptr};
+			static char double_types[] = {NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE};
+			Safe_PyObjectPtr ufunc = make_safe(PyUFunc_FromFuncAndData(
+				double_loops, double_data, double_types, 1, 3, 1, PyUFunc_None, "fma",
+				"Fused multiply-add: a * b + c in one pass, without a temporary, rounded once to "
+				"posit8_2 as with a quire. Python and NumPy scalars are converted to posit8_2, as "
+				"by the arithmetic operators, and so are small integer and float16 arrays; a wider "
+				"array among the operands makes the whole computation float64.",
+				0));
+			if (!ufunc || !RegisterUFuncLoop<TernaryUFunc<posit8_2, posit8_2, ufuncs::Fma>>(ufunc.get(), "fma"))
 			{
-				posit8_2 operator()(posit8_2 a)
+				return false;
+			}
+			fma_ufunc = ufunc.release();
+			return true;
+		}
+
+		// Ufuncs made from Python callables by posit8_2.make_unary_ufunc and
+		// make_binary_ufunc. The callable is evaluated once over every input,
+		// however many NumPy operations it chains, and its results make a table
+		// that runs on the same loop as divmod and modf. Errors the callable raises
+		// are reported while tabulating, so the entries carry no exceptions. The
+		// capsule holding the table and the name is the ufunc's 'obj', which the
+		// ufunc releases when it is deallocated.
+		struct UserUFunc
+		{
+			std::string name;
+			std::vector<std::uint32_t> table;
+		};
+
+		void UserUnaryUFuncLoop(char **args, const npy_intp *dimensions, const npy_intp *steps, void *data)
+		{
+			Posit8_2PairTableLoop(*static_cast<const std::vector<std::uint32_t> *>(data), args[0], steps[0], nullptr,
+								  0, args[1], steps[1], nullptr, 0, *dimensions);
+		}
+
+		void UserBinaryUFuncLoop(char **args, const npy_intp *dimensions, const npy_intp *steps, void *data)
+		{
+			Posit8_2PairTableLoop(*static_cast<const std::vector<std::uint32_t> *>(data), args[0], steps[0], args[1],
+								  steps[1], args[2], steps[2], nullptr, 0, *dimensions);
+		}
+
+		void UserUFuncCapsuleDestructor(PyObject *capsule)
+		{
+			delete static_cast<UserUFunc *>(PyCapsule_GetPointer(capsule, "posit8_2.ufunc"));
+		}
+
+		Safe_PyObjectPtr NewPosit8_2Array(npy_intp n)
+		{
+			Py_INCREF(&NPyPosit8_2_Descr);
+			return make_safe(
+				PyArray_NewFromDescr(&PyArray_Type, &NPyPosit8_2_Descr, 1, &n, nullptr, nullptr, 0, nullptr));
+		}
+
+		PyObject *MakeUFunc(PyObject *args, PyObject *kwds, int nin, const char *method)
+		{
+			static const char *kwlist[] = {"fn", "name", nullptr};
+			PyObject *fn;
+			const char *name = nullptr;
+			std::string format = std::string("O|z:") + method;
+			if (!PyArg_ParseTupleAndKeywords(args, kwds, format.c_str(), const_cast<char **>(kwlist), &fn, &name))
+			{
+				return nullptr;
+			}
+			// Every input code, or every pair of them with the first one major.
+			npy_intp n = nin == 1 ? 256 : 256 * 256;
+			Safe_PyObjectPtr x = NewPosit8_2Array(n), y = nin == 1 ? nullptr : NewPosit8_2Array(n);
+			if (!x || (nin == 2 && !y))
+			{
+				return nullptr;
+			}
+			uint8 *xs = reinterpret_cast<uint8 *>(PyArray_DATA(reinterpret_cast<PyArrayObject *>(x.get())));
+			for (npy_intp i = 0; i < n; ++i)
+			{
+				xs[i] = static_cast<uint8>(nin == 1 ? i : i >> 8);
+			}
+			if (y)
+			{
+				uint8 *ys = reinterpret_cast<uint8 *>(PyArray_DATA(reinterpret_cast<PyArrayObject *>(y.get())));
+				for (npy_intp i = 0; i < n; ++i)
 				{
-					return posit8_2(1.f / static_cast<float>(a));
+					ys[i] = static_cast<uint8>(i);
 				}
-			};
-			struct Rint
+			}
+			Safe_PyObjectPtr result = make_safe(PyObject_CallFunctionObjArgs(fn, x.get(), y.get(), nullptr));
+			if (!result)
 			{
-				posit8_2 operator()(posit8_2 a)
+				return nullptr;
+			}
+			// The results may be of any type, or a single value, as long as they
+			// broadcast against the inputs.
+			Safe_PyObjectPtr values = make_safe(PyArray_FromAny(result.get(), nullptr, 0, 0, 0, nullptr));
+			Safe_PyObjectPtr codes = NewPosit8_2Array(n);
+			if (!values || !codes ||
+				PyArray_CopyInto(reinterpret_cast<PyArrayObject *>(codes.get()),
+								 reinterpret_cast<PyArrayObject *>(values.get())) < 0)
+			{
+				return nullptr;
+			}
+
+			std::unique_ptr<UserUFunc> user(new UserUFunc);
+			if (name)
+			{
+				user->name = name;
+			}
+			else
+			{
+				Safe_PyObjectPtr fn_name = make_safe(PyObject_GetAttrString(fn, "__name__"));
+				const char *utf8 = fn_name && PyUnicode_Check(fn_name.get()) ? PyUnicode_AsUTF8(fn_name.get()) : nullptr;
+				PyErr_Clear();
+				user->name = utf8 ? utf8 : "posit8_2_ufunc";
+			}
+			const uint8 *results = reinterpret_cast<const uint8 *>(PyArray_DATA(reinterpret_cast<PyArrayObject *>(codes.get())));
+			user->table.assign(results, results + n);
+
+			Safe_PyObjectPtr ufunc = make_safe(PyUFunc_FromFuncAndData(
+				nullptr, nullptr, nullptr, 0, nin, 1, PyUFunc_None, user->name.c_str(), nullptr, 0));
+			if (!ufunc)
+			{
+				return nullptr;
+			}
+			std::vector<int> types(nin + 1, npy_posit8_2);
+			if (PyUFunc_RegisterLoopForType(reinterpret_cast<PyUFuncObject *>(ufunc.get()), npy_posit8_2,
+											nin == 1 ? UserUnaryUFuncLoop : UserBinaryUFuncLoop, types.data(),
+											&user->table) < 0)
+			{
+				return nullptr;
+			}
+			PyObject *capsule = PyCapsule_New(user.get(), "posit8_2.ufunc", UserUFuncCapsuleDestructor);
+			if (!capsule)
+			{
+				return nullptr;
+			}
+			user.release();
+			reinterpret_cast<PyUFuncObject *>(ufunc.get())->obj = capsule;
+			return ufunc.release();
+		}
+
+		PyObject *PyPosit8_2_MakeUnaryUFunc(PyObject *module, PyObject *args, PyObject *kwds)
+		{
+			return MakeUFunc(args, kwds, 1, "make_unary_ufunc");
+		}
+
+		PyObject *PyPosit8_2_MakeBinaryUFunc(PyObject *module, PyObject *args, PyObject *kwds)
+		{
+			return MakeUFunc(args, kwds, 2, "make_binary_ufunc");
+		}
+
+		// posit8_2.evaluate: elementwise expressions such as "tanh(a * w + b) * s"
+		// in a single pass. The expression is compiled to a short program for a
+		// machine whose registers each hold kExprBlock float32 values, all of them
+		// small enough to stay in L1. Operands are broadcast by a buffered NumPy
+		// iterator and widened a block at a time, and only the final result is
+		// rounded to posit8_2, so unlike the equivalent chain of ufuncs nothing is
+		// rounded in between and no full-size temporaries are allocated.
+		enum ExprOp : uint8
+		{
+			kExprLoad,
+			kExprConst,
+			kExprNegative,
+			kExprAdd,
+			kExprSubtract,
+			kExprMultiply,
+			kExprDivide,
+			kExprPower,
+			kExprPowerConst,
+			kExprMaximum,
+			kExprMinimum,
+			kExprAbs,
+			kExprSqrt,
+			kExprExp,
+			kExprExp2,
+			kExprExpm1,
+			kExprLog,
+			kExprLog2,
+			kExprLog10,
+			kExprLog1p,
+			kExprTanh,
+			kExprSin,
+			kExprCos,
+		};
+
+		// Replaces register 'dst' by op(dst) or op(dst, dst + 1). Loads read
+		// operand 'operand'; constants and constant exponents are 'value'.
+		struct ExprStep
+		{
+			ExprOp op;
+			int dst;
+			int operand;
+			float value;
+		};
+
+		struct ExprProgram
+		{
+			std::vector<ExprStep> steps;
+			// Operand names, in order of first use.
+			std::vector<std::string> names;
+			int registers = 0;
+		};
+
+		struct ExprFunction
+		{
+			const char *name;
+			ExprOp op;
+			int arity;
+		};
+
+		const ExprFunction kExprFunctions[] = {
+			{"abs", kExprAbs, 1},
+			{"sqrt", kExprSqrt, 1},
+			{"exp", kExprExp, 1},
+			{"exp2", kExprExp2, 1},
+			{"expm1", kExprExpm1, 1},
+			{"log", kExprLog, 1},
+			{"log2", kExprLog2, 1},
+			{"log10", kExprLog10, 1},
+			{"log1p", kExprLog1p, 1},
+			{"tanh", kExprTanh, 1},
+			{"sin", kExprSin, 1},
+			{"cos", kExprCos, 1},
+			{"maximum", kExprMaximum, 2},
+			{"minimum", kExprMinimum, 2},
+			{"power", kExprPower, 2},
+		};
+
+		constexpr npy_intp kExprBlock = 256;
+		constexpr int kExprMaxRegisters = 16;
+		constexpr int kExprMaxDepth = 64;
+
+		// Recursive descent over + - * / **, unary signs, parentheses, numbers,
+		// names and calls of kExprFunctions, with Python's precedences. Each
+		// subexpression is compiled to leave its value in the register it is
+		// given, and its operands in the registers above, so registers are
+		// allocated like a stack.
+		class ExprParser
+		{
+		public:
+			ExprParser(const char *text, ExprProgram *program) : text_(text), p_(text), program_(program) {}
+
+			// Sets a Python exception and returns false if the text is not an
+			// expression.
+			bool Parse()
+			{
+				SkipSpaces();
+				if (!Sum(0))
 				{
-					return posit8_2(std::rint(static_cast<float>(a)));
+					return false;
 				}
-			};
-			struct Sign
+				return *p_ == '\0' || Error("unexpected character");
+			}
+
+		private:
+			void SkipSpaces()
 			{
-				posit8_2 operator()(posit8_2 a)
+				while (Py_ISSPACE(*p_))
 				{
-					float f(a);
-					if (f < 0)
-					{
-						return posit8_2(-1);
-					}
-					if (f > 0)
-					{
-						return posit8_2(1);
-					}
-					return a;
+					++p_;
 				}
-			};
-			struct SignBit
+			}
+
+			bool Error(const char *what)
 			{
-				bool operator()(posit8_2 a) { return std::signbit(static_cast<float>(a)); }
-			};
-			struct Sqrt
+				PyErr_Format(PyExc_ValueError, "%s at position %d of expression '%s'", what,
+							 static_cast<int>(p_ - text_), text_);
+				return false;
+			}
+
+			bool Emit(ExprOp op, int dst, float value = 0.0f, int operand = 0)
 			{
-				posit8_2 operator()(posit8_2 a)
+				program_->steps.push_back({op, dst, operand, value});
+				program_->registers = std::max(program_->registers, dst + 1);
+				return true;
+			}
+
+			// A constant right operand needs no register of its own.
+			bool EmitPower(int dst)
+			{
+				const ExprStep &last = program_->steps.back();
+				if (last.op == kExprConst && last.dst == dst + 1)
 				{
-					return posit8_2(std::sqrt(static_cast<float>(a)));
+					float value = last.value;
+					program_->steps.pop_back();
+					return Emit(kExprPowerConst, dst, value);
 				}
-			};
-			struct Square
+				return Emit(kExprPower, dst);
+			}
+
+			bool Sum(int r)
 			{
-				posit8_2 operator()(posit8_2 a)
+				if (depth_ >= kExprMaxDepth)
 				{
-					float f(a);
-					return posit8_2(f * f);
+					return Error("expression nested too deeply");
 				}
-			};
-			struct Trunc
-			{
-				posit8_2 operator()(posit8_2 a)
+				++depth_;
+				bool ok = Product(r);
+				while (ok && (*p_ == '+' || *p_ == '-'))
 				{
-					return posit8_2(std::trunc(static_cast<float>(a)));
+					ExprOp op = *p_ == '+' ? kExprAdd : kExprSubtract;
+					++p_;
+					SkipSpaces();
+					ok = Product(r + 1) && Emit(op, r);
 				}
-			};
+				--depth_;
+				return ok;
+			}
 
-			// Trigonometric functions
-			struct Sin
+			bool Product(int r)
 			{
-				posit8_2 operator()(posit8_2 a)
+				bool ok = Signed(r);
+				while (ok && ((*p_ == '*' && p_[1] != '*') || *p_ == '/'))
 				{
-					return posit8_2(std::sin(static_cast<float>(a)));
+					ExprOp op = *p_ == '*' ? kExprMultiply : kExprDivide;
+					++p_;
+					SkipSpaces();
+					ok = Signed(r + 1) && Emit(op, r);
 				}
-			};
-			struct Cos
+				return ok;
+			}
+
+			// As in Python, -x ** y is -(x ** y) and x ** -y is x ** (-y).
+			bool Signed(int r)
 			{
-				posit8_2 operator()(posit8_2 a)
+				bool negative = false;
+				while (*p_ == '-' || *p_ == '+')
 				{
-					return posit8_2(std::cos(static_cast<float>(a)));
+					negative ^= *p_ == '-';
+					++p_;
+					SkipSpaces();
 				}
-			};
-			struct Tan
-			{
-				posit8_2 operator()(posit8_2 a)
+				if (!Power(r))
 				{
-					return posit8_2(std::tan(static_cast<float>(a)));
+					return false;
 				}
-			};
-			struct Arcsin
-			{
-				posit8_2 operator()(posit8_2 a)
+				if (!negative)
 				{
-					return posit8_2(std::asin(static_cast<float>(a)));
+					return true;
 				}
-			};
-			struct Arccos
-			{
-				posit8_2 operator()(posit8_2 a)
+				ExprStep &last = program_->steps.back();
+				if (last.op == kExprConst && last.dst == r)
 				{
-					return posit8_2(std::acos(static_cast<float>(a)));
+					last.value = -last.value;
+					return true;
 				}
-			};
-			struct Arctan
+				return Emit(kExprNegative, r);
+			}
+
+			bool Power(int r)
 			{
-				posit8_2 operator()(posit8_2 a)
+				if (!Atom(r))
 				{
-					return posit8_2(std::atan(static_cast<float>(a)));
+					return false;
 				}
-			};
-			struct Arctan2
-			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b)
+				if (*p_ != '*' || p_[1] != '*')
 				{
-					return posit8_2(std::atan2(static_cast<float>(a), static_cast<float>(b)));
+					return true;
 				}
-			};
-			struct Hypot
+				p_ += 2;
+				SkipSpaces();
+				return Signed(r + 1) && EmitPower(r);
+			}
+
+			bool Atom(int r)
 			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b)
+				if (r >= kExprMaxRegisters)
 				{
-					return posit8_2(std::hypot(static_cast<float>(a), static_cast<float>(b)));
+					return Error("expression too complex");
 				}
-			};
-			struct Sinh
-			{
-				posit8_2 operator()(posit8_2 a)
+				if (Py_ISDIGIT(*p_) || (*p_ == '.' && Py_ISDIGIT(p_[1])))
 				{
-					return posit8_2(std::sinh(static_cast<float>(a)));
+					char *end;
+					double value = PyOS_string_to_double(p_, &end, nullptr);
+					if (value == -1.0 && PyErr_Occurred())
+					{
+						return false;
+					}
+					p_ = end;
+					SkipSpaces();
+					return Emit(kExprConst, r, static_cast<float>(value));
 				}
-			};
-			struct Cosh
-			{
-				posit8_2 operator()(posit8_2 a)
+				if (Py_ISALPHA(*p_) || *p_ == '_')
 				{
-					return posit8_2(std::cosh(static_cast<float>(a)));
+					const char *start = p_;
+					while (Py_ISALNUM(*p_) || *p_ == '_')
+					{
+						++p_;
+					}
+					std::string name(start, p_);
+					SkipSpaces();
+					if (*p_ != '(')
+					{
+						auto it = std::find(program_->names.begin(), program_->names.end(), name);
+						int operand = static_cast<int>(it - program_->names.begin());
+						if (it == program_->names.end())
+						{
+							program_->names.push_back(name);
+						}
+						return Emit(kExprLoad, r, 0.0f, operand);
+					}
+					const ExprFunction *function = nullptr;
+					for (const ExprFunction &f : kExprFunctions)
+					{
+						if (name == f.name)
+						{
+							function = &f;
+						}
+					}
+					if (!function)
+					{
+						p_ = start;
+						return Error("unknown function");
+					}
+					++p_;
+					SkipSpaces();
+					for (int k = 0; k < function->arity; ++k)
+					{
+						if (k > 0 && *p_ != ',')
+						{
+							return Error("expected ','");
+						}
+						if (k > 0)
+						{
+							++p_;
+							SkipSpaces();
+						}
+						if (!Sum(r + k))
+						{
+							return false;
+						}
+					}
+					if (*p_ != ')')
+					{
+						return Error("expected ')'");
+					}
+					++p_;
+					SkipSpaces();
+					return function->op == kExprPower ? EmitPower(r) : Emit(function->op, r);
 				}
-			};
-			struct Tanh
-			{
-				posit8_2 operator()(posit8_2 a)
+				if (*p_ == '(')
 				{
-					return posit8_2(std::tanh(static_cast<float>(a)));
+					++p_;
+					SkipSpaces();
+					if (!Sum(r))
+					{
+						return false;
+					}
+					if (*p_ != ')')
+					{
+						return Error("expected ')'");
+					}
+					++p_;
+					SkipSpaces();
+					return true;
 				}
-			};
-			struct Arcsinh
+				return Error(*p_ ? "unexpected character" : "unexpected end");
+			}
+
+			const char *text_;
+			const char *p_;
+			ExprProgram *program_;
+			int depth_ = 0;
+		};
+
+		template <typename F>
+		void ExprMap(float *a, const float *b, npy_intp m, F f)
+		{
+			for (npy_intp k = 0; k < m; ++k)
 			{
-				posit8_2 operator()(posit8_2 a)
-				{
-					return posit8_2(std::asinh(static_cast<float>(a)));
-				}
-			};
-			struct Arccosh
+				a[k] = f(a[k], b[k]);
+			}
+		}
+
+		// Runs a step on m elements of its registers, a = dst and b = dst + 1, with
+		// the floating-point status live, so that it raises what float32
+		// arithmetic does. Loads and constants are left to RunExprProgram.
+		void ExprScalarStep(const ExprStep &step, float *a, const float *b, npy_intp m)
+		{
+			const float value = step.value;
+			switch (step.op)
 			{
-				posit8_2 operator()(posit8_2 a)
+			case kExprNegative:
+				ExprMap(a, b, m, [](float x, float) { return -x; });
+				break;
+			case kExprAdd:
+				ExprMap(a, b, m, [](float x, float y) { return x + y; });
+				break;
+			case kExprSubtract:
+				ExprMap(a, b, m, [](float x, float y) { return x - y; });
+				break;
+			case kExprMultiply:
+				ExprMap(a, b, m, [](float x, float y) { return x * y; });
+				break;
+			case kExprDivide:
+				ExprMap(a, b, m, [](float x, float y) { return x / y; });
+				break;
+			case kExprPower:
+				ExprMap(a, b, m, [](float x, float y) { return std::pow(x, y); });
+				break;
+			case kExprPowerConst:
+				if (value == 2.0f)
 				{
-					return posit8_2(std::acosh(static_cast<float>(a)));
+					ExprMap(a, b, m, [](float x, float) { return x * x; });
 				}
-			};
-			struct Arctanh
-			{
-				posit8_2 operator()(posit8_2 a)
+				else
 				{
-					return posit8_2(std::atanh(static_cast<float>(a)));
+					ExprMap(a, b, m, [value](float x, float) { return std::pow(x, value); });
 				}
-			};
-			struct Deg2rad
+				break;
+			// NaNs propagate, as with np.maximum and np.minimum, and the
+			// comparisons are quiet.
+			case kExprMaximum:
+				ExprMap(a, b, m, [](float x, float y) { return x != x || (y == y && x >= y) ? x : y; });
+				break;
+			case kExprMinimum:
+				ExprMap(a, b, m, [](float x, float y) { return x != x || (y == y && x <= y) ? x : y; });
+				break;
+			case kExprAbs:
+				ExprMap(a, b, m, [](float x, float) { return std::fabs(x); });
+				break;
+			case kExprSqrt:
+				ExprMap(a, b, m, [](float x, float) { return std::sqrt(x); });
+				break;
+			case kExprExp:
+				ExprMap(a, b, m, [](float x, float) { return std::exp(x); });
+				break;
+			case kExprExp2:
+				ExprMap(a, b, m, [](float x, float) { return std::exp2(x); });
+				break;
+			case kExprExpm1:
+				ExprMap(a, b, m, [](float x, float) { return std::expm1(x); });
+				break;
+			case kExprLog:
+				ExprMap(a, b, m, [](float x, float) { return std::log(x); });
+				break;
+			case kExprLog2:
+				ExprMap(a, b, m, [](float x, float) { return std::log2(x); });
+				break;
+			case kExprLog10:
+				ExprMap(a, b, m, [](float x, float) { return std::log10(x); });
+				break;
+			case kExprLog1p:
+				ExprMap(a, b, m, [](float x, float) { return std::log1p(x); });
+				break;
+			case kExprTanh:
+				ExprMap(a, b, m, [](float x, float) { return std::tanh(x); });
+				break;
+			case kExprSin:
+				ExprMap(a, b, m, [](float x, float) { return std::sin(x); });
+				break;
+			case kExprCos:
+				ExprMap(a, b, m, [](float x, float) { return std::cos(x); });
+				break;
+			case kExprLoad:
+			case kExprConst:
+				break;
+			}
+		}
+
+		// Runs 'program' over n elements of the iterator's operands, the result
+		// being the last. 'registers' holds program.registers + 1 blocks: the
+		// registers and the one above the highest, which unary steps name as
+		// their unused second operand. Operands are widened through 'widen', the
+		// float value of every posit8_2, and results narrowed like ufuncs::Fma, by
+		// rounding to odd on the way to bfloat16 so that the rounding to posit8_2
+		// is the only one.
+		void RunExprProgram(const ExprProgram &program, char *const *data, const npy_intp *strides, npy_intp n,
+							const float *widen, float *registers)
+		{
+			const uint8 *narrow = Bfloat16ToPosit8_2Table().data();
+			const std::size_t out = program.names.size();
+			for (npy_intp i0 = 0; i0 < n; i0 += kExprBlock)
 			{
-				posit8_2 operator()(posit8_2 a)
+				const npy_intp m = std::min(kExprBlock, n - i0);
+				for (const ExprStep &step : program.steps)
 				{
-					static constexpr float radians_per_degree = M_PI / 180.0f;
-					return posit8_2(static_cast<float>(a) * radians_per_degree);
+					float *a = registers + step.dst * kExprBlock;
+					if (step.op == kExprLoad)
+					{
+						const char *in = data[step.operand] + i0 * strides[step.operand];
+						for (npy_intp k = 0; k < m; ++k)
+						{
+							a[k] = widen[*reinterpret_cast<const uint8 *>(in + k * strides[step.operand])];
+						}
+					}
+					else if (step.op == kExprConst)
+					{
+						std::fill(a, a + m, step.value);
+					}
+					else
+					{
+						ExprScalarStep(step, a, a + kExprBlock, m);
+					}
 				}
-			};
-			struct Rad2deg
-			{
-				posit8_2 operator()(posit8_2 a)
+				char *o = data[out] + i0 * strides[out];
+				for (npy_intp k = 0; k < m; ++k)
 				{
-					static constexpr float degrees_per_radian = 180.0f / M_PI;
-					return posit8_2(static_cast<float>(a) * degrees_per_radian);
+					std::uint32_t bits;
+					memcpy(&bits, registers + k, sizeof(bits));
+					*reinterpret_cast<uint8 *>(o + k * strides[out]) = narrow[(bits >> 16) | ((bits & 0xffffu) != 0)];
 				}
-			};
+			}
+		}
 
-			struct Eq
+		// Warns or raises for the FE_* flags in 'status' as np.errstate says, for
+		// functions that are not ufuncs, whose flags NumPy does not check. 'call'
+		// and 'log' are treated like 'warn'.
+		bool ReportFloatStatus(int status, const char *where)
+		{
+			static const struct
 			{
-				npy_bool operator()(posit8_2 a, posit8_2 b) { return a == b; }
-			};
-			struct EqFloat
+				int flag;
+				const char *key, *what;
+			} kErrors[] = {{FE_DIVBYZERO, "divide", "divide by zero"},
+						   {FE_OVERFLOW, "over", "overflow"},
+						   {FE_UNDERFLOW, "under", "underflow"},
+						   {FE_INVALID, "invalid", "invalid value"}};
+			if (!(status & kPosit8_2Exceptions))
 			{
-				npy_bool operator()(posit8_2 a, float b) { return a == posit8_2(b); }
-			};
-			struct EqDouble
+				return true;
+			}
+			Safe_PyObjectPtr numpy = make_safe(PyImport_ImportModule("numpy"));
+			Safe_PyObjectPtr modes = make_safe(numpy ? PyObject_CallMethod(numpy.get(), "geterr", nullptr) : nullptr);
+			if (!modes)
 			{
-				npy_bool operator()(posit8_2 a, double b) { return a == posit8_2(b); }
-			};
-			struct Ne
+				return false;
+			}
+			for (const auto &error : kErrors)
 			{
-				npy_bool operator()(posit8_2 a, posit8_2 b) { return a != b; }
-			};
-			struct NeFloat
+				PyObject *mode = (status & error.flag) ? PyDict_GetItemString(modes.get(), error.key) : nullptr;
+				const char *name = mode && PyUnicode_Check(mode) ? PyUnicode_AsUTF8(mode) : "ignore";
+				if (!name)
+				{
+					return false;
+				}
+				if (strcmp(name, "raise") == 0)
+				{
+					PyErr_Format(PyExc_FloatingPointError, "%s encountered in %s", error.what, where);
+					return false;
+				}
+				if (strcmp(name, "ignore") != 0 &&
+					PyErr_WarnFormat(PyExc_RuntimeWarning, 1, "%s encountered in %s", error.what, where) < 0)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+
+		PyObject *PyPosit8_2_Evaluate(PyObject *module, PyObject *args, PyObject *kwds)
+		{
+			static const char *kwlist[] = {"ex", "local_dict", nullptr};
+			const char *ex;
+			PyObject *local_dict;
+			if (!PyArg_ParseTupleAndKeywords(args, kwds, "sO:evaluate", const_cast<char **>(kwlist), &ex,
+											 &local_dict))
 			{
-				npy_bool operator()(posit8_2 a, float b) { return a != posit8_2(b); }
-			};
-			struct NeDouble
+				return nullptr;
+			}
+			ExprProgram program;
+			if (!ExprParser(ex, &program).Parse())
 			{
-				npy_bool operator()(posit8_2 a, double b) { return a != posit8_2(b); }
-			};
-			struct Lt
+				return nullptr;
+			}
+			const std::size_t nop = program.names.size() + 1;
+			if (nop > NPY_MAXARGS)
 			{
-				npy_bool operator()(posit8_2 a, posit8_2 b) { return a < b; }
-			};
-			struct LtFloat
+				PyErr_Format(PyExc_ValueError, "more than %d arrays in expression '%s'", NPY_MAXARGS - 1, ex);
+				return nullptr;
+			}
+
+			// The operands, converted to posit8_2 as by astype, and the result.
+			std::vector<Safe_PyObjectPtr> arrays;
+			std::vector<PyArrayObject *> ops(nop, nullptr);
+			std::vector<npy_uint32> op_flags(nop, NPY_ITER_READONLY);
+			Safe_PyObjectPtr descr = make_safe(reinterpret_cast<PyObject *>(PyArray_DescrFromType(npy_posit8_2)));
+			std::vector<PyArray_Descr *> op_dtypes(nop, reinterpret_cast<PyArray_Descr *>(descr.get()));
+			for (std::size_t k = 0; k < program.names.size(); ++k)
+			{
+				Safe_PyObjectPtr value = make_safe(PyMapping_GetItemString(local_dict, program.names[k].c_str()));
+				if (!value)
+				{
+					if (PyErr_ExceptionMatches(PyExc_KeyError))
+					{
+						PyErr_Clear();
+						PyErr_Format(PyExc_NameError, "name '%s' is not defined", program.names[k].c_str());
+					}
+					return nullptr;
+				}
+				arrays.push_back(make_safe(PyArray_FromAny(value.get(), nullptr, 0, 0, 0, nullptr)));
+				if (!arrays.back())
+				{
+					return nullptr;
+				}
+				ops[k] = reinterpret_cast<PyArrayObject *>(arrays.back().get());
+			}
+			op_flags[nop - 1] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
+			NpyIter *iter = NpyIter_MultiNew(static_cast<int>(nop), ops.data(),
+											 NPY_ITER_EXTERNAL_LOOP | NPY_ITER_BUFFERED | NPY_ITER_ZEROSIZE_OK,
+											 NPY_KEEPORDER, NPY_UNSAFE_CASTING, op_flags.data(), op_dtypes.data());
+			if (!iter)
 			{
-				npy_bool operator()(posit8_2 a, float b) { return a < posit8_2(b); }
-			};
-			struct LtDouble
+				return nullptr;
+			}
+
+			const uint16 *bfloat16_bits = Posit8_2ToBfloat16Table().data();
+			float widen[256];
+			for (int b = 0; b < 256; ++b)
 			{
-				npy_bool operator()(posit8_2 a, double b) { return a < posit8_2(b); }
-			};
-			struct Gt
+				std::uint32_t bits = static_cast<std::uint32_t>(bfloat16_bits[b]) << 16;
+				memcpy(widen + b, &bits, sizeof(float));
+			}
+			std::vector<float> registers((program.registers + 1) * kExprBlock);
+			bool ok = true;
+			fenv_t fenv;
+			feholdexcept(&fenv);
+			if (NpyIter_GetIterSize(iter) > 0)
+			{
+				NpyIter_IterNextFunc *iternext = NpyIter_GetIterNext(iter, nullptr);
+				char **data = NpyIter_GetDataPtrArray(iter);
+				npy_intp *strides = NpyIter_GetInnerStrideArray(iter);
+				npy_intp *size = NpyIter_GetInnerLoopSizePtr(iter);
+				if (iternext)
+				{
+					do
+					{
+						RunExprProgram(program, data, strides, *size, widen, registers.data());
+					} while (iternext(iter));
+				}
+				ok = !PyErr_Occurred();
+			}
+			int status = fetestexcept(kPosit8_2Exceptions);
+			fesetenv(&fenv);
+			PyObject *result = reinterpret_cast<PyObject *>(NpyIter_GetOperandArray(iter)[nop - 1]);
+			Py_INCREF(result);
+			if (NpyIter_Deallocate(iter) != NPY_SUCCEED || !ok || !ReportFloatStatus(status, "evaluate"))
 			{
-				npy_bool operator()(posit8_2 a, posit8_2 b) { return a > b; }
-			};
-			struct GtFloat
+				Py_DECREF(result);
+				return nullptr;
+			}
+			return result;
+		}
+
+		// Registers Functor for posit8_2 combined with 'Other' on either side.
+		template <typename Other, typename OutType, typename Functor>
+		bool RegisterMixedUFunc(PyObject *numpy, const char *name)
+		{
+			return RegisterUFunc<BinaryUFuncMixed<Other, OutType, Functor>>(numpy, name) &&
+				   RegisterUFunc<BinaryUFuncMixed<Other, OutType, Functor, true>>(numpy, name);
+		}
+
+		// Arithmetic and comparison loops between posit8_2 and 'Other', a type
+		// that casts to posit8_2 safely (see RegisterMixedCasts), so that mixed
+		// expressions stay posit8_2 instead of being promoted.
+		template <typename Other>
+		bool RegisterMixedUFuncs(PyObject *numpy)
+		{
+			return RegisterMixedUFunc<Other, posit8_2, ufuncs::Add>(numpy, "add") &&
+				   RegisterMixedUFunc<Other, posit8_2, ufuncs::Subtract>(numpy, "subtract") &&
+				   RegisterMixedUFunc<Other, posit8_2, ufuncs::Multiply>(numpy, "multiply") &&
+				   RegisterMixedUFunc<Other, posit8_2, ufuncs::TrueDivide>(numpy, "true_divide") &&
+				   RegisterMixedUFunc<Other, bool, ufuncs::Eq>(numpy, "equal") &&
+				   RegisterMixedUFunc<Other, bool, ufuncs::Ne>(numpy, "not_equal") &&
+				   RegisterMixedUFunc<Other, bool, ufuncs::Lt>(numpy, "less") &&
+				   RegisterMixedUFunc<Other, bool, ufuncs::Gt>(numpy, "greater") &&
+				   RegisterMixedUFunc<Other, bool, ufuncs::Le>(numpy, "less_equal") &&
+				   RegisterMixedUFunc<Other, bool, ufuncs::Ge>(numpy, "greater_equal");
+		}
+
+		// Scalar arithmetic. posit8_2 scalars combined with each other or with
+		// Python floats and ints are computed here, two posit8_2 scalars through
+		// the lookup tables. Python operands are ranked by the value-based rule
+		// NumPy applies to them next to a posit8_2 array, so that a scalar gives
+		// what a 0-d slice of the array would: ints of up to 16 bits and floats
+		// NumPy would store as float16 combine with posit8_2 (see
+		// RegisterMixedUFuncs), computed in double and rounded once, other floats
+		// give float32 and other ints float64. Any other operand (arrays, other
+		// NumPy scalars) is handed to NumPy's generic scalar math, which is what
+		// these slots inherited before.
+		enum class ScalarRank
+		{
+			kPosit8_2,
+			kFloat,
+			kDouble,
+		};
+
+		// Converts an operand of scalar arithmetic to the value it takes part
+		// with, and a posit8_2 operand also to 'posit'. Returns false, without
+		// setting an error, if the operand is not handled natively.
+		bool Posit8_2Operand(PyObject *arg, double *output, ScalarRank *rank, const posit8_2 **posit)
+		{
+			if (PyPosit8_2_Check(arg))
 			{
-				npy_bool operator()(posit8_2 a, float b) { return a > posit8_2(b); }
-			};
-			struct GtDouble
+				*posit = &reinterpret_cast<PyPosit8_2 *>(arg)->value;
+				*output = FromPosit8_2Table<double>()[Posit8_2Bits(**posit)];
+				*rank = ScalarRank::kPosit8_2;
+				return true;
+			}
+			*posit = nullptr;
+			if (PyFloat_CheckExact(arg))
 			{
-				npy_bool operator()(posit8_2 a, double b) { return a > posit8_2(b); }
-			};
-			struct Le
+				double d = PyFloat_AS_DOUBLE(arg);
+				if ((d > -65000.0 && d < 65000.0) || !std::isfinite(d))
+				{
+					*output = npy_half_to_double(npy_double_to_half(d));
+					*rank = ScalarRank::kPosit8_2;
+				}
+				else
+				{
+					*output = d;
+					*rank = d > -3.4e38 && d < 3.4e38 ? ScalarRank::kFloat : ScalarRank::kDouble;
+				}
+				return true;
+			}
+			if (PyLong_CheckExact(arg))
 			{
-				npy_bool operator()(posit8_2 a, posit8_2 b) { return a <= b; }
-			};
-			struct LeFloat
+				double d = PyLong_AsDouble(arg);
+				if ((d == -1.0 && PyErr_Occurred()) || d < -0x1p63 || d >= 0x1p64)
+				{
+					PyErr_Clear();
+					return false;
+				}
+				*output = d;
+				*rank = d >= -32768.0 && d <= 65535.0 ? ScalarRank::kPosit8_2 : ScalarRank::kDouble;
+				return true;
+			}
+			return false;
+		}
+
+		// Raises or warns, as np.errstate says, for the floating-point exceptions
+		// flagged since the last npy_clear_floatstatus_barrier, the check NumPy
+		// runs after a ufunc loop. 'name' is the operation in the message, and
+		// 'result' is what was computed, which is stored before the flags are read.
+		template <typename T>
+		bool CheckFloatStatus(const char *name, T *result)
+		{
+			int status = npy_get_floatstatus_barrier(reinterpret_cast<char *>(result));
+			if (!status)
 			{
-				npy_bool operator()(posit8_2 a, float b) { return a <= posit8_2(b); }
-			};
-			struct LeDouble
+				return true;
+			}
+			int bufsize, errmask, first = 1;
+			PyObject *errobj;
+			if (PyUFunc_GetPyValues(const_cast<char *>(name), &bufsize, &errmask, &errobj) < 0)
 			{
-				npy_bool operator()(posit8_2 a, double b) { return a <= posit8_2(b); }
-			};
-			struct Ge
+				return false;
+			}
+			int failed = PyUFunc_handlefperr(errmask, errobj, status, &first);
+			Py_XDECREF(errobj);
+			return !failed;
+		}
+
+		// np.float32 and np.float64 scalars, for results wider than posit8_2.
+		PyObject *NumpyScalar(float value)
+		{
+			PyObject *scalar = PyArrayScalar_New(Float);
+			if (scalar)
 			{
-				npy_bool operator()(posit8_2 a, posit8_2 b) { return a >= b; }
-			};
-			struct GeFloat
+				PyArrayScalar_ASSIGN(scalar, Float, value);
+			}
+			return scalar;
+		}
+
+		PyObject *NumpyScalar(double value)
+		{
+			PyObject *scalar = PyArrayScalar_New(Double);
+			if (scalar)
 			{
-				npy_bool operator()(posit8_2 a, float b) { return a >= posit8_2(b); }
-			};
-			struct GeDouble
+				PyArrayScalar_ASSIGN(scalar, Double, value);
+			}
+			return scalar;
+		}
+
+		// 'Op' is Functor's arithmetic on plain numbers.
+		template <typename Functor, typename Op, binaryfunc PyNumberMethods::*Slot>
+		PyObject *PyPosit8_2_BinaryNumber(PyObject *a, PyObject *b, const char *name)
+		{
+			double x, y;
+			ScalarRank x_rank, y_rank;
+			const posit8_2 *px, *py;
+			// Cleared before the operands are even read, so the arithmetic cannot be
+			// moved ahead of it.
+			npy_clear_floatstatus_barrier(reinterpret_cast<char *>(&x));
+			if (!Posit8_2Operand(a, &x, &x_rank, &px) || !Posit8_2Operand(b, &y, &y_rank, &py))
+			{
+				return (PyGenericArrType_Type.tp_as_number->*Slot)(a, b);
+			}
+			switch (std::max(x_rank, y_rank))
 			{
-				npy_bool operator()(posit8_2 a, double b) { return a >= posit8_2(b); }
-			};
-			struct Maximum
+			case ScalarRank::kPosit8_2:
 			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b)
+				uint8 r;
+				if (px && py)
 				{
-					float fa(a), fb(b);
-					return Eigen::numext::isnan(fa) || fa > fb ? a : b;
+					const Posit8_2Table &table = Posit8_2BinaryTable<Functor>();
+					const int index = Posit8_2Bits(*px) * 256 + Posit8_2Bits(*py);
+					r = table.values[index];
+					SetFloatStatus(table.status[index]);
 				}
-			};
-			struct Minimum
-			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b)
+				else
 				{
-					float fa(a), fb(b);
-					return Eigen::numext::isnan(fa) || fa < fb ? a : b;
+					double d = Op()(x, y);
+					DoublesToPosit8_2(&d, &r, 1);
 				}
-			};
-			struct Fmax
+				return CheckFloatStatus(name, &r) ? PyPosit8_2_FromPosit8_2(Posit8_2FromBits(r)) : nullptr;
+			}
+			case ScalarRank::kFloat:
 			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b)
-				{
-					float fa(a), fb(b);
-					return Eigen::numext::isnan(fb) || fa > fb ? a : b;
-				}
-			};
-			struct Fmin
+				float r = Op()(static_cast<float>(x), static_cast<float>(y));
+				return CheckFloatStatus(name, &r) ? NumpyScalar(r) : nullptr;
+			}
+			default:
 			{
-				posit8_2 operator()(posit8_2 a, posit8_2 b)
-				{
-					float fa(a), fb(b);
-					return Eigen::numext::isnan(fb) || fa < fb ? a : b;
-				}
-			};
+				double r = Op()(x, y);
+				return CheckFloatStatus(name, &r) ? NumpyScalar(r) : nullptr;
+			}
+			}
+		}
 
-/*			struct LogicalNot
+		template <typename Functor>
+		PyObject *PyPosit8_2_UnaryNumber(PyObject *a)
+		{
+			const uint8 *table = Posit8_2UnaryTable<Functor>().values.data();
+			return PyPosit8_2_FromPosit8_2(
+				Posit8_2FromBits(table[Posit8_2Bits(PyPosit8_2_Posit8_2(a))]));
+		}
+
+		PyObject *PyPosit8_2_Add(PyObject *a, PyObject *b)
+		{
+			return PyPosit8_2_BinaryNumber<ufuncs::Add, std::plus<>, &PyNumberMethods::nb_add>(a, b, "scalar add");
+		}
+
+		PyObject *PyPosit8_2_Subtract(PyObject *a, PyObject *b)
+		{
+			return PyPosit8_2_BinaryNumber<ufuncs::Subtract, std::minus<>, &PyNumberMethods::nb_subtract>(a, b, "scalar subtract");
+		}
+
+		PyObject *PyPosit8_2_Multiply(PyObject *a, PyObject *b)
+		{
+			return PyPosit8_2_BinaryNumber<ufuncs::Multiply, std::multiplies<>, &PyNumberMethods::nb_multiply>(a, b, "scalar multiply");
+		}
+
+		PyObject *PyPosit8_2_TrueDivide(PyObject *a, PyObject *b)
+		{
+			return PyPosit8_2_BinaryNumber<ufuncs::TrueDivide, std::divides<>, &PyNumberMethods::nb_true_divide>(a, b, "scalar divide");
+		}
+
+		PyObject *PyPosit8_2_Negative(PyObject *a)
+		{
+			return PyPosit8_2_UnaryNumber<ufuncs::Negative>(a);
+		}
+
+		PyObject *PyPosit8_2_Positive(PyObject *a)
+		{
+			return PyPosit8_2_FromPosit8_2(PyPosit8_2_Posit8_2(a));
+		}
+
+		PyObject *PyPosit8_2_Absolute(PyObject *a)
+		{
+			return PyPosit8_2_UnaryNumber<ufuncs::Abs>(a);
+		}
+
+		// Comparisons on PyPosit8_2s. Two posit8_2 values are compared with the same
+		// functors as the comparison ufunc loops. Anything else is compared exactly,
+		// the way float does: self is widened to double, which holds every posit8_2
+		// value, and the other operand is never rounded, so comparisons agree with
+		// the hash. Python ints go through float's own comparison, which is exact
+		// at any magnitude. Arrays and other NumPy scalars go through NumPy;
+		// anything else is not comparable.
+		bool Posit8_2CompareOperand(PyObject *arg, double *output)
+		{
+			if (PyFloat_Check(arg))
 			{
-				npy_bool operator()(posit8_2 a) { return !a; }
-			};
-			struct LogicalAnd
+				*output = PyFloat_AS_DOUBLE(arg);
+				return true;
+			}
+			if (PyArray_IsScalar(arg, Half))
 			{
-				npy_bool operator()(posit8_2 a, posit8_2 b) { return a && b; }
-			};
-			struct LogicalOr
+				Eigen::half h;
+				PyArray_ScalarAsCtype(arg, &h);
+				*output = static_cast<double>(h);
+				return true;
+			}
+			if (PyArray_IsScalar(arg, Float))
 			{
-				npy_bool operator()(posit8_2 a, posit8_2 b) { return a || b; }
-			};
-			struct LogicalXor
+				float f;
+				PyArray_ScalarAsCtype(arg, &f);
+				*output = f;
+				return true;
+			}
+			if (PyArray_IsScalar(arg, Double))
 			{
-				npy_bool operator()(posit8_2 a, posit8_2 b)
+				double f;
+				PyArray_ScalarAsCtype(arg, &f);
+				*output = f;
+				return true;
+			}
+			return false;
+		}
+
+		PyObject *PyPosit8_2_RichCompare(PyObject *self, PyObject *other, int cmp_op)
+		{
+			posit8_2 x = PyPosit8_2_Posit8_2(self);
+			if (PyPosit8_2_Check(other))
+			{
+				posit8_2 y = PyPosit8_2_Posit8_2(other);
+				bool result;
+				switch (cmp_op)
 				{
-					return static_cast<bool>(a) ^ static_cast<bool>(b);
+				case Py_LT:
+					result = ufuncs::Lt()(x, y);
+					break;
+				case Py_LE:
+					result = ufuncs::Le()(x, y);
+					break;
+				case Py_EQ:
+					result = ufuncs::Eq()(x, y);
+					break;
+				case Py_NE:
+					result = ufuncs::Ne()(x, y);
+					break;
+				case Py_GT:
+					result = ufuncs::Gt()(x, y);
+					break;
+				case Py_GE:
+					result = ufuncs::Ge()(x, y);
+					break;
+				default:
+					Py_RETURN_NOTIMPLEMENTED;
 				}
-			};
-*/
-			struct NextAfter
+				return PyBool_FromLong(result);
+			}
+			double dx = static_cast<double>(x);
+			if (PyLong_Check(other))
 			{
-				posit8_2 operator()(posit8_2 from, posit8_2 to)
+				Safe_PyObjectPtr f = make_safe(PyFloat_FromDouble(dx));
+				if (!f)
 				{
-					long from_as_int, to_as_int;
-					const long sign_mask = 1 << 7;
-					float from_as_float(from), to_as_float(to);
-					memcpy(&from_as_int, &from, sizeof(posit8_2));
-					memcpy(&to_as_int, &to, sizeof(posit8_2));
-					if (Eigen::numext::isnan(from_as_float) ||
-						Eigen::numext::isnan(to_as_float))
-					{
-						return posit8_2(std::numeric_limits<float>::quiet_NaN());
-					}
-					if (from_as_int == to_as_int)
-					{
-						return to;
-					}
-					if (from_as_float == 0)
-					{
-						if (to_as_float == 0)
-						{
-							return to;
-						}
-						else
-						{
-							// Smallest subnormal signed like `to`.
-							uint8_t out_int = (to_as_int & sign_mask) | 1;
-							posit8_2 out;
-							memcpy(&out, &out_int, sizeof(posit8_2));
-							return out;
-						}
-					}
-					long from_sign = from_as_int & sign_mask;
-					long to_sign = to_as_int & sign_mask;
-					long from_abs = from_as_int & ~sign_mask;
-					long to_abs = to_as_int & ~sign_mask;
-					long magnitude_adjustment =
-						(from_abs > to_abs || from_sign != to_sign) ? 0xFFFF : 0x0001;
-					long out_int = from_as_int + magnitude_adjustment;
-					posit8_2 out;
-					memcpy(&out, &out_int, sizeof(posit8_2));
-					return out;
+					return nullptr;
 				}
-			};
-			// TODO(phawkins): implement spacing
+				return PyObject_RichCompare(f.get(), other, cmp_op);
+			}
+			double dy;
+			if (!Posit8_2CompareOperand(other, &dy))
+			{
+				if (PyArray_Check(other) || PyArray_IsScalar(other, Generic))
+				{
+					return PyPosit8_2_ArrayRichCompare(self, other, cmp_op);
+				}
+				Py_RETURN_NOTIMPLEMENTED;
+			}
+			Py_RETURN_RICHCOMPARE(dx, dy, cmp_op);
+		}
+
+		// Heap-type instances own a reference to their type, which must be released
+		// here.
+		void PyPosit8_2_Dealloc(PyObject *self)
+		{
+			PyTypeObject *type = Py_TYPE(self);
+			type->tp_free(self);
+			Py_DECREF(type);
+		}
+
+		// Python type for PyPosit8_2 objects. This is a heap type, created once per
+		// process when posit8_2 is registered with NumPy.
+
+		PyType_Slot posit8_2_type_slots[] = {
+			{Py_tp_dealloc, reinterpret_cast<void *>(PyPosit8_2_Dealloc)},
+			{Py_tp_repr, reinterpret_cast<void *>(PyPosit8_2_Repr)},
+			{Py_tp_str, reinterpret_cast<void *>(PyPosit8_2_Str)},
+			{Py_tp_hash, reinterpret_cast<void *>(PyPosit8_2_Hash)},
+			{Py_tp_richcompare, reinterpret_cast<void *>(PyPosit8_2_RichCompare)},
+			{Py_tp_methods, PyPosit8_2_methods},
+			{Py_tp_new, reinterpret_cast<void *>(PyPosit8_2_New)},
+			{Py_tp_doc, const_cast<char *>("posit8_2 floating-point values")},
+			{Py_nb_add, reinterpret_cast<void *>(PyPosit8_2_Add)},
+			{Py_nb_subtract, reinterpret_cast<void *>(PyPosit8_2_Subtract)},
+			{Py_nb_multiply, reinterpret_cast<void *>(PyPosit8_2_Multiply)},
+			{Py_nb_true_divide, reinterpret_cast<void *>(PyPosit8_2_TrueDivide)},
+			{Py_nb_negative, reinterpret_cast<void *>(PyPosit8_2_Negative)},
+			{Py_nb_positive, reinterpret_cast<void *>(PyPosit8_2_Positive)},
+			{Py_nb_absolute, reinterpret_cast<void *>(PyPosit8_2_Absolute)},
+			{Py_nb_int, reinterpret_cast<void *>(PyPosit8_2_Int)},
+			{Py_nb_float, reinterpret_cast<void *>(PyPosit8_2_Float)},
+#ifdef IMPLEMENT_BUFFER
+			{Py_bf_getbuffer, reinterpret_cast<void *>(PyPosit8_2_getbuffer)},
+#endif
+			{0, nullptr},
+		};
+
+		PyType_Spec posit8_2_type_spec = {
+			"posit8_2.posit8_2",							  // name
+			sizeof(PyPosit8_2),							  // basicsize
+			0,											  // itemsize
+			Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,	  // flags
+			posit8_2_type_slots,						  // slots
+		};
 
-		} // namespace ufuncs
 
 	} // namespace
 
@@ -1893,14 +4448,25 @@ namespace xposit8
 			}
 		}
 
-		posit8_2_type.tp_base = &PyGenericArrType_Type;
-
-		if (PyType_Ready(&posit8_2_type) < 0)
+		Safe_PyObjectPtr bases = make_safe(PyTuple_Pack(1, &PyGenericArrType_Type));
+		if (!bases)
+		{
+			return false;
+		}
+		PyObject *type = PyType_FromSpecWithBases(&posit8_2_type_spec, bases.get());
+		if (!type)
 		{
-			PyErr_Print();
-	        PyErr_SetString(PyExc_SystemError, "could not initialize posit8_2");
 			return false;
 		}
+		// The spec name gives the type its __module__, but NumPy, and the other
+		// module's casts, look the type up by tp_name, which must stay unqualified.
+		reinterpret_cast<PyTypeObject *>(type)->tp_name = "posit8_2";
+		// The NumPy descriptor keeps referring to the type for the lifetime of the
+		// process, so this reference is never released.
+		posit8_2_type_ptr = reinterpret_cast<PyTypeObject *>(type);
+#if PY_VERSION_HEX >= 0x03090000
+		posit8_2_type_ptr->tp_vectorcall = PyPosit8_2_Vectorcall;
+#endif
 
 		// Initializes the NumPy descriptor.
 		PyArray_InitArrFuncs(&NPyPosit8_2_ArrFuncs);
@@ -1910,32 +4476,52 @@ namespace xposit8
 		NPyPosit8_2_ArrFuncs.copyswap = NPyPosit8_2_CopySwap;
 		NPyPosit8_2_ArrFuncs.nonzero = NPyPosit8_2_NonZero;
 		NPyPosit8_2_ArrFuncs.fill = NPyPosit8_2_Fill;
+		NPyPosit8_2_ArrFuncs.fillwithscalar = NPyPosit8_2_FillWithScalar;
 		NPyPosit8_2_ArrFuncs.dotfunc = NPyPosit8_2_DotFunc;
 		NPyPosit8_2_ArrFuncs.compare = NPyPosit8_2_CompareFunc;
 		NPyPosit8_2_ArrFuncs.argmax = NPyPosit8_2_ArgMaxFunc;
 		NPyPosit8_2_ArrFuncs.argmin = NPyPosit8_2_ArgMinFunc;
 
-		Py_TYPE(&NPyPosit8_2_Descr) = &PyArrayDescr_Type;
-		npy_posit8_2 = PyArray_RegisterDataType(&NPyPosit8_2_Descr);
-		posit8_2_type_ptr = &posit8_2_type;
-		if (npy_posit8_2 < 0)
+		NPyPosit8_2_Descr.typeobj = posit8_2_type_ptr;
+		Py_SET_TYPE(&NPyPosit8_2_Descr, &PyArrayDescr_Type);
+		int typenum_registered = PyArray_RegisterDataType(&NPyPosit8_2_Descr);
+		if (typenum_registered < 0)
 		{
 			return false;
 		}
 
 		// Support dtype(posit8_2)
-		if (PyDict_SetItemString(posit8_2_type.tp_dict, "dtype",
-								 reinterpret_cast<PyObject *>(&NPyPosit8_2_Descr)) <
+		if (PyObject_SetAttrString(type, "dtype",
+								   reinterpret_cast<PyObject *>(&NPyPosit8_2_Descr)) <
 			0)
 		{
 			return false;
 		}
 
+		// Intern every posit8_2 value, as a scalar and as a Python float.
+		for (int bits = 0; bits < 256; ++bits)
+		{
+			PyObject *scalar = posit8_2_type_ptr->tp_alloc(posit8_2_type_ptr, 0);
+			if (!scalar)
+			{
+				return false;
+			}
+			reinterpret_cast<PyPosit8_2 *>(scalar)->value = Posit8_2FromBits(static_cast<uint8>(bits));
+			posit8_2_scalars[bits] = scalar;
+			posit8_2_floats[bits] = PyFloat_FromDouble(
+				static_cast<double>(Posit8_2FromBits(static_cast<uint8>(bits))));
+			if (!posit8_2_floats[bits])
+			{
+				return false;
+			}
+		}
+		npy_posit8_2 = typenum_registered;
+
 		// Register casts
-		//if (!RegisterPosit8_2Cast<Eigen::half>(NPY_HALF, /*cast_is_safe=*/false))
-		//{
-		//	return false;
-		//}
+		if (!RegisterPosit8_2TableCast<Eigen::half>(NPY_HALF, /*cast_is_safe=*/false))
+		{
+			return false;
+		}
 		if (!RegisterPosit8_2Cast<float>(NPY_FLOAT, /*cast_is_safe=*/true))
 		{
 			return false;
@@ -1944,74 +4530,80 @@ namespace xposit8
 		{
 			return false;
 		}
-		//if (!RegisterPosit8_2Cast<bool>(NPY_BOOL, /*cast_is_safe=*/false))
-		//{
-		//	return false;
-		//}
-		//if (!RegisterPosit8_2Cast<uint8>(NPY_UINT8, /*cast_is_safe=*/false))
-		//{
-		//	return false;
-		//}
-		if (!RegisterPosit8_2Cast<uint16>(NPY_UINT16, /*cast_is_safe=*/false))
+		if (!RegisterPosit8_2TableCast<bool>(NPY_BOOL, /*cast_is_safe=*/false))
+		{
+			return false;
+		}
+		if (!RegisterPosit8_2TableCast<uint8>(NPY_UINT8, /*cast_is_safe=*/false))
+		{
+			return false;
+		}
+		if (!RegisterPosit8_2TableCast<uint16>(NPY_UINT16, /*cast_is_safe=*/false))
 		{
 			return false;
 		}
-		if (!RegisterPosit8_2Cast<unsigned int>(NPY_UINT, /*cast_is_safe=*/false))
+		if (!RegisterPosit8_2TableCast<unsigned int>(NPY_UINT, /*cast_is_safe=*/false))
 		{
 			return false;
 		}
-		if (!RegisterPosit8_2Cast<unsigned long>(NPY_ULONG, // NOLINT
+		if (!RegisterPosit8_2TableCast<unsigned long>(NPY_ULONG, // NOLINT
 												 /*cast_is_safe=*/false))
 		{
 			return false;
 		}
-		if (!RegisterPosit8_2Cast<unsigned long long>( // NOLINT
+		if (!RegisterPosit8_2TableCast<unsigned long long>( // NOLINT
 				NPY_ULONGLONG, /*cast_is_safe=*/false))
 		{
 			return false;
 		}
-		if (!RegisterPosit8_2Cast<uint64>(NPY_UINT64, /*cast_is_safe=*/false))
+		if (!RegisterPosit8_2TableCast<uint64>(NPY_UINT64, /*cast_is_safe=*/false))
+		{
+			return false;
+		}
+		if (!RegisterPosit8_2TableCast<int8>(NPY_INT8, /*cast_is_safe=*/false))
 		{
 			return false;
 		}
-		//if (!RegisterPosit8_2Cast<int8>(NPY_INT8, /*cast_is_safe=*/false))
-		//{
-		//	return false;
-		//}
-		if (!RegisterPosit8_2Cast<int16>(NPY_INT16, /*cast_is_safe=*/false))
+		if (!RegisterPosit8_2TableCast<int16>(NPY_INT16, /*cast_is_safe=*/false))
 		{
 			return false;
 		}
-		if (!RegisterPosit8_2Cast<int>(NPY_INT, /*cast_is_safe=*/false))
+		if (!RegisterPosit8_2TableCast<int>(NPY_INT, /*cast_is_safe=*/false))
 		{
 			return false;
 		}
-		if (!RegisterPosit8_2Cast<long>(NPY_LONG, // NOLINT
+		if (!RegisterPosit8_2TableCast<long>(NPY_LONG, // NOLINT
 										/*cast_is_safe=*/false))
 		{
 			return false;
 		}
-		if (!RegisterPosit8_2Cast<long long>( // NOLINT
+		if (!RegisterPosit8_2TableCast<long long>( // NOLINT
 				NPY_LONGLONG, /*cast_is_safe=*/false))
 		{
 			return false;
 		}
 		// Following the numpy convention. imag part is dropped when converting to
 		// float.
-		//if (!RegisterPosit8_2Cast<std::complex<float>>(NPY_COMPLEX64,
-		//											   /*cast_is_safe=*/true))
-		//{
-		//	return false;
-		//}
-		//if (!RegisterPosit8_2Cast<std::complex<double>>(NPY_COMPLEX128, /*cast_is_safe=*/true))
-		//{
-		//	return false;
-		//}
+		if (!RegisterPosit8_2CastViaFloat<std::complex<float>>(NPY_COMPLEX64,
+																/*cast_is_safe=*/true))
+		{
+			return false;
+		}
+		if (!RegisterPosit8_2CastViaFloat<std::complex<double>>(NPY_COMPLEX128, /*cast_is_safe=*/true))
+		{
+			return false;
+		}
+		if (!RegisterMixedCasts())
+		{
+			return false;
+		}
+		if (!RegisterBfloat16Casts())
+		{
+			return false;
+		}
 
 		bool ok =
 			RegisterUFunc<BinaryUFunc<posit8_2, posit8_2, ufuncs::Add>>(numpy.get(), "add") &&
-			RegisterUFunc<BinaryUFunc2<float, posit8_2, posit8_2, ufuncs::ScalarFloatAdd>>(numpy.get(), "add") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, float, posit8_2, ufuncs::AddScalarFloat>>(numpy.get(), "add") &&
 			RegisterUFunc<BinaryUFunc<posit8_2, posit8_2, ufuncs::Subtract>>(numpy.get(), "subtract") &&
 			RegisterUFunc<BinaryUFunc<posit8_2, posit8_2, ufuncs::Multiply>>(
 				numpy.get(), "multiply") &&
@@ -2109,40 +4701,16 @@ namespace xposit8
 			// 													   "equal") &&
 			RegisterUFunc<BinaryUFunc<posit8_2, bool, ufuncs::Eq>>(numpy.get(),
 																   "equal") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, float, bool, ufuncs::EqFloat>>(numpy.get(),
-																    "equal") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, double, bool, ufuncs::EqDouble>>(numpy.get(),
-																   "equal") &&
 			RegisterUFunc<BinaryUFunc<posit8_2, bool, ufuncs::Ne>>(numpy.get(),
 																   "not_equal") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, float, bool, ufuncs::NeFloat>>(numpy.get(),
-																   "not_equal") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, double, bool, ufuncs::NeDouble>>(numpy.get(),
-																   "not_equal") &&
 			RegisterUFunc<BinaryUFunc<posit8_2, bool, ufuncs::Lt>>(numpy.get(),
 																   "less") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, float, bool, ufuncs::LtFloat>>(numpy.get(),
-																   "less") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, double, bool, ufuncs::LtDouble>>(numpy.get(),
-																   "less") &&
 			RegisterUFunc<BinaryUFunc<posit8_2, bool, ufuncs::Gt>>(numpy.get(),
 																   "greater") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, float, bool, ufuncs::GtFloat>>(numpy.get(),
-																   "greater") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, double, bool, ufuncs::GtDouble>>(numpy.get(),
-																   "greater") &&
 			RegisterUFunc<BinaryUFunc<posit8_2, bool, ufuncs::Le>>(numpy.get(),
 																   "less_equal") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, float, bool, ufuncs::LeFloat>>(numpy.get(),
-																   "less_equal") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, double, bool, ufuncs::LeDouble>>(numpy.get(),
-																   "less_equal") &&
 			RegisterUFunc<BinaryUFunc<posit8_2, bool, ufuncs::Ge>>(numpy.get(),
 																   "greater_equal") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, float, bool, ufuncs::GeFloat>>(numpy.get(),
-																   "greater_equal") &&
-			RegisterUFunc<BinaryUFunc2<posit8_2, double, bool, ufuncs::GeDouble>>(numpy.get(),
-																   "greater_equal") &&
 			RegisterUFunc<BinaryUFunc<posit8_2, posit8_2, ufuncs::Maximum>>(
 				numpy.get(), "maximum") &&
 			RegisterUFunc<BinaryUFunc<posit8_2, posit8_2, ufuncs::Minimum>>(
@@ -2184,30 +4752,57 @@ namespace xposit8
 			RegisterUFunc<UnaryUFunc<posit8_2, posit8_2, ufuncs::Trunc>>(numpy.get(),
 																		 "trunc") &&
 			RegisterUFunc<BinaryUFunc<posit8_2, posit8_2, ufuncs::NextAfter>>(
-				numpy.get(), "nextafter");// &&
+				numpy.get(), "nextafter") &&
+			RegisterUFunc<UnaryUFunc<posit8_2, posit8_2, ufuncs::Spacing>>(numpy.get(),
+																		   "spacing") &&
+			// Mixed loops go last. Wider operands need none: posit8_2 casts to
+			// float and double safely, so NumPy runs its own loops on the widened
+			// values.
+			RegisterMixedUFuncs<bool>(numpy.get()) &&
+			RegisterMixedUFuncs<int8>(numpy.get()) &&
+			RegisterMixedUFuncs<uint8>(numpy.get()) &&
+			RegisterMixedUFuncs<int16>(numpy.get()) &&
+			RegisterMixedUFuncs<uint16>(numpy.get()) &&
+			RegisterMixedUFuncs<Eigen::half>(numpy.get()) &&
+			CreateFmaUFunc();
 
 			//RegisterUFunc<UnaryUFunc<posit8_2, posit8_2, ufuncs::ToBinary<8UL>>>(numpy.get(), "binary_rep");
 
 		return ok;
 	}
 
-	bool RegisterNumpyPosit8_2()
+#if PY_VERSION_HEX >= 0x030D0000
+	// Module exec may run concurrently on free-threaded builds. NumPy's dtype
+	// registry is process-wide, so registration is serialized here and happens
+	// only once per process.
+	PyMutex registration_mutex = {0};
+#endif
+
+	// Returns the registered posit8_2 type, registering it first if this is the
+	// first module object in the process, or nullptr with an error set.
+	PyTypeObject *RegisterNumpyPosit8_2()
 	{
-		if (npy_posit8_2 != NPY_NOTYPE)
+		if (posit8_2_registered.load(std::memory_order_acquire))
 		{
-			// Already initialized.
-			return true;
+			return posit8_2_type_ptr;
 		}
-		if (!Initialize())
+#if PY_VERSION_HEX >= 0x030D0000
+		PyMutex_Lock(&registration_mutex);
+#endif
+		PyTypeObject *type = nullptr;
+		if (posit8_2_registered.load(std::memory_order_relaxed) || Initialize())
 		{
-			if (!PyErr_Occurred())
-			{
-				PyErr_SetString(PyExc_RuntimeError, "cannot load posit8_2 module.");
-			}
-			PyErr_Print();
-			return false;
+			posit8_2_registered.store(true, std::memory_order_release);
+			type = posit8_2_type_ptr;
+		}
+		else if (!PyErr_Occurred())
+		{
+			PyErr_SetString(PyExc_RuntimeError, "cannot load posit8_2 module.");
 		}
-		return true;
+#if PY_VERSION_HEX >= 0x030D0000
+		PyMutex_Unlock(&registration_mutex);
+#endif
+		return type;
 	}
 
 	PyObject *Posit8_2Dtype()
@@ -2217,17 +4812,87 @@ namespace xposit8
 
 	int Posit8_2NumpyType() { return npy_posit8_2; }
 
+	int Posit8_2ModuleExec(PyObject *m)
+	{
+		PyTypeObject *type = RegisterNumpyPosit8_2();
+		if (!type)
+		{
+			return -1;
+		}
+		// The type is shared by the whole process; NumPy's loops and casts have no
+		// module to look it up in, so it stays a global and each module object
+		// just holds a reference to it.
+		Py_INCREF(type);
+		if (PyModule_AddObject(m, "posit8_2", reinterpret_cast<PyObject *>(type)) < 0)
+		{
+			Py_DECREF(type);
+			return -1;
+		}
+		// Not created when another module registered the posit8_2 type first.
+		if (fma_ufunc)
+		{
+			Py_INCREF(fma_ufunc);
+			if (PyModule_AddObject(m, "fma", fma_ufunc) < 0)
+			{
+				Py_DECREF(fma_ufunc);
+				return -1;
+			}
+		}
+		return 0;
+	}
+
 	static PyMethodDef Posit8_2ModuleMethods[] = {
+		{
+			"make_unary_ufunc",
+			(PyCFunction)(void (*)(void)) PyPosit8_2_MakeUnaryUFunc,
+			METH_VARARGS | METH_KEYWORDS,
+			"make_unary_ufunc(fn, name=None) -> ufunc over posit8_2 computing fn(x) by table\n"
+			"lookup. fn is called once, with an array of all 256 posit8_2 values."
+		},
+		{
+			"make_binary_ufunc",
+			(PyCFunction)(void (*)(void)) PyPosit8_2_MakeBinaryUFunc,
+			METH_VARARGS | METH_KEYWORDS,
+			"make_binary_ufunc(fn, name=None) -> ufunc over posit8_2 computing fn(x, y) by\n"
+			"table lookup. fn is called once, with arrays of all 65536 posit8_2 pairs."
+		},
+		{
+			"evaluate",
+			(PyCFunction)(void (*)(void)) PyPosit8_2_Evaluate,
+			METH_VARARGS | METH_KEYWORDS,
+			"evaluate(ex, local_dict) -> posit8_2 array of the expression ex over the arrays\n"
+			"and numbers named in local_dict, broadcast together, in one pass without\n"
+			"temporaries. Intermediates are float32 and only the result is rounded. ex may\n"
+			"use + - * / **, numbers, parentheses, abs, sqrt, exp, exp2, expm1, log, log2,\n"
+			"log10, log1p, tanh, sin, cos, maximum, minimum and power"
+		},
 		{NULL, NULL, 0, NULL}
 	};
 
+	static PyModuleDef_Slot Posit8_2ModuleSlots[] = {
+		{Py_mod_exec, reinterpret_cast<void *>(Posit8_2ModuleExec)},
+#if PY_VERSION_HEX >= 0x030C0000
+		// The NumPy registration (type number, descriptor and scalar type) is
+		// process-wide and NumPy itself cannot be loaded into isolated
+		// sub-interpreters, so we cannot give each interpreter its own copy.
+		{Py_mod_multiple_interpreters, Py_MOD_MULTIPLE_INTERPRETERS_NOT_SUPPORTED},
+#endif
+#if PY_VERSION_HEX >= 0x030D0000
+		// All mutable state is written once under registration_mutex and
+		// published through posit8_2_registered; the NumPy loops themselves are
+		// stateless.
+		{Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+		{0, NULL}
+	};
+
 	static struct PyModuleDef Posit8_2Module = {
 		PyModuleDef_HEAD_INIT,
 		"numpy_posit8_2",
 		NULL,
-		-1,
+		0,
 		Posit8_2ModuleMethods,
-		NULL,
+		Posit8_2ModuleSlots,
 		NULL,
 		NULL,
 		NULL
@@ -2236,20 +4901,6 @@ namespace xposit8
 	PyMODINIT_FUNC
 	PyInit_posit8_2(void)
 	{
-		PyObject *m;
-		m = PyModule_Create(&Posit8_2Module);
-		if (m == NULL)
-			return NULL;
-		RegisterNumpyPosit8_2();
-		Py_INCREF(&posit8_2_type);
-		Py_XINCREF(&NPyPosit8_2_Descr);
-		if (PyModule_AddObject(m, "posit8_2", (PyObject *)&posit8_2_type) < 0)
-		{
-			Py_DECREF(&posit8_2_type);
-			Py_DECREF(m);
-			return NULL;
-		}
-
-		return m;
+		return PyModuleDef_Init(&Posit8_2Module);
 	}
 } // namespace ceremorphic